@@ -0,0 +1,61 @@
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use modbus_relay::{
+    calc_crc16,
+    crc::{crc16_bytewise, crc16_clmul, crc16_slicing},
+    MbapFramer,
+};
+
+fn crc16(c: &mut Criterion) {
+    let mut group = c.benchmark_group("crc16");
+
+    // A request, a 125 register read response and the longest RTU frame
+    for size in [8usize, 64, 256] {
+        let data: Vec<u8> = (0..size).map(|i| i as u8).collect();
+        group.throughput(Throughput::Bytes(size as u64));
+
+        group.bench_with_input(BenchmarkId::new("bytewise", size), &data, |b, data| {
+            b.iter(|| crc16_bytewise(black_box(data)))
+        });
+        group.bench_with_input(BenchmarkId::new("slicing", size), &data, |b, data| {
+            b.iter(|| crc16_slicing(black_box(data)))
+        });
+        if crc16_clmul(&data).is_some() {
+            group.bench_with_input(BenchmarkId::new("clmul", size), &data, |b, data| {
+                b.iter(|| crc16_clmul(black_box(data)))
+            });
+        }
+        group.bench_with_input(BenchmarkId::new("calc_crc16", size), &data, |b, data| {
+            b.iter(|| calc_crc16(black_box(data)))
+        });
+    }
+
+    group.finish();
+}
+
+fn mbap_framing(c: &mut Criterion) {
+    // Four pipelined Read Holding Registers requests in one segment
+    let segment: Vec<u8> = (0..4u8)
+        .flat_map(|i| {
+            [
+                0x00, i, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, i, 0x00, 0x0A,
+            ]
+        })
+        .collect();
+
+    let mut group = c.benchmark_group("mbap_framer");
+    group.throughput(Throughput::Elements(4));
+    group.bench_function("next_frame", |b| {
+        let mut framer = MbapFramer::new();
+        b.iter(|| {
+            framer.extend_from_slice(black_box(&segment));
+            while let Some(frame) = framer.next_frame().unwrap() {
+                black_box(frame);
+            }
+        })
+    });
+    group.finish();
+}
+
+criterion_group!(benches, crc16, mbap_framing);
+criterion_main!(benches);
@@ -0,0 +1,132 @@
+use std::{net::SocketAddr, sync::Arc};
+
+use criterion::{black_box, criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use tokio::{runtime::Runtime, sync::broadcast};
+
+use modbus_relay::{
+    mock::{MockSlave, MockTransport},
+    BusScheduler, CacheConfig, CircuitBreaker, LatencyStats, Metrics, ModbusProcessor, Priority,
+    ResponseCache, SchedulerConfig, ShadowImage,
+};
+
+/// Processor in front of a slave that answers right away, so only the
+/// relay's own overhead is measured
+fn processor(
+    runtime: &Runtime,
+    cache: CacheConfig,
+) -> (Arc<ModbusProcessor>, broadcast::Sender<()>) {
+    let _guard = runtime.enter();
+
+    let transport = Arc::new(MockTransport::new(Arc::new(MockSlave::new())));
+    let (scheduler, bus) = BusScheduler::new(
+        transport,
+        &SchedulerConfig::default(),
+        Arc::new(LatencyStats::new()),
+        Arc::new(CircuitBreaker::new(&Default::default())),
+    );
+    let (shutdown_tx, shutdown_rx) = broadcast::channel(1);
+    runtime.spawn(scheduler.run(shutdown_rx));
+
+    let processor = ModbusProcessor::new(
+        bus,
+        ResponseCache::new(cache),
+        Arc::new(ShadowImage::new(&[], Default::default())),
+        Arc::new(Metrics::new()),
+    );
+    (Arc::new(processor), shutdown_tx)
+}
+
+fn client(index: u16) -> SocketAddr {
+    SocketAddr::from(([127, 0, 0, 1], 40_000 + index))
+}
+
+/// Read Holding Registers, 10 registers
+const READ: [u8; 5] = [0x03, 0x00, 0x00, 0x00, 0x0A];
+
+fn process_request(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+    let mut group = c.benchmark_group("process_request");
+
+    let (bus, _shutdown) = processor(&runtime, CacheConfig::default());
+    group.bench_function("bus", |b| {
+        b.to_async(&runtime).iter(|| async {
+            let response = bus
+                .process_request(client(0), Priority::Normal, [0, 1], 1, &READ, false)
+                .await
+                .unwrap();
+            black_box(response)
+        })
+    });
+
+    let cached = CacheConfig {
+        enabled: true,
+        ..Default::default()
+    };
+    let (cache, _shutdown) = processor(&runtime, cached);
+    group.bench_function("cache_hit", |b| {
+        b.to_async(&runtime).iter(|| async {
+            let response = cache
+                .process_request(client(0), Priority::Normal, [0, 1], 1, &READ, false)
+                .await
+                .unwrap();
+            black_box(response)
+        })
+    });
+
+    group.finish();
+}
+
+fn multi_client_throughput(c: &mut Criterion) {
+    const REQUESTS_PER_CLIENT: u64 = 64;
+
+    let runtime = Runtime::new().unwrap();
+    let (processor, _shutdown) = processor(&runtime, CacheConfig::default());
+    let mut group = c.benchmark_group("multi_client_throughput");
+
+    for clients in [1u16, 8, 64] {
+        group.throughput(Throughput::Elements(clients as u64 * REQUESTS_PER_CLIENT));
+        group.bench_with_input(
+            BenchmarkId::from_parameter(clients),
+            &clients,
+            |b, &clients| {
+                b.to_async(&runtime).iter(|| {
+                    let processor = Arc::clone(&processor);
+                    async move {
+                        let tasks: Vec<_> = (0..clients)
+                            .map(|index| {
+                                let processor = Arc::clone(&processor);
+                                tokio::spawn(async move {
+                                    // Different units so single-flight doesn't fold the reads
+                                    let unit_id = (index % 247) as u8 + 1;
+                                    for i in 0..REQUESTS_PER_CLIENT {
+                                        let transaction_id = (i as u16).to_be_bytes();
+                                        processor
+                                            .process_request(
+                                                client(index),
+                                                Priority::Normal,
+                                                transaction_id,
+                                                unit_id,
+                                                &READ,
+                                                false,
+                                            )
+                                            .await
+                                            .unwrap();
+                                    }
+                                })
+                            })
+                            .collect();
+
+                        for task in tasks {
+                            task.await.unwrap();
+                        }
+                    }
+                })
+            },
+        );
+    }
+
+    group.finish();
+}
+
+criterion_group!(benches, process_request, multi_client_throughput);
+criterion_main!(benches);
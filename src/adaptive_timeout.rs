@@ -0,0 +1,280 @@
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Mutex,
+    },
+    time::Duration,
+};
+
+use serde::Serialize;
+
+use crate::{AdaptiveTimeoutConfig, RelayError, TransportError};
+
+/// Response times kept per unit ID and function code
+pub(crate) const WINDOW: usize = 128;
+
+/// Samples between two recalculations of a learned timeout
+const UPDATE_INTERVAL: usize = 16;
+
+/// Missed responses in a row after which the learned timeout stops doubling
+const MAX_BACKOFF: u32 = 6;
+
+/// Recent response times of one unit ID and function code
+struct ResponseTimes {
+    /// Ring of the last `WINDOW` response times in microseconds
+    samples: Vec<u32>,
+    next: usize,
+    since_update: usize,
+    learned: Option<Duration>,
+    /// Missed responses in a row, each one doubles the timeout
+    backoff: u32,
+}
+
+impl ResponseTimes {
+    fn new() -> Self {
+        Self {
+            samples: Vec::with_capacity(WINDOW),
+            next: 0,
+            since_update: 0,
+            learned: None,
+            backoff: 0,
+        }
+    }
+
+    fn push(&mut self, elapsed: Duration) {
+        let sample = elapsed.as_micros().min(u32::MAX as u128) as u32;
+        if self.samples.len() < WINDOW {
+            self.samples.push(sample);
+        } else {
+            self.samples[self.next] = sample;
+        }
+        self.next = (self.next + 1) % WINDOW;
+        self.since_update += 1;
+    }
+
+    /// Response time below which `quantile` of the samples fall
+    fn quantile(&self, quantile: f64) -> Duration {
+        let mut sorted = self.samples.clone();
+        let len = sorted.len();
+        let rank = (quantile * len as f64).ceil() as usize;
+        let (_, value, _) = sorted.select_nth_unstable(rank.clamp(1, len) - 1);
+        Duration::from_micros(*value as u64)
+    }
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct ResponseTimeoutSnapshot {
+    pub unit_id: u8,
+    pub function: u8,
+    pub samples: usize,
+    /// Time the unit currently gets to start its response
+    pub timeout_ms: u64,
+}
+
+/// Response timeouts of one bus, learned per unit ID and function code.
+///
+/// A device that always answers in 15 ms gets `quantile` x `multiplier` of
+/// its recent response times, so a lost frame costs tens of milliseconds
+/// instead of the timeout the slowest device on the bus needs. Until
+/// `min_samples` responses have been seen, and whenever adaption is
+/// disabled, the configured timeout of the transport applies, which is also
+/// the upper bound of anything learned. Every missed response doubles the
+/// learned timeout until the unit answers again, a device that got slower
+/// is not cut off for good.
+pub struct AdaptiveTimeouts {
+    config: AdaptiveTimeoutConfig,
+    /// Microseconds, follows the transport when its timing is reloaded
+    max_us: AtomicU64,
+    units: Mutex<HashMap<(u8, u8), ResponseTimes>>,
+}
+
+impl AdaptiveTimeouts {
+    /// `max` is the configured response timeout of the transport
+    pub fn new(config: &AdaptiveTimeoutConfig, max: Duration) -> Self {
+        Self {
+            config: config.clone(),
+            max_us: AtomicU64::new(max.as_micros() as u64),
+            units: Mutex::new(HashMap::new()),
+        }
+    }
+
+    pub fn enabled(&self) -> bool {
+        self.config.enabled
+    }
+
+    /// The configured response timeout of the transport
+    pub fn max(&self) -> Duration {
+        Duration::from_micros(self.max_us.load(Ordering::Relaxed))
+    }
+
+    /// Follows a new response timeout of the transport. What was learned is
+    /// kept, capped by the new value when it is used.
+    pub fn set_max(&self, max: Duration) {
+        self.max_us.store(max.as_micros() as u64, Ordering::Relaxed);
+    }
+
+    /// Time a request to `unit_id` with `function` gets to start its response
+    pub fn timeout(&self, unit_id: u8, function: u8) -> Duration {
+        // Broadcasts are never answered, nothing to learn from them
+        if !self.config.enabled || unit_id == 0 {
+            return self.max();
+        }
+
+        let units = self.units.lock().unwrap();
+        match units.get(&(unit_id, function)) {
+            Some(times) => self.backed_off(times),
+            None => self.max(),
+        }
+    }
+
+    /// Records the outcome of a transaction that took `elapsed`, only
+    /// answers are learned from, missed responses back the timeout off
+    pub fn record<T>(
+        &self,
+        unit_id: u8,
+        function: u8,
+        elapsed: Duration,
+        result: &Result<T, RelayError>,
+    ) {
+        if !self.config.enabled || unit_id == 0 {
+            return;
+        }
+
+        let mut units = self.units.lock().unwrap();
+        let times = units
+            .entry((unit_id, function))
+            .or_insert_with(ResponseTimes::new);
+
+        match result {
+            Ok(_) => {
+                times.backoff = 0;
+                times.push(elapsed);
+
+                let learning = times.learned.is_none();
+                if times.samples.len() >= self.config.min_samples.max(1)
+                    && (learning || times.since_update >= UPDATE_INTERVAL)
+                {
+                    let learned = times
+                        .quantile(self.config.quantile)
+                        .mul_f64(self.config.multiplier);
+                    let max = self.max();
+                    times.learned = Some(learned.clamp(self.config.min_timeout.min(max), max));
+                    times.since_update = 0;
+                }
+            }
+            Err(RelayError::Transport(
+                TransportError::Timeout { .. } | TransportError::NoResponse { .. },
+            )) => {
+                times.backoff = (times.backoff + 1).min(MAX_BACKOFF);
+            }
+            Err(_) => {}
+        }
+    }
+
+    pub fn snapshot(&self) -> Vec<ResponseTimeoutSnapshot> {
+        let units = self.units.lock().unwrap();
+        let mut snapshot: Vec<_> = units
+            .iter()
+            .map(|(&(unit_id, function), times)| ResponseTimeoutSnapshot {
+                unit_id,
+                function,
+                samples: times.samples.len(),
+                timeout_ms: self.backed_off(times).as_millis() as u64,
+            })
+            .collect();
+        snapshot.sort_by_key(|entry| (entry.unit_id, entry.function));
+        snapshot
+    }
+
+    fn backed_off(&self, times: &ResponseTimes) -> Duration {
+        match times.learned {
+            Some(learned) => (learned * (1 << times.backoff)).min(self.max()),
+            None => self.max(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn config() -> AdaptiveTimeoutConfig {
+        AdaptiveTimeoutConfig {
+            enabled: true,
+            min_samples: 4,
+            ..Default::default()
+        }
+    }
+
+    fn no_response() -> Result<(), RelayError> {
+        Err(RelayError::Transport(TransportError::NoResponse {
+            attempts: 1,
+            elapsed: Duration::from_millis(100),
+        }))
+    }
+
+    #[test]
+    fn test_learns_per_unit_and_function() {
+        let timeouts = AdaptiveTimeouts::new(&config(), Duration::from_secs(3));
+
+        for _ in 0..3 {
+            timeouts.record(1, 0x03, Duration::from_millis(15), &Ok(()));
+        }
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_secs(3));
+
+        timeouts.record(1, 0x03, Duration::from_millis(15), &Ok(()));
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(45));
+
+        // Other functions and units keep the configured timeout
+        assert_eq!(timeouts.timeout(1, 0x10), Duration::from_secs(3));
+        assert_eq!(timeouts.timeout(2, 0x03), Duration::from_secs(3));
+
+        // A slow device is bounded by the configured timeout
+        for _ in 0..4 {
+            timeouts.record(2, 0x03, Duration::from_millis(1_500), &Ok(()));
+        }
+        assert_eq!(timeouts.timeout(2, 0x03), Duration::from_secs(3));
+
+        // Fast answers are bounded by min_timeout
+        for _ in 0..4 {
+            timeouts.record(3, 0x03, Duration::from_millis(1), &Ok(()));
+        }
+        assert_eq!(timeouts.timeout(3, 0x03), Duration::from_millis(20));
+    }
+
+    #[test]
+    fn test_backs_off_after_missed_responses() {
+        let timeouts = AdaptiveTimeouts::new(&config(), Duration::from_secs(1));
+        for _ in 0..4 {
+            timeouts.record(1, 0x03, Duration::from_millis(10), &Ok(()));
+        }
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(30));
+
+        timeouts.record(1, 0x03, Duration::ZERO, &no_response());
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(60));
+        for _ in 0..10 {
+            timeouts.record(1, 0x03, Duration::ZERO, &no_response());
+        }
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_secs(1));
+
+        timeouts.record(1, 0x03, Duration::from_millis(10), &Ok(()));
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(30));
+
+        let snapshot = timeouts.snapshot();
+        assert_eq!(snapshot.len(), 1);
+        assert_eq!(snapshot[0].samples, 5);
+        assert_eq!(snapshot[0].timeout_ms, 30);
+    }
+
+    #[test]
+    fn test_disabled() {
+        let timeouts =
+            AdaptiveTimeouts::new(&AdaptiveTimeoutConfig::default(), Duration::from_secs(1));
+        for _ in 0..32 {
+            timeouts.record(1, 0x03, Duration::from_millis(10), &Ok(()));
+        }
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_secs(1));
+        assert!(timeouts.snapshot().is_empty());
+    }
+}
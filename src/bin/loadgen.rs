@@ -0,0 +1,607 @@
+//! Modbus TCP load generator.
+//!
+//! Opens a number of concurrent connections to a gateway, keeps up to
+//! `depth` requests in flight on each of them and reports throughput and
+//! the distribution of response times once the run is over. Combined with
+//! the simulated slaves of the `mock` feature it gives the saturation
+//! point of the relay itself, on a real bus that of the whole setup.
+//!
+//! With `--idle` it also holds connections open that never send anything,
+//! and given the relay's PID it reports what each of them costs in
+//! resident memory.
+
+use std::{
+    collections::HashMap,
+    net::SocketAddr,
+    process,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc,
+    },
+    time::{Duration, Instant},
+};
+
+use clap::Parser;
+use serde::Serialize;
+use tokio::{
+    io::AsyncWriteExt,
+    net::TcpStream,
+    time::{sleep, timeout_at},
+};
+
+use modbus_relay::{guess_response_size, Histogram, LatencySummary, MbapFramer};
+
+#[derive(Parser)]
+#[command(author, version, about = "Modbus TCP load generator", long_about = None)]
+struct Cli {
+    /// Gateway address
+    #[arg(short, long, default_value = "127.0.0.1:502")]
+    target: SocketAddr,
+
+    /// Concurrent connections
+    #[arg(short, long, default_value_t = 1)]
+    connections: usize,
+
+    /// Requests kept in flight on each connection
+    #[arg(short, long, default_value_t = 1)]
+    depth: usize,
+
+    /// Length of the run
+    #[arg(long, default_value = "10s", value_parser = humantime::parse_duration)]
+    duration: Duration,
+
+    /// Time a request gets to be answered
+    #[arg(long, default_value = "1s", value_parser = humantime::parse_duration)]
+    timeout: Duration,
+
+    /// Unit IDs to address, requests cycle through them
+    #[arg(short, long = "unit", default_values_t = [1u8])]
+    units: Vec<u8>,
+
+    /// Function codes and their weights, e.g. `3:8,4:1,6:1`
+    #[arg(short, long, default_value = "3:1", value_parser = parse_mix)]
+    mix: Mix,
+
+    /// First register or coil address
+    #[arg(long, default_value_t = 0)]
+    start: u16,
+
+    /// Registers or coils per request
+    #[arg(short, long, default_value_t = 10)]
+    quantity: u16,
+
+    /// Idle connections opened before the run and held until it ends
+    #[arg(long, default_value_t = 0)]
+    idle: usize,
+
+    /// PID of a relay on this host, to measure what idle connections cost
+    #[arg(long)]
+    relay_pid: Option<u32>,
+
+    /// Print the report as JSON
+    #[arg(long)]
+    json: bool,
+}
+
+/// Weighted function codes, expanded into the order they are sent in
+#[derive(Debug, Clone)]
+struct Mix(Vec<u8>);
+
+fn parse_mix(value: &str) -> Result<Mix, String> {
+    let mut schedule = Vec::new();
+
+    for entry in value.split(',') {
+        let (function, weight) = entry.split_once(':').unwrap_or((entry, "1"));
+        let function = parse_function(function.trim())?;
+        let weight: usize = weight
+            .trim()
+            .parse()
+            .map_err(|_| format!("Invalid weight in '{}'", entry))?;
+
+        if !matches!(function, 0x01..=0x06 | 0x0F | 0x10) {
+            return Err(format!("Unsupported function code 0x{:02X}", function));
+        }
+        schedule.extend(std::iter::repeat_n(function, weight));
+    }
+
+    if schedule.is_empty() {
+        return Err("The mix needs at least one function code".to_string());
+    }
+    Ok(Mix(schedule))
+}
+
+fn parse_function(value: &str) -> Result<u8, String> {
+    let parsed = match value
+        .strip_prefix("0x")
+        .or_else(|| value.strip_prefix("0X"))
+    {
+        Some(hex) => u8::from_str_radix(hex, 16),
+        None => value.parse(),
+    };
+    parsed.map_err(|_| format!("Invalid function code '{}'", value))
+}
+
+/// Largest quantity a request with `function` may ask for
+fn max_quantity(function: u8) -> u16 {
+    match function {
+        0x01 | 0x02 => 2000,
+        0x03 | 0x04 => 125,
+        0x0F => 1968,
+        0x10 => 123,
+        // Single writes ignore the quantity
+        _ => u16::MAX,
+    }
+}
+
+/// Builds the MBAP frame of a request with `function`
+fn build_request(
+    transaction_id: u16,
+    unit_id: u8,
+    function: u8,
+    start: u16,
+    quantity: u16,
+    out: &mut Vec<u8>,
+) {
+    let mut pdu = vec![function];
+    pdu.extend_from_slice(&start.to_be_bytes());
+
+    match function {
+        0x05 => pdu.extend_from_slice(&[0xFF, 0x00]),
+        0x06 => pdu.extend_from_slice(&transaction_id.to_be_bytes()),
+        0x0F => {
+            let bytes = quantity.div_ceil(8) as usize;
+            pdu.extend_from_slice(&quantity.to_be_bytes());
+            pdu.push(bytes as u8);
+            pdu.extend(std::iter::repeat_n(0x55, bytes));
+        }
+        0x10 => {
+            pdu.extend_from_slice(&quantity.to_be_bytes());
+            pdu.push((quantity * 2) as u8);
+            for _ in 0..quantity {
+                pdu.extend_from_slice(&transaction_id.to_be_bytes());
+            }
+        }
+        _ => pdu.extend_from_slice(&quantity.to_be_bytes()),
+    }
+
+    out.extend_from_slice(&transaction_id.to_be_bytes());
+    out.extend_from_slice(&[0x00, 0x00]);
+    out.extend_from_slice(&(pdu.len() as u16 + 1).to_be_bytes());
+    out.push(unit_id);
+    out.extend_from_slice(&pdu);
+}
+
+/// Checks the PDU of a response, returns the exception code if it is one
+fn check_response(function: u8, quantity: u16, pdu: &[u8]) -> Result<Option<u8>, ()> {
+    match pdu {
+        [code, exception] if *code == function | 0x80 => Ok(Some(*exception)),
+        // Unit ID and CRC are not part of the PDU
+        [code, ..]
+            if *code == function && pdu.len() == guess_response_size(function, quantity) - 3 =>
+        {
+            Ok(None)
+        }
+        _ => Err(()),
+    }
+}
+
+#[derive(Default)]
+struct Counters {
+    sent: AtomicU64,
+    answered: AtomicU64,
+    exceptions: AtomicU64,
+    timeouts: AtomicU64,
+    invalid: AtomicU64,
+    connect_errors: AtomicU64,
+    disconnects: AtomicU64,
+}
+
+struct Run {
+    cli: Cli,
+    deadline: Instant,
+    counters: Counters,
+    latency: Histogram,
+}
+
+/// A request on its way
+struct InFlight {
+    function: u8,
+    sent_at: Instant,
+}
+
+impl Run {
+    /// Drives one connection until the deadline, reconnecting after errors
+    async fn connection(&self, index: usize) {
+        let mut sequence = index;
+
+        while Instant::now() < self.deadline {
+            let mut stream = match TcpStream::connect(self.cli.target).await {
+                Ok(stream) => stream,
+                Err(_) => {
+                    self.counters.connect_errors.fetch_add(1, Ordering::Relaxed);
+                    sleep(Duration::from_millis(100)).await;
+                    continue;
+                }
+            };
+            stream.set_nodelay(true).ok();
+
+            if self.exchange(&mut stream, &mut sequence).await.is_err() {
+                self.counters.disconnects.fetch_add(1, Ordering::Relaxed);
+            }
+        }
+    }
+
+    /// Keeps `depth` requests in flight on `stream`, fails if the
+    /// connection has to be reopened
+    async fn exchange(&self, stream: &mut TcpStream, sequence: &mut usize) -> Result<(), ()> {
+        let cli = &self.cli;
+        let mut framer = MbapFramer::new();
+        let mut in_flight: HashMap<u16, InFlight> = HashMap::with_capacity(cli.depth);
+        let mut out = Vec::new();
+
+        loop {
+            let now = Instant::now();
+            if now >= self.deadline && in_flight.is_empty() {
+                return Ok(());
+            }
+
+            // Top the window up, nothing new goes out after the deadline
+            out.clear();
+            let mut requests = 0;
+            while now < self.deadline && in_flight.len() < cli.depth {
+                let transaction_id = *sequence as u16;
+                let function = cli.mix.0[*sequence % cli.mix.0.len()];
+                let unit_id = cli.units[*sequence % cli.units.len()];
+                *sequence = sequence.wrapping_add(1);
+
+                build_request(
+                    transaction_id,
+                    unit_id,
+                    function,
+                    cli.start,
+                    cli.quantity,
+                    &mut out,
+                );
+                in_flight.insert(
+                    transaction_id,
+                    InFlight {
+                        function,
+                        sent_at: now,
+                    },
+                );
+                requests += 1;
+            }
+            if requests > 0 {
+                stream.write_all(&out).await.map_err(|_| ())?;
+                self.counters.sent.fetch_add(requests, Ordering::Relaxed);
+            }
+
+            // The oldest request decides how long to wait
+            let oldest = in_flight.values().map(|request| request.sent_at).min();
+            let wait_until = oldest.unwrap_or(now) + cli.timeout;
+
+            match timeout_at(wait_until.into(), framer.read_from(stream)).await {
+                Ok(Ok(0)) | Ok(Err(_)) => {
+                    self.lost(in_flight.len());
+                    return Err(());
+                }
+                Ok(Ok(_)) => {}
+                Err(_) => {
+                    // Answers may still arrive for the rest, a fresh
+                    // connection keeps them apart
+                    self.lost(in_flight.len());
+                    return Err(());
+                }
+            }
+
+            loop {
+                let frame = match framer.next_frame() {
+                    Ok(Some(frame)) => frame,
+                    Ok(None) => break,
+                    Err(_) => {
+                        self.counters.invalid.fetch_add(1, Ordering::Relaxed);
+                        self.lost(in_flight.len());
+                        return Err(());
+                    }
+                };
+
+                let transaction_id = u16::from_be_bytes([frame[0], frame[1]]);
+                let Some(request) = in_flight.remove(&transaction_id) else {
+                    self.counters.invalid.fetch_add(1, Ordering::Relaxed);
+                    continue;
+                };
+
+                let elapsed = request.sent_at.elapsed();
+                self.latency.record(elapsed.as_micros() as u64);
+
+                match check_response(request.function, cli.quantity, &frame[7..]) {
+                    Ok(None) => {
+                        self.counters.answered.fetch_add(1, Ordering::Relaxed);
+                    }
+                    Ok(Some(_)) => {
+                        self.counters.answered.fetch_add(1, Ordering::Relaxed);
+                        self.counters.exceptions.fetch_add(1, Ordering::Relaxed);
+                    }
+                    Err(()) => {
+                        self.counters.invalid.fetch_add(1, Ordering::Relaxed);
+                    }
+                }
+            }
+        }
+    }
+
+    fn lost(&self, requests: usize) {
+        self.counters
+            .timeouts
+            .fetch_add(requests as u64, Ordering::Relaxed);
+    }
+}
+
+/// Resident memory of process `pid` in KiB, Linux only
+fn resident_kib(pid: u32) -> Option<u64> {
+    let status = std::fs::read_to_string(format!("/proc/{}/status", pid)).ok()?;
+    parse_vm_rss(&status)
+}
+
+fn parse_vm_rss(status: &str) -> Option<u64> {
+    status
+        .lines()
+        .find_map(|line| line.strip_prefix("VmRSS:"))?
+        .trim()
+        .strip_suffix("kB")?
+        .trim()
+        .parse()
+        .ok()
+}
+
+/// Idle connections and what the relay spent on them
+#[derive(Serialize)]
+struct IdleReport {
+    opened: usize,
+    connect_errors: usize,
+    rss_before_kib: Option<u64>,
+    rss_after_kib: Option<u64>,
+    /// Resident memory growth divided by the connections opened
+    bytes_per_connection: Option<u64>,
+}
+
+/// Opens `count` connections that send nothing, measuring the relay's
+/// resident memory before and after if its PID is known
+async fn open_idle(cli: &Cli) -> (Vec<TcpStream>, IdleReport) {
+    let rss_before_kib = cli.relay_pid.and_then(resident_kib);
+
+    let mut streams = Vec::with_capacity(cli.idle);
+    let mut connect_errors = 0;
+    for _ in 0..cli.idle {
+        match TcpStream::connect(cli.target).await {
+            Ok(stream) => streams.push(stream),
+            Err(_) => connect_errors += 1,
+        }
+    }
+
+    // Give the relay time to accept what is still in the backlog
+    sleep(Duration::from_secs(1)).await;
+    let rss_after_kib = cli.relay_pid.and_then(resident_kib);
+
+    let bytes_per_connection = match (rss_before_kib, rss_after_kib) {
+        (Some(before), Some(after)) if !streams.is_empty() => {
+            Some(after.saturating_sub(before) * 1024 / streams.len() as u64)
+        }
+        _ => None,
+    };
+
+    let report = IdleReport {
+        opened: streams.len(),
+        connect_errors,
+        rss_before_kib,
+        rss_after_kib,
+        bytes_per_connection,
+    };
+    (streams, report)
+}
+
+#[derive(Serialize)]
+struct Report {
+    target: SocketAddr,
+    connections: usize,
+    depth: usize,
+    elapsed_ms: u64,
+    sent: u64,
+    answered: u64,
+    exceptions: u64,
+    timeouts: u64,
+    invalid: u64,
+    connect_errors: u64,
+    disconnects: u64,
+    /// Answered requests per second
+    throughput: f64,
+    latency: LatencySummary,
+    /// Upper bound in microseconds and number of responses at or below it
+    histogram: Vec<(u64, u64)>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    idle: Option<IdleReport>,
+}
+
+/// Upper bounds of the printed histogram, in microseconds
+const HISTOGRAM_BOUNDS: [u64; 14] = [
+    100, 200, 500, 1_000, 2_000, 5_000, 10_000, 20_000, 50_000, 100_000, 200_000, 500_000,
+    1_000_000, 5_000_000,
+];
+
+fn report(run: &Run, elapsed: Duration, idle: Option<IdleReport>) -> Report {
+    let counters = &run.counters;
+    let latency = run.latency.snapshot();
+    let answered = counters.answered.load(Ordering::Relaxed);
+
+    Report {
+        target: run.cli.target,
+        connections: run.cli.connections,
+        depth: run.cli.depth,
+        elapsed_ms: elapsed.as_millis() as u64,
+        sent: counters.sent.load(Ordering::Relaxed),
+        answered,
+        exceptions: counters.exceptions.load(Ordering::Relaxed),
+        timeouts: counters.timeouts.load(Ordering::Relaxed),
+        invalid: counters.invalid.load(Ordering::Relaxed),
+        connect_errors: counters.connect_errors.load(Ordering::Relaxed),
+        disconnects: counters.disconnects.load(Ordering::Relaxed),
+        throughput: answered as f64 / elapsed.as_secs_f64(),
+        latency: latency.summary(),
+        histogram: HISTOGRAM_BOUNDS
+            .iter()
+            .map(|&bound| (bound, latency.count_le(bound)))
+            .collect(),
+        idle,
+    }
+}
+
+fn print_report(report: &Report) {
+    println!("Target          {}", report.target);
+    println!(
+        "Connections     {} x depth {}",
+        report.connections, report.depth
+    );
+    println!("Elapsed         {:.2} s", report.elapsed_ms as f64 / 1000.0);
+    println!(
+        "Requests        {} sent, {} answered, {} exceptions",
+        report.sent, report.answered, report.exceptions
+    );
+    println!(
+        "Errors          {} timeouts, {} invalid, {} connect errors, {} disconnects",
+        report.timeouts, report.invalid, report.connect_errors, report.disconnects
+    );
+    println!("Throughput      {:.1} responses/s", report.throughput);
+
+    if let Some(idle) = &report.idle {
+        println!(
+            "Idle            {} connections, {} connect errors",
+            idle.opened, idle.connect_errors
+        );
+        if let (Some(before), Some(after), Some(per_connection)) = (
+            idle.rss_before_kib,
+            idle.rss_after_kib,
+            idle.bytes_per_connection,
+        ) {
+            println!(
+                "Relay memory    {} KiB -> {} KiB, {} bytes per idle connection",
+                before, after, per_connection
+            );
+        }
+    }
+
+    let latency = &report.latency;
+    println!(
+        "Latency (us)    p50 {}  p90 {}  p99 {}  p99.9 {}  max {}",
+        latency.p50_us, latency.p90_us, latency.p99_us, latency.p999_us, latency.max_us
+    );
+
+    // Responses with a timing, invalid ones included
+    let total = latency.count.max(1) as f64;
+    for &(bound, count) in &report.histogram {
+        let share = count as f64 / total;
+        println!(
+            "  <= {:>9?}  {:>6.2}%  {}",
+            Duration::from_micros(bound),
+            share * 100.0,
+            "#".repeat((share * 40.0).round() as usize)
+        );
+        if count == latency.count {
+            break;
+        }
+    }
+}
+
+#[tokio::main]
+async fn main() {
+    let cli = Cli::parse();
+    if cli.connections == 0 || cli.depth == 0 || cli.units.is_empty() {
+        eprintln!("Connections, depth and units must not be zero");
+        process::exit(2);
+    }
+    if let Some(function) = cli
+        .mix
+        .0
+        .iter()
+        .find(|&&function| !(1..=max_quantity(function)).contains(&cli.quantity))
+    {
+        eprintln!(
+            "Function 0x{:02X} takes 1 to {} registers or coils",
+            function,
+            max_quantity(*function)
+        );
+        process::exit(2);
+    }
+
+    // Held open until the report is out
+    let (_idle_streams, idle) = match cli.idle {
+        0 => (Vec::new(), None),
+        _ => {
+            let (streams, report) = open_idle(&cli).await;
+            (streams, Some(report))
+        }
+    };
+
+    let started = Instant::now();
+    let run = Arc::new(Run {
+        deadline: started + cli.duration,
+        cli,
+        counters: Counters::default(),
+        latency: Histogram::default(),
+    });
+
+    let tasks: Vec<_> = (0..run.cli.connections)
+        .map(|index| {
+            let run = Arc::clone(&run);
+            tokio::spawn(async move { run.connection(index).await })
+        })
+        .collect();
+    for task in tasks {
+        task.await.ok();
+    }
+
+    let report = report(&run, started.elapsed(), idle);
+    if run.cli.json {
+        println!("{}", serde_json::to_string_pretty(&report).unwrap());
+    } else {
+        print_report(&report);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse_mix() {
+        assert_eq!(parse_mix("3:2,0x10:1,4").unwrap().0, vec![3, 3, 0x10, 4]);
+        assert!(parse_mix("3:0").is_err());
+        assert!(parse_mix("0x2B:1").is_err());
+        assert!(parse_mix("x").is_err());
+    }
+
+    #[test]
+    fn test_build_request() {
+        let mut out = Vec::new();
+        build_request(0x0102, 7, 0x03, 0x0010, 2, &mut out);
+        assert_eq!(out, [1, 2, 0, 0, 0, 6, 7, 3, 0, 0x10, 0, 2]);
+
+        out.clear();
+        build_request(5, 1, 0x10, 0, 2, &mut out);
+        assert_eq!(out, [0, 5, 0, 0, 0, 11, 1, 0x10, 0, 0, 0, 2, 4, 0, 5, 0, 5]);
+    }
+
+    #[test]
+    fn test_check_response() {
+        assert_eq!(check_response(0x03, 2, &[3, 4, 0, 1, 0, 2]), Ok(None));
+        assert_eq!(check_response(0x03, 2, &[0x83, 0x02]), Ok(Some(0x02)));
+        assert_eq!(check_response(0x03, 2, &[3, 2, 0, 1]), Err(()));
+        assert_eq!(check_response(0x06, 1, &[6, 0, 0, 0, 1]), Ok(None));
+    }
+
+    #[test]
+    fn test_parse_vm_rss() {
+        let status = "Name:\tmodbus-relay\nVmHWM:\t   9000 kB\nVmRSS:\t   8192 kB\n";
+        assert_eq!(parse_vm_rss(status), Some(8192));
+        assert_eq!(parse_vm_rss("Name:\tkthreadd\n"), None);
+    }
+}
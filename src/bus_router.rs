@@ -0,0 +1,82 @@
+use crate::UnitRange;
+
+/// Picks the RTU bus a request goes to.
+///
+/// Bus 0 is the default bus, it gets every unit ID no other bus claims.
+/// Connections accepted on a bus' own port skip the lookup and stay on
+/// that bus, see [`BusRouter::get`].
+#[derive(Debug)]
+pub struct BusRouter<T> {
+    buses: Vec<T>,
+    units: Vec<Vec<UnitRange>>,
+}
+
+impl<T> BusRouter<T> {
+    pub fn new(default: T) -> Self {
+        Self {
+            buses: vec![default],
+            units: vec![Vec::new()],
+        }
+    }
+
+    /// Adds a bus serving `units`, returns its index
+    pub fn push(&mut self, units: Vec<UnitRange>, bus: T) -> usize {
+        self.buses.push(bus);
+        self.units.push(units);
+        self.buses.len() - 1
+    }
+
+    /// Bus serving `unit_id`
+    pub fn route(&self, unit_id: u8) -> &T {
+        let index = self
+            .units
+            .iter()
+            .position(|ranges| ranges.iter().any(|range| range.contains(unit_id)))
+            .unwrap_or(0);
+
+        &self.buses[index]
+    }
+
+    /// # Panics
+    ///
+    /// Panics if there is no bus with that index.
+    pub fn get(&self, index: usize) -> &T {
+        &self.buses[index]
+    }
+
+    pub fn default_bus(&self) -> &T {
+        &self.buses[0]
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = &T> {
+        self.buses.iter()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_route_by_unit_id() {
+        let mut router = BusRouter::new("default");
+        let line2 = router.push(
+            vec![
+                UnitRange { start: 1, end: 10 },
+                UnitRange { start: 20, end: 20 },
+            ],
+            "line2",
+        );
+        router.push(vec![UnitRange { start: 11, end: 19 }], "line3");
+
+        assert_eq!(*router.route(1), "line2");
+        assert_eq!(*router.route(10), "line2");
+        assert_eq!(*router.route(11), "line3");
+        assert_eq!(*router.route(20), "line2");
+        assert_eq!(*router.route(21), "default");
+        assert_eq!(*router.route(0), "default");
+
+        assert_eq!(*router.get(line2), "line2");
+        assert_eq!(router.iter().count(), 3);
+    }
+}
@@ -0,0 +1,384 @@
+use std::{
+    collections::HashMap,
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    time::Instant,
+};
+
+use serde::Serialize;
+use tracing::trace;
+
+use crate::CacheConfig;
+
+/// Identifies a cacheable read: 0x01-0x04 with a start address and quantity
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct CacheKey {
+    pub unit_id: u8,
+    pub function: u8,
+    pub start: u16,
+    pub quantity: u16,
+}
+
+impl CacheKey {
+    /// Parses a read request PDU, `None` for anything that is not a plain read
+    pub fn from_request(unit_id: u8, pdu: &[u8]) -> Option<Self> {
+        match pdu {
+            [function @ 0x01..=0x04, start_hi, start_lo, qty_hi, qty_lo] => Some(Self {
+                unit_id,
+                function: *function,
+                start: u16::from_be_bytes([*start_hi, *start_lo]),
+                quantity: u16::from_be_bytes([*qty_hi, *qty_lo]),
+            }),
+            _ => None,
+        }
+    }
+
+    fn overlaps(&self, start: u16, quantity: u16) -> bool {
+        let (a_start, a_end) = (self.start as u32, self.start as u32 + self.quantity as u32);
+        let (b_start, b_end) = (start as u32, start as u32 + quantity as u32);
+
+        a_start < b_end && b_start < a_end
+    }
+}
+
+/// Address range touched by a write request.
+///
+/// `function` is the read function code whose data the write changes, coil
+/// writes affect 0x01 and register writes affect 0x03.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct WriteRange {
+    function: u8,
+    start: u16,
+    quantity: u16,
+}
+
+impl WriteRange {
+    /// Parses a write request PDU, `None` for anything that writes no data
+    pub fn from_request(pdu: &[u8]) -> Option<Self> {
+        let word = |i: usize| pdu.get(i..i + 2).map(|b| u16::from_be_bytes([b[0], b[1]]));
+
+        let (function, start, quantity) = match pdu.first()? {
+            // Write Single Coil
+            0x05 => (0x01, word(1)?, 1),
+            // Write Single Register / Mask Write Register
+            0x06 | 0x16 => (0x03, word(1)?, 1),
+            // Write Multiple Coils
+            0x0F => (0x01, word(1)?, word(3)?),
+            // Write Multiple Registers
+            0x10 => (0x03, word(1)?, word(3)?),
+            // Read/Write Multiple Registers, write part follows the read part
+            0x17 => (0x03, word(5)?, word(7)?),
+            _ => return None,
+        };
+
+        Some(Self {
+            function,
+            start,
+            quantity,
+        })
+    }
+    /// Whether the write changes data returned by the read `key`
+    pub fn overlaps(&self, key: &CacheKey) -> bool {
+        key.function == self.function && key.overlaps(self.start, self.quantity)
+    }
+}
+
+struct CacheEntry {
+    /// RTU response without CRC: Unit ID + PDU
+    response: Vec<u8>,
+    expires_at: Instant,
+}
+
+/// Cache hit/miss counters
+#[derive(Debug, Default)]
+pub struct CacheStats {
+    hits: AtomicU64,
+    misses: AtomicU64,
+    invalidations: AtomicU64,
+    entries: AtomicUsize,
+}
+
+/// Point in time copy of [`CacheStats`]
+#[derive(Debug, Clone, Serialize)]
+pub struct CacheStatsSnapshot {
+    pub hits: u64,
+    pub misses: u64,
+    pub invalidations: u64,
+    pub entries: usize,
+}
+
+impl CacheStats {
+    pub fn snapshot(&self) -> CacheStatsSnapshot {
+        CacheStatsSnapshot {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            invalidations: self.invalidations.load(Ordering::Relaxed),
+            entries: self.entries.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Cache of read responses, keyed by unit, function, start and quantity.
+///
+/// Writes going through the relay drop every cached read they overlap.
+/// A read that was on the bus while a write passed through is not stored,
+/// this is tracked with a generation counter bumped on every write.
+pub struct ResponseCache {
+    config: CacheConfig,
+    entries: Mutex<HashMap<CacheKey, CacheEntry>>,
+    generation: AtomicU64,
+    stats: Arc<CacheStats>,
+}
+
+impl ResponseCache {
+    pub fn new(config: CacheConfig) -> Self {
+        Self::with_stats(config, Arc::new(CacheStats::default()))
+    }
+
+    /// Creates a cache that counts into `stats`, which may be shared with other caches
+    pub fn with_stats(config: CacheConfig, stats: Arc<CacheStats>) -> Self {
+        Self {
+            config,
+            entries: Mutex::new(HashMap::new()),
+            generation: AtomicU64::new(0),
+            stats,
+        }
+    }
+
+    pub fn stats(&self) -> Arc<CacheStats> {
+        Arc::clone(&self.stats)
+    }
+
+    /// Returns the cache key for a request, `None` if it must not be cached
+    pub fn key_for(&self, unit_id: u8, pdu: &[u8]) -> Option<CacheKey> {
+        if !self.config.enabled || unit_id == 0 {
+            return None;
+        }
+
+        CacheKey::from_request(unit_id, pdu).filter(|key| {
+            !self
+                .config
+                .ttl_for(key.unit_id, key.start, key.quantity)
+                .is_zero()
+        })
+    }
+
+    /// Current write generation, to be passed back to [`ResponseCache::insert`]
+    pub fn generation(&self) -> u64 {
+        self.generation.load(Ordering::Acquire)
+    }
+
+    /// Passes a fresh cached response (Unit ID + PDU) to `f`
+    pub fn get_with<R>(&self, key: &CacheKey, f: impl FnOnce(&[u8]) -> R) -> Option<R> {
+        let mut entries = self.entries.lock().unwrap();
+
+        let response = match entries.get(key) {
+            Some(entry) if entry.expires_at > Instant::now() => Some(f(&entry.response)),
+            Some(_) => {
+                entries.remove(key);
+                self.stats.entries.fetch_sub(1, Ordering::Relaxed);
+                None
+            }
+            None => None,
+        };
+
+        let counter = match response {
+            Some(_) => &self.stats.hits,
+            None => &self.stats.misses,
+        };
+        counter.fetch_add(1, Ordering::Relaxed);
+
+        response
+    }
+
+    /// Stores a response read while the cache was at `generation`
+    pub fn insert(&self, key: CacheKey, response: &[u8], generation: u64) {
+        let ttl = self.config.ttl_for(key.unit_id, key.start, key.quantity);
+        let now = Instant::now();
+
+        let mut entries = self.entries.lock().unwrap();
+
+        // A write went through while this read was in flight
+        if self.generation.load(Ordering::Acquire) != generation {
+            trace!("Not caching {:?}, invalidated while in flight", key);
+            return;
+        }
+
+        if entries.len() >= self.config.max_entries && !entries.contains_key(&key) {
+            let before = entries.len();
+            entries.retain(|_, entry| entry.expires_at > now);
+            self.stats
+                .entries
+                .fetch_sub(before - entries.len(), Ordering::Relaxed);
+
+            if entries.len() >= self.config.max_entries {
+                return;
+            }
+        }
+
+        let previous = entries.insert(
+            key,
+            CacheEntry {
+                response: response.to_vec(),
+                expires_at: now + ttl,
+            },
+        );
+        if previous.is_none() {
+            self.stats.entries.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Drops cached reads overlapping `write`.
+    ///
+    /// A broadcast write (unit 0) invalidates the range on every unit.
+    pub fn invalidate(&self, unit_id: u8, write: WriteRange) {
+        if !self.config.enabled {
+            return;
+        }
+
+        let mut entries = self.entries.lock().unwrap();
+        self.generation.fetch_add(1, Ordering::AcqRel);
+
+        let before = entries.len();
+        entries.retain(|key, _| !((unit_id == 0 || key.unit_id == unit_id) && write.overlaps(key)));
+
+        let removed = before - entries.len();
+        if removed > 0 {
+            trace!(
+                "Write to unit 0x{:02X} invalidated {} cached reads",
+                unit_id,
+                removed
+            );
+        }
+
+        self.stats
+            .invalidations
+            .fetch_add(removed as u64, Ordering::Relaxed);
+        self.stats.entries.fetch_sub(removed, Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use super::*;
+
+    fn cache() -> ResponseCache {
+        ResponseCache::new(CacheConfig {
+            enabled: true,
+            default_ttl: Duration::from_secs(60),
+            ..Default::default()
+        })
+    }
+
+    fn write(pdu: &[u8]) -> WriteRange {
+        WriteRange::from_request(pdu).unwrap()
+    }
+
+    const READ_HOLDING: [u8; 5] = [0x03, 0x00, 0x10, 0x00, 0x04];
+    const RESPONSE: [u8; 11] = [
+        0x01, 0x03, 0x08, 0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04,
+    ];
+
+    #[test]
+    fn test_hit_and_miss() {
+        let cache = cache();
+        let key = cache.key_for(1, &READ_HOLDING).unwrap();
+
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_none());
+        cache.insert(key, &RESPONSE, cache.generation());
+        assert_eq!(cache.get_with(&key, <[u8]>::to_vec).unwrap(), RESPONSE);
+
+        let stats = cache.stats().snapshot();
+        assert_eq!((stats.hits, stats.misses, stats.entries), (1, 1, 1));
+
+        // Writes and broadcasts are never cached
+        assert!(cache.key_for(1, &[0x06, 0x00, 0x10, 0x00, 0x01]).is_none());
+        assert!(cache.key_for(0, &READ_HOLDING).is_none());
+    }
+
+    #[test]
+    fn test_write_invalidates_overlapping_reads() {
+        let cache = cache();
+        let key = cache.key_for(1, &READ_HOLDING).unwrap();
+        cache.insert(key, &RESPONSE, cache.generation());
+
+        // Coil write at the same address does not touch holding registers
+        cache.invalidate(1, write(&[0x05, 0x00, 0x12, 0xFF, 0x00]));
+        // Register write just past the cached block
+        cache.invalidate(1, write(&[0x06, 0x00, 0x14, 0x00, 0x01]));
+        // Same register on another unit
+        cache.invalidate(2, write(&[0x06, 0x00, 0x12, 0x00, 0x01]));
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_some());
+
+        // Write Multiple Registers 0x000E..0x0011 overlaps 0x0010..0x0013
+        cache.invalidate(
+            1,
+            write(&[0x10, 0x00, 0x0E, 0x00, 0x04, 0x08, 0, 0, 0, 0, 0, 0, 0, 0]),
+        );
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_none());
+        assert_eq!(cache.stats().snapshot().invalidations, 1);
+    }
+
+    #[test]
+    fn test_broadcast_write_invalidates_all_units() {
+        let cache = cache();
+        let key = cache.key_for(7, &READ_HOLDING).unwrap();
+        cache.insert(key, &RESPONSE, cache.generation());
+
+        cache.invalidate(0, write(&[0x06, 0x00, 0x13, 0x00, 0x01]));
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_none());
+    }
+
+    #[test]
+    fn test_read_racing_write_is_not_stored() {
+        let cache = cache();
+        let key = cache.key_for(1, &READ_HOLDING).unwrap();
+
+        let generation = cache.generation();
+        cache.invalidate(1, write(&[0x06, 0x00, 0x10, 0x00, 0x01]));
+        cache.insert(key, &RESPONSE, generation);
+
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_none());
+    }
+
+    #[test]
+    fn test_shared_stats() {
+        let stats = Arc::new(CacheStats::default());
+        let config = CacheConfig {
+            enabled: true,
+            default_ttl: Duration::from_secs(60),
+            ..Default::default()
+        };
+        let a = ResponseCache::with_stats(config.clone(), Arc::clone(&stats));
+        let b = ResponseCache::with_stats(config, Arc::clone(&stats));
+
+        let key = a.key_for(1, &READ_HOLDING).unwrap();
+        a.insert(key, &RESPONSE, a.generation());
+        b.insert(key, &RESPONSE, b.generation());
+        b.insert(key, &RESPONSE, b.generation());
+        assert_eq!(stats.snapshot().entries, 2);
+
+        b.invalidate(1, write(&[0x06, 0x00, 0x10, 0x00, 0x01]));
+        assert_eq!(stats.snapshot().entries, 1);
+        assert!(a.get_with(&key, <[u8]>::to_vec).is_some());
+    }
+
+    #[test]
+    fn test_expired_entry() {
+        let cache = ResponseCache::new(CacheConfig {
+            enabled: true,
+            default_ttl: Duration::from_millis(1),
+            ..Default::default()
+        });
+        let key = cache.key_for(1, &READ_HOLDING).unwrap();
+        cache.insert(key, &RESPONSE, cache.generation());
+
+        std::thread::sleep(Duration::from_millis(5));
+        assert!(cache.get_with(&key, <[u8]>::to_vec).is_none());
+        assert_eq!(cache.stats().snapshot().entries, 0);
+    }
+}
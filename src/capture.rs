@@ -0,0 +1,523 @@
+use std::{
+    collections::HashMap,
+    net::{IpAddr, Ipv6Addr, SocketAddr},
+    sync::atomic::{fence, AtomicU64, Ordering},
+    time::{SystemTime, UNIX_EPOCH},
+};
+
+use serde::{Serialize, Serializer};
+
+/// Bytes kept of a frame, a full Modbus TCP ADU is 260 and an RTU one 256
+pub const MAX_CAPTURED: usize = 264;
+
+const WORDS: usize = MAX_CAPTURED / 8;
+
+/// Where a captured frame was seen
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize)]
+#[serde(rename_all = "snake_case")]
+pub enum Direction {
+    /// Modbus TCP request read from a client
+    TcpRequest,
+    /// Modbus TCP response written to a client
+    TcpResponse,
+    /// RTU request written to a bus
+    RtuRequest,
+    /// RTU response read from a bus, before its CRC is checked
+    RtuResponse,
+}
+
+impl Direction {
+    const ALL: [Direction; 4] = [
+        Direction::TcpRequest,
+        Direction::TcpResponse,
+        Direction::RtuRequest,
+        Direction::RtuResponse,
+    ];
+
+    fn is_request(self) -> bool {
+        matches!(self, Direction::TcpRequest | Direction::RtuRequest)
+    }
+}
+
+/// One entry of the ring, guarded by a sequence lock.
+///
+/// Every field is an atomic, a reader racing a writer copies garbage but
+/// notices from `stamp` and drops it, there is no undefined behaviour.
+struct Slot {
+    /// `2 * seq + 1` while the frame `seq` is written, `2 * seq + 2` once
+    /// it is complete
+    stamp: AtomicU64,
+    /// Microseconds since the Unix epoch
+    time_us: AtomicU64,
+    /// Client address as IPv6, IPv4 addresses mapped
+    ip: [AtomicU64; 2],
+    /// Port, transaction ID, length, bus and direction, see [`Info`]
+    info: AtomicU64,
+    data: [AtomicU64; WORDS],
+}
+
+impl Slot {
+    fn new() -> Self {
+        Self {
+            stamp: AtomicU64::new(0),
+            time_us: AtomicU64::new(0),
+            ip: Default::default(),
+            info: AtomicU64::new(0),
+            data: std::array::from_fn(|_| AtomicU64::new(0)),
+        }
+    }
+}
+
+/// Fields of a frame packed into one word
+struct Info {
+    port: u16,
+    transaction_id: Option<u16>,
+    length: u16,
+    bus: Option<u8>,
+    direction: Direction,
+}
+
+impl Info {
+    fn pack(&self) -> u64 {
+        self.port as u64
+            | (self.transaction_id.unwrap_or_default() as u64) << 16
+            | (self.length as u64) << 32
+            | (self.bus.unwrap_or(u8::MAX) as u64) << 48
+            | (self.direction as u64) << 56
+            | (self.transaction_id.is_some() as u64) << 60
+    }
+
+    fn unpack(word: u64) -> Self {
+        let bus = (word >> 48) as u8;
+        Self {
+            port: word as u16,
+            transaction_id: (word >> 60 & 1 == 1).then_some((word >> 16) as u16),
+            length: (word >> 32) as u16,
+            bus: (bus != u8::MAX).then_some(bus),
+            direction: Direction::ALL[(word >> 56) as usize & 0x3],
+        }
+    }
+}
+
+/// A frame taken out of the ring
+#[derive(Debug, Clone, Serialize)]
+pub struct CapturedFrame {
+    /// Position in the capture, gaps are frames overwritten or skipped
+    pub seq: u64,
+    /// Microseconds since the Unix epoch
+    pub time_us: u64,
+    pub direction: Direction,
+    /// Client the frame was sent by or for
+    pub client: SocketAddr,
+    /// MBAP transaction ID, only known for Modbus TCP frames
+    pub transaction_id: Option<u16>,
+    /// Index of the bus an RTU frame went over, the default bus is 0
+    pub bus: Option<u8>,
+    /// Length on the wire, `data` holds at most [`MAX_CAPTURED`] bytes of it
+    pub length: u16,
+    #[serde(serialize_with = "serialize_hex")]
+    pub data: Vec<u8>,
+}
+
+fn serialize_hex<S: Serializer>(data: &[u8], serializer: S) -> Result<S::Ok, S::Error> {
+    serializer.serialize_str(&hex::encode_upper(data))
+}
+
+/// Fixed-size ring of the latest raw frames on every client connection and
+/// bus.
+///
+/// Recording claims a slot with one atomic add and copies the frame into
+/// it with plain stores, nothing is formatted or allocated and no lock is
+/// taken, so it can stay enabled in production. Readers take a consistent
+/// snapshot without stopping the writers.
+pub struct FrameCapture {
+    slots: Box<[Slot]>,
+    mask: u64,
+    head: AtomicU64,
+    /// Frames not recorded because their slot was still being written
+    skipped: AtomicU64,
+}
+
+impl FrameCapture {
+    /// Ring of `slots` frames, rounded up to a power of two
+    pub fn new(slots: usize) -> Self {
+        let slots = slots.max(1).next_power_of_two();
+        Self {
+            slots: (0..slots).map(|_| Slot::new()).collect(),
+            mask: slots as u64 - 1,
+            head: AtomicU64::new(0),
+            skipped: AtomicU64::new(0),
+        }
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.slots.len()
+    }
+
+    /// Frames recorded since start, overwritten ones included
+    pub fn recorded(&self) -> u64 {
+        self.head.load(Ordering::Relaxed)
+    }
+
+    pub fn skipped(&self) -> u64 {
+        self.skipped.load(Ordering::Relaxed)
+    }
+
+    /// Records a Modbus TCP frame of `client`
+    pub fn record_tcp(&self, direction: Direction, client: SocketAddr, frame: &[u8]) {
+        let transaction_id = frame
+            .get(..2)
+            .map(|tid| u16::from_be_bytes([tid[0], tid[1]]));
+        self.record(direction, client, transaction_id, None, frame);
+    }
+
+    /// Records an RTU frame sent on `bus` for `client`
+    pub fn record_rtu(&self, direction: Direction, client: SocketAddr, bus: u8, frame: &[u8]) {
+        self.record(direction, client, None, Some(bus), frame);
+    }
+
+    fn record(
+        &self,
+        direction: Direction,
+        client: SocketAddr,
+        transaction_id: Option<u16>,
+        bus: Option<u8>,
+        frame: &[u8],
+    ) {
+        let seq = self.head.fetch_add(1, Ordering::Relaxed);
+        let slot = &self.slots[(seq & self.mask) as usize];
+
+        // The ring came around to a slot another writer is still filling,
+        // rare enough to give up on this frame instead of waiting
+        let stamp = slot.stamp.load(Ordering::Relaxed);
+        if stamp & 1 == 1
+            || slot
+                .stamp
+                .compare_exchange(stamp, 2 * seq + 1, Ordering::Acquire, Ordering::Relaxed)
+                .is_err()
+        {
+            self.skipped.fetch_add(1, Ordering::Relaxed);
+            return;
+        }
+        // Readers that see any of the stores below also see the odd stamp
+        fence(Ordering::Release);
+
+        let time_us = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_or(0, |elapsed| elapsed.as_micros() as u64);
+        let ip = match client.ip() {
+            IpAddr::V4(ip) => ip.to_ipv6_mapped(),
+            IpAddr::V6(ip) => ip,
+        }
+        .to_bits();
+        let info = Info {
+            port: client.port(),
+            transaction_id,
+            length: frame.len().min(u16::MAX as usize) as u16,
+            bus,
+            direction,
+        };
+
+        slot.time_us.store(time_us, Ordering::Relaxed);
+        slot.ip[0].store((ip >> 64) as u64, Ordering::Relaxed);
+        slot.ip[1].store(ip as u64, Ordering::Relaxed);
+        slot.info.store(info.pack(), Ordering::Relaxed);
+
+        let data = &frame[..frame.len().min(MAX_CAPTURED)];
+        for (word, chunk) in slot.data.iter().zip(data.chunks(8)) {
+            let mut bytes = [0u8; 8];
+            bytes[..chunk.len()].copy_from_slice(chunk);
+            word.store(u64::from_le_bytes(bytes), Ordering::Relaxed);
+        }
+
+        slot.stamp.store(2 * seq + 2, Ordering::Release);
+    }
+
+    /// The recorded frames still in the ring, oldest first, at most `limit`
+    /// of the latest ones
+    pub fn snapshot(&self, limit: usize) -> Vec<CapturedFrame> {
+        let head = self.head.load(Ordering::Acquire);
+        let first = head
+            .saturating_sub(self.slots.len() as u64)
+            .max(head.saturating_sub(limit as u64));
+
+        (first..head).filter_map(|seq| self.read(seq)).collect()
+    }
+
+    /// Copies out frame `seq` unless it is being written or was overwritten
+    fn read(&self, seq: u64) -> Option<CapturedFrame> {
+        let slot = &self.slots[(seq & self.mask) as usize];
+        if slot.stamp.load(Ordering::Acquire) != 2 * seq + 2 {
+            return None;
+        }
+
+        let time_us = slot.time_us.load(Ordering::Relaxed);
+        let ip = (slot.ip[0].load(Ordering::Relaxed) as u128) << 64
+            | slot.ip[1].load(Ordering::Relaxed) as u128;
+        let info = Info::unpack(slot.info.load(Ordering::Relaxed));
+        let mut data = Vec::with_capacity(WORDS * 8);
+        for word in &slot.data[..(info.length as usize).min(MAX_CAPTURED).div_ceil(8)] {
+            data.extend_from_slice(&word.load(Ordering::Relaxed).to_le_bytes());
+        }
+        data.truncate((info.length as usize).min(MAX_CAPTURED));
+
+        // Any write that raced the copies above has moved the stamp on
+        fence(Ordering::Acquire);
+        if slot.stamp.load(Ordering::Relaxed) != 2 * seq + 2 {
+            return None;
+        }
+
+        let ip = Ipv6Addr::from_bits(ip);
+        let ip = ip.to_ipv4_mapped().map_or(IpAddr::V6(ip), IpAddr::V4);
+
+        Some(CapturedFrame {
+            seq,
+            time_us,
+            direction: info.direction,
+            client: SocketAddr::new(ip, info.port),
+            transaction_id: info.transaction_id,
+            bus: info.bus,
+            length: info.length,
+            data,
+        })
+    }
+}
+
+/// Port the relay side of captured Modbus TCP frames is shown on, where
+/// dissectors look for Modbus/TCP
+const PCAP_TCP_PORT: u16 = 502;
+
+/// UDP port of captured RTU frames on bus 0, bus `n` uses `n` above it.
+/// Not a registered Modbus port, use "Decode As... Modbus/RTU" on them
+pub const PCAP_RTU_PORT: u16 = 5020;
+
+/// LINKTYPE_RAW, packets start with their IP header
+const LINKTYPE_RAW: u32 = 101;
+
+/// Writes `frames` as a pcap file.
+///
+/// Modbus TCP frames become TCP segments between the client and port 502
+/// with consistent sequence numbers, RTU frames UDP datagrams between the
+/// client and [`PCAP_RTU_PORT`]. The relay's own address is not recorded,
+/// it shows as the unspecified address.
+pub fn write_pcap(frames: &[CapturedFrame]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(24 + frames.len() * (16 + 60 + 64));
+    out.extend_from_slice(&0xA1B2_C3D4u32.to_le_bytes());
+    out.extend_from_slice(&2u16.to_le_bytes());
+    out.extend_from_slice(&4u16.to_le_bytes());
+    out.extend_from_slice(&0i32.to_le_bytes());
+    out.extend_from_slice(&0u32.to_le_bytes());
+    out.extend_from_slice(&(MAX_CAPTURED as u32 + 60).to_le_bytes());
+    out.extend_from_slice(&LINKTYPE_RAW.to_le_bytes());
+
+    // Next TCP sequence number per client and direction
+    let mut sequence: HashMap<(SocketAddr, bool), u32> = HashMap::new();
+    let mut packet = Vec::with_capacity(MAX_CAPTURED + 60);
+
+    for frame in frames {
+        let request = frame.direction.is_request();
+        let relay = match frame.client.ip() {
+            IpAddr::V4(_) => IpAddr::V4(std::net::Ipv4Addr::UNSPECIFIED),
+            IpAddr::V6(_) => IpAddr::V6(Ipv6Addr::UNSPECIFIED),
+        };
+
+        let (relay_port, protocol) = match frame.direction {
+            Direction::TcpRequest | Direction::TcpResponse => (PCAP_TCP_PORT, 6),
+            _ => (PCAP_RTU_PORT + frame.bus.unwrap_or_default() as u16, 17),
+        };
+        let (src, dst) = match request {
+            true => (frame.client, SocketAddr::new(relay, relay_port)),
+            false => (SocketAddr::new(relay, relay_port), frame.client),
+        };
+
+        packet.clear();
+        let transport_len = if protocol == 6 { 20 } else { 8 } + frame.data.len();
+        write_ip_header(&mut packet, src.ip(), dst.ip(), protocol, transport_len);
+        packet.extend_from_slice(&src.port().to_be_bytes());
+        packet.extend_from_slice(&dst.port().to_be_bytes());
+
+        if protocol == 6 {
+            let ack = sequence
+                .get(&(frame.client, !request))
+                .copied()
+                .unwrap_or(1);
+            let next = sequence.entry((frame.client, request)).or_insert(1);
+            let seq = std::mem::replace(next, next.wrapping_add(frame.data.len() as u32));
+
+            packet.extend_from_slice(&seq.to_be_bytes());
+            packet.extend_from_slice(&ack.to_be_bytes());
+            // Data offset 5 words, PSH and ACK
+            packet.extend_from_slice(&[0x50, 0x18]);
+            packet.extend_from_slice(&u16::MAX.to_be_bytes());
+            // Checksum left out, urgent pointer
+            packet.extend_from_slice(&[0, 0, 0, 0]);
+        } else {
+            packet.extend_from_slice(&(transport_len as u16).to_be_bytes());
+            packet.extend_from_slice(&[0, 0]);
+        }
+        packet.extend_from_slice(&frame.data);
+
+        out.extend_from_slice(&((frame.time_us / 1_000_000) as u32).to_le_bytes());
+        out.extend_from_slice(&((frame.time_us % 1_000_000) as u32).to_le_bytes());
+        // Captured and original length, the IP length fields match the data kept
+        out.extend_from_slice(&(packet.len() as u32).to_le_bytes());
+        out.extend_from_slice(&(packet.len() as u32).to_le_bytes());
+        out.extend_from_slice(&packet);
+    }
+
+    out
+}
+
+fn write_ip_header(out: &mut Vec<u8>, src: IpAddr, dst: IpAddr, protocol: u8, payload: usize) {
+    match (src, dst) {
+        (IpAddr::V4(src), IpAddr::V4(dst)) => {
+            let start = out.len();
+            out.extend_from_slice(&[0x45, 0]);
+            out.extend_from_slice(&((20 + payload) as u16).to_be_bytes());
+            // Identification, don't fragment, TTL 64
+            out.extend_from_slice(&[0, 0, 0x40, 0, 64, protocol, 0, 0]);
+            out.extend_from_slice(&src.octets());
+            out.extend_from_slice(&dst.octets());
+
+            let sum = out[start..]
+                .chunks(2)
+                .map(|word| u16::from_be_bytes([word[0], word[1]]) as u32)
+                .sum::<u32>();
+            let sum = (sum & 0xFFFF) + (sum >> 16);
+            let checksum = !((sum & 0xFFFF) + (sum >> 16)) as u16;
+            out[start + 10..start + 12].copy_from_slice(&checksum.to_be_bytes());
+        }
+        (src, dst) => {
+            let to_v6 = |ip: IpAddr| match ip {
+                IpAddr::V4(ip) => ip.to_ipv6_mapped(),
+                IpAddr::V6(ip) => ip,
+            };
+            out.extend_from_slice(&[0x60, 0, 0, 0]);
+            out.extend_from_slice(&(payload as u16).to_be_bytes());
+            out.extend_from_slice(&[protocol, 64]);
+            out.extend_from_slice(&to_v6(src).octets());
+            out.extend_from_slice(&to_v6(dst).octets());
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn client() -> SocketAddr {
+        "192.168.1.10:40000".parse().unwrap()
+    }
+
+    #[test]
+    fn test_record_and_snapshot() {
+        let capture = FrameCapture::new(4);
+        let request = [
+            0x00, 0x07, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x01,
+        ];
+        capture.record_tcp(Direction::TcpRequest, client(), &request);
+        capture.record_rtu(Direction::RtuResponse, client(), 2, &[0x01, 0x83, 0x02]);
+
+        let frames = capture.snapshot(usize::MAX);
+        assert_eq!(frames.len(), 2);
+        assert_eq!(frames[0].direction, Direction::TcpRequest);
+        assert_eq!(frames[0].client, client());
+        assert_eq!(frames[0].transaction_id, Some(7));
+        assert_eq!(frames[0].bus, None);
+        assert_eq!(frames[0].data, request);
+        assert_eq!(frames[1].direction, Direction::RtuResponse);
+        assert_eq!(frames[1].transaction_id, None);
+        assert_eq!(frames[1].bus, Some(2));
+        assert_eq!(frames[1].data, [0x01, 0x83, 0x02]);
+        assert!(frames[0].time_us > 0);
+    }
+
+    #[test]
+    fn test_ring_keeps_latest() {
+        let capture = FrameCapture::new(3);
+        assert_eq!(capture.capacity(), 4);
+
+        for unit in 0..10u8 {
+            capture.record_rtu(Direction::RtuRequest, client(), 0, &[unit; 300]);
+        }
+
+        let frames = capture.snapshot(usize::MAX);
+        let seqs: Vec<_> = frames.iter().map(|frame| frame.seq).collect();
+        assert_eq!(seqs, [6, 7, 8, 9]);
+        assert_eq!(frames[3].length, 300);
+        assert_eq!(frames[3].data, [9; MAX_CAPTURED]);
+
+        assert_eq!(capture.snapshot(2).len(), 2);
+        assert_eq!(capture.recorded(), 10);
+    }
+
+    #[test]
+    fn test_concurrent_writers() {
+        let capture = std::sync::Arc::new(FrameCapture::new(64));
+        let writers: Vec<_> = (0..4u8)
+            .map(|writer| {
+                let capture = std::sync::Arc::clone(&capture);
+                std::thread::spawn(move || {
+                    for _ in 0..10_000 {
+                        capture.record_rtu(Direction::RtuRequest, client(), writer, &[writer; 40]);
+                    }
+                })
+            })
+            .collect();
+
+        // Whatever a reader gets while the writers run is a whole frame
+        while !writers.iter().all(|writer| writer.is_finished()) {
+            for frame in capture.snapshot(usize::MAX) {
+                assert_eq!(frame.data, [frame.bus.unwrap(); 40]);
+            }
+        }
+        for writer in writers {
+            writer.join().unwrap();
+        }
+        assert_eq!(capture.recorded(), 40_000);
+    }
+
+    #[test]
+    fn test_pcap_export() {
+        let capture = FrameCapture::new(8);
+        let request = [
+            0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x01,
+        ];
+        let response = [
+            0x00, 0x01, 0x00, 0x00, 0x00, 0x05, 0x01, 0x03, 0x02, 0x00, 0x2A,
+        ];
+        capture.record_tcp(Direction::TcpRequest, client(), &request);
+        capture.record_rtu(Direction::RtuRequest, client(), 0, &request[6..]);
+        capture.record_tcp(Direction::TcpResponse, client(), &response);
+
+        let pcap = write_pcap(&capture.snapshot(usize::MAX));
+        assert_eq!(&pcap[..4], &0xA1B2_C3D4u32.to_le_bytes());
+        assert_eq!(&pcap[20..24], &LINKTYPE_RAW.to_le_bytes());
+
+        // First record: 16 byte record header, IPv4, TCP from the client to 502
+        let packet = &pcap[24 + 16..];
+        let len = u32::from_le_bytes(pcap[24 + 8..24 + 12].try_into().unwrap()) as usize;
+        assert_eq!(len, 20 + 20 + request.len());
+        assert_eq!(packet[0], 0x45);
+        assert_eq!(packet[9], 6);
+        assert_eq!(&packet[12..16], &[192, 168, 1, 10]);
+        assert_eq!(u16::from_be_bytes([packet[22], packet[23]]), 502);
+        assert_eq!(&packet[40..len], &request);
+
+        // A valid IPv4 header sums to 0xFFFF
+        let sum = packet[..20]
+            .chunks(2)
+            .map(|word| u16::from_be_bytes([word[0], word[1]]) as u32)
+            .sum::<u32>();
+        assert_eq!((sum & 0xFFFF) + (sum >> 16), 0xFFFF);
+
+        // The response acknowledges the request's bytes
+        let second = 24 + 16 + len;
+        let len = u32::from_le_bytes(pcap[second + 8..second + 12].try_into().unwrap()) as usize;
+        let third = second + 16 + len;
+        let packet = &pcap[third + 16..];
+        assert_eq!(u16::from_be_bytes([packet[20], packet[21]]), 502);
+        let ack = u32::from_be_bytes(packet[28..32].try_into().unwrap());
+        assert_eq!(ack, 1 + request.len() as u32);
+    }
+}
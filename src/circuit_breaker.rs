@@ -0,0 +1,325 @@
+use std::{
+    sync::{
+        atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering},
+        Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Serialize;
+use tracing::{info, warn};
+
+use crate::{BackoffStrategy, BreakerConfig, ProtocolErrorKind, RelayError, TransportError};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize)]
+#[serde(rename_all = "snake_case")]
+pub enum BreakerState {
+    /// Requests go on the bus
+    Closed,
+    /// The unit is considered dead, requests fail right away
+    Open,
+    /// One probe request is on its way to the unit
+    HalfOpen,
+}
+
+/// Probe schedule of a tripped unit
+struct Trip {
+    probing: bool,
+    retry_at: Instant,
+    interval: Duration,
+    backoff: BackoffStrategy,
+}
+
+struct Unit {
+    tripped: AtomicBool,
+    failures: AtomicU32,
+    trips: AtomicU64,
+    trip: Mutex<Trip>,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct UnitBreakerSnapshot {
+    pub unit_id: u8,
+    pub state: BreakerState,
+    pub consecutive_failures: u32,
+    pub trips: u64,
+    /// Time left until the next probe while open
+    pub retry_in_ms: Option<u64>,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct BreakerSnapshot {
+    pub enabled: bool,
+    /// Requests failed without using the bus
+    pub rejected: u64,
+    /// Units that failed at least once
+    pub units: Vec<UnitBreakerSnapshot>,
+}
+
+/// Circuit breaker per unit ID of one bus.
+///
+/// A unit that times out `failure_threshold` times in a row is tripped,
+/// requests for it fail right away instead of holding the bus for the
+/// whole transaction timeout while other units wait. A single probe is let
+/// through after each backoff interval, the first answer closes the
+/// breaker again.
+///
+/// Units that answer only touch two atomics, the lock is taken while a
+/// unit is tripped or about to be.
+pub struct CircuitBreaker {
+    config: BreakerConfig,
+    units: Box<[Unit]>,
+    rejected: AtomicU64,
+}
+
+impl CircuitBreaker {
+    pub fn new(config: &BreakerConfig) -> Self {
+        let units = (0..=u8::MAX)
+            .map(|_| Unit {
+                tripped: AtomicBool::new(false),
+                failures: AtomicU32::new(0),
+                trips: AtomicU64::new(0),
+                trip: Mutex::new(Trip {
+                    probing: false,
+                    retry_at: Instant::now(),
+                    interval: config.probe_backoff.initial_interval,
+                    backoff: BackoffStrategy::new(config.probe_backoff.clone()),
+                }),
+            })
+            .collect();
+
+        Self {
+            config: config.clone(),
+            units,
+            rejected: AtomicU64::new(0),
+        }
+    }
+
+    /// Checks whether a request for `unit_id` may go on the bus.
+    ///
+    /// Fails with the configured gateway exception while the unit is
+    /// tripped, unless it is time for the next probe.
+    pub fn check(&self, unit_id: u8) -> Result<(), RelayError> {
+        let unit = &self.units[unit_id as usize];
+        if !self.config.enabled || unit_id == 0 || !unit.tripped.load(Ordering::Acquire) {
+            return Ok(());
+        }
+
+        let mut trip = unit.trip.lock().unwrap();
+        let now = Instant::now();
+
+        // A probe that never got an answer (the client left before it was
+        // sent) is given up on after one interval
+        if now >= trip.retry_at {
+            trip.probing = true;
+            trip.retry_at = now + trip.interval;
+            return Ok(());
+        }
+        drop(trip);
+
+        self.rejected.fetch_add(1, Ordering::Relaxed);
+
+        let kind = match self.config.exception_code {
+            0x0A => ProtocolErrorKind::GatewayPathUnavailable,
+            _ => ProtocolErrorKind::GatewayTargetFailedToRespond,
+        };
+        Err(RelayError::protocol(
+            kind,
+            format!("Unit 0x{:02X} is not responding, circuit open", unit_id),
+        ))
+    }
+
+    /// Records the outcome of a transaction with `unit_id` that went on
+    /// the bus, only a missing response counts as a failure
+    pub fn record<T>(&self, unit_id: u8, result: &Result<T, RelayError>) {
+        if !self.config.enabled || unit_id == 0 {
+            return;
+        }
+
+        let unit = &self.units[unit_id as usize];
+        match result {
+            Ok(_) => self.record_success(unit_id, unit),
+            Err(RelayError::Transport(
+                TransportError::Timeout { .. } | TransportError::NoResponse { .. },
+            )) => self.record_failure(unit_id, unit),
+            Err(_) => {}
+        }
+    }
+
+    fn record_success(&self, unit_id: u8, unit: &Unit) {
+        if unit.failures.load(Ordering::Relaxed) != 0 {
+            unit.failures.store(0, Ordering::Relaxed);
+        }
+        if !unit.tripped.load(Ordering::Acquire) {
+            return;
+        }
+
+        let mut trip = unit.trip.lock().unwrap();
+        if unit.tripped.swap(false, Ordering::AcqRel) {
+            trip.probing = false;
+            trip.backoff.reset();
+            info!("Unit 0x{:02X} is responding again, circuit closed", unit_id);
+        }
+    }
+
+    fn record_failure(&self, unit_id: u8, unit: &Unit) {
+        let failures = unit.failures.fetch_add(1, Ordering::Relaxed) + 1;
+        if !unit.tripped.load(Ordering::Acquire) && failures < self.config.failure_threshold {
+            return;
+        }
+
+        let mut trip = unit.trip.lock().unwrap();
+        let max_interval = self.config.probe_backoff.max_interval;
+
+        if unit.tripped.swap(true, Ordering::AcqRel) {
+            // A failed probe, wait longer for the next one
+            trip.interval = trip.backoff.next_backoff().unwrap_or(max_interval);
+        } else {
+            unit.trips.fetch_add(1, Ordering::Relaxed);
+            trip.backoff.reset();
+            trip.interval = trip.backoff.next_backoff().unwrap_or(max_interval);
+            warn!(
+                "Unit 0x{:02X} failed {} times in a row, circuit open for {:?}",
+                unit_id, failures, trip.interval
+            );
+        }
+        trip.probing = false;
+        trip.retry_at = Instant::now() + trip.interval;
+    }
+
+    pub fn state(&self, unit_id: u8) -> BreakerState {
+        let unit = &self.units[unit_id as usize];
+        if !unit.tripped.load(Ordering::Acquire) {
+            return BreakerState::Closed;
+        }
+
+        match unit.trip.lock().unwrap().probing {
+            true => BreakerState::HalfOpen,
+            false => BreakerState::Open,
+        }
+    }
+
+    /// Number of units currently tripped
+    pub fn open_units(&self) -> usize {
+        self.units
+            .iter()
+            .filter(|unit| unit.tripped.load(Ordering::Relaxed))
+            .count()
+    }
+
+    pub fn rejected(&self) -> u64 {
+        self.rejected.load(Ordering::Relaxed)
+    }
+
+    pub fn snapshot(&self) -> BreakerSnapshot {
+        let now = Instant::now();
+        let units = self
+            .units
+            .iter()
+            .enumerate()
+            .filter(|(_, unit)| {
+                unit.failures.load(Ordering::Relaxed) > 0 || unit.trips.load(Ordering::Relaxed) > 0
+            })
+            .map(|(unit_id, unit)| {
+                let state = self.state(unit_id as u8);
+                let retry_in_ms = (state == BreakerState::Open).then(|| {
+                    let retry_at = unit.trip.lock().unwrap().retry_at;
+                    retry_at.saturating_duration_since(now).as_millis() as u64
+                });
+
+                UnitBreakerSnapshot {
+                    unit_id: unit_id as u8,
+                    state,
+                    consecutive_failures: unit.failures.load(Ordering::Relaxed),
+                    trips: unit.trips.load(Ordering::Relaxed),
+                    retry_in_ms,
+                }
+            })
+            .collect();
+
+        BreakerSnapshot {
+            enabled: self.config.enabled,
+            rejected: self.rejected(),
+            units,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn timeout() -> Result<(), RelayError> {
+        Err(RelayError::Transport(TransportError::NoResponse {
+            attempts: 3,
+            elapsed: Duration::from_secs(1),
+        }))
+    }
+
+    fn test_breaker(initial_interval: Duration) -> CircuitBreaker {
+        let mut config = BreakerConfig {
+            enabled: true,
+            failure_threshold: 2,
+            ..Default::default()
+        };
+        config.probe_backoff.initial_interval = initial_interval;
+        CircuitBreaker::new(&config)
+    }
+
+    #[test]
+    fn test_trips_after_consecutive_timeouts() {
+        let breaker = test_breaker(Duration::from_secs(60));
+
+        breaker.record(5, &timeout());
+        breaker.record(5, &Ok(()));
+        breaker.record(5, &timeout());
+        assert!(breaker.check(5).is_ok());
+
+        breaker.record(5, &timeout());
+        assert_eq!(breaker.state(5), BreakerState::Open);
+        assert!(matches!(
+            breaker.check(5),
+            Err(RelayError::Protocol {
+                kind: ProtocolErrorKind::GatewayTargetFailedToRespond,
+                ..
+            })
+        ));
+
+        // Other units and broadcasts are not affected
+        assert!(breaker.check(6).is_ok());
+        assert!(breaker.check(0).is_ok());
+
+        let snapshot = breaker.snapshot();
+        assert_eq!(snapshot.rejected, 1);
+        assert_eq!(snapshot.units.len(), 1);
+        assert_eq!(snapshot.units[0].trips, 1);
+        assert_eq!(breaker.open_units(), 1);
+    }
+
+    #[test]
+    fn test_half_open_probe() {
+        let breaker = test_breaker(Duration::from_millis(50));
+        breaker.record(7, &timeout());
+        breaker.record(7, &timeout());
+        assert!(breaker.check(7).is_err());
+        std::thread::sleep(Duration::from_millis(60));
+
+        // One probe goes through, everything else waits for its outcome
+        assert!(breaker.check(7).is_ok());
+        assert_eq!(breaker.state(7), BreakerState::HalfOpen);
+        assert!(breaker.check(7).is_err());
+
+        breaker.record(7, &Ok(()));
+        assert_eq!(breaker.state(7), BreakerState::Closed);
+        assert!(breaker.check(7).is_ok());
+    }
+
+    #[test]
+    fn test_disabled() {
+        let breaker = CircuitBreaker::new(&BreakerConfig::default());
+        for _ in 0..10 {
+            breaker.record(1, &timeout());
+        }
+        assert!(breaker.check(1).is_ok());
+    }
+}
@@ -0,0 +1,33 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+/// Response timeouts learned per unit ID and function code
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Wait `quantile` x `multiplier` of the observed response times instead
+    /// of the configured timeout once a unit has answered `min_samples` times
+    pub enabled: bool,
+    /// Quantile of the recent response times the timeout is based on
+    pub quantile: f64,
+    /// Headroom on top of the quantile
+    pub multiplier: f64,
+    /// Lower bound of a learned timeout, the configured timeout is the upper bound
+    #[serde(with = "humantime_serde")]
+    pub min_timeout: Duration,
+    /// Responses needed before the timeout is adapted, 1 to 128
+    pub min_samples: usize,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            quantile: 0.99,
+            multiplier: 3.0,
+            min_timeout: Duration::from_millis(20),
+            min_samples: 16,
+        }
+    }
+}
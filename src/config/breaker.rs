@@ -0,0 +1,37 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+use super::BackoffConfig;
+
+/// Configuration for the per unit ID circuit breaker
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Fail requests to units that stopped answering without using the bus
+    pub enabled: bool,
+    /// Consecutive timeouts after which a unit is considered dead
+    pub failure_threshold: u32,
+    /// Exception code sent for a dead unit, 0x0A (gateway path unavailable)
+    /// or 0x0B (gateway target device failed to respond)
+    pub exception_code: u8,
+    /// Delay before each probe of a dead unit, the last interval repeats
+    /// once the retries are used up
+    pub probe_backoff: BackoffConfig,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            failure_threshold: 3,
+            exception_code: 0x0B,
+            probe_backoff: BackoffConfig {
+                initial_interval: Duration::from_secs(1),
+                max_interval: Duration::from_secs(60),
+                multiplier: 2.0,
+                max_retries: 6,
+            },
+        }
+    }
+}
@@ -0,0 +1,60 @@
+use serde::{Deserialize, Serialize};
+
+use super::{RtuConfig, SchedulerConfig, UpstreamConfig};
+
+/// Additional bus driven by the same relay.
+///
+/// The top-level `rtu` section is always the default bus, every entry of
+/// `buses` adds another serial line or downstream Modbus TCP device with
+/// its own transport and scheduler. Requests reach a bus either through its
+/// own TCP port or by unit ID.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct Config {
+    /// Name of the bus in logs, stats and metrics
+    pub name: String,
+    /// Serial line settings, either this or `upstream` must be set
+    #[serde(default)]
+    pub rtu: Option<RtuConfig>,
+    /// Modbus TCP device settings
+    #[serde(default)]
+    pub upstream: Option<UpstreamConfig>,
+    /// Scheduler settings, the top-level `scheduler` section if not set
+    #[serde(default)]
+    pub scheduler: Option<SchedulerConfig>,
+    /// Unit IDs routed to this bus from the main TCP port
+    #[serde(default)]
+    pub unit_ids: Vec<UnitRange>,
+    /// TCP port whose requests all go to this bus, whatever their unit ID
+    #[serde(default)]
+    pub bind_port: Option<u16>,
+}
+
+impl Config {
+    /// Serial device or device address of the bus
+    pub fn target(&self) -> Option<&str> {
+        match (&self.rtu, &self.upstream) {
+            (Some(rtu), None) => Some(&rtu.device),
+            (None, Some(upstream)) => Some(&upstream.address),
+            _ => None,
+        }
+    }
+}
+
+/// Inclusive range of unit IDs
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct UnitRange {
+    pub start: u8,
+    pub end: u8,
+}
+
+impl UnitRange {
+    pub fn contains(&self, unit_id: u8) -> bool {
+        (self.start..=self.end).contains(&unit_id)
+    }
+
+    pub fn overlaps(&self, other: &UnitRange) -> bool {
+        self.start <= other.end && other.start <= self.end
+    }
+}
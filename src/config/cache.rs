@@ -0,0 +1,107 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+/// Configuration for the read response cache
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Serve repeated reads (0x01-0x04) from the cache
+    pub enabled: bool,
+    /// TTL for reads that match no rule, zero disables caching for them
+    #[serde(with = "humantime_serde")]
+    pub default_ttl: Duration,
+    /// Maximum number of cached responses
+    pub max_entries: usize,
+    /// TTL overrides per unit and address range, the first matching rule wins
+    pub rules: Vec<CacheRule>,
+}
+
+/// TTL override for a unit and/or register address range
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct CacheRule {
+    /// Unit ID the rule applies to, any unit if not set
+    #[serde(default)]
+    pub unit_id: Option<u8>,
+    /// First address covered by the rule
+    #[serde(default)]
+    pub start: u16,
+    /// Last address covered by the rule (inclusive)
+    #[serde(default = "CacheRule::default_end")]
+    pub end: u16,
+    /// How long a response is served from the cache, zero disables caching
+    #[serde(with = "humantime_serde")]
+    pub ttl: Duration,
+}
+
+impl CacheRule {
+    fn default_end() -> u16 {
+        u16::MAX
+    }
+
+    /// Whether the rule covers the whole read of `quantity` items at `start`
+    pub fn matches(&self, unit_id: u8, start: u16, quantity: u16) -> bool {
+        let last = start as u32 + quantity.max(1) as u32 - 1;
+
+        self.unit_id.is_none_or(|id| id == unit_id)
+            && start >= self.start
+            && last <= self.end as u32
+    }
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            default_ttl: Duration::from_millis(500),
+            max_entries: 1024,
+            rules: Vec::new(),
+        }
+    }
+}
+
+impl Config {
+    /// TTL for a read of `quantity` items at `start` from `unit_id`
+    pub fn ttl_for(&self, unit_id: u8, start: u16, quantity: u16) -> Duration {
+        self.rules
+            .iter()
+            .find(|rule| rule.matches(unit_id, start, quantity))
+            .map_or(self.default_ttl, |rule| rule.ttl)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_ttl_rules() {
+        let config = Config {
+            rules: vec![
+                CacheRule {
+                    unit_id: Some(1),
+                    start: 100,
+                    end: 199,
+                    ttl: Duration::ZERO,
+                },
+                CacheRule {
+                    unit_id: None,
+                    start: 0,
+                    end: u16::MAX,
+                    ttl: Duration::from_secs(2),
+                },
+            ],
+            ..Default::default()
+        };
+
+        assert_eq!(config.ttl_for(1, 100, 10), Duration::ZERO);
+        assert_eq!(config.ttl_for(1, 190, 10), Duration::ZERO);
+        // Crosses the end of the first rule
+        assert_eq!(config.ttl_for(1, 195, 10), Duration::from_secs(2));
+        assert_eq!(config.ttl_for(2, 100, 10), Duration::from_secs(2));
+
+        let config = Config::default();
+        assert_eq!(config.ttl_for(1, 0, 1), config.default_ttl);
+    }
+}
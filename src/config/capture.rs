@@ -0,0 +1,20 @@
+use serde::{Deserialize, Serialize};
+
+/// Ring of the latest raw frames served on /debug/frames
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Record every Modbus TCP and RTU frame, cheap enough to leave on
+    pub enabled: bool,
+    /// Frames kept, rounded up to a power of two, each takes about 300 bytes
+    pub slots: usize,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: true,
+            slots: 1024,
+        }
+    }
+}
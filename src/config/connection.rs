@@ -2,7 +2,7 @@ use std::time::Duration;
 
 use serde::{Deserialize, Serialize};
 
-use super::BackoffConfig;
+use super::{BackoffConfig, RateLimitConfig};
 
 /// Configuration for managing connections
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -23,6 +23,9 @@ pub struct Config {
     pub per_ip_limits: Option<u64>,
     /// Parameters for backoff strategy
     pub backoff: BackoffConfig,
+    /// Request rate limit per client IP
+    #[serde(default)]
+    pub rate_limit: RateLimitConfig,
 }
 
 impl Default for Config {
@@ -39,6 +42,7 @@ impl Default for Config {
                 multiplier: 2.0,
                 max_retries: 5,
             },
+            rate_limit: RateLimitConfig::default(),
         }
     }
 }
@@ -0,0 +1,30 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+/// Admission control of the RTU bus
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Answer requests the bus cannot serve in time with an exception right
+    /// away instead of queueing them
+    pub enabled: bool,
+    /// Longest a request may take to be answered, about the time clients
+    /// wait before they give up and retry. Requests still queued after it
+    /// are dropped before they reach the bus
+    #[serde(with = "humantime_serde")]
+    pub max_wait: Duration,
+    /// Exception code sent for a shed request, 0x06 (server device busy) or
+    /// 0x0B (gateway target device failed to respond)
+    pub exception_code: u8,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            max_wait: Duration::from_secs(1),
+            exception_code: 0x06,
+        }
+    }
+}
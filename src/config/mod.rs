@@ -1,19 +1,43 @@
+mod adaptive_timeout;
 mod backoff;
+mod breaker;
+mod bus;
+mod cache;
+mod capture;
 mod connection;
 mod http;
+mod load_shedding;
 mod logging;
+mod poller;
+mod priority;
+mod rate_limit;
 mod relay;
 mod rtu;
+mod runtime;
+mod scheduler;
 mod stats;
 mod tcp;
 mod types;
+mod upstream;
 
+pub use adaptive_timeout::Config as AdaptiveTimeoutConfig;
 pub use backoff::Config as BackoffConfig;
+pub use breaker::Config as BreakerConfig;
+pub use bus::{Config as BusConfig, UnitRange};
+pub use cache::{CacheRule, Config as CacheConfig};
+pub use capture::Config as CaptureConfig;
 pub use connection::Config as ConnectionConfig;
 pub use http::Config as HttpConfig;
+pub use load_shedding::Config as LoadSheddingConfig;
 pub use logging::Config as LoggingConfig;
+pub use poller::{Config as PollerConfig, PollBlock};
+pub use priority::{Config as PriorityConfig, PriorityRule};
+pub use rate_limit::Config as RateLimitConfig;
 pub use relay::Config as RelayConfig;
 pub use rtu::Config as RtuConfig;
+pub use runtime::{Config as RuntimeConfig, SerialThreadConfig};
+pub use scheduler::Config as SchedulerConfig;
 pub use stats::Config as StatsConfig;
 pub use tcp::Config as TcpConfig;
-pub use types::{DataBits, Parity, RtsType, StopBits};
+pub use types::{DataBits, Fairness, Parity, Priority, RtsMode, RtsType, RuntimeFlavor, StopBits};
+pub use upstream::Config as UpstreamConfig;
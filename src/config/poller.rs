@@ -0,0 +1,58 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+/// Configuration of the background poller keeping the shadow register image
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Poll `blocks` and answer client reads they cover from memory
+    pub enabled: bool,
+    /// Oldest data served from the image, older reads go to the bus
+    #[serde(with = "humantime_serde")]
+    pub max_age: Duration,
+    /// Register and coil blocks to poll, each on the bus its unit is routed to
+    pub blocks: Vec<PollBlock>,
+}
+
+/// One read the poller issues on its own schedule
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct PollBlock {
+    pub unit_id: u8,
+    /// Read function code, 0x01-0x04
+    #[serde(default = "PollBlock::default_function")]
+    pub function: u8,
+    pub start: u16,
+    pub quantity: u16,
+    #[serde(with = "humantime_serde", default = "PollBlock::default_interval")]
+    pub interval: Duration,
+}
+
+impl PollBlock {
+    fn default_function() -> u8 {
+        0x03
+    }
+
+    fn default_interval() -> Duration {
+        Duration::from_secs(1)
+    }
+
+    /// Largest quantity a single read of `function` may ask for
+    pub fn max_quantity(function: u8) -> u16 {
+        match function {
+            0x01 | 0x02 => 2000,
+            _ => 125,
+        }
+    }
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            max_age: Duration::from_secs(5),
+            blocks: Vec::new(),
+        }
+    }
+}
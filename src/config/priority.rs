@@ -0,0 +1,111 @@
+use std::net::IpAddr;
+
+use serde::{Deserialize, Serialize};
+
+use super::Priority;
+
+/// Request priority classes of the bus scheduler
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Schedule requests by class, everything is `normal` otherwise
+    pub enabled: bool,
+    /// Turns a waiting class may be passed over by higher ones before it
+    /// gets one, zero serves strictly by class
+    pub starvation_limit: u32,
+    /// Class overrides by client, listen port and function code, the first
+    /// matching rule wins, requests matching none are `normal`
+    pub rules: Vec<PriorityRule>,
+}
+
+/// Class of the requests matching every criterion set
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct PriorityRule {
+    pub priority: Priority,
+    /// Client IP addresses, any client if empty
+    #[serde(default)]
+    pub clients: Vec<IpAddr>,
+    /// Ports the request was received on, any port if empty
+    #[serde(default)]
+    pub ports: Vec<u16>,
+    /// Function codes, any function if empty
+    #[serde(default)]
+    pub functions: Vec<u8>,
+}
+
+impl PriorityRule {
+    pub fn matches(&self, client: IpAddr, port: u16, function: u8) -> bool {
+        (self.clients.is_empty() || self.clients.contains(&client))
+            && (self.ports.is_empty() || self.ports.contains(&port))
+            && (self.functions.is_empty() || self.functions.contains(&function))
+    }
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            starvation_limit: 8,
+            // Writes go first
+            rules: vec![PriorityRule {
+                priority: Priority::High,
+                clients: Vec::new(),
+                ports: Vec::new(),
+                functions: vec![0x05, 0x06, 0x0F, 0x10, 0x16, 0x17],
+            }],
+        }
+    }
+}
+
+impl Config {
+    /// Class of a request with `function` from `client`, received on `port`
+    pub fn classify(&self, client: IpAddr, port: u16, function: u8) -> Priority {
+        if !self.enabled {
+            return Priority::Normal;
+        }
+
+        self.rules
+            .iter()
+            .find(|rule| rule.matches(client, port, function))
+            .map_or(Priority::Normal, |rule| rule.priority)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_classify() {
+        let historian: IpAddr = "10.0.0.5".parse().unwrap();
+        let scada: IpAddr = "10.0.0.9".parse().unwrap();
+
+        let mut config = Config {
+            enabled: true,
+            ..Default::default()
+        };
+        config.rules.push(PriorityRule {
+            priority: Priority::Low,
+            clients: vec![historian],
+            ports: Vec::new(),
+            functions: Vec::new(),
+        });
+        config.rules.push(PriorityRule {
+            priority: Priority::High,
+            clients: Vec::new(),
+            ports: vec![5020],
+            functions: vec![0x03],
+        });
+
+        assert_eq!(config.classify(scada, 502, 0x06), Priority::High);
+        // Writes match the first rule, whoever sends them
+        assert_eq!(config.classify(historian, 502, 0x10), Priority::High);
+        assert_eq!(config.classify(historian, 502, 0x03), Priority::Low);
+        assert_eq!(config.classify(scada, 5020, 0x03), Priority::High);
+        assert_eq!(config.classify(scada, 502, 0x03), Priority::Normal);
+
+        config.enabled = false;
+        assert_eq!(config.classify(scada, 502, 0x06), Priority::Normal);
+    }
+}
@@ -0,0 +1,28 @@
+use serde::{Deserialize, Serialize};
+
+/// Token bucket limiting the request rate of each client IP address
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Answer requests above the rate with an exception instead of
+    /// processing them
+    pub enabled: bool,
+    /// Sustained requests per second, shared by all connections of a client
+    pub requests_per_second: f64,
+    /// Requests a client may send in a burst after being quiet
+    pub burst: u32,
+    /// Exception code sent for a limited request, 0x06 (server device busy)
+    /// or 0x0B (gateway target device failed to respond)
+    pub exception_code: u8,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            enabled: false,
+            requests_per_second: 20.0,
+            burst: 40,
+            exception_code: 0x06,
+        }
+    }
+}
@@ -4,7 +4,11 @@ use serde::{Deserialize, Serialize};
 
 use config::{Config as ConfigBuilder, ConfigError, Environment, File, FileFormat};
 
-use super::{ConnectionConfig, HttpConfig, LoggingConfig, RtuConfig, TcpConfig};
+use super::{
+    BreakerConfig, BusConfig, CacheConfig, CaptureConfig, ConnectionConfig, HttpConfig,
+    LoggingConfig, PollBlock, PollerConfig, RtsMode, RtsType, RtuConfig, RuntimeConfig,
+    SchedulerConfig, TcpConfig,
+};
 
 /// Main application configuration
 #[derive(Default, Debug, Clone, Serialize, Deserialize)]
@@ -13,9 +17,13 @@ pub struct Config {
     /// TCP server configuration
     pub tcp: TcpConfig,
 
-    /// RTU client configuration
+    /// RTU client configuration of the default bus
     pub rtu: RtuConfig,
 
+    /// Additional RTU buses, each with its own serial line and scheduler
+    #[serde(default)]
+    pub buses: Vec<BusConfig>,
+
     /// HTTP API configuration
     pub http: HttpConfig,
 
@@ -24,12 +32,39 @@ pub struct Config {
 
     /// Connection management configuration
     pub connection: ConnectionConfig,
+
+    /// RTU bus scheduler configuration
+    #[serde(default)]
+    pub scheduler: SchedulerConfig,
+
+    /// Read response cache configuration
+    #[serde(default)]
+    pub cache: CacheConfig,
+
+    /// Circuit breaker for units that stopped answering, applied on every bus
+    #[serde(default)]
+    pub breaker: BreakerConfig,
+
+    /// Background polling into a shadow register image served to clients
+    #[serde(default)]
+    pub poller: PollerConfig,
+
+    /// Runtime flavor, worker threads and dedicated serial bus threads
+    #[serde(default)]
+    pub runtime: RuntimeConfig,
+
+    /// Raw frame capture served by the HTTP API
+    #[serde(default)]
+    pub capture: CaptureConfig,
 }
 
 impl Config {
     /// Default configuration directory
     pub const CONFIG_DIR: &'static str = "config";
 
+    /// Name of the bus configured by the top-level `rtu` section
+    pub const DEFAULT_BUS: &'static str = "default";
+
     /// Environment variable prefix
     const ENV_PREFIX: &'static str = "MODBUS_RELAY";
 
@@ -52,6 +87,7 @@ impl Config {
             // TCP configuration
             .set_default("tcp.bind_addr", defaults.tcp.bind_addr)?
             .set_default("tcp.bind_port", defaults.tcp.bind_port)?
+            .set_default("tcp.pipeline_depth", defaults.tcp.pipeline_depth as u64)?
             // RTU configuration
             .set_default("rtu.device", defaults.rtu.device)?
             .set_default("rtu.baud_rate", defaults.rtu.baud_rate)?
@@ -61,6 +97,7 @@ impl Config {
             .set_default("rtu.flush_after_write", defaults.rtu.flush_after_write)?
             .set_default("rtu.rts_type", defaults.rtu.rts_type.to_string())?
             .set_default("rtu.rts_delay_us", defaults.rtu.rts_delay_us)?
+            .set_default("rtu.rts_mode", defaults.rtu.rts_mode.to_string())?
             .set_default(
                 "rtu.transaction_timeout",
                 format!("{}s", defaults.rtu.transaction_timeout.as_secs()),
@@ -70,6 +107,26 @@ impl Config {
                 format!("{}s", defaults.rtu.serial_timeout.as_secs()),
             )?
             .set_default("rtu.max_frame_size", defaults.rtu.max_frame_size)?
+            .set_default(
+                "rtu.broadcast_turnaround",
+                format!("{}ms", defaults.rtu.broadcast_turnaround.as_millis()),
+            )?
+            .set_default(
+                "rtu.reconnect.initial_interval",
+                format!("{}ms", defaults.rtu.reconnect.initial_interval.as_millis()),
+            )?
+            .set_default(
+                "rtu.reconnect.max_interval",
+                format!("{}s", defaults.rtu.reconnect.max_interval.as_secs()),
+            )?
+            .set_default(
+                "rtu.reconnect.multiplier",
+                defaults.rtu.reconnect.multiplier,
+            )?
+            .set_default(
+                "rtu.reconnect.max_retries",
+                defaults.rtu.reconnect.max_retries,
+            )?
             // HTTP configuration
             .set_default("http.enabled", defaults.http.enabled)?
             .set_default("http.bind_addr", defaults.http.bind_addr)?
@@ -122,7 +179,50 @@ impl Config {
             .set_default(
                 "connection.backoff.max_retries",
                 defaults.connection.backoff.max_retries,
-            )?;
+            )?
+            // Scheduler configuration
+            .set_default("scheduler.queue_size", defaults.scheduler.queue_size as u64)?
+            .set_default(
+                "scheduler.fairness",
+                defaults.scheduler.fairness.to_string(),
+            )?
+            .set_default("scheduler.merge_reads", defaults.scheduler.merge_reads)?
+            .set_default(
+                "scheduler.merge_max_gap",
+                defaults.scheduler.merge_max_gap as u64,
+            )?
+            // Cache configuration
+            .set_default("cache.enabled", defaults.cache.enabled)?
+            .set_default(
+                "cache.default_ttl",
+                format!("{}ms", defaults.cache.default_ttl.as_millis()),
+            )?
+            .set_default("cache.max_entries", defaults.cache.max_entries as u64)?
+            // Circuit breaker configuration
+            .set_default("breaker.enabled", defaults.breaker.enabled)?
+            .set_default(
+                "breaker.failure_threshold",
+                defaults.breaker.failure_threshold as u64,
+            )?
+            .set_default(
+                "breaker.exception_code",
+                defaults.breaker.exception_code as u64,
+            )?
+            // Poller configuration
+            .set_default("poller.enabled", defaults.poller.enabled)?
+            .set_default(
+                "poller.max_age",
+                format!("{}ms", defaults.poller.max_age.as_millis()),
+            )?
+            // Runtime configuration
+            .set_default("runtime.flavor", defaults.runtime.flavor.to_string())?
+            .set_default(
+                "runtime.serial_thread.enabled",
+                defaults.runtime.serial_thread.enabled,
+            )?
+            // Frame capture configuration
+            .set_default("capture.enabled", defaults.capture.enabled)?
+            .set_default("capture.slots", defaults.capture.slots as u64)?;
 
         let config = builder
             // Load default config file
@@ -191,24 +291,224 @@ impl Config {
         if config.tcp.bind_port == 0 {
             return Err(validation_error("TCP port must be non-zero"));
         }
+        if config.tcp.pipeline_depth == 0 {
+            return Err(validation_error("TCP pipeline depth must be non-zero"));
+        }
 
-        // Validate RTU configuration
-        if config.rtu.device.is_empty() {
-            return Err(validation_error("RTU device must not be empty"));
+        // Validate RTU configuration of every bus
+        let rtus = config.buses.iter().filter_map(|bus| bus.rtu.as_ref());
+        for rtu in std::iter::once(&config.rtu).chain(rtus) {
+            if rtu.device.is_empty() {
+                return Err(validation_error("RTU device must not be empty"));
+            }
+            if rtu.baud_rate == 0 {
+                return Err(validation_error("RTU baud rate must be non-zero"));
+            }
+
+            // Validate connection configuration
+            if rtu.transaction_timeout.is_zero() {
+                return Err(validation_error("Transaction timeout must be non-zero"));
+            }
+            if rtu.serial_timeout.is_zero() {
+                return Err(validation_error("Serial timeout must be non-zero"));
+            }
+            if rtu.max_frame_size == 0 {
+                return Err(validation_error("Max frame size must be non-zero"));
+            }
+            if rtu.rts_mode == RtsMode::Kernel && rtu.rts_type == RtsType::None {
+                return Err(validation_error(
+                    "Kernel RTS mode needs an rts_type of up or down",
+                ));
+            }
+            if rtu.reconnect.initial_interval.is_zero() || rtu.reconnect.max_interval.is_zero() {
+                return Err(validation_error(
+                    "Serial reconnect intervals must be non-zero",
+                ));
+            }
+            if rtu.reconnect.multiplier < 1.0 {
+                return Err(validation_error(
+                    "Serial reconnect multiplier must be at least 1",
+                ));
+            }
         }
-        if config.rtu.baud_rate == 0 {
-            return Err(validation_error("RTU baud rate must be non-zero"));
+
+        // Validate downstream Modbus TCP devices
+        for upstream in config.buses.iter().filter_map(|bus| bus.upstream.as_ref()) {
+            if upstream.address.is_empty() {
+                return Err(validation_error("Upstream address must not be empty"));
+            }
+            if upstream.connections == 0 || upstream.max_in_flight == 0 {
+                return Err(validation_error(
+                    "Upstream connections and max in flight must be non-zero",
+                ));
+            }
+            if upstream.connect_timeout.is_zero() || upstream.request_timeout.is_zero() {
+                return Err(validation_error(
+                    "Upstream connect and request timeouts must be non-zero",
+                ));
+            }
         }
 
-        // Validate connection configuration
-        if config.rtu.transaction_timeout.is_zero() {
-            return Err(validation_error("Transaction timeout must be non-zero"));
+        // Validate scheduler configuration
+        let schedulers = std::iter::once(&config.scheduler)
+            .chain(config.buses.iter().filter_map(|bus| bus.scheduler.as_ref()));
+        for scheduler in schedulers {
+            if scheduler.queue_size == 0 {
+                return Err(validation_error("Scheduler queue size must be non-zero"));
+            }
+            let adaptive = &scheduler.adaptive_timeout;
+            if !(adaptive.quantile > 0.0 && adaptive.quantile <= 1.0) {
+                return Err(validation_error(
+                    "Adaptive timeout quantile must be in (0, 1]",
+                ));
+            }
+            if adaptive.multiplier < 1.0 {
+                return Err(validation_error(
+                    "Adaptive timeout multiplier must be at least 1",
+                ));
+            }
+            // Only the last WINDOW response times are kept, more never arrive
+            if !(1..=crate::adaptive_timeout::WINDOW).contains(&adaptive.min_samples) {
+                return Err(validation_error(&format!(
+                    "Adaptive timeout min samples must be between 1 and {}",
+                    crate::adaptive_timeout::WINDOW
+                )));
+            }
+            let shedding = &scheduler.load_shedding;
+            if shedding.max_wait.is_zero() {
+                return Err(validation_error("Load shedding max wait must be non-zero"));
+            }
+            if !matches!(shedding.exception_code, 0x06 | 0x0B) {
+                return Err(validation_error(
+                    "Load shedding exception code must be 0x06 or 0x0B",
+                ));
+            }
         }
-        if config.rtu.serial_timeout.is_zero() {
-            return Err(validation_error("Serial timeout must be non-zero"));
+
+        // Validate additional buses and their routing
+        for (i, bus) in config.buses.iter().enumerate() {
+            if bus.name.is_empty() || bus.name == Self::DEFAULT_BUS {
+                return Err(validation_error(
+                    "Bus name must not be empty or \"default\"",
+                ));
+            }
+            let Some(target) = bus.target() else {
+                return Err(validation_error(
+                    "Bus needs exactly one of rtu and upstream",
+                ));
+            };
+            if bus.unit_ids.is_empty() && bus.bind_port.is_none() {
+                return Err(validation_error(
+                    "Bus needs unit_ids or a bind_port to receive requests",
+                ));
+            }
+            if bus.bind_port == Some(0) || bus.bind_port == Some(config.tcp.bind_port) {
+                return Err(validation_error(
+                    "Bus port must be non-zero and differ from the TCP port",
+                ));
+            }
+            if bus.unit_ids.iter().any(|range| range.start > range.end) {
+                return Err(validation_error(
+                    "Bus unit ID range start must not be greater than end",
+                ));
+            }
+
+            for other in &config.buses[..i] {
+                if other.name == bus.name {
+                    return Err(validation_error("Bus names must be unique"));
+                }
+                if other.target() == Some(target) {
+                    return Err(validation_error("Buses must use different devices"));
+                }
+                if bus.bind_port.is_some() && other.bind_port == bus.bind_port {
+                    return Err(validation_error("Bus ports must be unique"));
+                }
+                let overlapping = bus
+                    .unit_ids
+                    .iter()
+                    .any(|range| other.unit_ids.iter().any(|o| range.overlaps(o)));
+                if overlapping {
+                    return Err(validation_error("Bus unit ID ranges must not overlap"));
+                }
+            }
+            if target == config.rtu.device {
+                return Err(validation_error("Buses must use different devices"));
+            }
+        }
+
+        // Validate cache configuration
+        if config.cache.enabled && config.cache.max_entries == 0 {
+            return Err(validation_error("Cache max entries must be non-zero"));
         }
-        if config.rtu.max_frame_size == 0 {
-            return Err(validation_error("Max frame size must be non-zero"));
+
+        for rule in &config.cache.rules {
+            if rule.start > rule.end {
+                return Err(validation_error(
+                    "Cache rule start address must not be greater than end address",
+                ));
+            }
+        }
+
+        // Validate circuit breaker configuration
+        if config.breaker.failure_threshold == 0 {
+            return Err(validation_error(
+                "Breaker failure threshold must be non-zero",
+            ));
+        }
+        if !matches!(config.breaker.exception_code, 0x0A | 0x0B) {
+            return Err(validation_error(
+                "Breaker exception code must be 0x0A or 0x0B",
+            ));
+        }
+        if config.breaker.probe_backoff.initial_interval.is_zero() {
+            return Err(validation_error(
+                "Breaker probe backoff initial interval must be non-zero",
+            ));
+        }
+
+        // Validate poll blocks
+        for block in &config.poller.blocks {
+            if !(1..=247).contains(&block.unit_id) {
+                return Err(validation_error("Poll block unit ID must be 1-247"));
+            }
+            if !(0x01..=0x04).contains(&block.function) {
+                return Err(validation_error(
+                    "Poll block function must be a read (0x01-0x04)",
+                ));
+            }
+            if block.quantity == 0 || block.quantity > PollBlock::max_quantity(block.function) {
+                return Err(validation_error(
+                    "Poll block quantity must be 1-125 registers or 1-2000 bits",
+                ));
+            }
+            if block.start as u32 + block.quantity as u32 > 0x1_0000 {
+                return Err(validation_error(
+                    "Poll block must not extend past address 65535",
+                ));
+            }
+            if block.interval.is_zero() {
+                return Err(validation_error("Poll block interval must be non-zero"));
+            }
+        }
+
+        // Validate runtime configuration
+        if config.runtime.worker_threads == Some(0) {
+            return Err(validation_error("Runtime worker threads must be non-zero"));
+        }
+        let serial_thread = &config.runtime.serial_thread;
+        if serial_thread
+            .priority
+            .is_some_and(|priority| !(1..=99).contains(&priority))
+        {
+            return Err(validation_error("Serial thread priority must be 1-99"));
+        }
+        if serial_thread.cpus.iter().any(|&cpu| cpu >= 1024) {
+            return Err(validation_error("Serial thread CPU must be below 1024"));
+        }
+
+        // Validate frame capture configuration
+        if config.capture.enabled && !(1..=1 << 20).contains(&config.capture.slots) {
+            return Err(validation_error("Capture slots must be 1-1048576"));
         }
 
         // Validate log level
@@ -259,6 +559,20 @@ impl Config {
             return Err(validation_error("Backoff max retries must be non-zero"));
         }
 
+        // Validate rate limits
+        let rate_limit = &config.connection.rate_limit;
+        let rate = rate_limit.requests_per_second;
+        if !rate.is_finite() || rate <= 0.0 || rate_limit.burst == 0 {
+            return Err(validation_error(
+                "Rate limit requests per second and burst must be non-zero",
+            ));
+        }
+        if !matches!(rate_limit.exception_code, 0x06 | 0x0B) {
+            return Err(validation_error(
+                "Rate limit exception code must be 0x06 or 0x0B",
+            ));
+        }
+
         Ok(())
     }
 }
@@ -395,4 +709,68 @@ mod tests {
         assert!(Config::new().is_err());
         std::env::remove_var("MODBUS_RELAY_TCP__BIND_PORT");
     }
+
+    #[test]
+    fn test_adaptive_timeout_validation() {
+        let mut config = Config::default();
+        config.scheduler.adaptive_timeout.min_samples = 128;
+        assert!(Config::validate(&config).is_ok());
+
+        config.scheduler.adaptive_timeout.min_samples = 129;
+        assert!(Config::validate(&config).is_err());
+
+        config.scheduler.adaptive_timeout.min_samples = 0;
+        assert!(Config::validate(&config).is_err());
+    }
+
+    #[test]
+    fn test_bus_validation() {
+        use crate::{BusConfig, UnitRange, UpstreamConfig};
+
+        let bus = |name: &str, device: &str, start: u8, end: u8| BusConfig {
+            name: name.to_string(),
+            rtu: Some(RtuConfig {
+                device: device.to_string(),
+                ..Default::default()
+            }),
+            upstream: None,
+            scheduler: None,
+            unit_ids: vec![UnitRange { start, end }],
+            bind_port: None,
+        };
+
+        let mut config = Config {
+            buses: vec![
+                bus("line2", "/dev/ttyUSB1", 1, 31),
+                bus("line3", "/dev/ttyUSB2", 32, 63),
+            ],
+            ..Default::default()
+        };
+        assert!(Config::validate(&config).is_ok());
+
+        config.buses[1].unit_ids[0].start = 31;
+        assert!(Config::validate(&config).is_err());
+
+        config.buses[1] = bus("line3", &config.rtu.device, 32, 63);
+        assert!(Config::validate(&config).is_err());
+
+        config.buses[1] = bus("line2", "/dev/ttyUSB2", 32, 63);
+        assert!(Config::validate(&config).is_err());
+
+        // A bus reachable only through its own port
+        config.buses[1] = bus("line3", "/dev/ttyUSB2", 0, 0);
+        config.buses[1].unit_ids.clear();
+        assert!(Config::validate(&config).is_err());
+        config.buses[1].bind_port = Some(5021);
+        assert!(Config::validate(&config).is_ok());
+
+        // A downstream Modbus TCP device instead of a serial line
+        config.buses[1].upstream = Some(UpstreamConfig {
+            address: "192.168.1.20:502".to_string(),
+            ..Default::default()
+        });
+        assert!(Config::validate(&config).is_err());
+        config.buses[1].rtu = None;
+        assert!(Config::validate(&config).is_ok());
+    }
 }
@@ -2,10 +2,10 @@ use std::time::Duration;
 
 use serde::{Deserialize, Serialize};
 
-use super::{DataBits, Parity, RtsType, StopBits};
+use super::{BackoffConfig, DataBits, Parity, RtsMode, RtsType, StopBits};
 
 #[derive(Debug, Clone, Serialize, Deserialize)]
-#[serde(deny_unknown_fields)]
+#[serde(deny_unknown_fields, default)]
 pub struct Config {
     pub device: String,
     pub baud_rate: u32,
@@ -16,6 +16,9 @@ pub struct Config {
     /// Flow control settings for the serial port
     pub rts_type: RtsType,
     pub rts_delay_us: u64,
+    /// Whether the relay or the kernel RS-485 driver toggles RTS. The
+    /// kernel holds RTS for whole milliseconds, `rts_delay_us` is rounded up
+    pub rts_mode: RtsMode,
 
     /// Whether to flush the serial port after writing
     pub flush_after_write: bool,
@@ -30,6 +33,15 @@ pub struct Config {
 
     /// Maximum size of the request/response buffer
     pub max_frame_size: u64,
+
+    /// Time devices get to carry out a broadcast (unit 0) before the next
+    /// request goes out, they never answer one
+    #[serde(with = "humantime_serde")]
+    pub broadcast_turnaround: Duration,
+
+    /// Backoff between attempts to reopen a lost serial port, once out of
+    /// retries it keeps trying every `max_interval`
+    pub reconnect: BackoffConfig,
 }
 
 impl Default for Config {
@@ -42,15 +54,73 @@ impl Default for Config {
             stop_bits: StopBits::default(),
             rts_type: RtsType::default(),
             rts_delay_us: 3500,
+            rts_mode: RtsMode::default(),
             flush_after_write: true,
             transaction_timeout: Duration::from_secs(5),
             serial_timeout: Duration::from_secs(1),
             max_frame_size: 256,
+            broadcast_turnaround: Duration::from_millis(100),
+            reconnect: BackoffConfig {
+                initial_interval: Duration::from_millis(500),
+                max_interval: Duration::from_secs(10),
+                multiplier: 2.0,
+                max_retries: 10,
+            },
         }
     }
 }
 
 impl Config {
+    /// Baud rates above this use the fixed inter-frame gap from the Modbus RTU spec
+    const FIXED_GAP_BAUD_RATE: u32 = 19200;
+
+    /// Inter-frame gap used above `FIXED_GAP_BAUD_RATE`
+    const FIXED_GAP: Duration = Duration::from_micros(1750);
+
+    /// Number of bits on the wire per character (start + data + parity + stop)
+    pub fn bits_per_char(&self) -> u32 {
+        let parity_bits = match self.parity {
+            Parity::None => 0,
+            Parity::Odd | Parity::Even => 1,
+        };
+        let stop_bits = match self.stop_bits {
+            StopBits::One => 1,
+            StopBits::Two => 2,
+        };
+
+        1 + self.data_bits.get() as u32 + parity_bits + stop_bits
+    }
+
+    /// Time needed to transmit a single character at the configured baud rate
+    pub fn char_time(&self) -> Duration {
+        Duration::from_nanos(
+            self.bits_per_char() as u64 * 1_000_000_000 / self.baud_rate.max(1) as u64,
+        )
+    }
+
+    /// Silent interval (T3.5) that marks the end of an RTU frame
+    pub fn inter_frame_gap(&self) -> Duration {
+        if self.baud_rate > Self::FIXED_GAP_BAUD_RATE {
+            Self::FIXED_GAP
+        } else {
+            self.char_time() * 7 / 2
+        }
+    }
+
+    /// This config with the timing of `other`, everything that can change
+    /// without reopening the port
+    pub fn with_timing(&self, other: &Self) -> Self {
+        Self {
+            rts_delay_us: other.rts_delay_us,
+            flush_after_write: other.flush_after_write,
+            transaction_timeout: other.transaction_timeout,
+            serial_timeout: other.serial_timeout,
+            broadcast_turnaround: other.broadcast_turnaround,
+            reconnect: other.reconnect.clone(),
+            ..self.clone()
+        }
+    }
+
     pub fn serial_port_info(&self) -> String {
         format!(
             "{} ({} baud, {} data bits, {} parity, {} stop bits)",
@@ -58,3 +128,25 @@ impl Config {
         )
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_inter_frame_gap() {
+        let config = Config {
+            baud_rate: 9600,
+            ..Default::default()
+        };
+        // 8N1 = 10 bits per char, 3.5 chars at 9600 baud
+        assert_eq!(config.bits_per_char(), 10);
+        assert_eq!(config.inter_frame_gap(), Duration::from_nanos(3_645_831));
+
+        let config = Config {
+            baud_rate: 115200,
+            ..Default::default()
+        };
+        assert_eq!(config.inter_frame_gap(), Duration::from_micros(1750));
+    }
+}
@@ -0,0 +1,55 @@
+use serde::{Deserialize, Serialize};
+
+use super::RuntimeFlavor;
+
+/// Threads the relay runs on
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// "multi_thread" or "current_thread", the latter runs every task on
+    /// the main thread and suits single core devices
+    pub flavor: RuntimeFlavor,
+    /// Worker threads of the multi-threaded runtime, one per CPU core when
+    /// omitted
+    pub worker_threads: Option<usize>,
+    /// Serial bus I/O on dedicated threads
+    pub serial_thread: SerialThreadConfig,
+}
+
+/// Runs the scheduler and port I/O of every RTU bus on an OS thread of its
+/// own, so RTS turnaround and frame timing do not wait for busy workers
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct SerialThreadConfig {
+    pub enabled: bool,
+    /// CPU cores the bus threads are pinned to, handed out in bus order and
+    /// reused from the start when there are more buses than cores. Empty
+    /// leaves the threads unpinned
+    pub cpus: Vec<usize>,
+    /// SCHED_FIFO priority of the bus threads, 1-99. Needs CAP_SYS_NICE,
+    /// the threads keep the normal policy when it cannot be set
+    pub priority: Option<u8>,
+}
+
+impl SerialThreadConfig {
+    /// CPU core the thread of the `index`th RTU bus is pinned to
+    pub fn cpu(&self, index: usize) -> Option<usize> {
+        (!self.cpus.is_empty()).then(|| self.cpus[index % self.cpus.len()])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cpu_assignment() {
+        let mut config = SerialThreadConfig::default();
+        assert_eq!(config.cpu(0), None);
+
+        config.cpus = vec![2, 3];
+        assert_eq!(config.cpu(0), Some(2));
+        assert_eq!(config.cpu(1), Some(3));
+        assert_eq!(config.cpu(2), Some(2));
+    }
+}
@@ -0,0 +1,37 @@
+use serde::{Deserialize, Serialize};
+
+use super::{AdaptiveTimeoutConfig, Fairness, LoadSheddingConfig, PriorityConfig};
+
+/// Configuration for the RTU bus scheduler
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Maximum number of requests waiting for the bus, senders wait once it is full
+    pub queue_size: usize,
+    /// How queued requests are grouped for round-robin scheduling
+    pub fairness: Fairness,
+    /// Classes that go on the bus before others, round-robin within each
+    pub priority: PriorityConfig,
+    /// Merge queued reads of nearby addresses on the same unit into one RTU read
+    pub merge_reads: bool,
+    /// Largest number of unrequested addresses allowed between merged reads
+    pub merge_max_gap: u16,
+    /// Per unit and function code response timeouts learned from the bus
+    pub adaptive_timeout: AdaptiveTimeoutConfig,
+    /// Requests that cannot be answered in time are rejected instead of queued
+    pub load_shedding: LoadSheddingConfig,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            queue_size: 256,
+            fairness: Fairness::default(),
+            priority: PriorityConfig::default(),
+            merge_reads: false,
+            merge_max_gap: 4,
+            adaptive_timeout: AdaptiveTimeoutConfig::default(),
+            load_shedding: LoadSheddingConfig::default(),
+        }
+    }
+}
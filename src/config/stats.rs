@@ -11,7 +11,6 @@ pub struct Config {
     pub idle_timeout: Duration,
     #[serde(with = "humantime_serde")]
     pub error_timeout: Duration,
-    pub max_events_per_second: u32,
 }
 
 impl Default for Config {
@@ -20,7 +19,6 @@ impl Default for Config {
             cleanup_interval: Duration::from_secs(60),
             idle_timeout: Duration::from_secs(300),
             error_timeout: Duration::from_secs(300),
-            max_events_per_second: 10000,
         }
     }
 }
@@ -9,6 +9,15 @@ pub struct Config {
     pub bind_port: u16,
     #[serde(with = "humantime_serde")]
     pub keep_alive: Duration,
+    /// Maximum number of pipelined requests in flight per connection
+    #[serde(default = "Config::default_pipeline_depth")]
+    pub pipeline_depth: usize,
+}
+
+impl Config {
+    fn default_pipeline_depth() -> usize {
+        16
+    }
 }
 
 impl Default for Config {
@@ -17,6 +26,7 @@ impl Default for Config {
             bind_addr: "0.0.0.0".to_string(),
             bind_port: 5000,
             keep_alive: Duration::from_secs(60),
+            pipeline_depth: Self::default_pipeline_depth(),
         }
     }
 }
@@ -0,0 +1,26 @@
+use serde::{Deserialize, Serialize};
+
+/// How queued requests are grouped when the bus scheduler takes turns
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum Fairness {
+    /// One turn per client IP address
+    Client,
+    /// One turn per Modbus unit ID
+    Unit,
+}
+
+impl Default for Fairness {
+    fn default() -> Self {
+        Self::Client
+    }
+}
+
+impl std::fmt::Display for Fairness {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Fairness::Client => write!(f, "client"),
+            Fairness::Unit => write!(f, "unit"),
+        }
+    }
+}
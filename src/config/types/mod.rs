@@ -1,9 +1,17 @@
 mod data_bits;
+mod fairness;
 mod parity;
+mod priority;
+mod rts_mode;
 mod rts_type;
+mod runtime_flavor;
 mod stop_bits;
 
 pub use data_bits::*;
+pub use fairness::*;
 pub use parity::*;
+pub use priority::*;
+pub use rts_mode::*;
 pub use rts_type::*;
+pub use runtime_flavor::*;
 pub use stop_bits::*;
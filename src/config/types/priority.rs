@@ -0,0 +1,38 @@
+use serde::{Deserialize, Serialize};
+
+/// Class a request is scheduled in, higher classes go on the bus first
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum Priority {
+    /// Writes and alarms
+    High,
+    Normal,
+    /// Bulk pollers that may wait
+    Low,
+}
+
+impl Priority {
+    /// Every class, highest first
+    pub const ALL: [Priority; 3] = [Priority::High, Priority::Normal, Priority::Low];
+
+    /// Position in [`Priority::ALL`]
+    pub fn index(self) -> usize {
+        self as usize
+    }
+}
+
+impl Default for Priority {
+    fn default() -> Self {
+        Self::Normal
+    }
+}
+
+impl std::fmt::Display for Priority {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Priority::High => write!(f, "high"),
+            Priority::Normal => write!(f, "normal"),
+            Priority::Low => write!(f, "low"),
+        }
+    }
+}
@@ -0,0 +1,26 @@
+use serde::{Deserialize, Serialize};
+
+/// What switches the RS-485 transceiver between sending and receiving
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum RtsMode {
+    /// The relay toggles RTS around every frame
+    Userspace,
+    /// The UART driver does, configured once through TIOCSRS485 (Linux)
+    Kernel,
+}
+
+impl Default for RtsMode {
+    fn default() -> Self {
+        Self::Userspace
+    }
+}
+
+impl std::fmt::Display for RtsMode {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            RtsMode::Userspace => write!(f, "userspace"),
+            RtsMode::Kernel => write!(f, "kernel"),
+        }
+    }
+}
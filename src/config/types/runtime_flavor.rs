@@ -0,0 +1,26 @@
+use serde::{Deserialize, Serialize};
+
+/// Scheduler of the tokio runtime the relay runs on
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum RuntimeFlavor {
+    /// Work-stealing pool of worker threads
+    MultiThread,
+    /// Every task on the main thread
+    CurrentThread,
+}
+
+impl Default for RuntimeFlavor {
+    fn default() -> Self {
+        Self::MultiThread
+    }
+}
+
+impl std::fmt::Display for RuntimeFlavor {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            RuntimeFlavor::MultiThread => write!(f, "multi_thread"),
+            RuntimeFlavor::CurrentThread => write!(f, "current_thread"),
+        }
+    }
+}
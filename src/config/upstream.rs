@@ -0,0 +1,38 @@
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+
+/// Downstream Modbus TCP device reached through a pool of persistent connections
+#[derive(Debug, Clone, Serialize, Deserialize)]
+#[serde(deny_unknown_fields, default)]
+pub struct Config {
+    /// Address of the device, e.g. "192.168.1.20:502"
+    pub address: String,
+    /// Persistent connections kept open to the device
+    pub connections: usize,
+    /// Requests sent on one connection before their responses arrive,
+    /// told apart by transaction ID
+    pub max_in_flight: usize,
+    /// Timeout for establishing a connection
+    #[serde(with = "humantime_serde")]
+    pub connect_timeout: Duration,
+    /// Timeout for a single request, waiting for a free slot included
+    #[serde(with = "humantime_serde")]
+    pub request_timeout: Duration,
+    /// How often idle connections are probed and lost ones reopened, 0s disables it
+    #[serde(with = "humantime_serde")]
+    pub health_check_interval: Duration,
+}
+
+impl Default for Config {
+    fn default() -> Self {
+        Self {
+            address: String::new(),
+            connections: 1,
+            max_in_flight: 1,
+            connect_timeout: Duration::from_secs(3),
+            request_timeout: Duration::from_secs(1),
+            health_check_interval: Duration::from_secs(10),
+        }
+    }
+}
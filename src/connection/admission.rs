@@ -0,0 +1,128 @@
+use std::{
+    collections::{hash_map::RandomState, HashMap},
+    hash::BuildHasher,
+    net::IpAddr,
+    sync::Mutex,
+};
+
+/// Independently locked parts of the table, a power of two
+const SHARDS: usize = 16;
+
+/// Open connections per client IP address.
+///
+/// Split into shards that are locked on their own, connections from
+/// different addresses rarely touch the same lock, and no lock is held
+/// across an await. An address is dropped from the table with its last
+/// connection, as long as every entry is backed by a global connection
+/// permit the table holds at most `max_connections` entries.
+#[derive(Debug)]
+pub struct AdmissionTable {
+    shards: Box<[Mutex<HashMap<IpAddr, usize>>]>,
+    hasher: RandomState,
+}
+
+impl Default for AdmissionTable {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl AdmissionTable {
+    pub fn new() -> Self {
+        Self {
+            shards: (0..SHARDS).map(|_| Mutex::new(HashMap::new())).collect(),
+            hasher: RandomState::new(),
+        }
+    }
+
+    fn shard(&self, ip: &IpAddr) -> &Mutex<HashMap<IpAddr, usize>> {
+        let index = self.hasher.hash_one(ip) as usize & (SHARDS - 1);
+        &self.shards[index]
+    }
+
+    /// Counts a new connection from `ip` unless it already has `limit`
+    /// open, `None` means no limit
+    pub fn try_admit(&self, ip: IpAddr, limit: Option<usize>) -> bool {
+        let mut shard = self.shard(&ip).lock().unwrap();
+        let count = shard.entry(ip).or_insert(0);
+
+        if limit.is_some_and(|limit| *count >= limit) {
+            if *count == 0 {
+                shard.remove(&ip);
+            }
+            return false;
+        }
+
+        *count += 1;
+        true
+    }
+
+    /// Counts a connection from `ip` as closed
+    pub fn release(&self, ip: IpAddr) {
+        let mut shard = self.shard(&ip).lock().unwrap();
+
+        if let Some(count) = shard.get_mut(&ip) {
+            *count = count.saturating_sub(1);
+            if *count == 0 {
+                shard.remove(&ip);
+            }
+        }
+    }
+
+    /// Open connections from `ip`
+    pub fn count(&self, ip: &IpAddr) -> usize {
+        self.shard(ip).lock().unwrap().get(ip).copied().unwrap_or(0)
+    }
+
+    /// Open connections over all addresses
+    pub fn total(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().values().sum::<usize>())
+            .sum()
+    }
+
+    /// Addresses with open connections
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().len())
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_limit_per_address() {
+        let table = AdmissionTable::new();
+        let a: IpAddr = "10.0.0.1".parse().unwrap();
+        let b: IpAddr = "10.0.0.2".parse().unwrap();
+
+        assert!(table.try_admit(a, Some(2)));
+        assert!(table.try_admit(a, Some(2)));
+        assert!(!table.try_admit(a, Some(2)));
+        assert!(table.try_admit(b, Some(2)));
+        assert_eq!(table.count(&a), 2);
+        assert_eq!(table.total(), 3);
+
+        table.release(a);
+        assert!(table.try_admit(a, Some(2)));
+
+        // Addresses are forgotten with their last connection
+        table.release(a);
+        table.release(a);
+        table.release(b);
+        assert!(table.is_empty());
+
+        // A limit of zero rejects without leaving an entry behind
+        assert!(!table.try_admit(a, Some(0)));
+        assert!(table.is_empty());
+    }
+}
@@ -1,33 +1,51 @@
-use std::{net::SocketAddr, sync::Arc};
+use std::{net::SocketAddr, sync::Arc, time::Duration};
 use tokio::sync::OwnedSemaphorePermit;
-use tracing::{trace, warn};
+use tracing::trace;
 
-use crate::connection::StatEvent;
-
-use super::ConnectionManager;
+use super::{ClientCounters, ConnectionManager, TokenBucket};
 
 /// RAII guard for the connection
 #[derive(Debug)]
 pub struct ConnectionGuard {
     pub manager: Arc<ConnectionManager>,
     pub addr: SocketAddr,
+    pub counters: Arc<ClientCounters>,
+    /// Request budget of the client, `None` without rate limiting
+    pub rate_limit: Option<Arc<TokenBucket>>,
     pub _global_permit: OwnedSemaphorePermit,
-    pub _per_ip_permit: Option<OwnedSemaphorePermit>,
+}
+
+impl ConnectionGuard {
+    /// Takes the budget for one request, `false` if the client is over
+    /// its rate and the request has to be rejected
+    pub fn try_request(&self) -> bool {
+        let Some(bucket) = &self.rate_limit else {
+            return true;
+        };
+
+        let allowed = bucket.try_take();
+        if !allowed {
+            self.manager.rate_limiter().record_limited();
+        }
+        allowed
+    }
+
+    /// Records a request handled on this connection
+    pub fn record_request(&self, success: bool, duration: Duration) {
+        self.manager
+            .stats()
+            .record_request(&self.counters, success, duration);
+    }
 }
 
 impl Drop for ConnectionGuard {
     fn drop(&mut self) {
         trace!("Dropping connection guard for {}", self.addr);
 
-        if let Err(e) = self
-            .manager
-            .stats_tx()
-            .try_send(StatEvent::ClientDisconnected(self.addr))
-        {
-            warn!("Failed to send disconnect event: {}", e);
-        }
-
-        self.manager.decrease_connection_count(self.addr);
+        self.manager
+            .stats()
+            .client_disconnected(self.addr, &self.counters);
+        self.manager.release(self.addr.ip());
 
         trace!("Connection guard dropped for {}", self.addr);
     }
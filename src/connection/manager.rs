@@ -1,35 +1,55 @@
-use std::{collections::HashMap, net::SocketAddr, sync::Arc, time::Duration};
+use std::{
+    net::{IpAddr, SocketAddr},
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    time::Duration,
+};
 
-use tokio::sync::{mpsc, oneshot, Mutex, Semaphore};
-use tracing::error;
+use tokio::sync::Semaphore;
 
-use crate::{config::ConnectionConfig, ConnectionError, RelayError};
+use crate::{config::ConnectionConfig, ConnectionError, RelayError, StatsManager};
 
-use super::{ConnectionGuard, ConnectionStats, StatEvent};
+use super::{AdmissionTable, ConnectionGuard, ConnectionStats, RateLimiter};
 
 /// TCP connection management
 #[derive(Debug)]
 pub struct Manager {
-    /// Connection limit per IP
-    per_ip_semaphores: Arc<Mutex<HashMap<SocketAddr, Arc<Semaphore>>>>,
     /// Global connection limit
     global_semaphore: Arc<Semaphore>,
-    /// Active connections counter per IP
-    active_connections: Arc<Mutex<HashMap<SocketAddr, usize>>>,
-    /// Configuration
-    config: ConnectionConfig,
-    /// Stats event sender
-    stats_tx: mpsc::Sender<StatEvent>,
+    /// Open connections per client IP, enforces the per-IP limit
+    admission: AdmissionTable,
+    /// Request rate per client IP
+    rate_limiter: RateLimiter,
+    /// Permits of the global limit, changed by [`Manager::set_limits`]
+    max_connections: AtomicUsize,
+    /// Connections per client IP, `usize::MAX` for no limit
+    per_ip_limit: AtomicUsize,
+    /// Permits still to take out of circulation after the global limit was
+    /// lowered below the open connections, they go as connections close
+    pending_shrink: AtomicUsize,
+    /// Serializes changes to the number of permits
+    resize: Mutex<()>,
+    /// Per-client counters
+    stats: Arc<StatsManager>,
 }
 
 impl Manager {
-    pub fn new(config: ConnectionConfig, stats_tx: mpsc::Sender<StatEvent>) -> Self {
+    pub fn new(config: ConnectionConfig, stats: Arc<StatsManager>) -> Self {
         Self {
-            per_ip_semaphores: Arc::new(Mutex::new(HashMap::new())),
             global_semaphore: Arc::new(Semaphore::new(config.max_connections as usize)),
-            active_connections: Arc::new(Mutex::new(HashMap::new())),
-            config,
-            stats_tx,
+            admission: AdmissionTable::new(),
+            rate_limiter: RateLimiter::new(config.rate_limit.clone()),
+            max_connections: AtomicUsize::new(config.max_connections as usize),
+            per_ip_limit: AtomicUsize::new(
+                config
+                    .per_ip_limits
+                    .map_or(usize::MAX, |limit| limit as usize),
+            ),
+            pending_shrink: AtomicUsize::new(0),
+            resize: Mutex::new(()),
+            stats,
         }
     }
 
@@ -38,25 +58,12 @@ impl Manager {
         self: &Arc<Self>,
         addr: SocketAddr,
     ) -> Result<ConnectionGuard, RelayError> {
-        // Check per IP limit if enabled
-        let per_ip_permit = if let Some(per_ip_limit) = self.config.per_ip_limits {
-            let mut semaphores = self.per_ip_semaphores.lock().await;
-
-            let semaphore = semaphores
-                .entry(addr)
-                .or_insert_with(|| Arc::new(Semaphore::new(per_ip_limit as usize)));
-
-            Some(semaphore.clone().try_acquire_owned().map_err(|_| {
-                RelayError::Connection(ConnectionError::limit_exceeded(format!(
-                    "Per-IP limit ({}) reached for {}",
-                    per_ip_limit, addr
-                )))
-            })?)
-        } else {
-            None
-        };
+        if self.pending_shrink.load(Ordering::Relaxed) > 0 {
+            self.shrink();
+        }
 
-        // Check if the global limit has been exceeded
+        // The global permit comes first, so the admission table never
+        // holds more addresses than there are connections
         let global_permit = self
             .global_semaphore
             .clone()
@@ -67,122 +74,120 @@ impl Manager {
                 ))
             })?;
 
-        // Increment active connections counter
-        {
-            let mut active_conns = self.active_connections.lock().await;
-            let conn_count = active_conns.entry(addr).or_default();
-            *conn_count = conn_count.saturating_add(1);
+        // The limit applies to the client address, whatever its port
+        let per_ip_limit = match self.per_ip_limit.load(Ordering::Relaxed) {
+            usize::MAX => None,
+            limit => Some(limit),
+        };
+        if !self.admission.try_admit(addr.ip(), per_ip_limit) {
+            return Err(RelayError::Connection(ConnectionError::limit_exceeded(
+                format!(
+                    "Per-IP limit ({}) reached for {}",
+                    per_ip_limit.unwrap_or_default(),
+                    addr
+                ),
+            )));
         }
 
-        // Notify stats manager about new connection
-        if let Err(e) = self.stats_tx.send(StatEvent::ClientConnected(addr)).await {
-            error!("Failed to send connection event to stats manager: {}", e);
-        }
+        let counters = self.stats.client_connected(addr);
+        let rate_limit = self.rate_limiter.bucket(addr.ip());
 
         Ok(ConnectionGuard {
             manager: Arc::clone(self),
             addr,
+            counters,
+            rate_limit,
             _global_permit: global_permit,
-            _per_ip_permit: per_ip_permit,
         })
     }
 
-    pub async fn get_connection_count(&self, addr: &SocketAddr) -> usize {
-        self.active_connections
-            .lock()
-            .await
-            .get(addr)
-            .copied()
-            .unwrap_or(0)
+    /// Open connections from `ip`
+    pub fn get_connection_count(&self, ip: &IpAddr) -> usize {
+        self.admission.count(ip)
     }
 
-    pub async fn get_total_connections(&self) -> usize {
-        self.active_connections.lock().await.values().sum()
+    /// Open connections, read from the global limit without taking any lock
+    pub fn active_connections(&self) -> usize {
+        (self.max_connections.load(Ordering::Relaxed) + self.pending_shrink.load(Ordering::Relaxed))
+            .saturating_sub(self.global_semaphore.available_permits())
     }
 
-    /// Updates statistics for a given request
-    pub async fn record_request(&self, addr: SocketAddr, success: bool, duration: Duration) {
-        if let Err(e) = self
-            .stats_tx
-            .send(StatEvent::RequestProcessed {
-                addr,
-                success,
-                duration_ms: duration.as_millis() as u64,
-            })
-            .await
-        {
-            error!("Failed to send request stats: {}", e);
+    /// Changes the connection limits at runtime. Open connections stay,
+    /// those over a lowered limit count against it until they close
+    pub fn set_limits(&self, max_connections: u64, per_ip_limits: Option<u64>) {
+        self.per_ip_limit.store(
+            per_ip_limits.map_or(usize::MAX, |limit| limit as usize),
+            Ordering::Relaxed,
+        );
+
+        let _resize = self.resize.lock().unwrap();
+        let max_connections = max_connections as usize;
+        let current = self
+            .max_connections
+            .swap(max_connections, Ordering::Relaxed);
+        let pending = self.pending_shrink.load(Ordering::Relaxed);
+
+        if max_connections >= current {
+            // Permits not taken out yet make up for part of the increase
+            let added = max_connections - current;
+            let cancelled = pending.min(added);
+            self.pending_shrink
+                .store(pending - cancelled, Ordering::Relaxed);
+            self.global_semaphore.add_permits(added - cancelled);
+        } else {
+            self.forget_permits(pending + current - max_connections);
         }
     }
 
-    /// Gets complete connection statistics
-    pub async fn get_stats(&self) -> Result<ConnectionStats, RelayError> {
-        let (tx, rx) = oneshot::channel();
-
-        self.stats_tx
-            .send(StatEvent::QueryConnectionStats { response_tx: tx })
-            .await
-            .map_err(|_| {
-                RelayError::Connection(ConnectionError::invalid_state(
-                    "Failed to query connection stats",
-                ))
-            })?;
+    /// Takes as many of the pending permits out of circulation as are free
+    fn shrink(&self) {
+        let _resize = self.resize.lock().unwrap();
+        self.forget_permits(self.pending_shrink.load(Ordering::Relaxed));
+    }
 
-        rx.await.map_err(|_| {
-            RelayError::Connection(ConnectionError::invalid_state(
-                "Failed to receive connection stats",
-            ))
-        })
+    /// Expects the resize lock to be held
+    fn forget_permits(&self, pending: usize) {
+        let forgotten = self.global_semaphore.forget_permits(pending);
+        self.pending_shrink
+            .store(pending - forgotten, Ordering::Relaxed);
     }
 
-    /// Cleans up idle connections
-    pub(crate) async fn cleanup_idle_connections(&self) -> Result<(), RelayError> {
-        // Cleanup is now handled by StatsManager, we just need to sync our active connections
-        let (tx, rx) = oneshot::channel();
+    pub fn get_total_connections(&self) -> usize {
+        self.admission.total()
+    }
 
-        self.stats_tx
-            .send(StatEvent::QueryConnectionStats { response_tx: tx })
-            .await
-            .map_err(|_| {
-                RelayError::Connection(ConnectionError::invalid_state(
-                    "Failed to query stats for cleanup",
-                ))
-            })?;
+    /// Updates statistics for a given request.
+    ///
+    /// Connection tasks should prefer [`ConnectionGuard::record_request`],
+    /// which skips the client lookup.
+    pub fn record_request(&self, addr: SocketAddr, success: bool, duration: Duration) {
+        if let Some(counters) = self.stats.client(&addr) {
+            self.stats.record_request(&counters, success, duration);
+        }
+    }
 
-        let stats = rx.await.map_err(|_| {
-            RelayError::Connection(ConnectionError::invalid_state(
-                "Failed to receive stats for cleanup",
-            ))
-        })?;
-
-        let mut active_conns = self.active_connections.lock().await;
-        active_conns.retain(|addr, count| {
-            if let Some(ip_stats) = stats.per_ip_stats.get(addr) {
-                ip_stats.active_connections > 0
-            } else {
-                // If no stats exist, connection is considered inactive
-                *count == 0
-            }
-        });
+    /// Gets complete connection statistics
+    pub fn get_stats(&self) -> ConnectionStats {
+        self.stats.connection_stats()
+    }
 
+    /// Cleans up the stats of idle clients, the admission table forgets
+    /// an address with its last connection by itself
+    pub(crate) async fn cleanup_idle_connections(&self) -> Result<(), RelayError> {
+        self.stats.cleanup_idle_stats();
+        self.rate_limiter.prune();
         Ok(())
     }
 
-    pub(crate) fn decrease_connection_count(&self, addr: SocketAddr) {
-        let mut active_conns = self
-            .active_connections
-            .try_lock()
-            .expect("Failed to lock active_connections in guard drop");
-
-        if let Some(count) = active_conns.get_mut(&addr) {
-            *count = count.saturating_sub(1);
-            if *count == 0 {
-                active_conns.remove(&addr);
-            }
-        }
+    pub(crate) fn release(&self, ip: IpAddr) {
+        self.admission.release(ip);
+    }
+
+    pub fn rate_limiter(&self) -> &RateLimiter {
+        &self.rate_limiter
     }
 
-    pub fn stats_tx(&self) -> mpsc::Sender<StatEvent> {
-        self.stats_tx.clone()
+    pub fn stats(&self) -> &Arc<StatsManager> {
+        &self.stats
     }
 }
@@ -0,0 +1,211 @@
+use std::{
+    collections::{hash_map::RandomState, HashMap},
+    hash::BuildHasher,
+    net::IpAddr,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+    time::Instant,
+};
+
+use crate::RateLimitConfig;
+
+/// Independently locked parts of the table, a power of two
+const SHARDS: usize = 16;
+
+type Shard = Mutex<HashMap<IpAddr, Arc<TokenBucket>>>;
+
+#[derive(Debug)]
+struct BucketState {
+    tokens: f64,
+    updated_at: Instant,
+}
+
+/// Request budget of one client IP, shared by all its connections
+#[derive(Debug)]
+pub struct TokenBucket {
+    rate: f64,
+    burst: f64,
+    state: Mutex<BucketState>,
+}
+
+impl TokenBucket {
+    pub fn new(rate: f64, burst: u32) -> Self {
+        Self {
+            rate,
+            burst: burst as f64,
+            state: Mutex::new(BucketState {
+                tokens: burst as f64,
+                updated_at: Instant::now(),
+            }),
+        }
+    }
+
+    fn refill(&self, state: &mut BucketState) {
+        let now = Instant::now();
+        let elapsed = now.duration_since(state.updated_at).as_secs_f64();
+        state.tokens = (state.tokens + elapsed * self.rate).min(self.burst);
+        state.updated_at = now;
+    }
+
+    /// Takes a token for one request, `false` if the client is over its rate
+    pub fn try_take(&self) -> bool {
+        let mut state = self.state.lock().unwrap();
+        self.refill(&mut state);
+
+        if state.tokens < 1.0 {
+            return false;
+        }
+        state.tokens -= 1.0;
+        true
+    }
+
+    /// Whether the bucket refilled completely, forgetting it changes nothing
+    fn is_full(&self) -> bool {
+        let mut state = self.state.lock().unwrap();
+        self.refill(&mut state);
+        state.tokens >= self.burst
+    }
+}
+
+/// Token buckets per client IP.
+///
+/// Connections look their bucket up once when accepted and keep it, the
+/// table is only locked on accept and by [`RateLimiter::prune`]. A bucket
+/// is forgotten once its client has no connections left and it has
+/// refilled, so reconnecting does not reset a client's budget.
+#[derive(Debug)]
+pub struct RateLimiter {
+    config: RateLimitConfig,
+    shards: Box<[Shard]>,
+    hasher: RandomState,
+    limited: AtomicU64,
+}
+
+impl RateLimiter {
+    pub fn new(config: RateLimitConfig) -> Self {
+        Self {
+            config,
+            shards: (0..SHARDS).map(|_| Mutex::new(HashMap::new())).collect(),
+            hasher: RandomState::new(),
+            limited: AtomicU64::new(0),
+        }
+    }
+
+    /// Bucket of `ip`, `None` if rate limiting is disabled
+    pub fn bucket(&self, ip: IpAddr) -> Option<Arc<TokenBucket>> {
+        if !self.config.enabled {
+            return None;
+        }
+
+        let index = self.hasher.hash_one(ip) as usize & (SHARDS - 1);
+        let mut shard = self.shards[index].lock().unwrap();
+        let bucket = shard.entry(ip).or_insert_with(|| {
+            Arc::new(TokenBucket::new(
+                self.config.requests_per_second,
+                self.config.burst,
+            ))
+        });
+        Some(Arc::clone(bucket))
+    }
+
+    /// Counts a request rejected for going over the rate
+    pub fn record_limited(&self) {
+        self.limited.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Requests rejected since start
+    pub fn limited(&self) -> u64 {
+        self.limited.load(Ordering::Relaxed)
+    }
+
+    /// Exception code answered to limited requests
+    pub fn exception_code(&self) -> u8 {
+        self.config.exception_code
+    }
+
+    /// Forgets the buckets of clients without connections that refilled
+    pub fn prune(&self) {
+        for shard in self.shards.iter() {
+            shard
+                .lock()
+                .unwrap()
+                .retain(|_, bucket| Arc::strong_count(bucket) > 1 || !bucket.is_full());
+        }
+    }
+
+    /// Clients with a bucket
+    pub fn len(&self) -> usize {
+        self.shards
+            .iter()
+            .map(|shard| shard.lock().unwrap().len())
+            .sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::Duration;
+
+    use super::*;
+
+    fn limiter(requests_per_second: f64, burst: u32) -> RateLimiter {
+        RateLimiter::new(RateLimitConfig {
+            enabled: true,
+            requests_per_second,
+            burst,
+            ..Default::default()
+        })
+    }
+
+    #[test]
+    fn test_bucket_shared_per_ip() {
+        let limiter = limiter(1.0, 3);
+        let ip: IpAddr = "10.0.0.1".parse().unwrap();
+
+        // Two connections of one client draw from the same budget
+        let first = limiter.bucket(ip).unwrap();
+        let second = limiter.bucket(ip).unwrap();
+        assert!(first.try_take() && second.try_take() && first.try_take());
+        assert!(!second.try_take());
+
+        let other = limiter.bucket("10.0.0.2".parse().unwrap()).unwrap();
+        assert!(other.try_take());
+
+        // Reconnecting does not reset an empty bucket
+        drop((first, second));
+        limiter.prune();
+        assert!(!limiter.bucket(ip).unwrap().try_take());
+    }
+
+    #[test]
+    fn test_refill_and_prune() {
+        let limiter = limiter(100.0, 1);
+        let ip: IpAddr = "10.0.0.1".parse().unwrap();
+
+        let bucket = limiter.bucket(ip).unwrap();
+        assert!(bucket.try_take());
+        assert!(!bucket.try_take());
+        std::thread::sleep(Duration::from_millis(20));
+        assert!(bucket.try_take());
+
+        // Only refilled buckets without connections are forgotten
+        limiter.prune();
+        assert_eq!(limiter.len(), 1);
+        drop(bucket);
+        std::thread::sleep(Duration::from_millis(20));
+        limiter.prune();
+        assert!(limiter.is_empty());
+    }
+
+    #[test]
+    fn test_disabled() {
+        let limiter = RateLimiter::new(RateLimitConfig::default());
+        assert!(limiter.bucket("10.0.0.1".parse().unwrap()).is_none());
+    }
+}
@@ -2,6 +2,8 @@ use std::time::SystemTime;
 
 use serde::Serialize;
 
+use crate::rates::RateReport;
+
 /// Stats for a single client
 #[derive(Debug, Clone, Serialize)]
 pub struct Stats {
@@ -17,6 +19,8 @@ pub struct Stats {
     pub last_error: Option<SystemTime>,
     /// Average response time
     pub avg_response_time_ms: u64,
+    /// Requests and errors per second over the last minutes
+    pub rates: RateReport,
 }
 
 impl Default for Stats {
@@ -28,6 +32,7 @@ impl Default for Stats {
             last_active: SystemTime::now(),
             last_error: None,
             avg_response_time_ms: 0,
+            rates: RateReport::default(),
         }
     }
 }
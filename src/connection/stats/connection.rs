@@ -1,11 +1,9 @@
-use std::{
-    collections::HashMap,
-    net::SocketAddr,
-    time::{Duration, SystemTime},
-};
+use std::{collections::HashMap, net::SocketAddr};
 
 use serde::Serialize;
 
+use crate::rates::RateReport;
+
 use super::{ClientStats, IpStats};
 
 #[derive(Debug, Serialize)]
@@ -14,13 +12,18 @@ pub struct Stats {
     pub active_connections: usize,
     pub total_requests: u64,
     pub total_errors: u64,
+    /// Over the last minute, the same as `rates.1m.requests_per_second`
     pub requests_per_second: f64,
     pub avg_response_time_ms: u64,
     pub per_ip_stats: HashMap<SocketAddr, IpStats>,
+    /// Requests and errors per second over the last minutes, all clients
+    pub rates: RateReport,
 }
 
 impl Stats {
-    pub fn from_client_stats(stats: &HashMap<SocketAddr, ClientStats>) -> Self {
+    /// Sums up `stats`, `rates` covers every client, those cleaned up
+    /// included
+    pub fn from_client_stats(stats: &HashMap<SocketAddr, ClientStats>, rates: RateReport) -> Self {
         let mut total_active = 0;
         let mut total_requests = 0;
         let mut total_errors = 0;
@@ -48,6 +51,7 @@ impl Stats {
                     last_active: client.last_active,
                     last_error: client.last_error,
                     avg_response_time_ms: client.avg_response_time_ms,
+                    rates: client.rates,
                 },
             );
         }
@@ -57,29 +61,14 @@ impl Stats {
             active_connections: total_active,
             total_requests,
             total_errors,
-            requests_per_second: Self::calculate_requests_per_second(stats),
+            requests_per_second: rates.one_minute.requests_per_second,
             avg_response_time_ms: if response_time_count > 0 {
                 total_response_time / response_time_count
             } else {
                 0
             },
             per_ip_stats: per_ip,
+            rates,
         }
     }
-
-    fn calculate_requests_per_second(stats: &HashMap<SocketAddr, ClientStats>) -> f64 {
-        let now = SystemTime::now();
-        let window = Duration::from_secs(60);
-        let mut recent_requests = 0;
-
-        for client in stats.values() {
-            if let Ok(duration) = now.duration_since(client.last_active) {
-                if duration <= window {
-                    recent_requests += client.total_requests as usize;
-                }
-            }
-        }
-
-        recent_requests as f64 / window.as_secs_f64()
-    }
 }
@@ -0,0 +1,153 @@
+use std::{
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        OnceLock,
+    },
+    time::{Duration, SystemTime, UNIX_EPOCH},
+};
+
+use crate::rates::{RateReport, RateWindow};
+
+use super::ClientStats;
+
+fn now_us() -> u64 {
+    SystemTime::now()
+        .duration_since(UNIX_EPOCH)
+        .map_or(0, |since_epoch| since_epoch.as_micros() as u64)
+}
+
+fn from_us(us: u64) -> SystemTime {
+    UNIX_EPOCH + Duration::from_micros(us)
+}
+
+/// Live counters for a single client address.
+///
+/// Updated with relaxed atomics from the connection task, so recording a
+/// request never waits on a lock or a channel. Readers take a
+/// [`ClientStats`] snapshot when stats are queried.
+#[derive(Debug)]
+pub struct Counters {
+    active_connections: AtomicUsize,
+    total_requests: AtomicU64,
+    total_errors: AtomicU64,
+    total_response_time_us: AtomicU64,
+    /// Microseconds since the UNIX epoch
+    last_active_us: AtomicU64,
+    /// Microseconds since the UNIX epoch, 0 if there was no error yet
+    last_error_us: AtomicU64,
+    /// Requests and errors over the last minutes, allocated by the first
+    /// request so connections that stay idle do not pay for the buckets
+    rates: OnceLock<Box<RateWindow>>,
+}
+
+impl Default for Counters {
+    fn default() -> Self {
+        Self {
+            active_connections: AtomicUsize::new(0),
+            total_requests: AtomicU64::new(0),
+            total_errors: AtomicU64::new(0),
+            total_response_time_us: AtomicU64::new(0),
+            last_active_us: AtomicU64::new(now_us()),
+            last_error_us: AtomicU64::new(0),
+            rates: OnceLock::new(),
+        }
+    }
+}
+
+impl Counters {
+    pub fn connected(&self) {
+        self.active_connections.fetch_add(1, Ordering::Relaxed);
+        self.touch();
+    }
+
+    pub fn disconnected(&self) {
+        // Saturating, a stray disconnect must not wrap the counter
+        let _ =
+            self.active_connections
+                .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |active| {
+                    active.checked_sub(1)
+                });
+        self.touch();
+    }
+
+    pub fn record_request(&self, success: bool, duration: Duration) {
+        self.total_requests.fetch_add(1, Ordering::Relaxed);
+        self.total_response_time_us
+            .fetch_add(duration.as_micros() as u64, Ordering::Relaxed);
+
+        let now = now_us();
+        if !success {
+            self.total_errors.fetch_add(1, Ordering::Relaxed);
+            self.last_error_us.store(now, Ordering::Relaxed);
+        }
+        self.last_active_us.store(now, Ordering::Relaxed);
+        self.rates
+            .get_or_init(Box::default)
+            .record(!success, duration);
+    }
+
+    pub fn active_connections(&self) -> usize {
+        self.active_connections.load(Ordering::Relaxed)
+    }
+
+    pub fn last_active(&self) -> SystemTime {
+        from_us(self.last_active_us.load(Ordering::Relaxed))
+    }
+
+    pub fn last_error(&self) -> Option<SystemTime> {
+        match self.last_error_us.load(Ordering::Relaxed) {
+            0 => None,
+            us => Some(from_us(us)),
+        }
+    }
+
+    pub fn snapshot(&self) -> ClientStats {
+        let total_requests = self.total_requests.load(Ordering::Relaxed);
+        let total_response_time_us = self.total_response_time_us.load(Ordering::Relaxed);
+
+        ClientStats {
+            active_connections: self.active_connections(),
+            total_requests,
+            total_errors: self.total_errors.load(Ordering::Relaxed),
+            last_active: self.last_active(),
+            last_error: self.last_error(),
+            avg_response_time_ms: total_response_time_us
+                .checked_div(total_requests)
+                .unwrap_or(0)
+                / 1000,
+            rates: self
+                .rates
+                .get()
+                .map_or_else(RateReport::default, |rates| rates.report()),
+        }
+    }
+
+    fn touch(&self) {
+        self.last_active_us.store(now_us(), Ordering::Relaxed);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_counters_snapshot() {
+        let counters = Counters::default();
+        counters.connected();
+        assert!(counters.rates.get().is_none());
+        counters.record_request(true, Duration::from_millis(10));
+        counters.record_request(false, Duration::from_millis(30));
+
+        let stats = counters.snapshot();
+        assert_eq!(stats.active_connections, 1);
+        assert_eq!(stats.total_requests, 2);
+        assert_eq!(stats.total_errors, 1);
+        assert_eq!(stats.avg_response_time_ms, 20);
+        assert!(stats.last_error.is_some());
+
+        counters.disconnected();
+        counters.disconnected();
+        assert_eq!(counters.active_connections(), 0);
+    }
+}
@@ -2,6 +2,8 @@ use std::time::SystemTime;
 
 use serde::Serialize;
 
+use crate::rates::RateReport;
+
 /// Stats for a single IP address
 #[derive(Debug, Clone, Serialize)]
 pub struct Stats {
@@ -11,4 +13,5 @@ pub struct Stats {
     pub last_active: SystemTime,
     pub last_error: Option<SystemTime>,
     pub avg_response_time_ms: u64,
+    pub rates: RateReport,
 }
@@ -1,7 +1,9 @@
 mod client;
 mod connection;
+mod counters;
 mod ip;
 
 pub use client::Stats as ClientStats;
 pub use connection::Stats as ConnectionStats;
+pub use counters::Counters as ClientCounters;
 pub use ip::Stats as IpStats;
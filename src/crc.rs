@@ -0,0 +1,276 @@
+//! CRC16-Modbus (reflected polynomial 0xA001, initial value 0xFFFF).
+//!
+//! [`calc_crc16`] picks the fastest implementation for the frame at hand:
+//!
+//! - frames of [`CLMUL_MIN_LEN`] bytes and more are folded 16 bytes at a
+//!   time with carry-less multiplication (PCLMULQDQ on x86_64, PMULL on
+//!   aarch64) when the CPU has it, the last block is finished by table
+//! - everything else runs slicing-by-8, eight table lookups per 8 bytes
+//!   without a dependency between them
+//! - the classic one table lookup per byte is kept as the reference the
+//!   others are tested against
+//!
+//! The variants are public so the benchmarks can compare them.
+
+/// Frames shorter than this are not worth the setup of the folding loop
+pub const CLMUL_MIN_LEN: usize = 32;
+
+/// Precomputed CRC16 lookup table for polynomial 0xA001 (Modbus standard)
+const TABLE: [u16; 256] = [
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241, 0xC601, 0x06C0, 0x0780, 0xC741,
+    0x0500, 0xC5C1, 0xC481, 0x0440, 0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841, 0xD801, 0x18C0, 0x1980, 0xD941,
+    0x1B00, 0xDBC1, 0xDA81, 0x1A40, 0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641, 0xD201, 0x12C0, 0x1380, 0xD341,
+    0x1100, 0xD1C1, 0xD081, 0x1040, 0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441, 0x3C00, 0xFCC1, 0xFD81, 0x3D40,
+    0xFF01, 0x3FC0, 0x3E80, 0xFE41, 0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41, 0xEE01, 0x2EC0, 0x2F80, 0xEF41,
+    0x2D00, 0xEDC1, 0xEC81, 0x2C40, 0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041, 0xA001, 0x60C0, 0x6180, 0xA141,
+    0x6300, 0xA3C1, 0xA281, 0x6240, 0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41, 0xAA01, 0x6AC0, 0x6B80, 0xAB41,
+    0x6900, 0xA9C1, 0xA881, 0x6840, 0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40, 0xB401, 0x74C0, 0x7580, 0xB541,
+    0x7700, 0xB7C1, 0xB681, 0x7640, 0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241, 0x9601, 0x56C0, 0x5780, 0x9741,
+    0x5500, 0x95C1, 0x9481, 0x5440, 0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841, 0x8801, 0x48C0, 0x4980, 0x8941,
+    0x4B00, 0x8BC1, 0x8A81, 0x4A40, 0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641, 0x8201, 0x42C0, 0x4380, 0x8341,
+    0x4100, 0x81C1, 0x8081, 0x4040,
+];
+
+/// `TABLE` advanced by one to seven more zero bytes, for slicing-by-8
+const SLICING_TABLES: [[u16; 256]; 8] = slicing_tables();
+
+const fn slicing_tables() -> [[u16; 256]; 8] {
+    let mut tables = [[0u16; 256]; 8];
+    tables[0] = TABLE;
+
+    let mut k = 1;
+    while k < 8 {
+        let mut i = 0;
+        while i < 256 {
+            let previous = tables[k - 1][i];
+            tables[k][i] = (previous >> 8) ^ TABLE[(previous & 0xFF) as usize];
+            i += 1;
+        }
+        k += 1;
+    }
+    tables
+}
+
+/// x^`n` mod P with P = x^16 + x^15 + x^2 + 1, not reflected
+const fn xpow_mod(n: u32) -> u64 {
+    let mut remainder: u64 = 1;
+    let mut i = 0;
+    while i < n {
+        remainder <<= 1;
+        if remainder & 0x1_0000 != 0 {
+            remainder ^= 0x1_8005;
+        }
+        i += 1;
+    }
+    remainder
+}
+
+/// Folding constants, reflected into 64 bits.
+///
+/// A 16 byte block moved 16 bytes further into the message is x^128 times
+/// its polynomial. Split into halves that is H x^192 + L x^128, and each
+/// power can be replaced by its remainder mod P. The carry-less product of
+/// two reflected 64 bit values comes out one bit short of 128, which is
+/// made up for by taking one power of x less.
+const FOLD_HIGH: u64 = xpow_mod(191).reverse_bits();
+const FOLD_LOW: u64 = xpow_mod(127).reverse_bits();
+
+/// Calculates the CRC16 checksum for Modbus RTU communication.
+///
+/// # Arguments
+///
+/// * `data` - A slice of bytes representing the data frame for which the CRC is to be computed.
+///
+/// # Returns
+///
+/// The computed 16-bit CRC as a `u16` value.
+pub fn calc_crc16(data: &[u8]) -> u16 {
+    if data.len() >= CLMUL_MIN_LEN {
+        if let Some(crc) = crc16_clmul(data) {
+            return crc;
+        }
+    }
+
+    crc16_slicing(data)
+}
+
+/// One table lookup per byte
+pub fn crc16_bytewise(data: &[u8]) -> u16 {
+    update_bytewise(0xFFFF, data)
+}
+
+/// Slicing-by-8, eight independent table lookups per 8 bytes
+pub fn crc16_slicing(data: &[u8]) -> u16 {
+    update_slicing(0xFFFF, data)
+}
+
+/// Carry-less multiplication folding, `None` if the CPU does not support it
+pub fn crc16_clmul(data: &[u8]) -> Option<u16> {
+    // The first block carries the initial value, the last one is finished
+    // by table
+    if data.len() < 32 {
+        return Some(crc16_slicing(data));
+    }
+
+    #[cfg(target_arch = "x86_64")]
+    if std::arch::is_x86_feature_detected!("pclmulqdq") {
+        // SAFETY: the CPU supports the instructions the function is built with
+        return Some(unsafe { x86_64::crc16(data) });
+    }
+
+    #[cfg(target_arch = "aarch64")]
+    if std::arch::is_aarch64_feature_detected!("aes") {
+        // SAFETY: the CPU supports the instructions the function is built with
+        return Some(unsafe { aarch64::crc16(data) });
+    }
+
+    None
+}
+
+fn update_bytewise(mut crc: u16, data: &[u8]) -> u16 {
+    for &byte in data {
+        // XOR the lower byte of the CRC with the current byte and find the lookup table index
+        let index = ((crc ^ byte as u16) & 0x00FF) as usize;
+        // Update the CRC by shifting right and XORing with the table value
+        crc = (crc >> 8) ^ TABLE[index];
+    }
+
+    crc
+}
+
+fn update_slicing(mut crc: u16, data: &[u8]) -> u16 {
+    let t = &SLICING_TABLES;
+    let mut chunks = data.chunks_exact(8);
+
+    for chunk in &mut chunks {
+        // The CRC only overlaps the first two bytes of the chunk
+        let [low, high] = crc.to_le_bytes();
+        crc = t[7][(chunk[0] ^ low) as usize]
+            ^ t[6][(chunk[1] ^ high) as usize]
+            ^ t[5][chunk[2] as usize]
+            ^ t[4][chunk[3] as usize]
+            ^ t[3][chunk[4] as usize]
+            ^ t[2][chunk[5] as usize]
+            ^ t[1][chunk[6] as usize]
+            ^ t[0][chunk[7] as usize];
+    }
+
+    update_bytewise(crc, chunks.remainder())
+}
+
+/// Folds `data` (at least 32 bytes) into its last 16 byte block with
+/// `$clmul(u64, u64) -> u128` and finishes the CRC by table.
+///
+/// A macro rather than a generic function, so the multiplication is
+/// expanded inside the caller and built with its target features.
+macro_rules! fold {
+    ($data:expr, $clmul:expr) => {{
+        let data: &[u8] = $data;
+        let (blocks, tail) = data.split_at(data.len() & !15);
+        let mut blocks = blocks.chunks_exact(16);
+
+        // The initial value is XORed into the first two bytes
+        let first = blocks.next().unwrap();
+        let mut acc = u128::from_le_bytes(first.try_into().unwrap()) ^ 0xFFFF;
+
+        for block in blocks {
+            let block = u128::from_le_bytes(block.try_into().unwrap());
+            acc = $clmul(acc as u64, FOLD_HIGH) ^ $clmul((acc >> 64) as u64, FOLD_LOW) ^ block;
+        }
+
+        let crc = update_slicing(0, &acc.to_le_bytes());
+        update_slicing(crc, tail)
+    }};
+}
+
+#[cfg(target_arch = "x86_64")]
+mod x86_64 {
+    use std::arch::x86_64::{
+        _mm_clmulepi64_si128, _mm_cvtsi128_si64, _mm_cvtsi64_si128, _mm_extract_epi64,
+    };
+
+    use super::*;
+
+    #[target_feature(enable = "pclmulqdq,sse2,sse4.1")]
+    pub(super) unsafe fn crc16(data: &[u8]) -> u16 {
+        fold!(data, |a: u64, b: u64| {
+            let product =
+                _mm_clmulepi64_si128(_mm_cvtsi64_si128(a as i64), _mm_cvtsi64_si128(b as i64), 0);
+            let low = _mm_cvtsi128_si64(product) as u64 as u128;
+            let high = _mm_extract_epi64(product, 1) as u64 as u128;
+            (high << 64) | low
+        })
+    }
+}
+
+#[cfg(target_arch = "aarch64")]
+mod aarch64 {
+    use std::arch::aarch64::vmull_p64;
+
+    use super::*;
+
+    #[target_feature(enable = "neon,aes")]
+    pub(super) unsafe fn crc16(data: &[u8]) -> u16 {
+        fold!(data, |a: u64, b: u64| vmull_p64(a, b))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// Carry-less multiplication in software, checks the folding math on
+    /// any CPU
+    fn clmul(a: u64, b: u64) -> u128 {
+        (0..64)
+            .filter(|bit| b >> bit & 1 != 0)
+            .fold(0, |product, bit| product ^ (a as u128) << bit)
+    }
+
+    fn crc16_soft_fold(data: &[u8]) -> u16 {
+        fold!(data, clmul)
+    }
+
+    fn test_data(len: usize) -> Vec<u8> {
+        (0..len)
+            .map(|i| (i * 131 + 7) as u8 ^ (i >> 8) as u8)
+            .collect()
+    }
+
+    #[test]
+    fn test_calc_crc16() {
+        // Read holding register 0 from unit 1
+        let crc = calc_crc16(&[0x01, 0x03, 0x00, 0x00, 0x00, 0x01]);
+        assert_eq!(crc.to_le_bytes(), [0x84, 0x0A]);
+
+        // Check value of CRC-16/MODBUS
+        assert_eq!(calc_crc16(b"123456789"), 0x4B37);
+    }
+
+    #[test]
+    fn test_variants_agree() {
+        for len in 0..=300 {
+            let data = test_data(len);
+            let expected = crc16_bytewise(&data);
+
+            assert_eq!(crc16_slicing(&data), expected, "slicing, {} bytes", len);
+            assert_eq!(calc_crc16(&data), expected, "dispatch, {} bytes", len);
+            if let Some(crc) = crc16_clmul(&data) {
+                assert_eq!(crc, expected, "clmul, {} bytes", len);
+            }
+            if len >= 32 {
+                assert_eq!(crc16_soft_fold(&data), expected, "fold, {} bytes", len);
+            }
+        }
+    }
+}
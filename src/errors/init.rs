@@ -4,10 +4,16 @@ use thiserror::Error;
 pub enum InitializationError {
     #[error("Logging initialization error: {0}")]
     Logging(String),
+    #[error("Runtime initialization error: {0}")]
+    Runtime(String),
 }
 
 impl InitializationError {
     pub fn logging(msg: impl Into<String>) -> Self {
         Self::Logging(msg.into())
     }
+
+    pub fn runtime(msg: impl Into<String>) -> Self {
+        Self::Runtime(msg.into())
+    }
 }
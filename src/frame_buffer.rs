@@ -0,0 +1,253 @@
+use std::{
+    ops::{Deref, DerefMut},
+    sync::{Arc, Mutex},
+};
+
+use crate::{mbap::MBAP_HEADER_SIZE, modbus::MAX_RTU_FRAME_SIZE};
+
+/// Room in front of an RTU frame for the MBAP header minus the Unit ID:
+/// Transaction ID(2) + Protocol ID(2) + Length(2)
+pub const MBAP_HEADROOM: usize = MBAP_HEADER_SIZE - 1;
+
+/// Size of every pooled buffer: the largest RTU frame behind the MBAP
+/// headroom. This also fits the largest Modbus TCP frame (260 bytes) with
+/// room left for the CRC appended when a request is turned into RTU.
+pub const FRAME_BUFFER_SIZE: usize = MBAP_HEADROOM + MAX_RTU_FRAME_SIZE;
+
+type Block = Box<[u8; FRAME_BUFFER_SIZE]>;
+
+/// Pool of fixed size frame buffers.
+///
+/// Buffers return to the pool when dropped, keeping up to `max_idle` of them
+/// around, so a request travelling from the TCP connection through the bus
+/// and back does not hit the allocator once the pool is warm.
+#[derive(Debug)]
+pub struct BufferPool {
+    free: Mutex<Vec<Block>>,
+    max_idle: usize,
+}
+
+impl BufferPool {
+    pub fn new(max_idle: usize) -> Arc<Self> {
+        Arc::new(Self {
+            free: Mutex::new(Vec::with_capacity(max_idle)),
+            max_idle,
+        })
+    }
+
+    /// Returns an empty buffer with its data starting at offset 0
+    pub fn get(self: &Arc<Self>) -> FrameBuffer {
+        self.get_with_headroom(0)
+    }
+
+    /// Returns an empty buffer with `headroom` bytes reserved for [`FrameBuffer::prepend`]
+    pub fn get_with_headroom(self: &Arc<Self>, headroom: usize) -> FrameBuffer {
+        assert!(headroom <= FRAME_BUFFER_SIZE);
+
+        let block = self
+            .free
+            .lock()
+            .unwrap()
+            .pop()
+            .unwrap_or_else(|| Box::new([0u8; FRAME_BUFFER_SIZE]));
+
+        FrameBuffer {
+            block: Some(block),
+            head: headroom,
+            len: 0,
+            pool: Arc::clone(self),
+        }
+    }
+
+    /// Number of idle buffers kept for reuse
+    pub fn idle(&self) -> usize {
+        self.free.lock().unwrap().len()
+    }
+
+    fn put(&self, block: Block) {
+        let mut free = self.free.lock().unwrap();
+        if free.len() < self.max_idle {
+            free.push(block);
+        }
+    }
+}
+
+/// A frame held in a pooled, fixed size buffer.
+///
+/// Dereferences to the frame bytes. Headroom in front of the frame lets a
+/// header be added without moving the data, which is how an RTU response
+/// becomes a Modbus TCP response in place.
+pub struct FrameBuffer {
+    block: Option<Block>,
+    head: usize,
+    len: usize,
+    pool: Arc<BufferPool>,
+}
+
+impl FrameBuffer {
+    fn block(&self) -> &[u8; FRAME_BUFFER_SIZE] {
+        self.block.as_deref().expect("frame buffer used after drop")
+    }
+
+    fn block_mut(&mut self) -> &mut [u8; FRAME_BUFFER_SIZE] {
+        self.block
+            .as_deref_mut()
+            .expect("frame buffer used after drop")
+    }
+
+    /// Free space behind the frame, to be filled and committed with [`FrameBuffer::set_len`]
+    pub fn spare_capacity_mut(&mut self) -> &mut [u8] {
+        let end = self.head + self.len;
+        &mut self.block_mut()[end..]
+    }
+
+    /// Sets the frame length, e.g. after writing into [`FrameBuffer::spare_capacity_mut`]
+    ///
+    /// # Panics
+    ///
+    /// Panics if the frame would not fit in the buffer.
+    pub fn set_len(&mut self, len: usize) {
+        assert!(self.head + len <= FRAME_BUFFER_SIZE);
+        self.len = len;
+    }
+
+    /// Shortens the frame, has no effect if `len` is not smaller than the current length
+    pub fn truncate(&mut self, len: usize) {
+        self.len = self.len.min(len);
+    }
+
+    /// Appends bytes behind the frame.
+    ///
+    /// # Panics
+    ///
+    /// Panics if the data does not fit in the buffer.
+    pub fn extend_from_slice(&mut self, data: &[u8]) {
+        let end = self.head + self.len;
+        self.block_mut()[end..end + data.len()].copy_from_slice(data);
+        self.len += data.len();
+    }
+
+    pub fn push(&mut self, byte: u8) {
+        self.extend_from_slice(&[byte]);
+    }
+
+    /// Drops `count` bytes from the front of the frame, they become headroom
+    pub fn advance(&mut self, count: usize) {
+        assert!(count <= self.len);
+        self.head += count;
+        self.len -= count;
+    }
+
+    /// Writes `header` into the headroom in front of the frame.
+    ///
+    /// # Panics
+    ///
+    /// Panics if there is not enough headroom.
+    pub fn prepend(&mut self, header: &[u8]) {
+        assert!(header.len() <= self.head, "not enough headroom");
+        self.head -= header.len();
+        let head = self.head;
+        self.block_mut()[head..head + header.len()].copy_from_slice(header);
+        self.len += header.len();
+    }
+}
+
+impl Deref for FrameBuffer {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        &self.block()[self.head..self.head + self.len]
+    }
+}
+
+impl DerefMut for FrameBuffer {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        let (head, len) = (self.head, self.len);
+        &mut self.block_mut()[head..head + len]
+    }
+}
+
+impl Clone for FrameBuffer {
+    fn clone(&self) -> Self {
+        let mut clone = self.pool.get_with_headroom(self.head);
+        clone.extend_from_slice(self);
+        clone
+    }
+}
+
+impl std::fmt::Debug for FrameBuffer {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(f, "{:02X?}", &**self)
+    }
+}
+
+impl Drop for FrameBuffer {
+    fn drop(&mut self) {
+        if let Some(block) = self.block.take() {
+            self.pool.put(block);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_buffers_are_reused() {
+        let pool = BufferPool::new(2);
+
+        let a = pool.get();
+        let b = pool.get();
+        let c = pool.get();
+        assert_eq!(pool.idle(), 0);
+
+        drop(a);
+        drop(b);
+        drop(c);
+        // Only max_idle buffers are kept
+        assert_eq!(pool.idle(), 2);
+
+        let _d = pool.get();
+        assert_eq!(pool.idle(), 1);
+    }
+
+    #[test]
+    fn test_prepend_into_headroom() {
+        let pool = BufferPool::new(1);
+        let mut frame = pool.get_with_headroom(MBAP_HEADROOM);
+
+        // An RTU response read straight into the spare capacity
+        let rtu = [0x01, 0x03, 0x02, 0x00, 0x2A, 0xAA, 0xBB];
+        frame.spare_capacity_mut()[..rtu.len()].copy_from_slice(&rtu);
+        frame.set_len(rtu.len());
+        assert_eq!(
+            frame.spare_capacity_mut().len(),
+            MAX_RTU_FRAME_SIZE - rtu.len()
+        );
+
+        // Drop the CRC and put the MBAP header in front
+        frame.truncate(rtu.len() - 2);
+        frame.prepend(&[0x12, 0x34, 0x00, 0x00, 0x00, 0x05]);
+        assert_eq!(
+            &frame[..],
+            &[0x12, 0x34, 0x00, 0x00, 0x00, 0x05, 0x01, 0x03, 0x02, 0x00, 0x2A]
+        );
+
+        let clone = frame.clone();
+        assert_eq!(&clone[..], &frame[..]);
+    }
+
+    #[test]
+    fn test_advance() {
+        let pool = BufferPool::new(1);
+        let mut frame = pool.get();
+        frame.extend_from_slice(&[0x00, 0x01, 0x00, 0x00, 0x00, 0x02, 0x01, 0x11]);
+
+        frame.advance(MBAP_HEADROOM);
+        assert_eq!(&frame[..], &[0x01, 0x11]);
+
+        frame.prepend(&[0xFF; MBAP_HEADROOM]);
+        assert_eq!(frame.len(), 8);
+    }
+}
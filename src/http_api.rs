@@ -1,11 +1,34 @@
-use std::{collections::HashMap, net::SocketAddr, sync::Arc, time::SystemTime};
-
-use axum::{extract::State, http::StatusCode, response::IntoResponse, routing::get, Json, Router};
-use serde::Serialize;
-use tokio::sync::{broadcast, oneshot};
+use std::{
+    collections::{BTreeMap, HashMap},
+    net::SocketAddr,
+    sync::Arc,
+    time::SystemTime,
+};
+
+use axum::{
+    extract::{Query, State},
+    http::{header, StatusCode},
+    response::IntoResponse,
+    routing::get,
+    Json, Router,
+};
+use serde::{Deserialize, Serialize};
+use tokio::sync::broadcast;
 use tracing::info;
 
-use crate::{connection::StatEvent, ConnectionManager};
+use crate::{
+    adaptive_timeout::{AdaptiveTimeouts, ResponseTimeoutSnapshot},
+    cache::{CacheStats, CacheStatsSnapshot},
+    capture::{write_pcap, CapturedFrame, FrameCapture},
+    circuit_breaker::{BreakerSnapshot, CircuitBreaker},
+    latency::{LatencyReport, LatencyStats},
+    metrics::{Metrics, PrometheusText},
+    poller::{PollBlockSnapshot, ShadowImage},
+    rates::RateReport,
+    scheduler::{BusStats, BusStatsSnapshot},
+    socket_activation::InheritedListeners,
+    ConnectionManager,
+};
 
 #[derive(Debug, Serialize)]
 struct HealthResponse {
@@ -22,6 +45,7 @@ struct IpStatsResponse {
     avg_response_time_ms: u64,
     last_active: SystemTime,
     last_error: Option<SystemTime>,
+    rates: RateReport,
 }
 
 #[derive(Debug, Serialize)]
@@ -34,137 +58,483 @@ struct StatsResponse {
     requests_per_second: f64,
     avg_response_time_ms: u64,
 
+    // Requests and errors per second over the last 1, 5 and 15 minutes
+    rates: RateReport,
+
     // Stats per IP
     per_ip_stats: HashMap<SocketAddr, IpStatsResponse>,
+
+    // RTU bus queue of the default bus
+    bus: BusStatsSnapshot,
+
+    // Every RTU bus by name, the default one included
+    buses: BTreeMap<String, BusStatsSnapshot>,
+
+    // Circuit breaker of every bus by name
+    breakers: BTreeMap<String, BreakerSnapshot>,
+
+    // Learned response timeouts of every bus by name, if enabled
+    response_timeouts: BTreeMap<String, Vec<ResponseTimeoutSnapshot>>,
+
+    // Shadow image blocks of every polling bus by name, with their age
+    poller: BTreeMap<String, Vec<PollBlockSnapshot>>,
+
+    // Read response cache
+    cache: CacheStatsSnapshot,
+
+    // Queue, bus and total time percentiles
+    latency: LatencyReport,
 }
 
-type ApiState = Arc<ConnectionManager>;
+#[derive(Debug, Default, Deserialize, PartialEq, Eq)]
+#[serde(rename_all = "lowercase")]
+enum FramesFormat {
+    #[default]
+    Json,
+    Pcap,
+}
 
-async fn health_handler(State(state): State<ApiState>) -> impl IntoResponse {
-    let (tx, rx) = oneshot::channel();
-
-    if (state
-        .stats_tx()
-        .send(StatEvent::QueryConnectionStats { response_tx: tx })
-        .await)
-        .is_err()
-    {
-        return (
-            StatusCode::INTERNAL_SERVER_ERROR,
-            Json(HealthResponse {
-                status: "error",
-                tcp_connections: 0,
-                rtu_status: "unknown",
-            }),
-        );
-    }
+#[derive(Debug, Deserialize)]
+struct FramesQuery {
+    #[serde(default)]
+    format: FramesFormat,
+    limit: Option<usize>,
+}
 
-    match rx.await {
-        Ok(stats) => {
-            (
-                StatusCode::OK,
-                Json(HealthResponse {
-                    status: "ok",
-                    tcp_connections: stats.active_connections as u32,
-                    rtu_status: "ok", // TODO(aljen): Implement RTU status check
-                }),
-            )
+#[derive(Debug, Serialize)]
+struct FramesResponse {
+    capacity: usize,
+    recorded: u64,
+    skipped: u64,
+    frames: Vec<CapturedFrame>,
+}
+
+/// What the API reports about one bus
+pub struct ApiBus {
+    pub name: String,
+    pub stats: Arc<BusStats>,
+    pub breaker: Arc<CircuitBreaker>,
+    pub timeouts: Arc<AdaptiveTimeouts>,
+    pub image: Arc<ShadowImage>,
+}
+
+/// Shared state of the HTTP API handlers
+#[derive(Clone)]
+pub struct ApiState {
+    manager: Arc<ConnectionManager>,
+    buses: Arc<[ApiBus]>,
+    cache_stats: Arc<CacheStats>,
+    latency: Arc<LatencyStats>,
+    metrics: Arc<Metrics>,
+    capture: Option<Arc<FrameCapture>>,
+}
+
+impl ApiState {
+    /// `buses` holds every bus, the default bus first
+    ///
+    /// # Panics
+    ///
+    /// Panics if `buses` is empty.
+    pub fn new(
+        manager: Arc<ConnectionManager>,
+        buses: Vec<ApiBus>,
+        cache_stats: Arc<CacheStats>,
+        latency: Arc<LatencyStats>,
+        metrics: Arc<Metrics>,
+    ) -> Self {
+        assert!(!buses.is_empty(), "the default bus is required");
+
+        Self {
+            manager,
+            buses: buses.into(),
+            cache_stats,
+            latency,
+            metrics,
+            capture: None,
         }
-        Err(_) => (
-            StatusCode::INTERNAL_SERVER_ERROR,
-            Json(HealthResponse {
-                status: "error",
-                tcp_connections: 0,
-                rtu_status: "unknown",
-            }),
-        ),
     }
+
+    /// Serves the frames of `capture` on `/debug/frames`
+    pub fn with_capture(mut self, capture: Option<Arc<FrameCapture>>) -> Self {
+        self.capture = capture;
+        self
+    }
+}
+
+async fn health_handler(State(state): State<ApiState>) -> impl IntoResponse {
+    let stats = state.manager.get_stats();
+
+    (
+        StatusCode::OK,
+        Json(HealthResponse {
+            status: "ok",
+            tcp_connections: stats.active_connections as u32,
+            rtu_status: "ok", // TODO(aljen): Implement RTU status check
+        }),
+    )
 }
 
 async fn stats_handler(State(state): State<ApiState>) -> impl IntoResponse {
-    let (tx, rx) = oneshot::channel();
-
-    if (state
-        .stats_tx()
-        .send(StatEvent::QueryConnectionStats { response_tx: tx })
-        .await)
-        .is_err()
-    {
-        return (
-            StatusCode::INTERNAL_SERVER_ERROR,
-            Json(StatsResponse {
-                total_connections: 0,
-                active_connections: 0,
-                total_requests: 0,
-                total_errors: 0,
-                requests_per_second: 0.0,
-                avg_response_time_ms: 0,
-                per_ip_stats: HashMap::new(),
-            }),
+    let stats = state.manager.get_stats();
+
+    let per_ip_stats = stats
+        .per_ip_stats
+        .into_iter()
+        .map(|(addr, ip_stats)| {
+            (
+                addr,
+                IpStatsResponse {
+                    active_connections: ip_stats.active_connections,
+                    total_requests: ip_stats.total_requests,
+                    total_errors: ip_stats.total_errors,
+                    avg_response_time_ms: ip_stats.avg_response_time_ms,
+                    last_active: ip_stats.last_active,
+                    last_error: ip_stats.last_error,
+                    rates: ip_stats.rates,
+                },
+            )
+        })
+        .collect();
+
+    (
+        StatusCode::OK,
+        Json(StatsResponse {
+            total_connections: stats.total_connections,
+            active_connections: stats.active_connections as u32,
+            total_requests: stats.total_requests,
+            total_errors: stats.total_errors,
+            requests_per_second: stats.requests_per_second,
+            avg_response_time_ms: stats.avg_response_time_ms,
+            rates: stats.rates,
+            per_ip_stats,
+            bus: state.buses[0].stats.snapshot(),
+            buses: state
+                .buses
+                .iter()
+                .map(|bus| (bus.name.clone(), bus.stats.snapshot()))
+                .collect(),
+            breakers: state
+                .buses
+                .iter()
+                .map(|bus| (bus.name.clone(), bus.breaker.snapshot()))
+                .collect(),
+            response_timeouts: state
+                .buses
+                .iter()
+                .filter(|bus| bus.timeouts.enabled())
+                .map(|bus| (bus.name.clone(), bus.timeouts.snapshot()))
+                .collect(),
+            poller: state
+                .buses
+                .iter()
+                .filter(|bus| !bus.image.is_empty())
+                .map(|bus| (bus.name.clone(), bus.image.snapshot()))
+                .collect(),
+            cache: state.cache_stats.snapshot(),
+            latency: state.latency.report(),
+        }),
+    )
+}
+
+/// Name, help, type and value of a per-bus metric
+type BusMetric = (
+    &'static str,
+    &'static str,
+    &'static str,
+    fn(&BusStatsSnapshot) -> f64,
+);
+
+/// Prometheus scrape target.
+///
+/// Only reads counters that are kept up to date on the request path anyway,
+/// nothing is aggregated per client and no lock the request path takes is
+/// held while rendering.
+async fn metrics_handler(State(state): State<ApiState>) -> impl IntoResponse {
+    let mut out = PrometheusText::new();
+
+    state.metrics.render(&mut out);
+
+    out.header(
+        "modbus_relay_connections_active",
+        "Open Modbus TCP connections",
+        "gauge",
+    );
+    out.sample(
+        "modbus_relay_connections_active",
+        &[],
+        state.manager.active_connections(),
+    );
+    out.header(
+        "modbus_relay_connections_total",
+        "Modbus TCP connections accepted",
+        "counter",
+    );
+    out.sample(
+        "modbus_relay_connections_total",
+        &[],
+        state.manager.stats().total_connections(),
+    );
+
+    out.header(
+        "modbus_relay_rate_limited_requests_total",
+        "Requests rejected for going over the client's rate limit",
+        "counter",
+    );
+    out.sample(
+        "modbus_relay_rate_limited_requests_total",
+        &[],
+        state.manager.rate_limiter().limited(),
+    );
+
+    // Live rates for alerting without a PromQL rate() over the counters
+    let windows = |rates: &RateReport| {
+        [
+            ("1m", rates.one_minute),
+            ("5m", rates.five_minutes),
+            ("15m", rates.fifteen_minutes),
+        ]
+    };
+    let rates = state.manager.stats().rates();
+    out.header(
+        "modbus_relay_requests_per_second",
+        "Modbus TCP requests per second over the window",
+        "gauge",
+    );
+    for (window, rates) in windows(&rates) {
+        out.sample(
+            "modbus_relay_requests_per_second",
+            &[("window", window)],
+            rates.requests_per_second,
+        );
+    }
+    out.header(
+        "modbus_relay_errors_per_second",
+        "Failed Modbus TCP requests per second over the window",
+        "gauge",
+    );
+    for (window, rates) in windows(&rates) {
+        out.sample(
+            "modbus_relay_errors_per_second",
+            &[("window", window)],
+            rates.errors_per_second,
         );
     }
 
-    match rx.await {
-        Ok(stats) => {
-            let per_ip_stats = stats
-                .per_ip_stats
-                .into_iter()
-                .map(|(addr, ip_stats)| {
-                    (
-                        addr,
-                        IpStatsResponse {
-                            active_connections: ip_stats.active_connections,
-                            total_requests: ip_stats.total_requests,
-                            total_errors: ip_stats.total_errors,
-                            avg_response_time_ms: ip_stats.avg_response_time_ms,
-                            last_active: ip_stats.last_active,
-                            last_error: ip_stats.last_error,
-                        },
-                    )
-                })
-                .collect();
+    let buses: Vec<_> = state
+        .buses
+        .iter()
+        .map(|bus| (bus.name.as_str(), bus.stats.snapshot()))
+        .collect();
+    let bus_metrics: [BusMetric; 7] = [
+        (
+            "modbus_relay_bus_queue_length",
+            "Requests waiting for the RTU bus",
+            "gauge",
+            |bus| bus.queue_length as f64,
+        ),
+        (
+            "modbus_relay_bus_queue_capacity",
+            "Size of the RTU bus queue",
+            "gauge",
+            |bus| bus.queue_capacity as f64,
+        ),
+        (
+            "modbus_relay_bus_transactions_total",
+            "RTU transactions sent, merged reads count once",
+            "counter",
+            |bus| bus.transactions as f64,
+        ),
+        (
+            "modbus_relay_bus_merged_requests_total",
+            "Requests served by a merged read",
+            "counter",
+            |bus| bus.merged_requests as f64,
+        ),
+        (
+            "modbus_relay_bus_busy_seconds_total",
+            "Time the RTU bus spent on transactions, its rate is the bus utilization",
+            "counter",
+            |bus| bus.bus_busy_us as f64 / 1_000_000.0,
+        ),
+        (
+            "modbus_relay_bus_shed_requests_total",
+            "Requests rejected because the bus could not answer them in time",
+            "counter",
+            |bus| bus.shed_requests as f64,
+        ),
+        (
+            "modbus_relay_bus_expired_requests_total",
+            "Queued requests dropped after their deadline passed",
+            "counter",
+            |bus| bus.expired_requests as f64,
+        ),
+    ];
+    for (name, help, kind, value) in bus_metrics {
+        out.header(name, help, kind);
+        for (bus_name, bus) in &buses {
+            out.sample(name, &[("bus", bus_name)], value(bus));
+        }
+    }
 
-            (
-                StatusCode::OK,
-                Json(StatsResponse {
-                    total_connections: stats.total_connections,
-                    active_connections: stats.active_connections as u32,
-                    total_requests: stats.total_requests,
-                    total_errors: stats.total_errors,
-                    requests_per_second: stats.requests_per_second,
-                    avg_response_time_ms: stats.avg_response_time_ms,
-                    per_ip_stats,
-                }),
-            )
+    out.header(
+        "modbus_relay_bus_busy_ratio",
+        "Share of the window the RTU bus spent on transactions",
+        "gauge",
+    );
+    for (bus_name, bus) in &buses {
+        for (window, rates) in windows(&bus.rates) {
+            out.sample(
+                "modbus_relay_bus_busy_ratio",
+                &[("bus", bus_name), ("window", window)],
+                rates.busy_ratio,
+            );
         }
-        Err(_) => (
-            StatusCode::INTERNAL_SERVER_ERROR,
-            Json(StatsResponse {
-                total_connections: 0,
-                active_connections: 0,
-                total_requests: 0,
-                total_errors: 0,
-                requests_per_second: 0.0,
-                avg_response_time_ms: 0,
-                per_ip_stats: HashMap::new(),
-            }),
-        ),
+    }
+
+    out.header(
+        "modbus_relay_breaker_open_units",
+        "Units whose circuit breaker is open",
+        "gauge",
+    );
+    for bus in state.buses.iter() {
+        out.sample(
+            "modbus_relay_breaker_open_units",
+            &[("bus", &bus.name)],
+            bus.breaker.open_units(),
+        );
+    }
+    out.header(
+        "modbus_relay_breaker_rejected_total",
+        "Requests failed by an open circuit breaker without using the bus",
+        "counter",
+    );
+    for bus in state.buses.iter() {
+        out.sample(
+            "modbus_relay_breaker_rejected_total",
+            &[("bus", &bus.name)],
+            bus.breaker.rejected(),
+        );
+    }
+
+    let cache = state.cache_stats.snapshot();
+    out.header(
+        "modbus_relay_cache_hits_total",
+        "Reads served from the response cache",
+        "counter",
+    );
+    out.sample("modbus_relay_cache_hits_total", &[], cache.hits);
+    out.header(
+        "modbus_relay_cache_misses_total",
+        "Cacheable reads that went to the bus",
+        "counter",
+    );
+    out.sample("modbus_relay_cache_misses_total", &[], cache.misses);
+    out.header(
+        "modbus_relay_cache_invalidations_total",
+        "Cached reads dropped by writes",
+        "counter",
+    );
+    out.sample(
+        "modbus_relay_cache_invalidations_total",
+        &[],
+        cache.invalidations,
+    );
+    out.header(
+        "modbus_relay_cache_entries",
+        "Responses held in the cache",
+        "gauge",
+    );
+    out.sample("modbus_relay_cache_entries", &[], cache.entries);
+
+    let all = state.latency.all();
+    out.header(
+        "modbus_relay_request_duration_seconds",
+        "Time requests spent queued, on the bus and in total",
+        "histogram",
+    );
+    for (stage, histogram) in [
+        ("queue", &all.queue),
+        ("bus", &all.bus),
+        ("total", &all.total),
+    ] {
+        out.histogram(
+            "modbus_relay_request_duration_seconds",
+            &[("stage", stage)],
+            histogram,
+        );
+    }
+
+    out.header(
+        "modbus_relay_unit_bus_duration_seconds",
+        "Time requests spent on the bus, per unit ID",
+        "histogram",
+    );
+    for (unit_id, latency) in state.latency.units() {
+        out.histogram(
+            "modbus_relay_unit_bus_duration_seconds",
+            &[("unit", &unit_id.to_string())],
+            &latency.bus,
+        );
+    }
+
+    (
+        [(header::CONTENT_TYPE, PrometheusText::CONTENT_TYPE)],
+        out.finish(),
+    )
+}
+
+/// Most recent frames of the capture ring, oldest first.
+///
+/// `?format=pcap` downloads them as a capture file for Wireshark,
+/// `?limit=N` keeps the last N only.
+async fn frames_handler(
+    State(state): State<ApiState>,
+    Query(query): Query<FramesQuery>,
+) -> axum::response::Response {
+    let Some(capture) = state.capture else {
+        return (StatusCode::NOT_FOUND, "Frame capture is disabled").into_response();
+    };
+
+    let frames = capture.snapshot(query.limit.unwrap_or(usize::MAX));
+
+    match query.format {
+        FramesFormat::Json => Json(FramesResponse {
+            capacity: capture.capacity(),
+            recorded: capture.recorded(),
+            skipped: capture.skipped(),
+            frames,
+        })
+        .into_response(),
+        FramesFormat::Pcap => (
+            [
+                (header::CONTENT_TYPE, "application/vnd.tcpdump.pcap"),
+                (
+                    header::CONTENT_DISPOSITION,
+                    "attachment; filename=\"modbus-relay.pcap\"",
+                ),
+            ],
+            write_pcap(&frames),
+        )
+            .into_response(),
     }
 }
 
 pub async fn start_http_server(
     address: String,
     port: u16,
-    manager: Arc<ConnectionManager>,
+    state: ApiState,
+    listeners: Arc<InheritedListeners>,
     mut shutdown_rx: broadcast::Receiver<()>,
 ) -> Result<(), Box<dyn std::error::Error + Send + Sync>> {
     let app = Router::new()
         .route("/health", get(health_handler))
         .route("/stats", get(stats_handler))
-        .with_state(manager);
+        .route("/metrics", get(metrics_handler))
+        .route("/debug/frames", get(frames_handler))
+        .with_state(state);
 
     let addr = format!("{}:{}", address, port);
-    let listener = tokio::net::TcpListener::bind(&addr).await?;
+    let listener = listeners.bind(&addr).await?;
 
     info!("HTTP server listening on {}", addr);
 
@@ -182,37 +552,55 @@ pub async fn start_http_server(
 
 #[cfg(test)]
 mod tests {
+    use std::time::Duration;
+
     use crate::{ConnectionConfig, StatsManager};
 
     use super::*;
     use axum::body::Body;
     use axum::http::Request;
-    use tokio::sync::Mutex;
     use tower::ServiceExt;
 
-    #[tokio::test]
-    async fn test_health_endpoint() {
-        // Create a test stats manager
-        let config = ConnectionConfig::default();
-        let stats_config = crate::StatsConfig::default();
-        let (stats_manager, stats_tx) = StatsManager::new(stats_config);
-        let stats_manager = Arc::new(Mutex::new(stats_manager));
-
-        let (shutdown_tx, shutdown_rx) = tokio::sync::watch::channel(false);
+    fn test_manager() -> Arc<ConnectionManager> {
+        let stats_manager = Arc::new(StatsManager::new(crate::StatsConfig::default()));
+        Arc::new(ConnectionManager::new(
+            ConnectionConfig::default(),
+            stats_manager,
+        ))
+    }
 
-        let stats_handle = tokio::spawn({
-            async move {
-                let mut stats_manager = stats_manager.lock().await;
-                stats_manager.run(shutdown_rx).await;
-            }
-        });
+    fn test_bus(name: &str, queue_size: usize) -> ApiBus {
+        ApiBus {
+            name: name.to_string(),
+            stats: Arc::new(BusStats::new(queue_size)),
+            breaker: Arc::new(CircuitBreaker::new(&Default::default())),
+            timeouts: Arc::new(AdaptiveTimeouts::new(
+                &Default::default(),
+                std::time::Duration::from_secs(1),
+            )),
+            image: Arc::new(ShadowImage::new(&[], Default::default())),
+        }
+    }
 
-        let manager = Arc::new(ConnectionManager::new(config, stats_tx));
+    fn test_state(manager: Arc<ConnectionManager>) -> ApiState {
+        let latency = Arc::new(LatencyStats::new());
+        latency.record_bus("127.0.0.1".parse().unwrap(), 1, 0x03, 150, 4_000);
+
+        ApiState::new(
+            manager,
+            vec![test_bus("default", 16), test_bus("line2", 8)],
+            Arc::new(CacheStats::default()),
+            latency,
+            Arc::new(Metrics::new()),
+        )
+    }
 
+    #[tokio::test]
+    async fn test_health_endpoint() {
         // Build test app
         let app = Router::new()
             .route("/health", get(health_handler))
-            .with_state(manager);
+            .with_state(test_state(test_manager()));
 
         // Create test request
         let req = Request::builder()
@@ -224,43 +612,144 @@ mod tests {
         let response = app.oneshot(req).await.unwrap();
 
         assert_eq!(response.status(), StatusCode::OK);
-
-        shutdown_tx.send(true).unwrap();
-        stats_handle.await.unwrap();
     }
 
     #[tokio::test]
     async fn test_stats_endpoint() {
-        let config = ConnectionConfig::default();
-        let stats_config = crate::StatsConfig::default();
-        let (stats_manager, stats_tx) = StatsManager::new(stats_config);
-        let stats_manager = Arc::new(Mutex::new(stats_manager));
+        let manager = test_manager();
+        let guard = manager
+            .accept_connection("127.0.0.1:5020".parse().unwrap())
+            .await
+            .unwrap();
+        guard.record_request(true, Duration::from_millis(4));
+
+        let app = Router::new()
+            .route("/stats", get(stats_handler))
+            .with_state(test_state(Arc::clone(&manager)));
+
+        let req = Request::builder()
+            .uri("/stats")
+            .body(Body::empty())
+            .unwrap();
 
-        let (shutdown_tx, shutdown_rx) = tokio::sync::watch::channel(false);
+        let response = app.oneshot(req).await.unwrap();
 
-        let stats_handle = tokio::spawn({
-            async move {
-                let mut stats_manager = stats_manager.lock().await;
-                stats_manager.run(shutdown_rx).await;
-            }
-        });
+        assert_eq!(response.status(), StatusCode::OK);
 
-        let manager = Arc::new(ConnectionManager::new(config, stats_tx));
+        let body = axum::body::to_bytes(response.into_body(), usize::MAX)
+            .await
+            .unwrap();
+        let stats: serde_json::Value = serde_json::from_slice(&body).unwrap();
+        assert_eq!(stats["total_connections"], 1);
+        assert_eq!(stats["active_connections"], 1);
+        assert_eq!(stats["total_requests"], 1);
+        assert_eq!(stats["bus"]["queue_length"], 0);
+        assert_eq!(stats["bus"]["queue_capacity"], 16);
+        assert_eq!(stats["buses"]["line2"]["queue_capacity"], 8);
+        assert_eq!(stats["breakers"]["default"]["rejected"], 0);
+        assert_eq!(stats["cache"]["hits"], 0);
+        assert_eq!(stats["rates"]["5m"]["requests_per_second"], 0.0);
+        assert_eq!(stats["bus"]["rates"]["1m"]["busy_ratio"], 0.0);
+        assert_eq!(stats["latency"]["per_unit"]["1"]["bus"]["count"], 1);
+        assert!(
+            stats["latency"]["per_client"]["127.0.0.1"]["queue"]["p99_us"].as_u64() >= Some(150)
+        );
+    }
 
+    #[tokio::test]
+    async fn test_metrics_endpoint() {
         let app = Router::new()
-            .route("/stats", get(stats_handler))
-            .with_state(manager);
+            .route("/metrics", get(metrics_handler))
+            .with_state(test_state(test_manager()));
 
         let req = Request::builder()
-            .uri("/stats")
+            .uri("/metrics")
             .body(Body::empty())
             .unwrap();
 
         let response = app.oneshot(req).await.unwrap();
 
         assert_eq!(response.status(), StatusCode::OK);
+        assert_eq!(
+            response.headers()[header::CONTENT_TYPE],
+            PrometheusText::CONTENT_TYPE
+        );
+
+        let body = axum::body::to_bytes(response.into_body(), usize::MAX)
+            .await
+            .unwrap();
+        let text = String::from_utf8(body.to_vec()).unwrap();
+        assert!(text.contains("# TYPE modbus_relay_requests_total counter\n"));
+        assert!(text.contains("modbus_relay_bus_queue_capacity{bus=\"default\"} 16\n"));
+        assert!(text.contains("modbus_relay_bus_queue_capacity{bus=\"line2\"} 8\n"));
+        assert!(text.contains("modbus_relay_cache_hits_total 0\n"));
+        assert!(text.contains("modbus_relay_requests_per_second{window=\"15m\"} 0\n"));
+        assert!(text.contains("modbus_relay_bus_busy_ratio{bus=\"line2\",window=\"1m\"} 0\n"));
+        assert!(text.contains("modbus_relay_breaker_open_units{bus=\"line2\"} 0\n"));
+        assert!(text.contains("modbus_relay_request_duration_seconds_count{stage=\"bus\"} 1\n"));
+        assert!(text
+            .contains("modbus_relay_unit_bus_duration_seconds_bucket{unit=\"1\",le=\"+Inf\"} 1\n"));
+    }
+
+    #[tokio::test]
+    async fn test_frames_endpoint() {
+        let capture = Arc::new(FrameCapture::new(8));
+        let client: SocketAddr = "127.0.0.1:5020".parse().unwrap();
+        capture.record_tcp(
+            crate::capture::Direction::TcpRequest,
+            client,
+            &[
+                0x00, 0x07, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x01,
+            ],
+        );
+
+        let app = Router::new()
+            .route("/debug/frames", get(frames_handler))
+            .with_state(test_state(test_manager()).with_capture(Some(capture)));
+
+        let req = Request::builder()
+            .uri("/debug/frames?limit=10")
+            .body(Body::empty())
+            .unwrap();
+        let response = app.clone().oneshot(req).await.unwrap();
+        assert_eq!(response.status(), StatusCode::OK);
+
+        let body = axum::body::to_bytes(response.into_body(), usize::MAX)
+            .await
+            .unwrap();
+        let frames: serde_json::Value = serde_json::from_slice(&body).unwrap();
+        assert_eq!(frames["recorded"], 1);
+        assert_eq!(frames["frames"][0]["transaction_id"], 7);
+        assert_eq!(frames["frames"][0]["data"], "000700000006010300000001");
+
+        let req = Request::builder()
+            .uri("/debug/frames?format=pcap")
+            .body(Body::empty())
+            .unwrap();
+        let response = app.oneshot(req).await.unwrap();
+        assert_eq!(response.status(), StatusCode::OK);
+        assert_eq!(
+            response.headers()[header::CONTENT_TYPE],
+            "application/vnd.tcpdump.pcap"
+        );
+
+        let body = axum::body::to_bytes(response.into_body(), usize::MAX)
+            .await
+            .unwrap();
+        assert_eq!(body[..4], 0xA1B2_C3D4u32.to_le_bytes());
+    }
+
+    #[tokio::test]
+    async fn test_frames_endpoint_disabled() {
+        let app = Router::new()
+            .route("/debug/frames", get(frames_handler))
+            .with_state(test_state(test_manager()));
 
-        shutdown_tx.send(true).unwrap();
-        stats_handle.await.unwrap();
+        let req = Request::builder()
+            .uri("/debug/frames")
+            .body(Body::empty())
+            .unwrap();
+        let response = app.oneshot(req).await.unwrap();
+        assert_eq!(response.status(), StatusCode::NOT_FOUND);
     }
 }
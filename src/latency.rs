@@ -0,0 +1,452 @@
+use std::{
+    collections::{BTreeMap, HashMap},
+    net::IpAddr,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, OnceLock, RwLock,
+    },
+};
+
+use serde::Serialize;
+
+/// Linear sub-buckets per power of two, bounds the relative error to 1/16
+const SUB_BUCKET_BITS: u32 = 4;
+const SUB_BUCKETS: usize = 1 << SUB_BUCKET_BITS;
+
+/// Values are recorded exactly below this, each bucket is one microsecond wide
+const LINEAR_LIMIT: u64 = 2 * SUB_BUCKETS as u64;
+
+/// Largest recordable value (about 19 hours), anything above is clamped
+const MAX_VALUE_US: u64 = (1 << 36) - 1;
+
+const BUCKETS: usize = bucket_index(MAX_VALUE_US) + 1;
+
+/// Clients tracked individually, later ones only count towards the unit
+/// and function code histograms
+const MAX_TRACKED_CLIENTS: usize = 1024;
+
+const fn bucket_index(value: u64) -> usize {
+    if value < LINEAR_LIMIT {
+        return value as usize;
+    }
+
+    // Keep the top SUB_BUCKET_BITS + 1 bits, the leading one is implied
+    let shift = 64 - value.leading_zeros() - (SUB_BUCKET_BITS + 1);
+    let mantissa = (value >> shift) as usize - SUB_BUCKETS;
+
+    LINEAR_LIMIT as usize + (shift as usize - 1) * SUB_BUCKETS + mantissa
+}
+
+/// Smallest value that falls into bucket `index`
+const fn bucket_start(index: usize) -> u64 {
+    if index < LINEAR_LIMIT as usize {
+        return index as u64;
+    }
+
+    let index = index - LINEAR_LIMIT as usize;
+    let shift = index / SUB_BUCKETS + 1;
+    let mantissa = (SUB_BUCKETS + index % SUB_BUCKETS) as u64;
+
+    mantissa << shift
+}
+
+/// Log-linear histogram of microsecond latencies.
+///
+/// Values below 32us are kept exactly, above that every power of two is
+/// split into 16 buckets. Recording is a couple of relaxed atomic adds, so
+/// it can sit on the request path; histograms of the same shape can be
+/// merged, which gives totals without recording everything twice.
+#[derive(Debug)]
+pub struct Histogram {
+    buckets: Box<[AtomicU64]>,
+    count: AtomicU64,
+    sum: AtomicU64,
+    max: AtomicU64,
+}
+
+impl Default for Histogram {
+    fn default() -> Self {
+        Self {
+            buckets: (0..BUCKETS).map(|_| AtomicU64::new(0)).collect(),
+            count: AtomicU64::new(0),
+            sum: AtomicU64::new(0),
+            max: AtomicU64::new(0),
+        }
+    }
+}
+
+impl Histogram {
+    pub fn record(&self, value_us: u64) {
+        let value_us = value_us.min(MAX_VALUE_US);
+
+        self.buckets[bucket_index(value_us)].fetch_add(1, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(value_us, Ordering::Relaxed);
+        self.max.fetch_max(value_us, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> HistogramSnapshot {
+        HistogramSnapshot {
+            buckets: self
+                .buckets
+                .iter()
+                .map(|bucket| bucket.load(Ordering::Relaxed))
+                .collect(),
+            count: self.count.load(Ordering::Relaxed),
+            sum: self.sum.load(Ordering::Relaxed),
+            max: self.max.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Point in time copy of a [`Histogram`]
+#[derive(Debug, Clone)]
+pub struct HistogramSnapshot {
+    buckets: Vec<u64>,
+    count: u64,
+    sum: u64,
+    max: u64,
+}
+
+impl Default for HistogramSnapshot {
+    fn default() -> Self {
+        Self {
+            buckets: vec![0; BUCKETS],
+            count: 0,
+            sum: 0,
+            max: 0,
+        }
+    }
+}
+
+impl HistogramSnapshot {
+    pub fn count(&self) -> u64 {
+        self.count
+    }
+
+    /// Sum of all recorded values, in microseconds
+    pub fn sum(&self) -> u64 {
+        self.sum
+    }
+
+    /// Number of values in buckets that lie entirely at or below `value_us`
+    pub fn count_le(&self, value_us: u64) -> u64 {
+        self.buckets
+            .iter()
+            .enumerate()
+            .take_while(|(index, _)| bucket_start(index + 1) - 1 <= value_us)
+            .map(|(_, bucket)| bucket)
+            .sum()
+    }
+
+    pub fn merge(&mut self, other: &HistogramSnapshot) {
+        for (bucket, other) in self.buckets.iter_mut().zip(&other.buckets) {
+            *bucket += other;
+        }
+        self.count += other.count;
+        self.sum += other.sum;
+        self.max = self.max.max(other.max);
+    }
+
+    /// Value at quantile `q` (0.0..=1.0), reported as the upper end of its
+    /// bucket so it never under-states the latency
+    pub fn quantile(&self, q: f64) -> u64 {
+        if self.count == 0 {
+            return 0;
+        }
+
+        let rank = ((q * self.count as f64).ceil() as u64).clamp(1, self.count);
+        let mut seen = 0;
+
+        for (index, bucket) in self.buckets.iter().enumerate() {
+            seen += bucket;
+            if seen >= rank {
+                return (bucket_start(index + 1) - 1).min(self.max);
+            }
+        }
+
+        self.max
+    }
+
+    pub fn summary(&self) -> LatencySummary {
+        LatencySummary {
+            count: self.count,
+            p50_us: self.quantile(0.50),
+            p90_us: self.quantile(0.90),
+            p99_us: self.quantile(0.99),
+            p999_us: self.quantile(0.999),
+            max_us: self.max,
+        }
+    }
+}
+
+/// Percentiles of a histogram, in microseconds
+#[derive(Debug, Clone, Serialize)]
+pub struct LatencySummary {
+    pub count: u64,
+    pub p50_us: u64,
+    pub p90_us: u64,
+    pub p99_us: u64,
+    pub p999_us: u64,
+    pub max_us: u64,
+}
+
+/// Where a request spent its time
+#[derive(Debug, Default)]
+pub struct RequestLatency {
+    /// Waiting in the bus scheduler queue
+    pub queue: Histogram,
+    /// On the RTU bus, request out to response in
+    pub bus: Histogram,
+    /// From the complete TCP request to the response being written
+    pub total: Histogram,
+}
+
+/// Point in time copy of a [`RequestLatency`]
+#[derive(Debug, Default, Clone)]
+pub struct RequestLatencySnapshot {
+    pub queue: HistogramSnapshot,
+    pub bus: HistogramSnapshot,
+    pub total: HistogramSnapshot,
+}
+
+impl RequestLatency {
+    fn snapshot(&self) -> RequestLatencySnapshot {
+        RequestLatencySnapshot {
+            queue: self.queue.snapshot(),
+            bus: self.bus.snapshot(),
+            total: self.total.snapshot(),
+        }
+    }
+}
+
+impl RequestLatencySnapshot {
+    pub fn merge(&mut self, other: &RequestLatencySnapshot) {
+        self.queue.merge(&other.queue);
+        self.bus.merge(&other.bus);
+        self.total.merge(&other.total);
+    }
+
+    pub fn summary(&self) -> RequestLatencySummary {
+        RequestLatencySummary {
+            queue: self.queue.summary(),
+            bus: self.bus.summary(),
+            total: self.total.summary(),
+        }
+    }
+}
+
+/// Percentiles of queue, bus and total time
+#[derive(Debug, Clone, Serialize)]
+pub struct RequestLatencySummary {
+    pub queue: LatencySummary,
+    pub bus: LatencySummary,
+    pub total: LatencySummary,
+}
+
+/// Latency percentiles as served by the HTTP API
+#[derive(Debug, Clone, Serialize)]
+pub struct LatencyReport {
+    /// Every request, whoever sent it
+    pub all: RequestLatencySummary,
+    pub per_client: HashMap<IpAddr, RequestLatencySummary>,
+    pub per_unit: BTreeMap<u8, RequestLatencySummary>,
+    pub per_function: BTreeMap<u8, RequestLatencySummary>,
+}
+
+/// Latency histograms per client IP, unit ID and function code.
+///
+/// Every sample is recorded into all three, so a slow slave shows up in
+/// its unit ID no matter which clients talk to it.
+#[derive(Debug)]
+pub struct LatencyStats {
+    clients: RwLock<HashMap<IpAddr, Arc<RequestLatency>>>,
+    units: Box<[OnceLock<Box<RequestLatency>>]>,
+    functions: Box<[OnceLock<Box<RequestLatency>>]>,
+}
+
+impl Default for LatencyStats {
+    fn default() -> Self {
+        Self {
+            clients: RwLock::new(HashMap::new()),
+            units: (0..256).map(|_| OnceLock::new()).collect(),
+            functions: (0..256).map(|_| OnceLock::new()).collect(),
+        }
+    }
+}
+
+impl LatencyStats {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Records the time a request spent queued and on the bus
+    pub fn record_bus(
+        &self,
+        client: IpAddr,
+        unit_id: u8,
+        function: u8,
+        queue_us: u64,
+        bus_us: u64,
+    ) {
+        self.each(client, unit_id, function, |latency| {
+            latency.queue.record(queue_us);
+            latency.bus.record(bus_us);
+        });
+    }
+
+    /// Records the end to end time of a request
+    pub fn record_total(&self, client: IpAddr, unit_id: u8, function: u8, total_us: u64) {
+        self.each(client, unit_id, function, |latency| {
+            latency.total.record(total_us)
+        });
+    }
+
+    /// Histograms of every unit ID that has seen traffic
+    pub fn units(&self) -> Vec<(u8, RequestLatencySnapshot)> {
+        Self::snapshots(&self.units)
+    }
+
+    /// Histograms of every request, merged from the per-unit ones
+    pub fn all(&self) -> RequestLatencySnapshot {
+        Self::merged(&self.units())
+    }
+
+    pub fn report(&self) -> LatencyReport {
+        let units = self.units();
+        let summaries = |snapshots: &[(u8, RequestLatencySnapshot)]| {
+            snapshots
+                .iter()
+                .map(|(key, snapshot)| (*key, snapshot.summary()))
+                .collect()
+        };
+
+        let per_client = self
+            .clients
+            .read()
+            .unwrap()
+            .iter()
+            .map(|(ip, latency)| (*ip, latency.snapshot().summary()))
+            .collect();
+
+        LatencyReport {
+            all: Self::merged(&units).summary(),
+            per_client,
+            per_unit: summaries(&units),
+            per_function: summaries(&Self::snapshots(&self.functions)),
+        }
+    }
+
+    fn snapshots(slots: &[OnceLock<Box<RequestLatency>>]) -> Vec<(u8, RequestLatencySnapshot)> {
+        slots
+            .iter()
+            .enumerate()
+            .filter_map(|(key, slot)| Some((key as u8, slot.get()?.snapshot())))
+            .collect()
+    }
+
+    fn merged(snapshots: &[(u8, RequestLatencySnapshot)]) -> RequestLatencySnapshot {
+        let mut all = RequestLatencySnapshot::default();
+        for (_, snapshot) in snapshots {
+            all.merge(snapshot);
+        }
+        all
+    }
+
+    fn each(&self, client: IpAddr, unit_id: u8, function: u8, f: impl Fn(&RequestLatency)) {
+        f(self.units[unit_id as usize].get_or_init(Default::default));
+        // Exception responses are accounted to the function they answer
+        f(self.functions[(function & 0x7F) as usize].get_or_init(Default::default));
+
+        if let Some(latency) = self.client(client) {
+            f(&latency);
+        }
+    }
+
+    fn client(&self, client: IpAddr) -> Option<Arc<RequestLatency>> {
+        if let Some(latency) = self.clients.read().unwrap().get(&client) {
+            return Some(Arc::clone(latency));
+        }
+
+        let mut clients = self.clients.write().unwrap();
+        if clients.len() >= MAX_TRACKED_CLIENTS && !clients.contains_key(&client) {
+            return None;
+        }
+
+        Some(Arc::clone(clients.entry(client).or_default()))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bucket_bounds() {
+        for value in [0, 1, 31, 32, 33, 63, 64, 100, 1_000, 123_456, MAX_VALUE_US] {
+            let index = bucket_index(value);
+            assert!(bucket_start(index) <= value, "value {}", value);
+            assert!(value < bucket_start(index + 1), "value {}", value);
+
+            // Bucket width stays within 1/16 of the value
+            let width = bucket_start(index + 1) - bucket_start(index);
+            assert!(width == 1 || width * 16 <= value, "value {}", value);
+        }
+
+        assert_eq!(bucket_index(MAX_VALUE_US), BUCKETS - 1);
+    }
+
+    #[test]
+    fn test_quantiles() {
+        let histogram = Histogram::default();
+        for value in 1..=1000 {
+            histogram.record(value);
+        }
+
+        let summary = histogram.snapshot().summary();
+        assert_eq!(summary.count, 1000);
+        assert_eq!(summary.max_us, 1000);
+        assert!((500..=532).contains(&summary.p50_us), "{:?}", summary);
+        assert!((990..=1000).contains(&summary.p99_us), "{:?}", summary);
+        assert_eq!(summary.p999_us, 1000);
+
+        assert_eq!(HistogramSnapshot::default().quantile(0.5), 0);
+    }
+
+    #[test]
+    fn test_merge() {
+        let fast = Histogram::default();
+        let slow = Histogram::default();
+        for _ in 0..99 {
+            fast.record(10);
+        }
+        slow.record(50_000);
+
+        let mut merged = fast.snapshot();
+        merged.merge(&slow.snapshot());
+        assert_eq!(merged.count(), 100);
+        assert_eq!(merged.sum(), 99 * 10 + 50_000);
+        assert_eq!(merged.count_le(1_000), 99);
+        assert_eq!(merged.quantile(0.5), 10);
+        assert!(merged.quantile(1.0) >= 50_000);
+    }
+
+    #[test]
+    fn test_report_per_unit() {
+        let stats = LatencyStats::new();
+        let client: IpAddr = "10.0.0.1".parse().unwrap();
+
+        stats.record_bus(client, 1, 0x03, 100, 2_000);
+        stats.record_bus(client, 2, 0x03, 100, 90_000);
+        stats.record_total(client, 2, 0x83, 95_000);
+
+        let report = stats.report();
+        assert_eq!(report.per_unit.len(), 2);
+        assert!(report.per_unit[&2].bus.p50_us >= 90_000);
+        assert!(report.per_unit[&1].bus.p50_us < 3_000);
+        assert_eq!(report.per_function[&0x03].bus.count, 2);
+        assert_eq!(report.per_function[&0x03].total.count, 1);
+        assert_eq!(report.per_client[&client].queue.count, 2);
+        assert_eq!(report.all.bus.count, 2);
+    }
+}
@@ -1,26 +1,69 @@
+pub mod adaptive_timeout;
+pub mod bus_router;
+pub mod cache;
+pub mod capture;
+pub mod circuit_breaker;
 pub mod config;
 pub mod connection;
+pub mod crc;
 pub mod errors;
+pub mod frame_buffer;
 pub mod http_api;
+pub mod latency;
+pub mod mbap;
+pub mod metrics;
+#[cfg(any(test, feature = "mock"))]
+pub mod mock;
 pub mod modbus;
 pub mod modbus_relay;
+pub mod poller;
+pub mod rates;
+#[cfg(target_os = "linux")]
+mod rs485;
 pub mod rtu_transport;
+pub mod runtime;
+pub mod scheduler;
+pub mod single_flight;
+pub mod socket_activation;
 pub mod stats_manager;
+pub mod tcp_upstream;
+pub mod transport;
 mod utils;
 
+pub use adaptive_timeout::AdaptiveTimeouts;
+pub use bus_router::BusRouter;
+pub use cache::{CacheStats, ResponseCache};
+pub use capture::FrameCapture;
+pub use circuit_breaker::{BreakerState, CircuitBreaker};
 pub use config::{
-    ConnectionConfig, HttpConfig, LoggingConfig, RelayConfig, RtuConfig, StatsConfig, TcpConfig,
+    AdaptiveTimeoutConfig, BreakerConfig, BusConfig, CacheConfig, CacheRule, CaptureConfig,
+    ConnectionConfig, HttpConfig, LoadSheddingConfig, LoggingConfig, PollBlock, PollerConfig,
+    PriorityConfig, PriorityRule, RateLimitConfig, RelayConfig, RtuConfig, RuntimeConfig,
+    SchedulerConfig, SerialThreadConfig, StatsConfig, TcpConfig, UnitRange, UpstreamConfig,
 };
-pub use config::{DataBits, Parity, RtsType, StopBits};
+pub use config::{DataBits, Fairness, Parity, Priority, RtsMode, RtsType, RuntimeFlavor, StopBits};
 pub use connection::BackoffStrategy;
-pub use connection::{ClientStats, ConnectionStats, IpStats};
+pub use connection::{ClientCounters, ClientStats, ConnectionStats, IpStats};
 pub use connection::{ConnectionGuard, ConnectionManager};
+pub use crc::calc_crc16;
 pub use errors::{
     BackoffError, ClientErrorKind, ConfigValidationError, ConnectionError, FrameErrorKind,
     IoOperation, ProtocolErrorKind, RelayError, RtsError, SerialErrorKind, TransportError,
 };
-pub use http_api::start_http_server;
+pub use frame_buffer::{BufferPool, FrameBuffer};
+pub use http_api::{start_http_server, ApiBus, ApiState};
+pub use latency::{Histogram, LatencyStats, LatencySummary};
+pub use mbap::MbapFramer;
+pub use metrics::Metrics;
 pub use modbus::{guess_response_size, ModbusProcessor};
 pub use modbus_relay::ModbusRelay;
+pub use poller::ShadowImage;
+pub use rates::{RateReport, RateWindow};
 pub use rtu_transport::RtuTransport;
+pub use scheduler::{BusHandle, BusScheduler, BusStats};
+pub use socket_activation::InheritedListeners;
 pub use stats_manager::StatsManager;
+pub use tcp_upstream::TcpUpstream;
+pub use transport::Transport;
+#[cfg(unix)]
+pub use utils::raise_fd_limit;
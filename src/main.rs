@@ -3,8 +3,9 @@ use std::process;
 use std::sync::Arc;
 
 use clap::Parser;
+use config::ConfigError;
 use time::UtcOffset;
-use tracing::{error, info};
+use tracing::{error, info, warn};
 use tracing_appender::{non_blocking, rolling};
 use tracing_subscriber::{
     fmt::time::OffsetTime, layer::SubscriberExt, util::SubscriberInitExt, EnvFilter, Layer,
@@ -12,7 +13,8 @@ use tracing_subscriber::{
 };
 
 use modbus_relay::{
-    errors::InitializationError, ModbusRelay, RelayConfig, RelayError, TransportError,
+    errors::InitializationError, raise_fd_limit, InheritedListeners, ModbusRelay, RelayConfig,
+    RelayError, TransportError,
 };
 
 #[derive(Parser)]
@@ -115,18 +117,19 @@ pub fn setup_logging(config: &RelayConfig) -> Result<(impl Drop, impl Drop), Rel
     Ok((stdout_guard, file_guard))
 }
 
-#[tokio::main]
-async fn main() {
+/// Loads the configuration from `path`, or the default locations
+fn load_config(path: Option<&PathBuf>) -> Result<RelayConfig, ConfigError> {
+    match path {
+        Some(path) => RelayConfig::from_file(path.clone()),
+        None => RelayConfig::new(),
+    }
+}
+
+fn main() {
     let cli = Cli::parse();
 
     // Load configuration
-    let config = if let Some(config_path) = &cli.common.config {
-        RelayConfig::from_file(config_path.clone())
-    } else {
-        RelayConfig::new()
-    };
-
-    let config = match config {
+    let config = match load_config(cli.common.config.as_ref()) {
         Ok(config) => config,
         Err(e) => {
             eprintln!("Failed to load configuration: {:#}", e);
@@ -134,6 +137,10 @@ async fn main() {
         }
     };
 
+    // Read while the process is still single threaded, logging starts
+    // writer threads
+    let listeners = InheritedListeners::from_env();
+
     // Setup logging based on configuration
     let (_stdout_guard, _file_guard) = match setup_logging(&config) {
         Ok(guards) => guards,
@@ -144,8 +151,33 @@ async fn main() {
     };
 
     info!("Starting Modbus Relay...");
+    if !listeners.is_empty() {
+        info!("{} listening sockets passed by systemd", listeners.len());
+    }
+
+    // Every client holds a socket, the rest covers serial ports, upstream
+    // and HTTP connections and log files
+    let wanted_fds = config.connection.max_connections.saturating_add(64);
+    match raise_fd_limit(wanted_fds) {
+        Ok(limit) if limit < wanted_fds => warn!(
+            "Open file limit is {}, lower than max_connections allows for",
+            limit
+        ),
+        Ok(_) => {}
+        Err(e) => warn!("Failed to raise the open file limit: {}", e),
+    }
 
-    if let Err(e) = run(config).await {
+    // Built from the config, which is why main is not #[tokio::main]
+    let runtime = match modbus_relay::runtime::build(&config.runtime) {
+        Ok(runtime) => runtime,
+        Err(e) => {
+            error!("Fatal error: {:#}", e);
+            process::exit(1);
+        }
+    };
+    info!("Running on the {} runtime", config.runtime.flavor);
+
+    if let Err(e) = runtime.block_on(run(config, cli.common.config, listeners)) {
         error!("Fatal error: {:#}", e);
         if let Some(RelayError::Transport(TransportError::Io { details, .. })) =
             e.downcast_ref::<RelayError>()
@@ -162,8 +194,28 @@ async fn main() {
     }
 }
 
-async fn run(config: RelayConfig) -> Result<(), Box<dyn std::error::Error>> {
-    let relay = Arc::new(ModbusRelay::new(config)?);
+async fn run(
+    config: RelayConfig,
+    config_path: Option<PathBuf>,
+    listeners: InheritedListeners,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let relay = Arc::new(ModbusRelay::new(config)?.with_listeners(listeners));
+
+    // SIGHUP reloads the configuration, a broken one leaves things as they are
+    let reload_task = tokio::spawn({
+        let relay = Arc::clone(&relay);
+        async move {
+            let mut sighup = tokio::signal::unix::signal(tokio::signal::unix::SignalKind::hangup())
+                .expect("Failed to create SIGHUP signal handler");
+            while sighup.recv().await.is_some() {
+                info!("Received SIGHUP, reloading configuration");
+                match load_config(config_path.as_ref()) {
+                    Ok(config) => relay.reload(&config),
+                    Err(e) => error!("Failed to reload configuration: {:#}", e),
+                }
+            }
+        }
+    });
 
     let relay_clone = Arc::clone(&relay);
 
@@ -187,6 +239,7 @@ async fn run(config: RelayConfig) -> Result<(), Box<dyn std::error::Error>> {
     info!("Waiting for shutdown to complete...");
 
     shutdown_task.await?;
+    reload_task.abort();
 
     info!("Modbus Relay stopped");
 
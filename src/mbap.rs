@@ -0,0 +1,272 @@
+use std::sync::Arc;
+
+use tokio::io::{AsyncRead, AsyncReadExt};
+
+use crate::{
+    frame_buffer::{BufferPool, FrameBuffer},
+    FrameErrorKind, ProtocolErrorKind, RelayError,
+};
+
+/// Size of the MBAP header: Transaction ID(2) + Protocol ID(2) + Length(2) + Unit ID(1)
+pub const MBAP_HEADER_SIZE: usize = 7;
+
+/// Largest value accepted in the MBAP length field (Unit ID + PDU)
+pub const MAX_MBAP_LENGTH: usize = 249;
+
+/// Read buffer size, large enough to hold a few pipelined frames at once
+const BUFFER_SIZE: usize = 4 * (6 + MAX_MBAP_LENGTH);
+
+/// Splits a Modbus TCP byte stream into MBAP frames.
+///
+/// TCP gives no guarantee that one `read()` returns exactly one frame, a
+/// client that pipelines requests may deliver several frames in a single
+/// segment, or a frame may be split across segments. The framer buffers
+/// incoming bytes and hands out complete frames one at a time, keeping any
+/// trailing partial frame for the next read.
+///
+/// Frames are handed out in buffers taken from a [`BufferPool`]. The read
+/// buffer is allocated on first use and can be given back with
+/// [`MbapFramer::release`] while the connection is idle.
+pub struct MbapFramer {
+    buffer: Option<Box<[u8; BUFFER_SIZE]>>,
+    start: usize,
+    end: usize,
+    pool: Arc<BufferPool>,
+}
+
+impl Default for MbapFramer {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl MbapFramer {
+    pub fn new() -> Self {
+        Self::with_pool(BufferPool::new(4))
+    }
+
+    pub fn with_pool(pool: Arc<BufferPool>) -> Self {
+        Self {
+            buffer: None,
+            start: 0,
+            end: 0,
+            pool,
+        }
+    }
+
+    /// Number of buffered bytes not yet returned as a frame
+    pub fn pending(&self) -> usize {
+        self.end - self.start
+    }
+
+    /// Frees the read buffer if it holds nothing, the next read allocates
+    /// a new one
+    pub fn release(&mut self) {
+        if self.pending() == 0 {
+            self.buffer = None;
+        }
+    }
+
+    /// Moves the partial frame to the front of the read buffer, returns
+    /// the free space behind it
+    fn compact(&mut self) -> &mut [u8] {
+        let buffer = self
+            .buffer
+            .get_or_insert_with(|| Box::new([0u8; BUFFER_SIZE]));
+        if self.start > 0 {
+            buffer.copy_within(self.start..self.end, 0);
+            self.end -= self.start;
+            self.start = 0;
+        }
+        &mut buffer[self.end..]
+    }
+
+    /// Reads more bytes from the stream into the buffer.
+    ///
+    /// Returns the number of bytes read, `0` means the peer closed the
+    /// connection. Cancel safe, as long as the underlying `read` is.
+    pub async fn read_from<R>(&mut self, reader: &mut R) -> std::io::Result<usize>
+    where
+        R: AsyncRead + Unpin,
+    {
+        let free = self.compact();
+
+        // Only reachable if complete frames were left unconsumed
+        if free.is_empty() {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                "MBAP buffer full, complete frames must be consumed first",
+            ));
+        }
+
+        let n = reader.read(free).await?;
+        self.end += n;
+        Ok(n)
+    }
+
+    /// Extends the buffer with bytes received elsewhere.
+    ///
+    /// Returns how many bytes were taken, which is less than `data.len()`
+    /// when buffered frames have to be consumed first.
+    pub fn extend_from_slice(&mut self, data: &[u8]) -> usize {
+        let free = self.compact();
+        let n = data.len().min(free.len());
+        free[..n].copy_from_slice(&data[..n]);
+        self.end += n;
+        n
+    }
+
+    /// Returns the next complete frame, or `None` if more bytes are needed.
+    ///
+    /// A malformed header is reported as an error. The stream cannot be
+    /// resynchronized after that, so the caller should drop the connection.
+    pub fn next_frame(&mut self) -> Result<Option<FrameBuffer>, RelayError> {
+        let Some(buffer) = &self.buffer else {
+            return Ok(None);
+        };
+        let available = &buffer[self.start..self.end];
+
+        // Transaction ID(2) + Protocol ID(2) + Length(2)
+        if available.len() < 6 {
+            return Ok(None);
+        }
+
+        let protocol_id = u16::from_be_bytes([available[2], available[3]]);
+        if protocol_id != 0 {
+            return Err(RelayError::protocol(
+                ProtocolErrorKind::InvalidProtocolId,
+                format!("Invalid protocol ID: {}", protocol_id),
+            ));
+        }
+
+        let length = u16::from_be_bytes([available[4], available[5]]) as usize;
+        if length > MAX_MBAP_LENGTH {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Frame too long: {} bytes", length),
+                None,
+            ));
+        }
+
+        // Unit ID + Function code at the very least
+        if length < 2 {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooShort,
+                format!("Frame too short: {} bytes", length + 6),
+                Some(available[..available.len().min(length + 6)].to_vec()),
+            ));
+        }
+
+        let frame_len = 6 + length;
+        if available.len() < frame_len {
+            return Ok(None);
+        }
+
+        let mut frame = self.pool.get();
+        frame.extend_from_slice(&available[..frame_len]);
+        self.start += frame_len;
+
+        if self.start == self.end {
+            self.start = 0;
+            self.end = 0;
+        }
+
+        Ok(Some(frame))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const FRAME_A: [u8; 12] = [
+        0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x00, 0x00, 0x02,
+    ];
+    const FRAME_B: [u8; 12] = [
+        0x00, 0x02, 0x00, 0x00, 0x00, 0x06, 0x01, 0x04, 0x00, 0x10, 0x00, 0x01,
+    ];
+
+    #[test]
+    fn test_coalesced_frames() {
+        let mut framer = MbapFramer::new();
+        let mut data = FRAME_A.to_vec();
+        data.extend_from_slice(&FRAME_B);
+        assert_eq!(framer.extend_from_slice(&data), data.len());
+
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_A);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_B);
+        assert!(framer.next_frame().unwrap().is_none());
+        assert_eq!(framer.pending(), 0);
+    }
+
+    #[test]
+    fn test_split_frame() {
+        let mut framer = MbapFramer::new();
+
+        framer.extend_from_slice(&FRAME_A[..4]);
+        assert!(framer.next_frame().unwrap().is_none());
+
+        framer.extend_from_slice(&FRAME_A[4..9]);
+        assert!(framer.next_frame().unwrap().is_none());
+
+        // The rest of A together with the start of B
+        let mut data = FRAME_A[9..].to_vec();
+        data.extend_from_slice(&FRAME_B[..3]);
+        framer.extend_from_slice(&data);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_A);
+        assert!(framer.next_frame().unwrap().is_none());
+        assert_eq!(framer.pending(), 3);
+
+        framer.extend_from_slice(&FRAME_B[3..]);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_B);
+    }
+
+    #[test]
+    fn test_invalid_header() {
+        let mut framer = MbapFramer::new();
+        framer.extend_from_slice(&[0x00, 0x01, 0x00, 0x01, 0x00, 0x06]);
+        assert!(matches!(
+            framer.next_frame(),
+            Err(RelayError::Protocol {
+                kind: ProtocolErrorKind::InvalidProtocolId,
+                ..
+            })
+        ));
+
+        let mut framer = MbapFramer::new();
+        framer.extend_from_slice(&[0x00, 0x01, 0x00, 0x00, 0x01, 0x00]);
+        assert!(framer.next_frame().is_err());
+    }
+
+    #[tokio::test]
+    async fn test_read_from_stream() {
+        let mut data = FRAME_A.to_vec();
+        data.extend_from_slice(&FRAME_B);
+        let mut reader = &data[..];
+
+        let mut framer = MbapFramer::new();
+        assert_eq!(framer.read_from(&mut reader).await.unwrap(), data.len());
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_A);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_B);
+        assert_eq!(framer.read_from(&mut reader).await.unwrap(), 0);
+    }
+
+    #[test]
+    fn test_release_keeps_partial_frame() {
+        let mut framer = MbapFramer::new();
+        assert!(framer.buffer.is_none());
+
+        framer.extend_from_slice(&FRAME_A[..4]);
+        framer.release();
+        assert_eq!(framer.pending(), 4);
+
+        framer.extend_from_slice(&FRAME_A[4..]);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_A);
+        framer.release();
+        assert!(framer.buffer.is_none());
+
+        // Allocated again by the next read
+        framer.extend_from_slice(&FRAME_B);
+        assert_eq!(&framer.next_frame().unwrap().unwrap()[..], FRAME_B);
+    }
+}
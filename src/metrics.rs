@@ -0,0 +1,362 @@
+use std::{
+    fmt::{Display, Write},
+    sync::atomic::{AtomicU64, Ordering},
+};
+
+use crate::{
+    errors::{FrameError, FrameFormatKind, FrameSizeKind},
+    latency::HistogramSnapshot,
+    ClientErrorKind, ConnectionError, ProtocolErrorKind, RelayError, TransportError,
+};
+
+/// `(type, kind)` label pairs of `modbus_relay_errors_total`, one counter each
+const ERROR_LABELS: [(&str, &str); 39] = [
+    ("transport", "serial"),
+    ("transport", "network"),
+    ("transport", "io"),
+    ("transport", "timeout"),
+    ("transport", "no_response"),
+    ("transport", "rts"),
+    ("frame", "too_short"),
+    ("frame", "too_long"),
+    ("frame", "buffer_overflow"),
+    ("frame", "invalid_header"),
+    ("frame", "invalid_format"),
+    ("frame", "unexpected_response"),
+    ("frame", "invalid_crc"),
+    ("protocol", "invalid_function"),
+    ("protocol", "invalid_data_address"),
+    ("protocol", "invalid_data_value"),
+    ("protocol", "server_failure"),
+    ("protocol", "acknowledge"),
+    ("protocol", "server_busy"),
+    ("protocol", "gateway_path_unavailable"),
+    ("protocol", "gateway_target_failed"),
+    ("protocol", "invalid_protocol_id"),
+    ("protocol", "invalid_transaction_id"),
+    ("protocol", "invalid_unit_id"),
+    ("protocol", "invalid_pdu"),
+    ("connection", "limit_exceeded"),
+    ("connection", "timeout"),
+    ("connection", "invalid_state"),
+    ("connection", "rejected"),
+    ("connection", "disconnected"),
+    ("connection", "backoff"),
+    ("client", "connection_lost"),
+    ("client", "timeout"),
+    ("client", "invalid_request"),
+    ("client", "too_many_requests"),
+    ("client", "too_many_connections"),
+    ("client", "write_error"),
+    ("config", "config"),
+    ("init", "init"),
+];
+
+/// Upper bounds of the exported latency histogram buckets, in microseconds
+const LATENCY_BUCKETS_US: [u64; 15] = [
+    100, 250, 500, 1_000, 2_500, 5_000, 10_000, 25_000, 50_000, 100_000, 250_000, 500_000,
+    1_000_000, 2_500_000, 5_000_000,
+];
+
+fn error_labels(error: &RelayError) -> (&'static str, &'static str) {
+    match error {
+        RelayError::Transport(e) => (
+            "transport",
+            match e {
+                TransportError::Serial { .. } => "serial",
+                TransportError::Network(_) => "network",
+                TransportError::Io { .. } => "io",
+                TransportError::Timeout { .. } => "timeout",
+                TransportError::NoResponse { .. } => "no_response",
+                TransportError::Rts(_) => "rts",
+            },
+        ),
+        RelayError::Frame(e) => (
+            "frame",
+            match e {
+                FrameError::Size { kind, .. } => match kind {
+                    FrameSizeKind::TooShort => "too_short",
+                    FrameSizeKind::TooLong => "too_long",
+                    FrameSizeKind::BufferOverflow => "buffer_overflow",
+                },
+                FrameError::Format { kind, .. } => match kind {
+                    FrameFormatKind::InvalidHeader => "invalid_header",
+                    FrameFormatKind::InvalidFormat => "invalid_format",
+                    FrameFormatKind::UnexpectedResponse => "unexpected_response",
+                },
+                FrameError::Crc { .. } => "invalid_crc",
+            },
+        ),
+        RelayError::Protocol { kind, .. } => (
+            "protocol",
+            match kind {
+                ProtocolErrorKind::InvalidFunction => "invalid_function",
+                ProtocolErrorKind::InvalidDataAddress => "invalid_data_address",
+                ProtocolErrorKind::InvalidDataValue => "invalid_data_value",
+                ProtocolErrorKind::ServerFailure => "server_failure",
+                ProtocolErrorKind::Acknowledge => "acknowledge",
+                ProtocolErrorKind::ServerBusy => "server_busy",
+                ProtocolErrorKind::GatewayPathUnavailable => "gateway_path_unavailable",
+                ProtocolErrorKind::GatewayTargetFailedToRespond => "gateway_target_failed",
+                ProtocolErrorKind::InvalidProtocolId => "invalid_protocol_id",
+                ProtocolErrorKind::InvalidTransactionId => "invalid_transaction_id",
+                ProtocolErrorKind::InvalidUnitId => "invalid_unit_id",
+                ProtocolErrorKind::InvalidPdu => "invalid_pdu",
+            },
+        ),
+        RelayError::Connection(e) => (
+            "connection",
+            match e {
+                ConnectionError::LimitExceeded(_) => "limit_exceeded",
+                ConnectionError::Timeout(_) => "timeout",
+                ConnectionError::InvalidState(_) => "invalid_state",
+                ConnectionError::Rejected(_) => "rejected",
+                ConnectionError::Disconnected => "disconnected",
+                ConnectionError::Backoff(_) => "backoff",
+            },
+        ),
+        RelayError::Client { kind, .. } => (
+            "client",
+            match kind {
+                ClientErrorKind::ConnectionLost => "connection_lost",
+                ClientErrorKind::Timeout => "timeout",
+                ClientErrorKind::InvalidRequest => "invalid_request",
+                ClientErrorKind::TooManyRequests => "too_many_requests",
+                ClientErrorKind::TooManyConnections => "too_many_connections",
+                ClientErrorKind::WriteError => "write_error",
+            },
+        ),
+        RelayError::Config(_) => ("config", "config"),
+        RelayError::Init(_) => ("init", "init"),
+    }
+}
+
+/// Request path counters that have no other home.
+///
+/// Everything is registered up front, so recording never allocates or
+/// locks and the exporter only has to read the atomics.
+#[derive(Debug)]
+pub struct Metrics {
+    requests: AtomicU64,
+    exceptions: AtomicU64,
+    errors: [AtomicU64; ERROR_LABELS.len()],
+}
+
+impl Default for Metrics {
+    fn default() -> Self {
+        Self {
+            requests: AtomicU64::new(0),
+            exceptions: AtomicU64::new(0),
+            errors: std::array::from_fn(|_| AtomicU64::new(0)),
+        }
+    }
+}
+
+impl Metrics {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn record_request(&self) {
+        self.requests.fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Counts a Modbus exception response sent to a client
+    pub fn record_exception(&self) {
+        self.exceptions.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn record_error(&self, error: &RelayError) {
+        let labels = error_labels(error);
+
+        if let Some(index) = ERROR_LABELS.iter().position(|known| *known == labels) {
+            self.errors[index].fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Writes the counters in Prometheus text format
+    pub fn render(&self, out: &mut PrometheusText) {
+        out.header(
+            "modbus_relay_requests_total",
+            "Modbus TCP requests received",
+            "counter",
+        );
+        out.sample(
+            "modbus_relay_requests_total",
+            &[],
+            self.requests.load(Ordering::Relaxed),
+        );
+
+        out.header(
+            "modbus_relay_exceptions_total",
+            "Modbus exception responses sent to clients",
+            "counter",
+        );
+        out.sample(
+            "modbus_relay_exceptions_total",
+            &[],
+            self.exceptions.load(Ordering::Relaxed),
+        );
+
+        out.header(
+            "modbus_relay_errors_total",
+            "Errors by type and kind",
+            "counter",
+        );
+        for ((error_type, kind), counter) in ERROR_LABELS.iter().zip(&self.errors) {
+            out.sample(
+                "modbus_relay_errors_total",
+                &[("type", error_type), ("kind", kind)],
+                counter.load(Ordering::Relaxed),
+            );
+        }
+    }
+}
+
+/// Builder for the Prometheus text exposition format (version 0.0.4)
+#[derive(Debug, Default)]
+pub struct PrometheusText {
+    out: String,
+}
+
+impl PrometheusText {
+    pub const CONTENT_TYPE: &'static str = "text/plain; version=0.0.4; charset=utf-8";
+
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// `# HELP` and `# TYPE` lines, once per metric name
+    pub fn header(&mut self, name: &str, help: &str, kind: &str) {
+        let _ = writeln!(self.out, "# HELP {} {}", name, help);
+        let _ = writeln!(self.out, "# TYPE {} {}", name, kind);
+    }
+
+    pub fn sample(&mut self, name: &str, labels: &[(&str, &str)], value: impl Display) {
+        self.out.push_str(name);
+        self.labels(labels, None);
+        let _ = writeln!(self.out, " {}", value);
+    }
+
+    /// Writes a microsecond histogram as a histogram in seconds.
+    ///
+    /// Bucket bounds rarely line up with the log-linear buckets, a sample is
+    /// only counted below a bound once its whole bucket is, so the cumulative
+    /// counts lean towards the slower side.
+    pub fn histogram(
+        &mut self,
+        name: &str,
+        labels: &[(&str, &str)],
+        histogram: &HistogramSnapshot,
+    ) {
+        let bucket = format!("{}_bucket", name);
+
+        for bound in LATENCY_BUCKETS_US {
+            let le = (bound as f64 / 1_000_000.0).to_string();
+            self.out.push_str(&bucket);
+            self.labels(labels, Some(&le));
+            let _ = writeln!(self.out, " {}", histogram.count_le(bound));
+        }
+        self.out.push_str(&bucket);
+        self.labels(labels, Some("+Inf"));
+        let _ = writeln!(self.out, " {}", histogram.count());
+
+        self.sample(
+            &format!("{}_sum", name),
+            labels,
+            histogram.sum() as f64 / 1_000_000.0,
+        );
+        self.sample(&format!("{}_count", name), labels, histogram.count());
+    }
+
+    pub fn finish(self) -> String {
+        self.out
+    }
+
+    fn labels(&mut self, labels: &[(&str, &str)], le: Option<&str>) {
+        if labels.is_empty() && le.is_none() {
+            return;
+        }
+
+        self.out.push('{');
+        let mut first = true;
+        for (key, value) in labels.iter().chain(le.map(|le| ("le", le)).iter()) {
+            if !first {
+                self.out.push(',');
+            }
+            first = false;
+            let _ = write!(self.out, "{}=\"", key);
+            // Bus names come from the config and may contain anything
+            for c in value.chars() {
+                match c {
+                    '\\' => self.out.push_str("\\\\"),
+                    '"' => self.out.push_str("\\\""),
+                    '\n' => self.out.push_str("\\n"),
+                    c => self.out.push(c),
+                }
+            }
+            self.out.push('"');
+        }
+        self.out.push('}');
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::{latency::Histogram, FrameErrorKind};
+
+    use super::*;
+
+    #[test]
+    fn test_error_counters() {
+        let metrics = Metrics::new();
+        metrics.record_request();
+        metrics.record_error(&RelayError::frame(FrameErrorKind::TooLong, "", None));
+        metrics.record_error(&RelayError::Transport(TransportError::NoResponse {
+            attempts: 3,
+            elapsed: std::time::Duration::from_secs(1),
+        }));
+
+        let mut out = PrometheusText::new();
+        metrics.render(&mut out);
+        let text = out.finish();
+
+        assert!(text.contains("modbus_relay_requests_total 1\n"));
+        assert!(text.contains("modbus_relay_errors_total{type=\"frame\",kind=\"too_long\"} 1\n"));
+        assert!(
+            text.contains("modbus_relay_errors_total{type=\"transport\",kind=\"no_response\"} 1\n")
+        );
+        assert!(text.contains("modbus_relay_errors_total{type=\"transport\",kind=\"io\"} 0\n"));
+    }
+
+    #[test]
+    fn test_label_values_escaped() {
+        let mut out = PrometheusText::new();
+        out.sample("modbus_relay_test", &[("bus", "a\"b\\c\nd")], 1);
+        assert_eq!(
+            out.finish(),
+            "modbus_relay_test{bus=\"a\\\"b\\\\c\\nd\"} 1\n"
+        );
+    }
+
+    #[test]
+    fn test_histogram_format() {
+        let histogram = Histogram::default();
+        histogram.record(50);
+        histogram.record(3_000);
+
+        let mut out = PrometheusText::new();
+        out.histogram(
+            "latency_seconds",
+            &[("stage", "bus")],
+            &histogram.snapshot(),
+        );
+        let text = out.finish();
+
+        assert!(text.contains("latency_seconds_bucket{stage=\"bus\",le=\"0.0001\"} 1\n"));
+        assert!(text.contains("latency_seconds_bucket{stage=\"bus\",le=\"0.005\"} 2\n"));
+        assert!(text.contains("latency_seconds_bucket{stage=\"bus\",le=\"+Inf\"} 2\n"));
+        assert!(text.contains("latency_seconds_sum{stage=\"bus\"} 0.00305\n"));
+        assert!(text.contains("latency_seconds_count{stage=\"bus\"} 2\n"));
+    }
+}
@@ -0,0 +1,433 @@
+//! Simulated Modbus RTU slaves for tests and benchmarks.
+//!
+//! [`MockSlave`] answers reads and writes from its own register and coil
+//! memory, optionally taking as long as the exchange would take on a real
+//! line. [`MockTransport`] puts it behind the [`Transport`] trait in memory,
+//! [`PtySlave`] behind a pseudo-terminal for code that opens a serial port.
+
+use std::{
+    ffi::CStr,
+    fs::File,
+    future::Future,
+    io::{self, Read, Write},
+    ops::RangeInclusive,
+    os::unix::io::FromRawFd,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use crate::{crc::calc_crc16, FrameErrorKind, RelayError, Transport, TransportError};
+
+/// Address space of every register and coil table
+const ADDRESSES: usize = 0x1_0000;
+
+/// Modbus RTU slave answering from memory.
+///
+/// Holding and input registers share one table starting out as
+/// `register[i] = i`, coils and discrete inputs share another starting out
+/// cleared. Requests to units it does not serve, broadcasts and frames with
+/// a broken CRC get no answer, like on a real bus.
+pub struct MockSlave {
+    units: RangeInclusive<u8>,
+    latency: Duration,
+    char_time: Duration,
+    registers: Mutex<Vec<u16>>,
+    coils: Mutex<Vec<bool>>,
+    requests: AtomicU64,
+}
+
+impl Default for MockSlave {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl MockSlave {
+    /// A slave answering every unit ID right away
+    pub fn new() -> Self {
+        Self {
+            units: 1..=247,
+            latency: Duration::ZERO,
+            char_time: Duration::ZERO,
+            registers: Mutex::new((0..ADDRESSES).map(|i| i as u16).collect()),
+            coils: Mutex::new(vec![false; ADDRESSES]),
+            requests: AtomicU64::new(0),
+        }
+    }
+
+    /// Only answers requests to `units`
+    pub fn with_units(mut self, units: RangeInclusive<u8>) -> Self {
+        self.units = units;
+        self
+    }
+
+    /// Time the slave takes between the end of a request and its response
+    pub fn with_latency(mut self, latency: Duration) -> Self {
+        self.latency = latency;
+        self
+    }
+
+    /// Takes as long as the frames need on a line at `baud_rate`, 8N1
+    pub fn with_baud_rate(mut self, baud_rate: u32) -> Self {
+        self.char_time = Duration::from_nanos(10 * 1_000_000_000 / baud_rate.max(1) as u64);
+        self
+    }
+
+    /// Requests received so far, answered or not
+    pub fn requests(&self) -> u64 {
+        self.requests.load(Ordering::Relaxed)
+    }
+
+    pub fn register(&self, address: u16) -> u16 {
+        self.registers.lock().unwrap()[address as usize]
+    }
+
+    pub fn coil(&self, address: u16) -> bool {
+        self.coils.lock().unwrap()[address as usize]
+    }
+
+    /// Time a request and its response of these lengths keep the line busy
+    pub fn exchange_time(&self, request_len: usize, response_len: usize) -> Duration {
+        self.char_time * (request_len + response_len) as u32 + self.latency
+    }
+
+    /// RTU response to the RTU `request`, `None` if the slave stays silent
+    pub fn respond(&self, request: &[u8]) -> Option<Vec<u8>> {
+        self.requests.fetch_add(1, Ordering::Relaxed);
+
+        let (frame, crc) = request.split_at_checked(request.len().checked_sub(2)?)?;
+        if frame.len() < 2 || calc_crc16(frame) != u16::from_le_bytes([crc[0], crc[1]]) {
+            return None;
+        }
+
+        let (unit_id, function, data) = (frame[0], frame[1], &frame[2..]);
+        if unit_id != 0 && !self.units.contains(&unit_id) {
+            return None;
+        }
+
+        let response = self.execute(function, data);
+        // Broadcasts are carried out but never answered
+        if unit_id == 0 {
+            return None;
+        }
+
+        let mut response = match response {
+            Ok(pdu) => [&[unit_id, function][..], &pdu].concat(),
+            Err(code) => vec![unit_id, function | 0x80, code],
+        };
+        let crc = calc_crc16(&response);
+        response.extend_from_slice(&crc.to_le_bytes());
+        Some(response)
+    }
+
+    /// Data of the response PDU, or the exception code
+    fn execute(&self, function: u8, data: &[u8]) -> Result<Vec<u8>, u8> {
+        let word = |i: usize| {
+            data.get(i..i + 2)
+                .map(|b| u16::from_be_bytes([b[0], b[1]]))
+                .ok_or(0x03u8)
+        };
+        let range = |start: u16, quantity: u16, max: u16| {
+            let end = start as usize + quantity as usize;
+            match quantity {
+                0 => Err(0x03),
+                _ if quantity > max => Err(0x03),
+                _ if end > ADDRESSES => Err(0x02),
+                _ => Ok(start as usize..end),
+            }
+        };
+
+        match function {
+            0x01 | 0x02 => {
+                let range = range(word(0)?, word(2)?, 2000)?;
+                let coils = self.coils.lock().unwrap();
+                let mut bytes = vec![0u8; range.len().div_ceil(8)];
+                for (i, &coil) in coils[range].iter().enumerate() {
+                    bytes[i / 8] |= (coil as u8) << (i % 8);
+                }
+                Ok([&[bytes.len() as u8][..], &bytes].concat())
+            }
+            0x03 | 0x04 => {
+                let range = range(word(0)?, word(2)?, 125)?;
+                let registers = self.registers.lock().unwrap();
+                let mut pdu = vec![(range.len() * 2) as u8];
+                pdu.extend(registers[range].iter().flat_map(|r| r.to_be_bytes()));
+                Ok(pdu)
+            }
+            0x05 => {
+                let on = match word(2)? {
+                    0xFF00 => true,
+                    0x0000 => false,
+                    _ => return Err(0x03),
+                };
+                self.coils.lock().unwrap()[word(0)? as usize] = on;
+                Ok(data[..4].to_vec())
+            }
+            0x06 => {
+                self.registers.lock().unwrap()[word(0)? as usize] = word(2)?;
+                Ok(data[..4].to_vec())
+            }
+            0x0F => {
+                let range = range(word(0)?, word(2)?, 1968)?;
+                let bits = data.get(5..).ok_or(0x03u8)?;
+                if bits.len() < range.len().div_ceil(8) {
+                    return Err(0x03);
+                }
+                let mut coils = self.coils.lock().unwrap();
+                for (i, address) in range.enumerate() {
+                    coils[address] = bits[i / 8] & (1 << (i % 8)) != 0;
+                }
+                Ok(data[..4].to_vec())
+            }
+            0x10 => {
+                let range = range(word(0)?, word(2)?, 123)?;
+                let values = data.get(5..5 + range.len() * 2).ok_or(0x03u8)?;
+                let mut registers = self.registers.lock().unwrap();
+                for (address, value) in range.zip(values.chunks_exact(2)) {
+                    registers[address] = u16::from_be_bytes([value[0], value[1]]);
+                }
+                Ok(data[..4].to_vec())
+            }
+            _ => Err(0x01),
+        }
+    }
+}
+
+/// Length of the RTU request starting `frame`, as far as it says
+fn request_length(frame: &[u8]) -> Option<usize> {
+    match *frame.get(1)? {
+        0x01..=0x06 => Some(8),
+        0x0F | 0x10 => frame.get(6).map(|&count| 9 + count as usize),
+        // Nothing else is supported, take what arrived
+        _ => Some(frame.len()),
+    }
+}
+
+/// [`MockSlave`] behind the [`Transport`] trait, one transaction at a time
+/// like a serial line
+pub struct MockTransport {
+    slave: Arc<MockSlave>,
+    line: tokio::sync::Mutex<()>,
+    response_timeout: Duration,
+    broadcast_turnaround: Duration,
+}
+
+impl MockTransport {
+    pub fn new(slave: Arc<MockSlave>) -> Self {
+        Self {
+            slave,
+            line: tokio::sync::Mutex::new(()),
+            response_timeout: Duration::from_millis(100),
+            broadcast_turnaround: Duration::ZERO,
+        }
+    }
+
+    /// Time waited for units that don't answer
+    pub fn with_response_timeout(mut self, response_timeout: Duration) -> Self {
+        self.response_timeout = response_timeout;
+        self
+    }
+
+    /// Time the line is held after a broadcast
+    pub fn with_broadcast_turnaround(mut self, turnaround: Duration) -> Self {
+        self.broadcast_turnaround = turnaround;
+        self
+    }
+
+    pub fn slave(&self) -> &MockSlave {
+        &self.slave
+    }
+}
+
+impl Transport for MockTransport {
+    async fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> Result<usize, RelayError> {
+        let _line = self.line.lock().await;
+        let started = Instant::now();
+
+        let Some(reply) = self.slave.respond(request) else {
+            tokio::time::sleep(response_timeout).await;
+            return Err(RelayError::Transport(TransportError::NoResponse {
+                attempts: 1,
+                elapsed: started.elapsed(),
+            }));
+        };
+
+        let busy = self.slave.exchange_time(request.len(), reply.len());
+        if !busy.is_zero() {
+            tokio::time::sleep(busy).await;
+        }
+
+        let Some(buffer) = response.get_mut(..reply.len()) else {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Response of {} bytes does not fit", reply.len()),
+                Some(reply),
+            ));
+        };
+        buffer.copy_from_slice(&reply);
+        Ok(reply.len())
+    }
+
+    fn response_timeout(&self) -> Duration {
+        self.response_timeout
+    }
+
+    fn answers_broadcasts(&self) -> bool {
+        false
+    }
+
+    async fn broadcast(&self, request: &[u8]) -> Result<(), RelayError> {
+        let _line = self.line.lock().await;
+        self.slave.respond(request);
+
+        let busy = self.slave.exchange_time(request.len(), 0) + self.broadcast_turnaround;
+        if !busy.is_zero() {
+            tokio::time::sleep(busy).await;
+        }
+        Ok(())
+    }
+
+    fn close(&self) -> impl Future<Output = Result<(), TransportError>> + Send {
+        std::future::ready(Ok(()))
+    }
+}
+
+/// Opens a pseudo-terminal pair, returning the master side and the slave device path
+pub fn open_pty() -> io::Result<(File, String)> {
+    // SAFETY: the master fd is checked before use and owned by the returned
+    // File, ptsname is read before anything else can call it on this thread
+    unsafe {
+        let master = libc::posix_openpt(libc::O_RDWR | libc::O_NOCTTY);
+        if master < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let master = File::from_raw_fd(master);
+
+        let fd = std::os::unix::io::AsRawFd::as_raw_fd(&master);
+        if libc::grantpt(fd) != 0 || libc::unlockpt(fd) != 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let name = libc::ptsname(fd);
+        if name.is_null() {
+            return Err(io::Error::last_os_error());
+        }
+
+        Ok((master, CStr::from_ptr(name).to_string_lossy().into_owned()))
+    }
+}
+
+/// [`MockSlave`] answering on a pseudo-terminal, point a serial port at
+/// [`PtySlave::device`].
+///
+/// A thread serves the master side until reading from it fails, which
+/// happens once the serial port has been opened and closed again.
+pub struct PtySlave {
+    device: String,
+}
+
+impl PtySlave {
+    pub fn spawn(slave: Arc<MockSlave>) -> io::Result<Self> {
+        let (mut master, device) = open_pty()?;
+
+        std::thread::Builder::new()
+            .name("pty-slave".to_string())
+            .spawn(move || {
+                let mut buffer = Vec::with_capacity(256);
+                let mut chunk = [0u8; 256];
+
+                while let Ok(n) = master.read(&mut chunk) {
+                    if n == 0 {
+                        break;
+                    }
+                    buffer.extend_from_slice(&chunk[..n]);
+
+                    while let Some(length) = request_length(&buffer) {
+                        if buffer.len() < length {
+                            break;
+                        }
+                        let request: Vec<u8> = buffer.drain(..length).collect();
+
+                        if let Some(reply) = slave.respond(&request) {
+                            std::thread::sleep(slave.exchange_time(request.len(), reply.len()));
+                            if master.write_all(&reply).is_err() {
+                                return;
+                            }
+                        }
+                    }
+                }
+            })?;
+
+        Ok(Self { device })
+    }
+
+    /// Path of the serial device the slave answers on
+    pub fn device(&self) -> &str {
+        &self.device
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn frame(adu: &[u8]) -> Vec<u8> {
+        let mut frame = adu.to_vec();
+        frame.extend_from_slice(&calc_crc16(adu).to_le_bytes());
+        frame
+    }
+
+    #[test]
+    fn test_slave_reads_and_writes() {
+        let slave = MockSlave::new().with_units(1..=2);
+
+        let response = slave.respond(&frame(&[0x01, 0x03, 0x00, 0x0A, 0x00, 0x02]));
+        assert_eq!(
+            response,
+            Some(frame(&[0x01, 0x03, 0x04, 0x00, 0x0A, 0x00, 0x0B]))
+        );
+
+        slave.respond(&frame(&[0x02, 0x06, 0x00, 0x0A, 0x12, 0x34]));
+        assert_eq!(slave.register(10), 0x1234);
+
+        slave.respond(&frame(&[0x01, 0x0F, 0x00, 0x03, 0x00, 0x03, 0x01, 0b101]));
+        let response = slave.respond(&frame(&[0x01, 0x01, 0x00, 0x00, 0x00, 0x08]));
+        assert_eq!(response, Some(frame(&[0x01, 0x01, 0x01, 0b0010_1000])));
+
+        // Exceptions, silence for other units, broadcasts and broken frames
+        let response = slave.respond(&frame(&[0x01, 0x03, 0xFF, 0xFF, 0x00, 0x02]));
+        assert_eq!(response, Some(frame(&[0x01, 0x83, 0x02])));
+        assert_eq!(
+            slave.respond(&frame(&[0x03, 0x03, 0x00, 0x00, 0x00, 0x01])),
+            None
+        );
+        assert_eq!(
+            slave.respond(&frame(&[0x00, 0x06, 0x00, 0x01, 0x00, 0x07])),
+            None
+        );
+        assert_eq!(slave.register(1), 7);
+        assert_eq!(
+            slave.respond(&[0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0, 0]),
+            None
+        );
+        assert_eq!(slave.requests(), 8);
+    }
+
+    #[test]
+    fn test_exchange_time() {
+        let slave = MockSlave::new()
+            .with_baud_rate(9600)
+            .with_latency(Duration::from_millis(5));
+
+        // 8 + 7 characters of 10 bits at 9600 baud, plus the latency
+        let time = slave.exchange_time(8, 7);
+        assert!(time > Duration::from_micros(20_600) && time < Duration::from_micros(20_700));
+    }
+}
@@ -1,62 +1,25 @@
-use std::sync::Arc;
+use std::{
+    net::{IpAddr, SocketAddr},
+    sync::Arc,
+};
 
+use futures::FutureExt;
 use tracing::{debug, trace};
 
-use crate::{errors::FrameError, FrameErrorKind, RelayError, RtuTransport};
-
-/// Calculates the CRC16 checksum for Modbus RTU communication using a lookup table for high performance.
-///
-/// This function computes the CRC16-Modbus checksum for the provided data frame.
-/// It uses a precomputed lookup table to optimize performance by eliminating
-/// bitwise calculations within the inner loop.
-///
-/// # Arguments
-///
-/// * `data` - A slice of bytes representing the data frame for which the CRC is to be computed.
-///
-/// # Returns
-///
-/// The computed 16-bit CRC as a `u16` value.
-fn calc_crc16(data: &[u8]) -> u16 {
-    // Precomputed CRC16 lookup table for polynomial 0xA001 (Modbus standard)
-    const CRC16_TABLE: [u16; 256] = [
-        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241, 0xC601, 0x06C0, 0x0780,
-        0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440, 0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1,
-        0xCE81, 0x0E40, 0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841, 0xD801,
-        0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40, 0x1E00, 0xDEC1, 0xDF81, 0x1F40,
-        0xDD01, 0x1DC0, 0x1C80, 0xDC41, 0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680,
-        0xD641, 0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040, 0xF001, 0x30C0,
-        0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240, 0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501,
-        0x35C0, 0x3480, 0xF441, 0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
-        0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840, 0x2800, 0xE8C1, 0xE981,
-        0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41, 0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1,
-        0xEC81, 0x2C40, 0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640, 0x2200,
-        0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041, 0xA001, 0x60C0, 0x6180, 0xA141,
-        0x6300, 0xA3C1, 0xA281, 0x6240, 0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480,
-        0xA441, 0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41, 0xAA01, 0x6AC0,
-        0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840, 0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01,
-        0x7BC0, 0x7A80, 0xBA41, 0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
-        0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640, 0x7200, 0xB2C1, 0xB381,
-        0x7340, 0xB101, 0x71C0, 0x7080, 0xB041, 0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0,
-        0x5280, 0x9241, 0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440, 0x9C01,
-        0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40, 0x5A00, 0x9AC1, 0x9B81, 0x5B40,
-        0x9901, 0x59C0, 0x5880, 0x9841, 0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81,
-        0x4A40, 0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41, 0x4400, 0x84C1,
-        0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641, 0x8201, 0x42C0, 0x4380, 0x8341, 0x4100,
-        0x81C1, 0x8081, 0x4040,
-    ];
-
-    let mut crc: u16 = 0xFFFF; // Initialize CRC to 0xFFFF as per Modbus standard
-
-    for &byte in data {
-        // XOR the lower byte of the CRC with the current byte and find the lookup table index
-        let index = ((crc ^ byte as u16) & 0x00FF) as usize;
-        // Update the CRC by shifting right and XORing with the table value
-        crc = (crc >> 8) ^ CRC16_TABLE[index];
-    }
-
-    crc
-}
+use crate::{
+    cache::{CacheKey, CacheStats, ResponseCache, WriteRange},
+    capture::FrameCapture,
+    crc::calc_crc16,
+    errors::FrameError,
+    frame_buffer::{BufferPool, FrameBuffer, FRAME_BUFFER_SIZE, MBAP_HEADROOM},
+    latency::LatencyStats,
+    mbap::MBAP_HEADER_SIZE,
+    metrics::Metrics,
+    poller::ShadowImage,
+    scheduler::BusHandle,
+    single_flight::SingleFlight,
+    FrameErrorKind, Priority, ProtocolErrorKind, RelayError,
+};
 
 /// Estimates the expected size of a Modbus RTU response frame based on the function code and quantity.
 ///
@@ -101,6 +64,80 @@ pub fn guess_response_size(function: u8, quantity: u16) -> usize {
     }
 }
 
+/// Maximum size of a Modbus RTU frame: Address(1) + PDU(253) + CRC(2)
+pub const MAX_RTU_FRAME_SIZE: usize = 256;
+
+/// Outcome of inspecting a partially received Modbus RTU response.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RtuFrameLength {
+    /// The header is not complete yet, at least this many bytes are needed to decide
+    NeedMore(usize),
+    /// The complete frame, including CRC, is exactly this many bytes long
+    Complete(usize),
+    /// The function code does not define its length, the end is marked by the T3.5 gap
+    Unknown,
+}
+
+/// Works out the length of a Modbus RTU response from the bytes received so far.
+///
+/// The length follows from the exception bit, the fixed layout of the write
+/// echoes or the byte count field of the read responses, so the caller can
+/// stop reading as soon as the last byte arrives instead of waiting for the
+/// line to go quiet. This is cheap enough to be called after every read.
+///
+/// # Arguments
+///
+/// * `frame` - The bytes of the response received so far, starting with the unit ID.
+///
+/// # Returns
+///
+/// The frame length if it can be determined, how many bytes are needed to
+/// determine it, or `Unknown` for function codes without a derivable length.
+pub fn rtu_response_length(frame: &[u8]) -> RtuFrameLength {
+    // Address(1) + Function(1)
+    let Some(&function) = frame.get(1) else {
+        return RtuFrameLength::NeedMore(2);
+    };
+
+    // Byte count driven frames: Address(1) + Function(1) + Byte Count(n) + Data + CRC(2)
+    let with_byte_count = |count_len: usize| match frame.get(2..2 + count_len) {
+        Some(count) => {
+            let data_bytes = count.iter().fold(0usize, |acc, &b| (acc << 8) | b as usize);
+            RtuFrameLength::Complete(2 + count_len + data_bytes + 2)
+        }
+        None => RtuFrameLength::NeedMore(2 + count_len),
+    };
+
+    match function {
+        // Exception: Address(1) + Function(1) + Exception Code(1) + CRC(2)
+        f if f & 0x80 != 0 => RtuFrameLength::Complete(5),
+        // Reads and other byte count prefixed responses
+        0x01..=0x04 | 0x0C | 0x11 | 0x14 | 0x15 | 0x17 => with_byte_count(1),
+        // Read FIFO Queue uses a two byte count
+        0x18 => with_byte_count(2),
+        // Read Exception Status: Address(1) + Function(1) + Status(1) + CRC(2)
+        0x07 => RtuFrameLength::Complete(5),
+        // Echoes: Address(1) + Function(1) + Address/Sub-function(2) + Value/Quantity(2) + CRC(2)
+        0x05 | 0x06 | 0x08 | 0x0B | 0x0F | 0x10 => RtuFrameLength::Complete(8),
+        // Mask Write Register: Address(1) + Function(1) + Address(2) + AND(2) + OR(2) + CRC(2)
+        0x16 => RtuFrameLength::Complete(10),
+        _ => RtuFrameLength::Unknown,
+    }
+}
+
+/// Response the relay gives for the broadcast `pdu`, which no device
+/// answers, or `None` for functions that only read and cannot be broadcast.
+///
+/// Writes of multiple coils or registers answer with their address and
+/// quantity, every other function with an echo of the request.
+pub fn broadcast_echo(pdu: &[u8]) -> Option<&[u8]> {
+    match *pdu.first()? {
+        0x01..=0x04 | 0x07 | 0x0B | 0x0C | 0x11 | 0x14 | 0x17 | 0x18 | 0x2B => None,
+        0x0F | 0x10 => pdu.get(..5),
+        _ => Some(pdu),
+    }
+}
+
 /// Extracts a 16-bit unsigned integer from a Modbus RTU request frame starting at the specified index.
 ///
 /// This function attempts to retrieve two consecutive bytes from the provided request slice,
@@ -171,20 +208,142 @@ pub fn get_quantity(function_code: u8, request: &[u8]) -> Result<u16, RelayError
     }
 }
 
+/// MBAP header without the Unit ID, which the RTU frame already starts with
+fn mbap_prefix(transaction_id: [u8; 2], unit_and_pdu_len: usize) -> [u8; MBAP_HEADROOM] {
+    let [len_hi, len_lo] = (unit_and_pdu_len as u16).to_be_bytes();
+    [
+        transaction_id[0],
+        transaction_id[1],
+        0x00, // Protocol ID
+        0x00,
+        len_hi, // Length of Unit ID + PDU
+        len_lo,
+    ]
+}
+
+/// Result of an RTU transaction, shared between coalesced requests
+type BusResult = Result<FrameBuffer, Arc<RelayError>>;
+
 pub struct ModbusProcessor {
-    transport: Arc<RtuTransport>,
+    bus: BusHandle,
+    cache: ResponseCache,
+    image: Arc<ShadowImage>,
+    reads: SingleFlight<CacheKey, BusResult>,
+    metrics: Arc<Metrics>,
+    capture: Option<Arc<FrameCapture>>,
 }
 
 impl ModbusProcessor {
-    pub fn new(transport: Arc<RtuTransport>) -> Self {
-        Self { transport }
+    /// Reads covered by `image` are answered from it, `cache` serves the rest
+    pub fn new(
+        bus: BusHandle,
+        cache: ResponseCache,
+        image: Arc<ShadowImage>,
+        metrics: Arc<Metrics>,
+    ) -> Self {
+        Self {
+            bus,
+            cache,
+            image,
+            reads: SingleFlight::new(),
+            metrics,
+            capture: None,
+        }
+    }
+
+    /// Modbus TCP exception response to a request with `function`
+    pub fn exception_response(
+        &self,
+        transaction_id: [u8; 2],
+        unit_id: u8,
+        function: u8,
+        exception_code: u8,
+    ) -> FrameBuffer {
+        let mut response = self.buffers().get();
+        response.extend_from_slice(&mbap_prefix(transaction_id, 3)); // Unit ID + Function + Exception Code
+        response.push(unit_id);
+        response.push(function | 0x80); // Exception function code
+        response.push(exception_code);
+        response
+    }
+
+    /// Ring client connections record their Modbus TCP frames into
+    pub fn with_capture(mut self, capture: Arc<FrameCapture>) -> Self {
+        self.capture = Some(capture);
+        self
+    }
+
+    pub fn metrics(&self) -> Arc<Metrics> {
+        Arc::clone(&self.metrics)
+    }
+
+    pub fn capture(&self) -> Option<Arc<FrameCapture>> {
+        self.capture.clone()
+    }
+
+    pub fn cache_stats(&self) -> Arc<CacheStats> {
+        self.cache.stats()
+    }
+
+    pub fn latency(&self) -> Arc<LatencyStats> {
+        self.bus.latency()
+    }
+
+    /// Class a request with `function` from `client`, received on `port`,
+    /// is scheduled in on this bus
+    pub fn classify(&self, client: IpAddr, port: u16, function: u8) -> Priority {
+        self.bus.classify(client, port, function)
+    }
+
+    /// Pool the frame buffers passed to [`ModbusProcessor::process_frame`] should come from
+    pub fn buffers(&self) -> Arc<BufferPool> {
+        self.bus.buffers()
     }
 
-    /// Processes a Modbus TCP request by converting it to Modbus RTU, sending it over the transport,
+    /// Sends an RTU request through the bus scheduler.
+    ///
+    /// Identical reads arriving while one is already queued or on the wire
+    /// share its response instead of going down the bus again.
+    async fn bus_transaction(
+        &self,
+        client: SocketAddr,
+        priority: Priority,
+        unit_id: u8,
+        read: Option<CacheKey>,
+        rtu_request: FrameBuffer,
+    ) -> BusResult {
+        match read.filter(|_| unit_id != 0) {
+            Some(key) => {
+                let bus = self.bus.clone();
+                self.reads
+                    .run(key, move || {
+                        async move {
+                            bus.transaction(client, priority, unit_id, rtu_request)
+                                .await
+                                .map_err(Arc::new)
+                        }
+                        .boxed()
+                    })
+                    .await
+            }
+            None => self
+                .bus
+                .transaction(client, priority, unit_id, rtu_request)
+                .await
+                .map_err(Arc::new),
+        }
+    }
+
+    /// Processes a Modbus TCP request by converting it to Modbus RTU, queueing it on the bus,
     /// and then converting the RTU response back to Modbus TCP format.
     ///
+    /// Convenience wrapper around [`ModbusProcessor::process_frame`] for callers
+    /// holding the request in pieces.
+    ///
     /// # Arguments
     ///
+    /// * `client` - Address of the TCP client, used for fair scheduling on the bus.
+    /// * `priority` - Class the request is scheduled in, see [`ModbusProcessor::classify`].
     /// * `transaction_id` - The Modbus TCP transaction ID.
     /// * `unit_id` - The Modbus unit ID (slave address).
     /// * `pdu` - The Protocol Data Unit from the Modbus TCP request.
@@ -194,75 +353,160 @@ impl ModbusProcessor {
     /// A `Result` containing the Modbus TCP response as a vector of bytes, or a `RelayError`.
     pub async fn process_request(
         &self,
+        client: SocketAddr,
+        priority: Priority,
         transaction_id: [u8; 2],
         unit_id: u8,
         pdu: &[u8],
         trace_frames: bool,
     ) -> Result<Vec<u8>, RelayError> {
-        // Build RTU request frame: [Unit ID][PDU][CRC16]
-        let mut rtu_request = Vec::with_capacity(1 + pdu.len() + 2); // Unit ID + PDU + CRC16
-        rtu_request.push(unit_id);
-        rtu_request.extend_from_slice(pdu);
+        // Unit ID + PDU + CRC16 has to fit in an RTU frame
+        if pdu.is_empty() || pdu.len() + 3 > MAX_RTU_FRAME_SIZE {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Invalid PDU length: {} bytes", pdu.len()),
+                Some(pdu.to_vec()),
+            ));
+        }
+
+        let mut frame = self.buffers().get();
+        frame.extend_from_slice(&mbap_prefix(transaction_id, 1 + pdu.len()));
+        frame.push(unit_id);
+        frame.extend_from_slice(pdu);
+
+        self.process_frame(client, priority, frame, trace_frames)
+            .await
+            .map(|response| response.to_vec())
+    }
+
+    /// Processes a complete Modbus TCP request frame (MBAP header + PDU).
+    ///
+    /// The request is turned into an RTU frame in place by appending the CRC
+    /// behind the PDU, and the RTU response comes back in a buffer with room
+    /// for the MBAP header in front of it, so no frame is copied on the way.
+    ///
+    /// # Returns
+    ///
+    /// A `Result` containing the Modbus TCP response frame, or a `RelayError`.
+    pub async fn process_frame(
+        &self,
+        client: SocketAddr,
+        priority: Priority,
+        mut frame: FrameBuffer,
+        trace_frames: bool,
+    ) -> Result<FrameBuffer, RelayError> {
+        if frame.len() < MBAP_HEADER_SIZE + 1 || frame.len() + 2 > FRAME_BUFFER_SIZE {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooShort,
+                format!("Invalid Modbus TCP frame: {} bytes", frame.len()),
+                Some(frame.to_vec()),
+            ));
+        }
+
+        let transaction_id = [frame[0], frame[1]];
+        let unit_id = frame[6];
+        let function_code = frame[7];
+
+        let pdu = &frame[MBAP_HEADER_SIZE..];
+        let read = CacheKey::from_request(unit_id, pdu);
+        let write = WriteRange::from_request(pdu);
 
-        // Calculate CRC16 checksum and append to the request
-        let crc = calc_crc16(&rtu_request);
-        rtu_request.extend_from_slice(&crc.to_le_bytes()); // Append CRC16 in little-endian
+        if let Some(key) = &read {
+            let mut response = self.buffers().get_with_headroom(MBAP_HEADROOM);
+            if self.image.read(key, &mut response) {
+                if trace_frames {
+                    trace!("Serving {:?} from the shadow image", key);
+                }
+                response.prepend(&mbap_prefix(transaction_id, response.len()));
+                return Ok(response);
+            }
+        }
+
+        let cache_key = self.cache.key_for(unit_id, pdu);
+        if let Some(key) = &cache_key {
+            let hit = self.cache.get_with(key, |rtu_response| {
+                frame.truncate(0);
+                frame.extend_from_slice(&mbap_prefix(transaction_id, rtu_response.len()));
+                frame.extend_from_slice(rtu_response);
+            });
+
+            if hit.is_some() {
+                if trace_frames {
+                    trace!("Serving {:?} from cache", key);
+                }
+                return Ok(frame);
+            }
+        }
+        let cache_generation = self.cache.generation();
+
+        // Build RTU request frame in place: [Unit ID][PDU][CRC16] follows the
+        // MBAP header, so only the CRC has to be appended
+        let crc = calc_crc16(&frame[MBAP_HEADROOM..]);
+        frame.extend_from_slice(&crc.to_le_bytes()); // Append CRC16 in little-endian
+        frame.advance(MBAP_HEADROOM);
 
         if trace_frames {
             trace!(
                 "Sending RTU request: unit_id=0x{:02X}, function=0x{:02X}, data={:02X?}, crc=0x{:04X}",
                 unit_id,
-                pdu.first().copied().unwrap_or(0),
-                &pdu[1..],
+                function_code,
+                &frame[2..frame.len() - 2],
                 crc
             );
         }
 
-        // Estimate the expected RTU response size
-        let function_code = pdu.first().copied().unwrap_or(0);
-        let quantity = get_quantity(function_code, &rtu_request)?;
+        // Execute RTU transaction, the scheduler returns the frame as read
+        // from the bus
+        let result = self
+            .bus_transaction(client, priority, unit_id, read, frame)
+            .await;
 
-        let expected_response_size = guess_response_size(function_code, quantity);
-
-        // Allocate buffer for RTU response
-        let mut rtu_response = vec![0u8; expected_response_size];
+        // Whether or not the slave answered, the write may have been applied
+        if let Some(write) = write {
+            self.cache.invalidate(unit_id, write);
+            self.image.invalidate(unit_id, write);
+        }
 
-        // Execute RTU transaction
-        let rtu_len = match self
-            .transport
-            .transaction(&rtu_request, &mut rtu_response)
-            .await
-        {
-            Ok(len) => {
+        let mut rtu_response = match result {
+            Ok(rtu_response) => {
+                let len = rtu_response.len();
                 if len < 5 {
                     // Minimum RTU response size: Unit ID(1) + Function(1) + Data(1) + CRC(2)
                     return Err(RelayError::frame(
                         FrameErrorKind::TooShort,
                         format!("RTU response too short: {} bytes", len),
-                        Some(rtu_response[..len].to_vec()),
+                        Some(rtu_response.to_vec()),
                     ));
                 }
-                len
+                rtu_response
             }
             Err(e) => {
                 debug!("Transport transaction error: {:?}", e);
+                self.metrics.record_error(&e);
+
+                // Gateway exception: 0x0A (Gateway Path Unavailable) or 0x06
+                // (Server Device Busy) when the circuit breaker or load
+                // shedding ask for it, 0x0B (Gateway Target Device Failed to
+                // Respond) otherwise
+                let exception_code = match *e {
+                    RelayError::Protocol {
+                        kind:
+                            kind @ (ProtocolErrorKind::GatewayPathUnavailable
+                            | ProtocolErrorKind::ServerBusy),
+                        ..
+                    } => kind.to_exception_code(),
+                    _ => 0x0B,
+                };
 
-                // Prepare Modbus exception response with exception code 0x0B (Gateway Path Unavailable)
-                let exception_code = 0x0B;
-                let mut exception_response = Vec::with_capacity(9);
-                exception_response.extend_from_slice(&transaction_id);
-                exception_response.extend_from_slice(&[0x00, 0x00]); // Protocol ID
-                exception_response.extend_from_slice(&[0x00, 0x03]); // Length (Unit ID + Function + Exception Code)
-                exception_response.push(unit_id);
-                exception_response.push(function_code | 0x80); // Exception function code
-                exception_response.push(exception_code);
-
-                return Ok(exception_response);
+                return Ok(self.exception_response(
+                    transaction_id,
+                    unit_id,
+                    function_code,
+                    exception_code,
+                ));
             }
         };
-
-        // Truncate the buffer to the actual response length
-        rtu_response.truncate(rtu_len);
+        let rtu_len = rtu_response.len();
 
         // Verify the CRC16 checksum of the RTU response
         let expected_crc = calc_crc16(&rtu_response[..rtu_len - 2]);
@@ -287,18 +531,85 @@ impl ModbusProcessor {
                     "Unexpected unit ID in RTU response: expected=0x{:02X}, received=0x{:02X}",
                     unit_id, rtu_response[0]
                 ),
-                Some(rtu_response.clone()),
+                Some(rtu_response.to_vec()),
             ));
         }
 
-        // Convert RTU response to Modbus TCP response
-        let tcp_length = rtu_response.len() as u16; // Length of Unit ID + PDU
-        let mut tcp_response = Vec::with_capacity(7 + rtu_response.len()); // MBAP Header(7) + PDU
-        tcp_response.extend_from_slice(&transaction_id); // Transaction ID
-        tcp_response.extend_from_slice(&[0x00, 0x00]); // Protocol ID
-        tcp_response.extend_from_slice(&tcp_length.to_be_bytes()); // Length field
-        tcp_response.extend_from_slice(&rtu_response); // Unit ID + PDU
+        // Exception responses are passed through but never cached
+        if let Some(key) = cache_key {
+            if rtu_response[1] & 0x80 == 0 {
+                self.cache.insert(key, &rtu_response, cache_generation);
+            }
+        }
+
+        // Convert RTU response to Modbus TCP response by filling in the MBAP
+        // header in front of it
+        let header = mbap_prefix(transaction_id, rtu_response.len());
+        rtu_response.prepend(&header);
+
+        Ok(rtu_response)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_rtu_response_length_reads() {
+        assert_eq!(rtu_response_length(&[]), RtuFrameLength::NeedMore(2));
+        assert_eq!(rtu_response_length(&[0x01]), RtuFrameLength::NeedMore(2));
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x03]),
+            RtuFrameLength::NeedMore(3)
+        );
+        // Two registers: byte count 4
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x03, 0x04]),
+            RtuFrameLength::Complete(9)
+        );
+        // Read FIFO queue with a two byte count
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x18, 0x00]),
+            RtuFrameLength::NeedMore(4)
+        );
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x18, 0x00, 0x06]),
+            RtuFrameLength::Complete(12)
+        );
+    }
+
+    #[test]
+    fn test_broadcast_echo() {
+        let write_single = [0x06, 0x00, 0x10, 0x12, 0x34];
+        assert_eq!(broadcast_echo(&write_single), Some(&write_single[..]));
+
+        let write_multiple = [0x10, 0x00, 0x10, 0x00, 0x01, 0x02, 0x12, 0x34];
+        assert_eq!(broadcast_echo(&write_multiple), Some(&write_multiple[..5]));
+
+        assert_eq!(broadcast_echo(&[0x03, 0x00, 0x00, 0x00, 0x01]), None);
+        assert_eq!(broadcast_echo(&[]), None);
+    }
 
-        Ok(tcp_response)
+    #[test]
+    fn test_rtu_response_length_fixed() {
+        // Exception response for any function
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x83]),
+            RtuFrameLength::Complete(5)
+        );
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x06]),
+            RtuFrameLength::Complete(8)
+        );
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x10]),
+            RtuFrameLength::Complete(8)
+        );
+        assert_eq!(
+            rtu_response_length(&[0x01, 0x16]),
+            RtuFrameLength::Complete(10)
+        );
+        assert_eq!(rtu_response_length(&[0x01, 0x2B]), RtuFrameLength::Unknown);
     }
 }
@@ -1,34 +1,142 @@
 use std::{future::Future, net::SocketAddr, sync::Arc, time::Duration, time::Instant};
 
+use futures::stream::{FuturesOrdered, StreamExt};
 use tokio::{
-    io::{AsyncReadExt, AsyncWriteExt},
-    net::{TcpListener, TcpStream},
-    sync::{broadcast, mpsc, Mutex},
+    io::AsyncWriteExt,
+    net::TcpStream,
+    runtime::Handle,
+    sync::{broadcast, Mutex},
     task::{JoinError, JoinHandle},
     time::{sleep, timeout},
 };
-use tracing::{debug, error, info, trace, warn};
+use tracing::{debug, error, info, trace, warn, Instrument};
 
 use crate::{
-    connection::StatEvent,
-    errors::{
-        ClientErrorKind, ConnectionError, FrameErrorKind, ProtocolErrorKind, RelayError,
-        TransportError,
-    },
-    http_api::start_http_server,
+    adaptive_timeout::AdaptiveTimeouts,
+    bus_router::BusRouter,
+    cache::{CacheStats, ResponseCache},
+    capture::{Direction, FrameCapture},
+    circuit_breaker::CircuitBreaker,
+    errors::{ClientErrorKind, ConnectionError, RelayError, TransportError},
+    http_api::{start_http_server, ApiBus, ApiState},
+    latency::LatencyStats,
+    mbap::MbapFramer,
+    metrics::Metrics,
+    poller::ShadowImage,
     rtu_transport::RtuTransport,
+    runtime::BusThread,
+    scheduler::{BusHandle, BusScheduler, BusStats},
+    socket_activation::InheritedListeners,
+    tcp_upstream::TcpUpstream,
     utils::generate_request_id,
-    ConnectionManager, IoOperation, ModbusProcessor, RelayConfig, StatsConfig, StatsManager,
+    BreakerConfig, ConnectionManager, IoOperation, ModbusProcessor, RelayConfig, RtuConfig,
+    SchedulerConfig, StatsConfig, StatsManager, Transport,
 };
 
 use socket2::{SockRef, TcpKeepalive};
 
+/// What a bus talks to
+enum BusLink {
+    /// A serial line, driven by its own thread when one was started for it
+    Rtu(Arc<RtuTransport>, Option<BusThread>),
+    Upstream(Arc<TcpUpstream>),
+}
+
+impl BusLink {
+    /// Spawns the scheduler driving this link, plus the health checks of
+    /// an upstream pool, into `tasks`
+    fn start(
+        &self,
+        config: &SchedulerConfig,
+        latency: Arc<LatencyStats>,
+        breaker: &BreakerConfig,
+        capture: Option<(Arc<FrameCapture>, u8)>,
+        shutdown: &broadcast::Sender<()>,
+        tasks: &mut Vec<JoinHandle<()>>,
+    ) -> BusHandle {
+        #[allow(clippy::too_many_arguments)]
+        fn spawn<T: Transport>(
+            runtime: &Handle,
+            transport: &Arc<T>,
+            config: &SchedulerConfig,
+            latency: Arc<LatencyStats>,
+            breaker: &BreakerConfig,
+            capture: Option<(Arc<FrameCapture>, u8)>,
+            shutdown: &broadcast::Sender<()>,
+            tasks: &mut Vec<JoinHandle<()>>,
+        ) -> BusHandle {
+            let breaker = Arc::new(CircuitBreaker::new(breaker));
+            let (mut scheduler, bus) =
+                BusScheduler::new(Arc::clone(transport), config, latency, breaker);
+            if let Some((capture, index)) = capture {
+                scheduler = scheduler.with_capture(capture, index);
+            }
+            tasks.push(runtime.spawn(scheduler.run(shutdown.subscribe())));
+            bus
+        }
+
+        match self {
+            BusLink::Rtu(transport, thread) => {
+                let runtime = thread
+                    .as_ref()
+                    .map_or_else(Handle::current, |thread| thread.handle().clone());
+                spawn(
+                    &runtime, transport, config, latency, breaker, capture, shutdown, tasks,
+                )
+            }
+            BusLink::Upstream(upstream) => {
+                let upstream_shutdown = shutdown.subscribe();
+                tasks.push(tokio::spawn(
+                    Arc::clone(upstream).run_health_checks(upstream_shutdown),
+                ));
+                spawn(
+                    &Handle::current(),
+                    upstream,
+                    config,
+                    latency,
+                    breaker,
+                    capture,
+                    shutdown,
+                    tasks,
+                )
+            }
+        }
+    }
+
+    async fn close(&self) -> Result<(), TransportError> {
+        match self {
+            BusLink::Rtu(transport, _) => transport.close().await,
+            BusLink::Upstream(upstream) => Transport::close(upstream.as_ref()).await,
+        }
+    }
+}
+
+/// One bus with its own scheduler, cache and single-flight table
+struct RelayBus {
+    name: String,
+    link: BusLink,
+    modbus: Arc<ModbusProcessor>,
+    stats: Arc<BusStats>,
+    breaker: Arc<CircuitBreaker>,
+    timeouts: Arc<AdaptiveTimeouts>,
+    image: Arc<ShadowImage>,
+    bind_port: Option<u16>,
+}
+
 pub struct ModbusRelay {
     config: RelayConfig,
-    transport: Arc<RtuTransport>,
+    buses: Arc<BusRouter<RelayBus>>,
+    cache_stats: Arc<CacheStats>,
+    latency: Arc<LatencyStats>,
+    metrics: Arc<Metrics>,
+    capture: Option<Arc<FrameCapture>>,
+    /// Sockets from systemd socket activation, used before binding anew
+    listeners: Arc<InheritedListeners>,
     connection_manager: Arc<ConnectionManager>,
-    stats_tx: mpsc::Sender<StatEvent>,
     shutdown: broadcast::Sender<()>,
+    /// Stops the bus schedulers, sent once clients are gone so requests
+    /// they already read still reach the bus
+    bus_shutdown: broadcast::Sender<()>,
     main_shutdown: tokio::sync::watch::Sender<bool>,
     stats_manager_shutdown: tokio::sync::watch::Sender<bool>,
     tasks: Arc<Mutex<Vec<JoinHandle<()>>>>,
@@ -40,53 +148,183 @@ impl ModbusRelay {
         // Validate the config first
         RelayConfig::validate(&config)?;
 
-        let transport = RtuTransport::new(&config.rtu, config.logging.trace_frames)?;
-
         // Create stats manager first
         let stats_config = StatsConfig {
             cleanup_interval: config.connection.idle_timeout,
             idle_timeout: config.connection.idle_timeout,
             error_timeout: config.connection.error_timeout,
-            max_events_per_second: 10000, // TODO(aljen): Make configurable
         };
-        let (stats_manager, stats_tx) = StatsManager::new(stats_config);
-        let stats_manager = Arc::new(Mutex::new(stats_manager));
+        let stats_manager = Arc::new(StatsManager::new(stats_config));
 
-        // Initialize connection manager with stats sender
+        // Initialize connection manager with the stats registry
         let connection_manager = Arc::new(ConnectionManager::new(
             config.connection.clone(),
-            stats_tx.clone(),
+            Arc::clone(&stats_manager),
         ));
 
         let (shutdown_tx, _) = broadcast::channel(1);
+        let (bus_shutdown_tx, _) = broadcast::channel(1);
         let (main_shutdown_tx, _) = tokio::sync::watch::channel(false);
         let (stats_manager_shutdown_tx, _) = tokio::sync::watch::channel(false);
 
+        // Statistics are shared, so the API reports the relay as a whole
+        let latency = Arc::new(LatencyStats::new());
+        let metrics = Arc::new(Metrics::new());
+        let cache_stats = Arc::new(CacheStats::default());
+        let capture = config
+            .capture
+            .enabled
+            .then(|| Arc::new(FrameCapture::new(config.capture.slots)));
+        let mut tasks = Vec::with_capacity(config.buses.len() + 1);
+
+        // Each scheduler owns its bus, every request for it goes through its queue
+        let trace_frames = config.logging.trace_frames;
+
+        // Blocks are polled on the bus their unit is routed to, see BusRouter::route
+        let poll_bus = |unit_id: u8| {
+            config
+                .buses
+                .iter()
+                .position(|bus| bus.unit_ids.iter().any(|range| range.contains(unit_id)))
+                .map_or(0, |index| index + 1)
+        };
+        let mut bus_index = 0;
+
+        let mut open_bus = |name: &str,
+                            link: BusLink,
+                            scheduler: &SchedulerConfig,
+                            bind_port: Option<u16>|
+         -> RelayBus {
+            let index = bus_index;
+            bus_index += 1;
+            let bus = link.start(
+                scheduler,
+                Arc::clone(&latency),
+                &config.breaker,
+                capture
+                    .as_ref()
+                    .map(|capture| (Arc::clone(capture), index as u8)),
+                &bus_shutdown_tx,
+                &mut tasks,
+            );
+            let stats = bus.stats();
+            let breaker = bus.breaker();
+            let timeouts = bus.timeouts();
+
+            let blocks = config
+                .poller
+                .blocks
+                .iter()
+                .filter(|block| config.poller.enabled && poll_bus(block.unit_id) == index);
+            let image = Arc::new(ShadowImage::new(blocks, config.poller.max_age));
+            if !image.is_empty() {
+                let (image, bus, shutdown_rx) =
+                    (Arc::clone(&image), bus.clone(), shutdown_tx.subscribe());
+                tasks.push(tokio::spawn(
+                    async move { image.run(bus, shutdown_rx).await },
+                ));
+            }
+
+            let cache = ResponseCache::with_stats(config.cache.clone(), Arc::clone(&cache_stats));
+            let mut modbus =
+                ModbusProcessor::new(bus, cache, Arc::clone(&image), Arc::clone(&metrics));
+            if let Some(capture) = &capture {
+                modbus = modbus.with_capture(Arc::clone(capture));
+            }
+
+            RelayBus {
+                name: name.to_string(),
+                link,
+                modbus: Arc::new(modbus),
+                stats,
+                breaker,
+                timeouts,
+                image,
+                bind_port,
+            }
+        };
+
+        // Serial lines on threads of their own are opened on those threads,
+        // their readiness is then polled there too
+        let serial_thread = &config.runtime.serial_thread;
+        let mut rtu_index = 0;
+        let mut open_rtu = |name: &str, rtu: &RtuConfig| -> Result<BusLink, RelayError> {
+            let thread = if serial_thread.enabled {
+                let cpu = serial_thread.cpu(rtu_index);
+                Some(BusThread::spawn(name, cpu, serial_thread.priority)?)
+            } else {
+                None
+            };
+            rtu_index += 1;
+
+            let transport = {
+                let _runtime = thread.as_ref().map(|thread| thread.handle().enter());
+                RtuTransport::new(rtu, trace_frames)?
+            };
+            Ok(BusLink::Rtu(Arc::new(transport), thread))
+        };
+
+        info!("RTU bus default on {}", config.rtu.serial_port_info());
+        let default_bus = open_bus(
+            RelayConfig::DEFAULT_BUS,
+            open_rtu(RelayConfig::DEFAULT_BUS, &config.rtu)?,
+            &config.scheduler,
+            None,
+        );
+
+        let mut buses = BusRouter::new(default_bus);
+        for bus in &config.buses {
+            let link = match (&bus.rtu, &bus.upstream) {
+                (Some(rtu), _) => {
+                    info!("RTU bus {} on {}", bus.name, rtu.serial_port_info());
+                    open_rtu(&bus.name, rtu)?
+                }
+                (None, Some(upstream)) => {
+                    info!("Modbus TCP bus {} to {}", bus.name, upstream.address);
+                    BusLink::Upstream(Arc::new(TcpUpstream::new(upstream, trace_frames)))
+                }
+                (None, None) => unreachable!("validated config has a target for every bus"),
+            };
+
+            let scheduler = bus.scheduler.as_ref().unwrap_or(&config.scheduler);
+            let relay_bus = open_bus(&bus.name, link, scheduler, bus.bind_port);
+            buses.push(bus.unit_ids.clone(), relay_bus);
+        }
+
         // Start stats manager but keep its handle separate from tasks vector
         let stats_manager_handle = tokio::spawn({
             let stats_manager = Arc::clone(&stats_manager);
             let stats_manager_shutdown_tx = stats_manager_shutdown_tx.subscribe();
 
             tokio::spawn(async move {
-                let mut stats_manager = stats_manager.lock().await;
-
                 stats_manager.run(stats_manager_shutdown_tx).await;
             })
         });
 
         Ok(Self {
             config,
-            transport: Arc::new(transport),
+            buses: Arc::new(buses),
+            cache_stats,
+            latency,
+            metrics,
+            capture,
+            listeners: Arc::new(InheritedListeners::default()),
             connection_manager,
-            stats_tx,
             shutdown: shutdown_tx,
+            bus_shutdown: bus_shutdown_tx,
             main_shutdown: main_shutdown_tx,
             stats_manager_shutdown: stats_manager_shutdown_tx,
-            tasks: Arc::new(Mutex::new(Vec::new())),
+            tasks: Arc::new(Mutex::new(tasks)),
             stats_manager_handle: Mutex::new(Some(stats_manager_handle)),
         })
     }
 
+    /// Listens on `listeners` where they match a configured address
+    pub fn with_listeners(mut self, listeners: InheritedListeners) -> Self {
+        self.listeners = Arc::new(listeners);
+        self
+    }
+
     fn spawn_task<F>(&self, name: &str, future: F)
     where
         F: Future<Output = ()> + Send + 'static,
@@ -140,100 +378,152 @@ impl ModbusRelay {
         Ok(())
     }
 
-    pub async fn run(self: Arc<Self>) -> Result<(), RelayError> {
-        // Start TCP server
-        let tcp_server = {
-            let transport = Arc::clone(&self.transport);
-            let manager = Arc::clone(&self.connection_manager);
-            let stats_tx = self.stats_tx.clone();
-            let mut rx = self.shutdown.subscribe();
-            let config = self.config.clone();
-            let keep_alive_duration = self.config.tcp.keep_alive;
-            let trace_frames = self.config.logging.trace_frames;
-
-            let shutdown_rx = self.shutdown.subscribe();
+    /// Accepts Modbus TCP connections on `port`.
+    ///
+    /// Requests are routed by unit ID, unless `pinned` names the bus every
+    /// request on this port goes to.
+    fn spawn_tcp_server(&self, port: u16, pinned: Option<usize>) {
+        let buses = Arc::clone(&self.buses);
+        let manager = Arc::clone(&self.connection_manager);
+        let metrics = Arc::clone(&self.metrics);
+        let mut rx = self.shutdown.subscribe();
+        let bind_addr = self.config.tcp.bind_addr.clone();
+        let keep_alive_duration = self.config.tcp.keep_alive;
+        let trace_frames = self.config.logging.trace_frames;
+        let pipeline_depth = self.config.tcp.pipeline_depth;
+        let idle_timeout = self.config.connection.idle_timeout;
+        let listeners = Arc::clone(&self.listeners);
+
+        let shutdown_rx = self.shutdown.subscribe();
+
+        let tcp_server = tokio::spawn(async move {
+            let addr = format!("{}:{}", bind_addr, port);
+            let listener = listeners.bind(&addr).await.map_err(|e| {
+                RelayError::Transport(TransportError::Io {
+                    operation: IoOperation::Listen,
+                    details: format!("Failed to bind TCP listener to {}", addr),
+                    source: e,
+                })
+            })?;
 
-            tokio::spawn(async move {
-                let addr = format!("{}:{}", config.tcp.bind_addr, config.tcp.bind_port);
-                let listener = TcpListener::bind(&addr).await.map_err(|e| {
-                    RelayError::Transport(TransportError::Io {
-                        operation: IoOperation::Listen,
-                        details: format!("Failed to bind TCP listener to {}", addr),
-                        source: e,
-                    })
-                })?;
-
-                info!("MODBUS TCP server listening on {}", addr);
-
-                loop {
-                    tokio::select! {
-                        accept_result = listener.accept() => {
-                            match accept_result {
-                                Ok((socket, peer)) => {
-                                    let transport = Arc::clone(&transport);
-                                    let manager = Arc::clone(&manager);
-                                    let stats_tx = stats_tx.clone();
-                                    let shutdown_rx = shutdown_rx.resubscribe();
-
-                                    Self::configure_tcp_stream(&socket, keep_alive_duration)
-                                        .await
-                                        .map_err(|e| {
-                                            error!("Failed to configure TCP stream: {}", e);
-                                        })
-                                        .map(|_| {
-                                            debug!(
-                                                "TCP stream configured with keepalive: {:?}",
-                                                keep_alive_duration
-                                            )
-                                        })
-                                        .ok();
-
-                                    tokio::spawn(async move {
-                                        if let Err(e) = handle_client(
-                                            socket,
-                                            peer,
-                                            transport,
-                                            manager,
-                                            stats_tx,
-                                            shutdown_rx,
-                                            trace_frames,
+            match pinned {
+                Some(index) => info!(
+                    "MODBUS TCP server for bus {} listening on {}",
+                    buses.get(index).name,
+                    addr
+                ),
+                None => info!("MODBUS TCP server listening on {}", addr),
+            }
+
+            loop {
+                tokio::select! {
+                    accept_result = listener.accept() => {
+                        match accept_result {
+                            Ok((socket, peer)) => {
+                                let buses = Arc::clone(&buses);
+                                let manager = Arc::clone(&manager);
+                                let metrics = Arc::clone(&metrics);
+                                let shutdown_rx = shutdown_rx.resubscribe();
+
+                                Self::configure_tcp_stream(&socket, keep_alive_duration)
+                                    .await
+                                    .map_err(|e| {
+                                        error!("Failed to configure TCP stream: {}", e);
+                                    })
+                                    .map(|_| {
+                                        debug!(
+                                            "TCP stream configured with keepalive: {:?}",
+                                            keep_alive_duration
                                         )
-                                        .await
-                                        {
-                                            error!("Client error: {}", e);
-                                        }
-                                    });
-                                }
-                                Err(e) => {
-                                    error!("Failed to accept connection: {}", e);
-                                }
+                                    })
+                                    .ok();
+
+                                // Only entered while the client task runs, a
+                                // guard held across awaits would leak into
+                                // whatever else runs on the worker
+                                let client_span = tracing::info_span!(
+                                    "client_connection",
+                                    peer_addr = %peer,
+                                    request_id = %generate_request_id(),
+                                    protocol = "modbus_tcp"
+                                );
+
+                                tokio::spawn(async move {
+                                    if let Err(e) = handle_client(
+                                        socket,
+                                        peer,
+                                        buses,
+                                        pinned,
+                                        manager,
+                                        shutdown_rx,
+                                        trace_frames,
+                                        pipeline_depth,
+                                        idle_timeout,
+                                    )
+                                    .instrument(client_span)
+                                    .await
+                                    {
+                                        metrics.record_error(&e);
+                                        error!("Client error: {}", e);
+                                    }
+                                });
+                            }
+                            Err(e) => {
+                                error!("Failed to accept connection: {}", e);
                             }
-                        }
-                        _ = rx.recv() => {
-                            info!("MODBUS TCP server shutting down");
-                            break;
                         }
                     }
+                    _ = rx.recv() => {
+                        info!("MODBUS TCP server on {} shutting down", addr);
+                        break;
+                    }
                 }
+            }
 
-                info!("MODBUS TCP server shutdown complete");
+            info!("MODBUS TCP server on {} shutdown complete", addr);
 
-                Ok::<_, RelayError>(())
-            })
-        };
+            Ok::<_, RelayError>(())
+        });
 
         self.spawn_task("tcp_server", async move {
             if let Err(e) = tcp_server.await {
                 error!("TCP server task failed: {}", e);
             }
         });
+    }
+
+    pub async fn run(self: Arc<Self>) -> Result<(), RelayError> {
+        // Start TCP servers, the main port plus one for each bus with its own
+        self.spawn_tcp_server(self.config.tcp.bind_port, None);
+        for (index, bus) in self.buses.iter().enumerate() {
+            if let Some(port) = bus.bind_port {
+                self.spawn_tcp_server(port, Some(index));
+            }
+        }
 
         // Start HTTP server if enabled
         if self.config.http.enabled {
             let http_server = start_http_server(
                 self.config.http.bind_addr.clone(),
                 self.config.http.bind_port,
-                self.connection_manager.clone(),
+                ApiState::new(
+                    self.connection_manager.clone(),
+                    self.buses
+                        .iter()
+                        .map(|bus| ApiBus {
+                            name: bus.name.clone(),
+                            stats: Arc::clone(&bus.stats),
+                            breaker: Arc::clone(&bus.breaker),
+                            timeouts: Arc::clone(&bus.timeouts),
+                            image: Arc::clone(&bus.image),
+                        })
+                        .collect(),
+                    self.cache_stats.clone(),
+                    self.latency.clone(),
+                    self.metrics.clone(),
+                )
+                .with_capture(self.capture.clone()),
+                Arc::clone(&self.listeners),
                 self.shutdown.subscribe(),
             );
 
@@ -282,6 +572,56 @@ impl ModbusRelay {
         Ok(())
     }
 
+    /// Applies what of `config` can change while the relay runs: the serial
+    /// timing of every RTU bus and the connection limits. Client connections
+    /// and queued requests are kept, other changes wait for a restart.
+    pub fn reload(&self, config: &RelayConfig) {
+        let rtus = std::iter::once((RelayConfig::DEFAULT_BUS, Some(&config.rtu))).chain(
+            config
+                .buses
+                .iter()
+                .map(|bus| (bus.name.as_str(), bus.rtu.as_ref())),
+        );
+        for (name, rtu) in rtus {
+            let bus = self.buses.iter().find_map(|bus| match &bus.link {
+                BusLink::Rtu(transport, _) if bus.name == name => Some((bus, transport)),
+                _ => None,
+            });
+            if let (Some((bus, transport)), Some(rtu)) = (bus, rtu) {
+                transport.reload(rtu);
+                // The scheduler hands every transaction its timeout
+                bus.timeouts.set_max(transport.response_timeout());
+            }
+        }
+
+        self.connection_manager.set_limits(
+            config.connection.max_connections,
+            config.connection.per_ip_limits,
+        );
+
+        // What the relay runs with now, to tell whether anything was left out
+        let mut applied = self.config.clone();
+        applied.rtu = applied.rtu.with_timing(&config.rtu);
+        for bus in &mut applied.buses {
+            let reloaded = config
+                .buses
+                .iter()
+                .find(|reloaded| reloaded.name == bus.name)
+                .and_then(|reloaded| reloaded.rtu.as_ref());
+            if let (Some(rtu), Some(reloaded)) = (&mut bus.rtu, reloaded) {
+                *rtu = rtu.with_timing(reloaded);
+            }
+        }
+        applied.connection.max_connections = config.connection.max_connections;
+        applied.connection.per_ip_limits = config.connection.per_ip_limits;
+
+        if serde_json::to_value(&applied).ok() != serde_json::to_value(config).ok() {
+            warn!("Configuration reloaded, changes other than RTU timing and connection limits need a restart");
+        } else {
+            info!("Configuration reloaded");
+        }
+    }
+
     /// Graceful shutdown
     pub async fn shutdown(&self) -> Result<(), RelayError> {
         info!("Initiating graceful shutdown");
@@ -291,7 +631,7 @@ impl ModbusRelay {
         let _ = self.main_shutdown.send(true);
 
         // 1. Log initial state
-        let stats = self.connection_manager.get_stats().await?;
+        let stats = self.connection_manager.get_stats();
         trace!(
             "Current state: {} active connections, {} total requests",
             stats.active_connections,
@@ -314,16 +654,15 @@ impl ModbusRelay {
         );
         let start = Instant::now();
         while start.elapsed() < timeout_duration {
-            if let Ok(stats) = self.connection_manager.get_stats().await {
-                if stats.active_connections == 0 {
-                    info!("All connections closed");
-                    break;
-                }
-                info!(
-                    "Waiting for {} connections to close",
-                    stats.active_connections
-                );
+            let stats = self.connection_manager.get_stats();
+            if stats.active_connections == 0 {
+                info!("All connections closed");
+                break;
             }
+            info!(
+                "Waiting for {} connections to close",
+                stats.active_connections
+            );
 
             trace!("Sleeping for 100ms");
             sleep(Duration::from_millis(100)).await;
@@ -334,13 +673,11 @@ impl ModbusRelay {
             warn!("Timeout waiting for connections to close, forcing shutdown");
         }
 
-        // 4. Now we can safely close the serial port
-        info!("Closing serial port");
-        if let Err(e) = self.transport.close().await {
-            error!("Error closing serial port: {}", e);
-        }
+        // Schedulers serve what is still queued, then stop
+        trace!("Stopping bus schedulers");
+        let _ = self.bus_shutdown.send(());
 
-        // 5. Waiting for all tasks to complete
+        // 4. Waiting for all tasks to complete, schedulers included
         trace!("Waiting for tasks to complete");
         let tasks = {
             let mut tasks_guard = self.tasks.lock().await;
@@ -370,6 +707,14 @@ impl ModbusRelay {
             }
         }
 
+        // 5. Now we can safely close the serial ports and upstream connections
+        for bus in self.buses.iter() {
+            info!("Closing bus {}", bus.name);
+            if let Err(e) = bus.link.close().await {
+                error!("Error closing bus {}: {}", bus.name, e);
+            }
+        }
+
         let handle = {
             let mut guard = self.stats_manager_handle.lock().await;
             guard.take()
@@ -401,94 +746,6 @@ impl ModbusRelay {
     }
 }
 
-async fn read_frame(
-    reader: &mut tokio::net::tcp::ReadHalf<'_>,
-    peer_addr: &SocketAddr,
-    trace_frames: bool,
-) -> Result<(Vec<u8>, [u8; 2]), RelayError> {
-    let mut tcp_buf = vec![0u8; 256];
-
-    // Read TCP request with timeout
-    let n = match timeout(Duration::from_secs(60), reader.read(&mut tcp_buf)).await {
-        Ok(Ok(0)) => {
-            return Err(RelayError::Connection(ConnectionError::Disconnected));
-        }
-        Ok(Ok(n)) => {
-            if n < 7 {
-                return Err(RelayError::frame(
-                    FrameErrorKind::TooShort,
-                    format!("Frame too short: {} bytes", n),
-                    Some(tcp_buf[..n].to_vec()),
-                ));
-            }
-            n
-        }
-        Ok(Err(e)) => {
-            return Err(RelayError::Connection(ConnectionError::InvalidState(
-                format!("Connection lost: {}", e),
-            )));
-        }
-        Err(_) => {
-            return Err(RelayError::Connection(ConnectionError::Timeout(
-                "Read operation timed out".to_string(),
-            )));
-        }
-    };
-
-    if trace_frames {
-        trace!(
-            "Received TCP frame from {}: {:02X?}",
-            peer_addr,
-            &tcp_buf[..n]
-        );
-    }
-
-    // Validate MBAP header
-    let transaction_id = [tcp_buf[0], tcp_buf[1]];
-    let protocol_id = u16::from_be_bytes([tcp_buf[2], tcp_buf[3]]);
-    if protocol_id != 0 {
-        return Err(RelayError::protocol(
-            ProtocolErrorKind::InvalidProtocolId,
-            format!("Invalid protocol ID: {}", protocol_id),
-        ));
-    }
-
-    let length = u16::from_be_bytes([tcp_buf[4], tcp_buf[5]]) as usize;
-    if length > 249 {
-        return Err(RelayError::frame(
-            FrameErrorKind::TooLong,
-            format!("Frame too long: {} bytes", length),
-            None,
-        ));
-    }
-
-    if length + 6 != n {
-        return Err(RelayError::frame(
-            FrameErrorKind::InvalidFormat,
-            format!("Invalid frame length, expected {}, got {}", length + 6, n),
-            Some(tcp_buf[..n].to_vec()),
-        ));
-    }
-
-    Ok((tcp_buf[..n].to_vec(), transaction_id))
-}
-
-async fn process_frame(
-    modbus: &ModbusProcessor,
-    frame: &[u8],
-    transaction_id: [u8; 2],
-    trace_frames: bool,
-) -> Result<Vec<u8>, RelayError> {
-    modbus
-        .process_request(
-            transaction_id,
-            frame[6],    // Unit ID
-            &frame[7..], // PDU
-            trace_frames,
-        )
-        .await
-}
-
 async fn send_response(
     writer: &mut tokio::net::tcp::WriteHalf<'_>,
     response: &[u8],
@@ -515,143 +772,205 @@ async fn send_response(
     }
 }
 
-async fn handle_frame(
-    reader: &mut tokio::net::tcp::ReadHalf<'_>,
-    writer: &mut tokio::net::tcp::WriteHalf<'_>,
-    peer_addr: &SocketAddr,
-    modbus: &ModbusProcessor,
-    stats_tx: &mpsc::Sender<StatEvent>,
-    trace_frames: bool,
-) -> Result<bool, RelayError> {
-    let frame_start = Instant::now();
-
-    // 1. Read frame
-    let (frame, transaction_id) = match read_frame(reader, peer_addr, trace_frames).await {
-        Ok((frame, id)) => (frame, id),
-        Err(RelayError::Connection(ConnectionError::Disconnected)) => {
-            info!("Client {} disconnected", peer_addr);
-            return Ok(false); // Signal to break the loop
-        }
-        Err(e) => {
-            stats_tx
-                .send(StatEvent::RequestProcessed {
-                    addr: *peer_addr,
-                    success: false,
-                    duration_ms: frame_start.elapsed().as_millis() as u64,
-                })
-                .await
-                .map_err(|e| {
-                    warn!("Failed to send stats event: {}", e);
-                })
-                .ok();
-
-            return Err(e);
-        }
-    };
-
-    // 2. Process frame
-    let response = match process_frame(modbus, &frame, transaction_id, trace_frames).await {
-        Ok(response) => {
-            // Record successful Modbus request
-            stats_tx
-                .send(StatEvent::RequestProcessed {
-                    addr: *peer_addr,
-                    success: true,
-                    duration_ms: frame_start.elapsed().as_millis() as u64,
-                })
-                .await
-                .map_err(|e| {
-                    warn!("Failed to send stats event: {}", e);
-                })
-                .ok();
-
-            response
-        }
-        Err(e) => {
-            // Record failed Modbus request
-            stats_tx
-                .send(StatEvent::RequestProcessed {
-                    addr: *peer_addr,
-                    success: false,
-                    duration_ms: frame_start.elapsed().as_millis() as u64,
-                })
-                .await
-                .map_err(|e| {
-                    warn!("Failed to send stats event: {}", e);
-                })
-                .ok();
-
-            return Err(e);
-        }
-    };
-
-    // 3. Send response
-    if let Err(e) = send_response(writer, &response, peer_addr, trace_frames).await {
-        stats_tx
-            .send(StatEvent::RequestProcessed {
-                addr: *peer_addr,
-                success: false,
-                duration_ms: frame_start.elapsed().as_millis() as u64,
-            })
-            .await
-            .map_err(|e| {
-                warn!("Failed to send stats event: {}", e);
-            })
-            .ok();
-
-        return Err(e);
-    }
-
-    Ok(true) // Continue the loop
-}
-
+#[allow(clippy::too_many_arguments)]
 async fn handle_client(
     mut stream: TcpStream,
     peer_addr: SocketAddr,
-    transport: Arc<RtuTransport>,
+    buses: Arc<BusRouter<RelayBus>>,
+    pinned: Option<usize>,
     manager: Arc<ConnectionManager>,
-    stats_tx: mpsc::Sender<StatEvent>,
     mut shutdown_rx: broadcast::Receiver<()>,
     trace_frames: bool,
+    pipeline_depth: usize,
+    idle_timeout: Duration,
 ) -> Result<(), RelayError> {
     // Create connection guard to track this connection
-    let _guard = manager.accept_connection(peer_addr).await?;
-
-    let request_id = generate_request_id();
-
-    let client_span = tracing::info_span!(
-        "client_connection",
-        %peer_addr,
-        request_id = %request_id,
-        protocol = "modbus_tcp"
-    );
-    let _enter = client_span.enter();
-
-    let addr = stream.peer_addr().map_err(|e| {
-        RelayError::Transport(TransportError::Io {
-            operation: IoOperation::Control,
-            details: "Failed to get peer address".to_string(),
-            source: e,
-        })
-    })?;
+    let guard = manager.accept_connection(peer_addr).await?;
+
+    debug!("New client connected from {}", peer_addr);
 
-    debug!("New client connected from {}", addr);
+    // Priority rules may match on the port the client connected to
+    let listen_port = stream.local_addr().map_or(0, |local| local.port());
 
     let (mut reader, mut writer) = stream.split();
-    let modbus = ModbusProcessor::new(transport);
+
+    // Requests are read ahead and processed while earlier ones wait for the
+    // bus, responses leave in the order the requests arrived. Buses and
+    // their processors are shared, what a connection owns itself is kept
+    // small so thousands of idle ones stay cheap.
+    let default_bus = &buses.default_bus().modbus;
+    let mut framer = MbapFramer::with_pool(default_bus.buffers());
+    let latency = default_bus.latency();
+    let metrics = default_bus.metrics();
+    let capture = default_bus.capture();
+    let mut in_flight = FuturesOrdered::new();
+    let mut disconnected = false;
+    let rate_limit_exception = manager.rate_limiter().exception_code();
+
+    // One timer for the whole connection, activity only moves the deadline
+    // and the timer is re-armed when it fires early
+    let mut last_activity = Instant::now();
+    let idle = sleep(idle_timeout);
+    tokio::pin!(idle);
 
     loop {
+        // Nothing new is taken once the client is going away
+        while !disconnected && in_flight.len() < pipeline_depth {
+            let frame_start = Instant::now();
+
+            match framer.next_frame() {
+                Ok(Some(frame)) => {
+                    if trace_frames {
+                        trace!("Received TCP frame from {}: {:?}", peer_addr, frame);
+                    }
+
+                    if let Some(capture) = &capture {
+                        capture.record_tcp(Direction::TcpRequest, peer_addr, &frame);
+                    }
+
+                    metrics.record_request();
+
+                    // The framer never hands out frames without a function code
+                    let (unit_id, function) = (frame[6], frame[7]);
+
+                    let modbus = match pinned {
+                        Some(index) => &buses.get(index).modbus,
+                        None => &buses.route(unit_id).modbus,
+                    };
+                    let priority = modbus.classify(peer_addr.ip(), listen_port, function);
+                    let limited = !guard.try_request();
+
+                    // A broadcast on the shared port is meant for every
+                    // serial line, not just the one unit 0 routes to
+                    let fan_out: Vec<&ModbusProcessor> = match (pinned, unit_id) {
+                        (None, 0) => buses
+                            .iter()
+                            .filter(|bus| matches!(bus.link, BusLink::Rtu(..)))
+                            .map(|bus| bus.modbus.as_ref())
+                            .collect(),
+                        _ => Vec::new(),
+                    };
+
+                    in_flight.push_back(async move {
+                        let result = match limited {
+                            true => Ok(modbus.exception_response(
+                                [frame[0], frame[1]],
+                                unit_id,
+                                function,
+                                rate_limit_exception,
+                            )),
+                            // Answered once every line has sent it, with
+                            // the first failure if there was one
+                            false if fan_out.len() > 1 => {
+                                futures::future::join_all(fan_out.iter().map(|bus| {
+                                    bus.process_frame(
+                                        peer_addr,
+                                        priority,
+                                        frame.clone(),
+                                        trace_frames,
+                                    )
+                                }))
+                                .await
+                                .into_iter()
+                                .reduce(|first, result| {
+                                    first.and_then(|first| result.map(|_| first))
+                                })
+                                .expect("at least two buses")
+                            }
+                            false => {
+                                modbus
+                                    .process_frame(peer_addr, priority, frame, trace_frames)
+                                    .await
+                            }
+                        };
+                        (result, frame_start, unit_id, function)
+                    });
+                }
+                Ok(None) => break,
+                Err(e) => {
+                    guard.record_request(false, frame_start.elapsed());
+                    return Err(e);
+                }
+            }
+        }
+
+        if disconnected && in_flight.is_empty() {
+            break;
+        }
+
+        let can_read = !disconnected && in_flight.len() < pipeline_depth;
+        let waiting = in_flight.is_empty() && framer.pending() == 0;
+
         tokio::select! {
-            result = handle_frame(&mut reader, &mut writer, &peer_addr, &modbus, &stats_tx, trace_frames) => {
-                match result {
-                    Ok(true) => continue,
-                    Ok(false) => break, // Client disconnected
-                    Err(e) => return Err(e),
+            read = async {
+                // An idle connection waits for data without a read buffer
+                if waiting {
+                    framer.release();
+                    reader.readable().await?;
+                }
+                framer.read_from(&mut reader).await
+            }, if can_read => {
+                let read_start = Instant::now();
+                last_activity = read_start;
+
+                match read {
+                    Ok(0) => {
+                        info!("Client {} disconnected", peer_addr);
+                        disconnected = true;
+                    }
+                    Ok(_) => {}
+                    Err(e) => {
+                        guard.record_request(false, read_start.elapsed());
+                        return Err(RelayError::Connection(ConnectionError::InvalidState(
+                            format!("Connection lost: {}", e),
+                        )));
+                    }
                 }
             }
-            _ = shutdown_rx.recv() => {
-                info!("Client {} received shutdown signal", peer_addr);
-                break;
+            () = &mut idle, if can_read => {
+                let deadline = last_activity + idle_timeout;
+                if Instant::now() >= deadline {
+                    guard.record_request(false, Duration::ZERO);
+                    return Err(RelayError::Connection(ConnectionError::Timeout(
+                        "Read operation timed out".to_string(),
+                    )));
+                }
+                idle.as_mut().reset(deadline.into());
+            }
+            Some((result, frame_start, unit_id, function)) = in_flight.next() => {
+                let response = match result {
+                    Ok(response) => response,
+                    Err(e) => {
+                        guard.record_request(false, frame_start.elapsed());
+                        return Err(e);
+                    }
+                };
+
+                if response.get(7).is_some_and(|function| function & 0x80 != 0) {
+                    metrics.record_exception();
+                }
+
+                if let Some(capture) = &capture {
+                    capture.record_tcp(Direction::TcpResponse, peer_addr, &response);
+                }
+
+                let sent = send_response(&mut writer, &response, &peer_addr, trace_frames).await;
+                last_activity = Instant::now();
+                let elapsed = frame_start.elapsed();
+                guard.record_request(sent.is_ok(), elapsed);
+                sent?;
+
+                latency.record_total(peer_addr.ip(), unit_id, function, elapsed.as_micros() as u64);
+            }
+            // Requests already read still get their response, the bus
+            // transactions behind them are not cut off halfway
+            _ = shutdown_rx.recv(), if !disconnected => {
+                info!(
+                    "Client {} received shutdown signal, finishing {} requests",
+                    peer_addr,
+                    in_flight.len()
+                );
+                disconnected = true;
             }
         }
     }
@@ -663,15 +982,244 @@ async fn handle_client(
 
 #[cfg(test)]
 mod tests {
-    // use super::*;
+    use tokio::io::{AsyncReadExt, AsyncWriteExt};
+
+    use crate::{
+        mock::{MockSlave, PtySlave},
+        BusConfig, HttpConfig, RtsType, RtuConfig, TcpConfig, UnitRange,
+    };
+
+    use super::*;
+
+    #[tokio::test]
+    async fn test_modbus_relay_roundtrip_and_shutdown() {
+        let slave = PtySlave::spawn(Arc::new(MockSlave::new())).unwrap();
+        let port = std::net::TcpListener::bind("127.0.0.1:0")
+            .unwrap()
+            .local_addr()
+            .unwrap()
+            .port();
+
+        let config = RelayConfig {
+            tcp: TcpConfig {
+                bind_addr: "127.0.0.1".to_string(),
+                bind_port: port,
+                ..Default::default()
+            },
+            rtu: RtuConfig {
+                device: slave.device().to_string(),
+                rts_type: RtsType::None,
+                flush_after_write: false,
+                ..Default::default()
+            },
+            http: HttpConfig {
+                enabled: false,
+                ..Default::default()
+            },
+            ..Default::default()
+        };
+        let relay = Arc::new(ModbusRelay::new(config).unwrap());
+        let run = tokio::spawn(Arc::clone(&relay).run());
+
+        let mut stream = loop {
+            match TcpStream::connect(("127.0.0.1", port)).await {
+                Ok(stream) => break stream,
+                Err(_) => sleep(Duration::from_millis(10)).await,
+            }
+        };
+
+        // Read Holding Registers 10-11 of unit 1
+        stream
+            .write_all(&[
+                0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x01, 0x03, 0x00, 0x0A, 0x00, 0x02,
+            ])
+            .await
+            .unwrap();
+        let mut response = [0u8; 13];
+        stream.read_exact(&mut response).await.unwrap();
+        assert_eq!(
+            response,
+            [0x00, 0x01, 0x00, 0x00, 0x00, 0x07, 0x01, 0x03, 0x04, 0x00, 0x0A, 0x00, 0x0B]
+        );
+        drop(stream);
+
+        assert!(relay.shutdown().await.is_ok());
+        assert!(run.await.unwrap().is_ok());
+    }
+
+    #[tokio::test]
+    async fn test_broadcast_reaches_every_line() {
+        let (default_slave, line2_slave) = (Arc::new(MockSlave::new()), Arc::new(MockSlave::new()));
+        let default_pty = PtySlave::spawn(Arc::clone(&default_slave)).unwrap();
+        let line2_pty = PtySlave::spawn(Arc::clone(&line2_slave)).unwrap();
+        let port = std::net::TcpListener::bind("127.0.0.1:0")
+            .unwrap()
+            .local_addr()
+            .unwrap()
+            .port();
+
+        let rtu = |device: &str| RtuConfig {
+            device: device.to_string(),
+            rts_type: RtsType::None,
+            flush_after_write: false,
+            ..Default::default()
+        };
+        let config = RelayConfig {
+            tcp: TcpConfig {
+                bind_addr: "127.0.0.1".to_string(),
+                bind_port: port,
+                ..Default::default()
+            },
+            rtu: rtu(default_pty.device()),
+            http: HttpConfig {
+                enabled: false,
+                ..Default::default()
+            },
+            buses: vec![BusConfig {
+                name: "line2".to_string(),
+                rtu: Some(rtu(line2_pty.device())),
+                upstream: None,
+                scheduler: None,
+                unit_ids: vec![UnitRange { start: 1, end: 10 }],
+                bind_port: None,
+            }],
+            ..Default::default()
+        };
+        let relay = Arc::new(ModbusRelay::new(config).unwrap());
+        let run = tokio::spawn(Arc::clone(&relay).run());
+
+        let mut stream = loop {
+            match TcpStream::connect(("127.0.0.1", port)).await {
+                Ok(stream) => break stream,
+                Err(_) => sleep(Duration::from_millis(10)).await,
+            }
+        };
+
+        // Write Single Register 5 = 0x1234 to every unit
+        let request = [
+            0x00, 0x01, 0x00, 0x00, 0x00, 0x06, 0x00, 0x06, 0x00, 0x05, 0x12, 0x34,
+        ];
+        stream.write_all(&request).await.unwrap();
+        let mut response = [0u8; 12];
+        stream.read_exact(&mut response).await.unwrap();
+        assert_eq!(response, request);
+
+        assert_eq!(default_slave.register(5), 0x1234);
+        assert_eq!(line2_slave.register(5), 0x1234);
+
+        drop(stream);
+        assert!(relay.shutdown().await.is_ok());
+        assert!(run.await.unwrap().is_ok());
+    }
 
-    // #[tokio::test]
-    // Disabled for now, needs port mocking
-    // async fn test_modbus_relay_shutdown() {
-    //     let mut config = RelayConfig::default();
-    //     config.rtu.device = "/dev/null".to_string();
-    //     let relay = ModbusRelay::new(config).unwrap();
+    #[tokio::test]
+    async fn test_reload_changes_response_timeout() {
+        let slave = PtySlave::spawn(Arc::new(MockSlave::new())).unwrap();
+        let mut config = RelayConfig {
+            rtu: RtuConfig {
+                device: slave.device().to_string(),
+                rts_type: RtsType::None,
+                flush_after_write: false,
+                serial_timeout: Duration::from_millis(100),
+                ..Default::default()
+            },
+            ..Default::default()
+        };
+        let relay = ModbusRelay::new(config.clone()).unwrap();
+        let timeouts = &relay.buses.default_bus().timeouts;
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(300));
+
+        config.rtu.serial_timeout = Duration::from_millis(20);
+        relay.reload(&config);
+        assert_eq!(timeouts.timeout(1, 0x03), Duration::from_millis(60));
+    }
 
-    //     assert!(relay.shutdown().await.is_ok());
-    // }
+    #[tokio::test]
+    async fn test_shutdown_answers_pipelined_requests() {
+        let slave = Arc::new(MockSlave::new().with_latency(Duration::from_millis(100)));
+        let slave = PtySlave::spawn(slave).unwrap();
+        let port = std::net::TcpListener::bind("127.0.0.1:0")
+            .unwrap()
+            .local_addr()
+            .unwrap()
+            .port();
+
+        let config = RelayConfig {
+            tcp: TcpConfig {
+                bind_addr: "127.0.0.1".to_string(),
+                bind_port: port,
+                ..Default::default()
+            },
+            rtu: RtuConfig {
+                device: slave.device().to_string(),
+                rts_type: RtsType::None,
+                flush_after_write: false,
+                ..Default::default()
+            },
+            http: HttpConfig {
+                enabled: false,
+                ..Default::default()
+            },
+            ..Default::default()
+        };
+        let relay = Arc::new(ModbusRelay::new(config).unwrap());
+        let run = tokio::spawn(Arc::clone(&relay).run());
+
+        let mut stream = loop {
+            match TcpStream::connect(("127.0.0.1", port)).await {
+                Ok(stream) => break stream,
+                Err(_) => sleep(Duration::from_millis(10)).await,
+            }
+        };
+
+        // Three reads queued behind each other on the slow bus
+        let mut requests = Vec::new();
+        for transaction_id in 1..=3u8 {
+            requests.extend_from_slice(&[
+                0x00,
+                transaction_id,
+                0x00,
+                0x00,
+                0x00,
+                0x06,
+                0x01,
+                0x03,
+                0x00,
+                transaction_id,
+                0x00,
+                0x01,
+            ]);
+        }
+        stream.write_all(&requests).await.unwrap();
+        sleep(Duration::from_millis(50)).await;
+
+        let shutdown = tokio::spawn({
+            let relay = Arc::clone(&relay);
+            async move { relay.shutdown().await }
+        });
+
+        for transaction_id in 1..=3u8 {
+            let mut response = [0u8; 11];
+            stream.read_exact(&mut response).await.unwrap();
+            assert_eq!(
+                response,
+                [
+                    0x00,
+                    transaction_id,
+                    0x00,
+                    0x00,
+                    0x00,
+                    0x05,
+                    0x01,
+                    0x03,
+                    0x02,
+                    0x00,
+                    transaction_id
+                ]
+            );
+        }
+
+        assert!(shutdown.await.unwrap().is_ok());
+        assert!(run.await.unwrap().is_ok());
+    }
 }
@@ -0,0 +1,334 @@
+use std::{
+    net::{IpAddr, Ipv4Addr, SocketAddr},
+    sync::{
+        atomic::{AtomicBool, AtomicU64, Ordering},
+        Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Serialize;
+use tokio::sync::{broadcast, Notify};
+use tracing::{debug, info};
+
+use crate::{
+    cache::{CacheKey, WriteRange},
+    frame_buffer::FrameBuffer,
+    scheduler::{BusHandle, ReadSpan},
+    PollBlock, Priority,
+};
+
+/// Client address the poller's requests are scheduled and accounted under
+pub const POLLER_ADDR: SocketAddr = SocketAddr::new(IpAddr::V4(Ipv4Addr::UNSPECIFIED), 0);
+
+/// Last data read for a block
+struct BlockData {
+    /// Data bytes of the read response, without unit, function and count
+    data: Vec<u8>,
+    updated_at: Option<Instant>,
+}
+
+struct Block {
+    span: ReadSpan,
+    key: CacheKey,
+    interval: Duration,
+    data: Mutex<BlockData>,
+    /// Bumped by writes, a poll that started before one is not stored
+    generation: AtomicU64,
+    /// Set by writes, polls the block ahead of its schedule
+    refresh: AtomicBool,
+    polls: AtomicU64,
+    errors: AtomicU64,
+    hits: AtomicU64,
+}
+
+#[derive(Debug, Clone, Serialize)]
+pub struct PollBlockSnapshot {
+    pub unit_id: u8,
+    pub function: u8,
+    pub start: u16,
+    pub quantity: u16,
+    /// Time since the data was read, `None` if there is no valid data
+    pub age_ms: Option<u64>,
+    pub polls: u64,
+    pub errors: u64,
+    /// Client reads answered from this block
+    pub hits: u64,
+}
+
+/// In-memory copy of the register and coil blocks polled on one bus.
+///
+/// [`ShadowImage::run`] reads every block on its own interval through the
+/// bus scheduler, client reads covered by a block no older than `max_age`
+/// are answered from memory without touching the bus, so bus load no
+/// longer grows with the number of clients. Writes still go to the bus,
+/// the blocks they touch are not served again until they have been read
+/// back.
+pub struct ShadowImage {
+    blocks: Vec<Block>,
+    max_age: Duration,
+    wake: Notify,
+}
+
+impl ShadowImage {
+    pub fn new<'a>(blocks: impl IntoIterator<Item = &'a PollBlock>, max_age: Duration) -> Self {
+        let blocks = blocks
+            .into_iter()
+            .map(|block| {
+                let key = CacheKey {
+                    unit_id: block.unit_id,
+                    function: block.function,
+                    start: block.start,
+                    quantity: block.quantity,
+                };
+
+                Block {
+                    span: ReadSpan::from(key),
+                    key,
+                    interval: block.interval,
+                    data: Mutex::new(BlockData {
+                        data: Vec::new(),
+                        updated_at: None,
+                    }),
+                    generation: AtomicU64::new(0),
+                    refresh: AtomicBool::new(false),
+                    polls: AtomicU64::new(0),
+                    errors: AtomicU64::new(0),
+                    hits: AtomicU64::new(0),
+                }
+            })
+            .collect();
+
+        Self {
+            blocks,
+            max_age,
+            wake: Notify::new(),
+        }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.blocks.is_empty()
+    }
+
+    /// Writes the RTU response to the read `key`, without CRC, into
+    /// `response` if a block with fresh enough data covers it
+    pub fn read(&self, key: &CacheKey, response: &mut FrameBuffer) -> bool {
+        let part = ReadSpan::from(*key);
+
+        for block in self.blocks.iter().filter(|block| block.span.covers(&part)) {
+            let data = block.data.lock().unwrap();
+            let fresh = data
+                .updated_at
+                .is_some_and(|updated_at| updated_at.elapsed() <= self.max_age);
+
+            if fresh {
+                block.span.write_part(&part, &data.data, response);
+                block.hits.fetch_add(1, Ordering::Relaxed);
+                return true;
+            }
+        }
+
+        false
+    }
+
+    /// Drops the data of every block `write` to `unit_id` may have changed
+    /// and has them read back right away
+    pub fn invalidate(&self, unit_id: u8, write: WriteRange) {
+        let mut touched = false;
+
+        for block in &self.blocks {
+            if (unit_id == 0 || block.key.unit_id == unit_id) && write.overlaps(&block.key) {
+                block.generation.fetch_add(1, Ordering::AcqRel);
+                block.data.lock().unwrap().updated_at = None;
+                block.refresh.store(true, Ordering::Release);
+                touched = true;
+            }
+        }
+
+        if touched {
+            self.wake.notify_one();
+        }
+    }
+
+    /// Polls the blocks through `bus` until shutdown is signalled
+    pub async fn run(&self, bus: BusHandle, mut shutdown_rx: broadcast::Receiver<()>) {
+        if self.blocks.is_empty() {
+            return;
+        }
+        info!("Polling {} blocks into the shadow image", self.blocks.len());
+
+        let mut due = vec![Instant::now(); self.blocks.len()];
+
+        loop {
+            for (block, due) in self.blocks.iter().zip(due.iter_mut()) {
+                let now = Instant::now();
+                // Cleared on every pass, a poll that was due anyway serves it
+                let refresh = block.refresh.swap(false, Ordering::AcqRel);
+                if *due > now && !refresh {
+                    continue;
+                }
+
+                self.poll(block, &bus).await;
+
+                // Keep the schedule, skipping polls the bus had no time for
+                *due += block.interval;
+                if *due <= now {
+                    *due = now + block.interval;
+                }
+            }
+
+            let next = due.iter().min().copied().unwrap_or_else(Instant::now);
+            tokio::select! {
+                _ = tokio::time::sleep_until(next.into()) => {}
+                _ = self.wake.notified() => {}
+                _ = shutdown_rx.recv() => break,
+            }
+        }
+    }
+
+    async fn poll(&self, block: &Block, bus: &BusHandle) {
+        let generation = block.generation.load(Ordering::Acquire);
+        let mut frame = bus.buffers().get();
+        block.span.to_frame(&mut frame);
+        block.polls.fetch_add(1, Ordering::Relaxed);
+
+        let result = bus
+            .transaction(POLLER_ADDR, Priority::Normal, block.key.unit_id, frame)
+            .await;
+
+        let response = match result {
+            Ok(response) => response,
+            Err(e) => {
+                debug!("Polling {:?} failed: {}", block.key, e);
+                block.errors.fetch_add(1, Ordering::Relaxed);
+                return;
+            }
+        };
+        let Some(data) = block.span.response_data(&response) else {
+            debug!("Polling {:?} returned an exception", block.key);
+            block.errors.fetch_add(1, Ordering::Relaxed);
+            return;
+        };
+
+        let mut stored = block.data.lock().unwrap();
+        // A write went out while the read was on its way, the data may
+        // predate it
+        if block.generation.load(Ordering::Acquire) != generation {
+            return;
+        }
+        stored.data.clear();
+        stored.data.extend_from_slice(data);
+        stored.updated_at = Some(Instant::now());
+    }
+
+    pub fn snapshot(&self) -> Vec<PollBlockSnapshot> {
+        self.blocks
+            .iter()
+            .map(|block| {
+                let updated_at = block.data.lock().unwrap().updated_at;
+
+                PollBlockSnapshot {
+                    unit_id: block.key.unit_id,
+                    function: block.key.function,
+                    start: block.key.start,
+                    quantity: block.key.quantity,
+                    age_ms: updated_at.map(|updated_at| updated_at.elapsed().as_millis() as u64),
+                    polls: block.polls.load(Ordering::Relaxed),
+                    errors: block.errors.load(Ordering::Relaxed),
+                    hits: block.hits.load(Ordering::Relaxed),
+                }
+            })
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use crate::frame_buffer::BufferPool;
+
+    use super::*;
+
+    fn block(start: u16, quantity: u16) -> PollBlock {
+        PollBlock {
+            unit_id: 1,
+            function: 0x03,
+            start,
+            quantity,
+            interval: Duration::from_secs(1),
+        }
+    }
+
+    fn key(start: u16, quantity: u16) -> CacheKey {
+        CacheKey {
+            unit_id: 1,
+            function: 0x03,
+            start,
+            quantity,
+        }
+    }
+
+    /// Stores registers `start..start + values.len()` into the first block
+    fn store(image: &ShadowImage, values: &[u16]) {
+        let block = &image.blocks[0];
+        let mut data = block.data.lock().unwrap();
+        data.data = values
+            .iter()
+            .flat_map(|value| value.to_be_bytes())
+            .collect();
+        data.updated_at = Some(Instant::now());
+    }
+
+    #[test]
+    fn test_read_from_image() {
+        let pool = BufferPool::new(1);
+        let image = ShadowImage::new(&[block(100, 4)], Duration::from_secs(5));
+
+        // Nothing polled yet
+        let mut response = pool.get();
+        assert!(!image.read(&key(100, 2), &mut response));
+
+        store(&image, &[10, 11, 12, 13]);
+        assert!(image.read(&key(101, 2), &mut response));
+        assert_eq!(&response[..], &[0x01, 0x03, 0x04, 0x00, 11, 0x00, 12]);
+
+        // Partly outside the block and other units go to the bus
+        assert!(!image.read(&key(102, 4), &mut pool.get()));
+        assert!(!image.read(
+            &CacheKey {
+                unit_id: 2,
+                ..key(100, 1)
+            },
+            &mut pool.get()
+        ));
+
+        assert_eq!(image.snapshot()[0].hits, 1);
+        assert!(image.snapshot()[0].age_ms.is_some());
+    }
+
+    #[test]
+    fn test_write_invalidates_block() {
+        let pool = BufferPool::new(1);
+        let image = ShadowImage::new(&[block(0, 10), block(20, 10)], Duration::from_secs(5));
+        store(&image, &[0; 10]);
+
+        // Write Single Register 5 of another unit, then of this one
+        let write = WriteRange::from_request(&[0x06, 0x00, 0x05, 0x00, 0x01]).unwrap();
+        image.invalidate(2, write);
+        assert!(image.read(&key(0, 1), &mut pool.get()));
+
+        image.invalidate(1, write);
+        assert!(!image.read(&key(0, 1), &mut pool.get()));
+        assert!(image.blocks[0].refresh.load(Ordering::Relaxed));
+        assert!(!image.blocks[1].refresh.load(Ordering::Relaxed));
+        assert_eq!(image.snapshot()[0].age_ms, None);
+    }
+
+    #[test]
+    fn test_stale_data_not_served() {
+        let image = ShadowImage::new(&[block(0, 2)], Duration::from_millis(10));
+        store(&image, &[1, 2]);
+        std::thread::sleep(Duration::from_millis(20));
+
+        assert!(!image.read(&key(0, 2), &mut BufferPool::new(1).get()));
+    }
+}
@@ -0,0 +1,249 @@
+use std::{
+    sync::{
+        atomic::{AtomicU32, AtomicU64, Ordering},
+        OnceLock,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Serialize;
+
+/// One second buckets, the last minute
+const FINE_WIDTH_SECS: u64 = 1;
+const FINE_BUCKETS: usize = 60;
+
+/// Fifteen second buckets, the last fifteen minutes
+const COARSE_WIDTH_SECS: u64 = 15;
+const COARSE_BUCKETS: usize = 60;
+
+/// Time since the first window was created, shared by all of them
+fn uptime() -> Duration {
+    static EPOCH: OnceLock<Instant> = OnceLock::new();
+    EPOCH.get_or_init(Instant::now).elapsed()
+}
+
+/// Counts of one time slice, tagged with the slice they belong to
+#[derive(Debug, Default)]
+struct Bucket {
+    /// Index of the slice plus one, 0 for a bucket never written
+    tag: AtomicU32,
+    requests: AtomicU32,
+    errors: AtomicU32,
+    busy_us: AtomicU64,
+}
+
+impl Bucket {
+    fn record(&self, tag: u32, error: bool, busy_us: u64) {
+        let current = self.tag.load(Ordering::Acquire);
+        // The first writer of a new slice clears what the ring left behind
+        if current != tag
+            && self
+                .tag
+                .compare_exchange(current, tag, Ordering::AcqRel, Ordering::Acquire)
+                .is_ok()
+        {
+            self.requests.store(0, Ordering::Relaxed);
+            self.errors.store(0, Ordering::Relaxed);
+            self.busy_us.store(0, Ordering::Relaxed);
+        }
+
+        self.requests.fetch_add(1, Ordering::Relaxed);
+        if error {
+            self.errors.fetch_add(1, Ordering::Relaxed);
+        }
+        self.busy_us.fetch_add(busy_us, Ordering::Relaxed);
+    }
+
+    /// Counts of slice `tag`, zero if the bucket holds another one
+    fn read(&self, tag: u32) -> (u64, u64, u64) {
+        if self.tag.load(Ordering::Acquire) != tag {
+            return (0, 0, 0);
+        }
+        (
+            self.requests.load(Ordering::Relaxed) as u64,
+            self.errors.load(Ordering::Relaxed) as u64,
+            self.busy_us.load(Ordering::Relaxed),
+        )
+    }
+}
+
+/// Ring of `N` buckets `width` seconds wide
+#[derive(Debug)]
+struct Ring<const N: usize> {
+    width_secs: u64,
+    buckets: [Bucket; N],
+}
+
+impl<const N: usize> Ring<N> {
+    fn new(width_secs: u64) -> Self {
+        Self {
+            width_secs,
+            buckets: std::array::from_fn(|_| Bucket::default()),
+        }
+    }
+
+    fn slice(&self, at: Duration) -> u64 {
+        at.as_secs() / self.width_secs
+    }
+
+    fn record(&self, at: Duration, error: bool, busy_us: u64) {
+        let slice = self.slice(at);
+        self.buckets[slice as usize % N].record(slice as u32 + 1, error, busy_us);
+    }
+
+    /// Rates over the last `slices` complete slices before `at`, fewer if
+    /// the window has not been around that long
+    fn rates(&self, at: Duration, created: Duration, slices: usize) -> WindowRates {
+        let current = self.slice(at);
+        // The slice the window was created in only counts once complete
+        let first = self.slice(created) + 1;
+        let slices = (slices.min(N) as u64).min(current.saturating_sub(first));
+        if slices == 0 {
+            return WindowRates::default();
+        }
+
+        let (mut requests, mut errors, mut busy_us) = (0, 0, 0);
+        for slice in current - slices..current {
+            let (r, e, b) = self.buckets[slice as usize % N].read(slice as u32 + 1);
+            requests += r;
+            errors += e;
+            busy_us += b;
+        }
+
+        let secs = (slices * self.width_secs) as f64;
+        WindowRates {
+            requests_per_second: requests as f64 / secs,
+            errors_per_second: errors as f64 / secs,
+            busy_ratio: busy_us as f64 / (secs * 1e6),
+        }
+    }
+}
+
+/// Request rates over one window
+#[derive(Debug, Clone, Copy, Default, PartialEq, Serialize)]
+pub struct WindowRates {
+    pub requests_per_second: f64,
+    pub errors_per_second: f64,
+    /// Busy time per second of the window: the share of time a bus was
+    /// occupied, or the average number of client requests in flight
+    pub busy_ratio: f64,
+}
+
+/// Request rates over the last 1, 5 and 15 minutes
+#[derive(Debug, Clone, Copy, Default, PartialEq, Serialize)]
+pub struct RateReport {
+    #[serde(rename = "1m")]
+    pub one_minute: WindowRates,
+    #[serde(rename = "5m")]
+    pub five_minutes: WindowRates,
+    #[serde(rename = "15m")]
+    pub fifteen_minutes: WindowRates,
+}
+
+/// Requests, errors and busy time in time buckets over the last 15 minutes.
+///
+/// Recording touches two buckets with relaxed atomics, whatever the rate,
+/// reading sums a fixed number of them. Rates cover complete buckets only,
+/// so the last minute lags by up to a second and the longer windows by up
+/// to fifteen. A request racing its bucket being reused for a new slice
+/// may go uncounted.
+#[derive(Debug)]
+pub struct RateWindow {
+    fine: Ring<FINE_BUCKETS>,
+    coarse: Ring<COARSE_BUCKETS>,
+    created: Duration,
+}
+
+impl Default for RateWindow {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl RateWindow {
+    pub fn new() -> Self {
+        Self::new_at(uptime())
+    }
+
+    fn new_at(created: Duration) -> Self {
+        Self {
+            fine: Ring::new(FINE_WIDTH_SECS),
+            coarse: Ring::new(COARSE_WIDTH_SECS),
+            created,
+        }
+    }
+
+    /// Records a request that kept its bus or client busy for `busy`
+    pub fn record(&self, error: bool, busy: Duration) {
+        self.record_at(uptime(), error, busy);
+    }
+
+    fn record_at(&self, at: Duration, error: bool, busy: Duration) {
+        let busy_us = busy.as_micros() as u64;
+        self.fine.record(at, error, busy_us);
+        self.coarse.record(at, error, busy_us);
+    }
+
+    pub fn report(&self) -> RateReport {
+        self.report_at(uptime())
+    }
+
+    fn report_at(&self, at: Duration) -> RateReport {
+        let slices = |window_secs: u64| (window_secs / COARSE_WIDTH_SECS) as usize;
+
+        RateReport {
+            one_minute: self.fine.rates(at, self.created, FINE_BUCKETS),
+            five_minutes: self.coarse.rates(at, self.created, slices(300)),
+            fifteen_minutes: self.coarse.rates(at, self.created, slices(900)),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_rates_over_windows() {
+        let secs = Duration::from_secs;
+        let window = RateWindow::new_at(secs(0));
+
+        // 10 requests a second for two minutes, one in five failing, each
+        // keeping the bus busy for 50ms
+        for second in 0..120 {
+            for i in 0..10 {
+                let at = secs(second) + Duration::from_millis(i * 100);
+                window.record_at(at, i % 5 == 0, Duration::from_millis(50));
+            }
+        }
+
+        let report = window.report_at(secs(120));
+        assert_eq!(report.one_minute.requests_per_second, 10.0);
+        assert_eq!(report.one_minute.errors_per_second, 2.0);
+        assert!((report.one_minute.busy_ratio - 0.5).abs() < 1e-9);
+        // The first slices are skipped, they were partial
+        assert_eq!(report.five_minutes.requests_per_second, 10.0);
+        assert_eq!(report.fifteen_minutes.requests_per_second, 10.0);
+
+        // A silent minute later the short window is empty, the long ones
+        // average the quiet time in
+        let report = window.report_at(secs(180));
+        assert_eq!(report.one_minute.requests_per_second, 0.0);
+        assert_eq!(report.five_minutes.requests_per_second, 1050.0 / 165.0);
+
+        // Buckets reused by the ring do not carry old counts
+        window.record_at(secs(181), false, Duration::ZERO);
+        let report = window.report_at(secs(182));
+        assert_eq!(report.one_minute.requests_per_second, 1.0 / 60.0);
+    }
+
+    #[test]
+    fn test_new_window_reports_nothing() {
+        let window = RateWindow::new_at(Duration::from_millis(500));
+        window.record_at(Duration::from_millis(600), false, Duration::ZERO);
+        assert_eq!(
+            window.report_at(Duration::from_millis(900)),
+            RateReport::default()
+        );
+    }
+}
@@ -0,0 +1,82 @@
+//! Linux kernel RS-485 mode, the UART driver switches the transceiver
+//! direction around every frame it sends
+
+use std::{io, os::unix::io::RawFd, time::Duration};
+
+use crate::RtsType;
+
+/// Flags of `struct serial_rs485`, see linux/serial.h
+const SER_RS485_ENABLED: u32 = 1 << 0;
+const SER_RS485_RTS_ON_SEND: u32 = 1 << 1;
+const SER_RS485_RTS_AFTER_SEND: u32 = 1 << 2;
+
+/// `struct serial_rs485` from linux/serial.h, libc does not define it
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct SerialRs485 {
+    pub flags: u32,
+    /// Milliseconds RTS is asserted before the first bit goes out
+    pub delay_rts_before_send: u32,
+    /// Milliseconds RTS stays asserted after the last bit went out
+    pub delay_rts_after_send: u32,
+    padding: [u32; 5],
+}
+
+impl SerialRs485 {
+    /// RTS at the level `rts_type` gives while sending, asserted `delay`
+    /// ahead of every frame. Nothing is held after a frame, the response
+    /// may start right away
+    pub fn new(rts_type: RtsType, delay: Duration) -> Self {
+        let mut flags = SER_RS485_ENABLED;
+        if rts_type.to_signal_level(true) {
+            flags |= SER_RS485_RTS_ON_SEND;
+        }
+        if rts_type.to_signal_level(false) {
+            flags |= SER_RS485_RTS_AFTER_SEND;
+        }
+
+        Self {
+            flags,
+            // The driver only counts whole milliseconds
+            delay_rts_before_send: delay.as_micros().div_ceil(1000) as u32,
+            ..Default::default()
+        }
+    }
+
+    /// Hands direction switching of `fd` to its driver
+    pub fn apply(&self, fd: RawFd) -> io::Result<()> {
+        if unsafe { libc::ioctl(fd, libc::TIOCSRS485, self as *const Self) } < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_flags_and_delay() {
+        assert_eq!(std::mem::size_of::<SerialRs485>(), 32);
+
+        let up = SerialRs485::new(RtsType::Up, Duration::from_micros(3500));
+        assert_eq!(up.flags, SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND);
+        assert_eq!(up.delay_rts_before_send, 4);
+        assert_eq!(up.delay_rts_after_send, 0);
+
+        let down = SerialRs485::new(RtsType::Down, Duration::ZERO);
+        assert_eq!(down.flags, SER_RS485_ENABLED | SER_RS485_RTS_AFTER_SEND);
+        assert_eq!(down.delay_rts_before_send, 0);
+    }
+
+    #[test]
+    fn test_unsupported_device() {
+        // A pty has no RS-485 mode
+        let (master, _) = crate::mock::open_pty().unwrap();
+        let fd = std::os::unix::io::AsRawFd::as_raw_fd(&master);
+        assert!(SerialRs485::new(RtsType::Up, Duration::ZERO)
+            .apply(fd)
+            .is_err());
+    }
+}
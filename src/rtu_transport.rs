@@ -1,35 +1,87 @@
-use std::time::{Duration, Instant};
+use std::{
+    future::Future,
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Arc, RwLock,
+    },
+    time::{Duration, Instant},
+};
 
 #[cfg(any(target_os = "linux", target_os = "macos"))]
-use std::os::unix::io::AsRawFd;
+use std::os::unix::io::{AsRawFd, RawFd};
 
 #[cfg(any(target_os = "linux", target_os = "macos"))]
-use libc::{TIOCMGET, TIOCMSET, TIOCM_RTS};
+use libc::{TIOCMBIC, TIOCMBIS, TIOCM_RTS};
 
 #[cfg(any(target_os = "linux", target_os = "macos"))]
 use serialport::TTYPort;
 
+#[cfg(any(target_os = "linux", target_os = "macos"))]
+use tokio::io::unix::AsyncFd;
+
 use serialport::SerialPort;
 use tokio::sync::Mutex;
-use tracing::{info, trace};
+use tracing::{info, trace, warn};
 
-use crate::{RtsError, RtsType};
+use crate::{
+    modbus::{rtu_response_length, RtuFrameLength},
+    BackoffStrategy, RtsError, RtsMode, RtsType,
+};
 
-use crate::{FrameErrorKind, IoOperation, RelayError, RtuConfig, TransportError};
+use crate::{FrameErrorKind, IoOperation, RelayError, RtuConfig, Transport, TransportError};
 
-pub struct RtuTransport {
-    port: Mutex<Box<dyn SerialPort>>,
-    config: RtuConfig,
-    trace_frames: bool,
+/// Serial timeouts a device gets to start its response by default
+const MAX_TIMEOUTS: u32 = 3;
+
+/// Tokio timers tick in milliseconds and may fire a tick late, RTS delays
+/// on a bus thread sleep until this much is left and spin through the rest
+const SPIN_THRESHOLD: Duration = Duration::from_millis(2);
+
+/// What `thread::sleep` may overshoot by, spun through on the blocking pool
+const BLOCKING_SPIN: Duration = Duration::from_micros(200);
+
+#[cfg(any(target_os = "linux", target_os = "macos"))]
+type Serial = TTYPort;
+
+#[cfg(not(any(target_os = "linux", target_os = "macos")))]
+type Serial = Box<dyn SerialPort>;
+
+/// An open serial port
+struct Port {
+    /// Non-blocking handle registered with the tokio reactor, so waiting for
+    /// bytes parks the task instead of spinning on a worker thread. Declared
+    /// before `serial` to be deregistered before the port closes
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    io: AsyncFd<RawFd>,
 
     #[cfg(any(target_os = "linux", target_os = "macos"))]
-    raw_fd: i32,
+    raw_fd: RawFd,
+
+    serial: Serial,
 }
 
-impl RtuTransport {
-    pub fn new(config: &RtuConfig, trace_frames: bool) -> Result<Self, TransportError> {
-        info!("Opening serial port {}", config.serial_port_info());
+/// The port behind the bus lock, gone while a lost port waits to be reopened
+struct PortState {
+    port: Option<Port>,
+    backoff: BackoffStrategy,
+    /// First moment the next reopen may be tried
+    retry_at: Instant,
+}
+
+pub struct RtuTransport {
+    /// The lock serializes access to the bus
+    state: Mutex<PortState>,
+    /// Replaced as a whole when the timing is reloaded, every transaction
+    /// runs with the settings it started with
+    config: RwLock<Arc<RtuConfig>>,
+    /// Set by a reload that changed the kernel RS-485 delays, the driver
+    /// gets them before the next transaction
+    rs485_changed: AtomicBool,
+    trace_frames: bool,
+}
 
+impl Port {
+    fn open(config: &RtuConfig) -> Result<Self, TransportError> {
         // Explicitly open as TTYPort on Unix
         #[cfg(any(target_os = "linux", target_os = "macos"))]
         let tty_port: TTYPort = serialport::new(&config.device, config.baud_rate)
@@ -49,10 +101,18 @@ impl RtuTransport {
         let raw_fd = tty_port.as_raw_fd();
 
         #[cfg(any(target_os = "linux", target_os = "macos"))]
-        let port: Box<dyn SerialPort> = Box::new(tty_port);
+        let io = Self::register_fd(raw_fd, &config.device)?;
+
+        #[cfg(any(target_os = "linux", target_os = "macos"))]
+        if config.rts_mode == RtsMode::Kernel {
+            Self::enable_kernel_rs485(config, raw_fd)?;
+        }
+
+        #[cfg(any(target_os = "linux", target_os = "macos"))]
+        let serial = tty_port;
 
         #[cfg(not(any(target_os = "linux", target_os = "macos")))]
-        let port = serialport::new(&config.rtu_device, config.rtu_baud_rate)
+        let serial = serialport::new(&config.rtu_device, config.rtu_baud_rate)
             .data_bits(config.data_bits.into())
             .parity(config.parity.into())
             .stop_bits(config.stop_bits.into())
@@ -66,78 +126,174 @@ impl RtuTransport {
             })?;
 
         Ok(Self {
-            port: Mutex::new(port),
-            config: config.clone(),
-            trace_frames,
+            #[cfg(any(target_os = "linux", target_os = "macos"))]
+            io,
             #[cfg(any(target_os = "linux", target_os = "macos"))]
             raw_fd,
+            serial,
         })
     }
 
-    pub async fn close(&self) -> Result<(), TransportError> {
-        let port = self.port.lock().await;
-        port.clear(serialport::ClearBuffer::All)
-            .map_err(|e| TransportError::Io {
-                operation: IoOperation::Flush,
-                details: "Failed to clear buffers".to_string(),
-                source: std::io::Error::new(std::io::ErrorKind::Other, e.description),
-            })?;
-
-        #[cfg(unix)]
+    /// Switches the port into non-blocking mode and registers it with the reactor.
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    fn register_fd(raw_fd: RawFd, device: &str) -> Result<AsyncFd<RawFd>, TransportError> {
         unsafe {
-            if libc::close(self.raw_fd) != 0 {
+            let flags = libc::fcntl(raw_fd, libc::F_GETFL);
+            if flags < 0 || libc::fcntl(raw_fd, libc::F_SETFL, flags | libc::O_NONBLOCK) < 0 {
                 return Err(TransportError::Io {
-                    operation: IoOperation::Control,
-                    details: "Failed to close serial port".to_string(),
+                    operation: IoOperation::Configure,
+                    details: format!("Failed to set O_NONBLOCK on serial port {}", device),
                     source: std::io::Error::last_os_error(),
                 });
             }
         }
 
+        AsyncFd::new(raw_fd).map_err(|e| TransportError::Io {
+            operation: IoOperation::Configure,
+            details: format!("Failed to register serial port {} with reactor", device),
+            source: e,
+        })
+    }
+
+    /// Has the UART driver switch RTS around every frame
+    #[cfg(target_os = "linux")]
+    fn enable_kernel_rs485(config: &RtuConfig, raw_fd: RawFd) -> Result<(), TransportError> {
+        let delay = Duration::from_micros(config.rts_delay_us);
+        crate::rs485::SerialRs485::new(config.rts_type, delay)
+            .apply(raw_fd)
+            .map_err(|e| {
+                TransportError::Rts(RtsError::config(format!(
+                    "Failed to enable kernel RS-485 mode on {}: {}",
+                    config.device, e
+                )))
+            })?;
+
+        info!("Kernel RS-485 mode enabled on {}", config.device);
+        Ok(())
+    }
+
+    #[cfg(target_os = "macos")]
+    fn enable_kernel_rs485(config: &RtuConfig, _raw_fd: RawFd) -> Result<(), TransportError> {
+        Err(TransportError::Rts(RtsError::config(format!(
+            "Kernel RS-485 mode is only supported on Linux, not for {}",
+            config.device
+        ))))
+    }
+
+    /// Reads whatever is available, waiting for readiness without blocking the worker.
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    async fn read_some(&self, buf: &mut [u8]) -> std::io::Result<usize> {
+        loop {
+            let mut guard = self.io.readable().await?;
+            let hung_up = guard.ready().is_read_closed();
+
+            let result = guard.try_io(|fd| {
+                let n = unsafe {
+                    libc::read(
+                        *fd.get_ref(),
+                        buf.as_mut_ptr() as *mut libc::c_void,
+                        buf.len(),
+                    )
+                };
+                match n {
+                    // Nothing more will ever arrive on a hung up line
+                    0 if hung_up => Err(std::io::ErrorKind::UnexpectedEof.into()),
+                    // A tty with VMIN=0 may report readiness and then return nothing,
+                    // treat that as "no data yet" so the readiness flag gets cleared
+                    0 => Err(std::io::ErrorKind::WouldBlock.into()),
+                    n if n < 0 => Err(std::io::Error::last_os_error()),
+                    n => Ok(n as usize),
+                }
+            });
+
+            match result {
+                Ok(result) => return result,
+                Err(_would_block) => continue,
+            }
+        }
+    }
+
+    /// Writes the whole buffer, waiting for writability without blocking the worker.
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    async fn write_all(&self, mut data: &[u8]) -> std::io::Result<()> {
+        while !data.is_empty() {
+            let mut guard = self.io.writable().await?;
+
+            let result = guard.try_io(|fd| {
+                let n = unsafe {
+                    libc::write(
+                        *fd.get_ref(),
+                        data.as_ptr() as *const libc::c_void,
+                        data.len(),
+                    )
+                };
+                if n < 0 {
+                    Err(std::io::Error::last_os_error())
+                } else {
+                    Ok(n as usize)
+                }
+            });
+
+            match result {
+                Ok(Ok(0)) => return Err(std::io::ErrorKind::WriteZero.into()),
+                Ok(Ok(n)) => data = &data[n..],
+                Ok(Err(e)) => return Err(e),
+                Err(_would_block) => continue,
+            }
+        }
+
         Ok(())
     }
 
-    fn set_rts(&self, on: bool, trace_frames: bool) -> Result<(), TransportError> {
+    /// Waits until the UART has shifted out everything we wrote.
+    ///
+    /// `tcdrain` has no non-blocking variant, so it runs on the blocking pool
+    /// instead of stalling an async worker for the duration of the frame.
+    #[cfg(any(target_os = "linux", target_os = "macos"))]
+    async fn drain(&self) -> std::io::Result<()> {
+        let raw_fd = self.raw_fd;
+
+        tokio::task::spawn_blocking(move || unsafe {
+            if libc::tcdrain(raw_fd) != 0 {
+                Err(std::io::Error::last_os_error())
+            } else {
+                Ok(())
+            }
+        })
+        .await
+        .map_err(std::io::Error::other)?
+    }
+
+    fn set_rts(&self, on: bool, delay_us: u64, trace_frames: bool) -> Result<(), TransportError> {
         let rts_span = tracing::info_span!(
             "rts_control",
             signal = if on { "HIGH" } else { "LOW" },
-            delay_us = self.config.rts_delay_us,
+            delay_us,
         );
         let _enter = rts_span.enter();
 
-        unsafe {
-            let mut flags = 0i32;
-
-            // Get current flags
-            if libc::ioctl(self.raw_fd, TIOCMGET, &mut flags) < 0 {
-                let err = std::io::Error::last_os_error();
-                return Err(TransportError::Rts(RtsError::signal(format!(
-                    "Failed to get RTS flags: {} (errno: {})",
-                    err,
-                    err.raw_os_error().unwrap_or(-1)
-                ))));
-            }
-
-            // Modify RTS flag
-            if on {
-                flags |= TIOCM_RTS; // Set RTS HIGH
-            } else {
-                flags &= !TIOCM_RTS; // Set RTS LOW
-            }
-
-            // Set new flags
-            if libc::ioctl(self.raw_fd, TIOCMSET, &flags) < 0 {
-                let err = std::io::Error::last_os_error();
-                return Err(TransportError::Rts(RtsError::signal(format!(
-                    "Failed to set RTS flags: {} (errno: {})",
-                    err,
-                    err.raw_os_error().unwrap_or(-1)
-                ))));
+        // Sets or clears just the RTS bit, one call instead of get and set
+        let request = if on { TIOCMBIS } else { TIOCMBIC };
+        let bits = TIOCM_RTS;
+        if unsafe { libc::ioctl(self.raw_fd, request, &bits) } < 0 {
+            let err = std::io::Error::last_os_error();
+            if is_port_lost(&err) {
+                return Err(TransportError::Io {
+                    operation: IoOperation::Control,
+                    details: "Failed to set RTS".to_string(),
+                    source: err,
+                });
             }
+            return Err(TransportError::Rts(RtsError::signal(format!(
+                "Failed to set RTS {}: {} (errno: {})",
+                if on { "HIGH" } else { "LOW" },
+                err,
+                err.raw_os_error().unwrap_or(-1)
+            ))));
+        }
 
-            if trace_frames {
-                trace!("RTS set to {}", if on { "HIGH" } else { "LOW" });
-            }
+        if trace_frames {
+            trace!("RTS set to {}", if on { "HIGH" } else { "LOW" });
         }
 
         Ok(())
@@ -159,200 +315,723 @@ impl RtuTransport {
         }
         Ok(())
     }
+}
+
+/// Whether `error` means the device behind the port is gone, as when a USB
+/// adapter is unplugged or resets, rather than a single failed operation
+fn is_port_lost(error: &std::io::Error) -> bool {
+    matches!(
+        error.raw_os_error(),
+        Some(libc::EIO | libc::ENXIO | libc::ENODEV | libc::EBADF)
+    ) || matches!(
+        error.kind(),
+        std::io::ErrorKind::UnexpectedEof | std::io::ErrorKind::BrokenPipe
+    )
+}
+
+impl RtuTransport {
+    pub fn new(config: &RtuConfig, trace_frames: bool) -> Result<Self, TransportError> {
+        info!("Opening serial port {}", config.serial_port_info());
+
+        let port = Port::open(config)?;
+
+        Ok(Self {
+            state: Mutex::new(PortState {
+                port: Some(port),
+                backoff: BackoffStrategy::new(config.reconnect.clone()),
+                retry_at: Instant::now(),
+            }),
+            config: RwLock::new(Arc::new(config.clone())),
+            rs485_changed: AtomicBool::new(false),
+            trace_frames,
+        })
+    }
 
-    pub async fn transaction(
+    /// Settings the next transaction runs with
+    pub fn config(&self) -> Arc<RtuConfig> {
+        Arc::clone(&self.config.read().unwrap())
+    }
+
+    /// Takes over the timing of `config` from the next transaction on, the
+    /// port itself stays open with the settings it was opened with
+    pub fn reload(&self, config: &RtuConfig) {
+        let mut current = self.config.write().unwrap();
+        let reloaded = current.with_timing(config);
+        if reloaded.rts_mode == RtsMode::Kernel && reloaded.rts_delay_us != current.rts_delay_us {
+            self.rs485_changed.store(true, Ordering::Release);
+        }
+        *current = Arc::new(reloaded);
+    }
+
+    /// The open port, reopening a lost one once its backoff has passed
+    fn port<'a>(
         &self,
-        request: &[u8],
-        response: &mut [u8],
-    ) -> Result<usize, RelayError> {
-        if request.len() > self.config.max_frame_size as usize {
-            return Err(RelayError::frame(
-                FrameErrorKind::TooLong,
-                format!("Request frame too long: {} bytes", request.len()),
-                Some(request.to_vec()),
-            ));
+        state: &'a mut PortState,
+        config: &RtuConfig,
+    ) -> Result<&'a Port, TransportError> {
+        if state.port.is_none() {
+            let now = Instant::now();
+            if now < state.retry_at {
+                return Err(TransportError::Io {
+                    operation: IoOperation::Configure,
+                    details: format!(
+                        "serial port {} lost, reopening in {:?}",
+                        config.device,
+                        state.retry_at - now
+                    ),
+                    source: std::io::ErrorKind::NotConnected.into(),
+                });
+            }
+
+            match Port::open(config) {
+                Ok(port) => {
+                    info!("Serial port {} reopened", config.device);
+                    state.backoff.reset();
+                    state.port = Some(port);
+                }
+                Err(e) => {
+                    // Once out of retries keep trying at the longest interval
+                    let backoff = state
+                        .backoff
+                        .next_backoff()
+                        .unwrap_or(config.reconnect.max_interval);
+                    state.retry_at = now + backoff;
+                    warn!(
+                        "Failed to reopen serial port {}, retrying in {:?}: {}",
+                        config.device, backoff, e
+                    );
+                    return Err(e);
+                }
+            }
         }
 
-        let expected_size = response.len();
+        let port = state.port.as_ref().expect("port was just opened");
 
-        if self.trace_frames {
-            trace!("TX: {} bytes: {:02X?}", request.len(), request);
-            trace!("Expected response size: {} bytes", expected_size);
+        // The driver switches RTS itself, it only learns new delays here
+        #[cfg(any(target_os = "linux", target_os = "macos"))]
+        if self.rs485_changed.swap(false, Ordering::AcqRel) {
+            if let Err(e) = Port::enable_kernel_rs485(config, port.raw_fd) {
+                warn!("Failed to apply reloaded RS-485 delays: {}", e);
+            }
         }
 
-        let transaction_start = Instant::now();
+        Ok(port)
+    }
+
+    /// Closes the port if `result` shows it is gone, the next transaction
+    /// reopens it
+    fn check_lost<T>(
+        &self,
+        state: &mut PortState,
+        config: &RtuConfig,
+        result: &Result<T, TransportError>,
+    ) {
+        if let Err(TransportError::Io { source, .. }) = result {
+            if state.port.is_some() && is_port_lost(source) {
+                warn!("Serial port {} lost: {}", config.device, source);
+                state.port = None;
+                state.backoff = BackoffStrategy::new(config.reconnect.clone());
+                state.retry_at = Instant::now();
+            }
+        }
+    }
 
-        let result = tokio::time::timeout(self.config.transaction_timeout, async {
-            let mut port = self.port.lock().await;
+    pub async fn close(&self) -> Result<(), TransportError> {
+        let mut state = self.state.lock().await;
 
-            if self.config.rts_type != RtsType::None {
-                if self.trace_frames {
-                    trace!("RTS -> TX mode");
-                }
+        // Dropping the port closes it
+        if let Some(port) = state.port.take() {
+            port.serial
+                .clear(serialport::ClearBuffer::All)
+                .map_err(|e| TransportError::Io {
+                    operation: IoOperation::Flush,
+                    details: "Failed to clear buffers".to_string(),
+                    source: std::io::Error::new(std::io::ErrorKind::Other, e.description),
+                })?;
+        }
 
-                self.set_rts(
-                    self.config.rts_type.to_signal_level(true),
-                    self.trace_frames,
-                )?;
+        Ok(())
+    }
 
-                if self.config.rts_delay_us > 0 {
-                    if self.trace_frames {
-                        trace!("RTS -> TX mode [waiting]");
-                    }
-                    tokio::time::sleep(Duration::from_micros(self.config.rts_delay_us)).await;
-                }
-            }
+    /// Puts `request` on the line, switching RTS around it, returns whether
+    /// it waited for the frame to be sent
+    async fn send_request(
+        &self,
+        port: &Port,
+        config: &RtuConfig,
+        request: &[u8],
+        must_drain: bool,
+    ) -> Result<bool, TransportError> {
+        // In kernel mode the driver switches direction on its own
+        let toggle_rts = config.rts_type != RtsType::None && config.rts_mode == RtsMode::Userspace;
 
-            // Write request
+        if toggle_rts {
             if self.trace_frames {
-                trace!("Writing request");
+                trace!("RTS -> TX mode");
+            }
+
+            port.set_rts(
+                config.rts_type.to_signal_level(true),
+                config.rts_delay_us,
+                self.trace_frames,
+            )?;
+
+            if config.rts_delay_us > 0 {
+                if self.trace_frames {
+                    trace!("RTS -> TX mode [waiting]");
+                }
+                precise_delay(Duration::from_micros(config.rts_delay_us)).await;
             }
-            port.write_all(request).map_err(|e| TransportError::Io {
+        }
+
+        // Write request
+        if self.trace_frames {
+            trace!("Writing request");
+        }
+        port.write_all(request)
+            .await
+            .map_err(|e| TransportError::Io {
                 operation: IoOperation::Write,
                 details: "Failed to write request".to_string(),
                 source: e,
             })?;
 
-            port.flush().map_err(|e| TransportError::Io {
+        // Only wait for the frame to leave the UART when something has
+        // to happen after it, a response would be buffered anyway
+        let drain = must_drain || toggle_rts || config.flush_after_write;
+        if drain {
+            port.drain().await.map_err(|e| TransportError::Io {
                 operation: IoOperation::Flush,
                 details: "Failed to flush write buffer".to_string(),
                 source: e,
             })?;
+        }
 
-            if self.config.rts_type != RtsType::None {
-                if self.trace_frames {
-                    trace!("RTS -> RX mode");
-                }
-
-                self.set_rts(
-                    self.config.rts_type.to_signal_level(false),
-                    self.trace_frames,
-                )?;
+        if toggle_rts {
+            if self.trace_frames {
+                trace!("RTS -> RX mode");
             }
 
-            if self.config.flush_after_write {
-                if self.trace_frames {
-                    trace!("RTS -> TX mode [flushing]");
-                }
-                self.tc_flush()?;
-            }
+            port.set_rts(
+                config.rts_type.to_signal_level(false),
+                config.rts_delay_us,
+                self.trace_frames,
+            )?;
+        }
 
-            if self.config.rts_type != RtsType::None && self.config.rts_delay_us > 0 {
-                if self.trace_frames {
-                    trace!("RTS -> RX mode [waiting]");
-                }
-                tokio::time::sleep(Duration::from_micros(self.config.rts_delay_us)).await;
+        if config.flush_after_write {
+            if self.trace_frames {
+                trace!("RTS -> TX mode [flushing]");
             }
+            port.tc_flush()?;
+        }
 
-            // Read response
+        if toggle_rts && config.rts_delay_us > 0 {
             if self.trace_frames {
-                trace!("Reading response (expecting {} bytes)", expected_size);
+                trace!("RTS -> RX mode [waiting]");
             }
+            precise_delay(Duration::from_micros(config.rts_delay_us)).await;
+        }
+
+        Ok(drain)
+    }
+
+    /// Reads the response to a request sent `transaction_start`
+    async fn read_response(
+        &self,
+        port: &Port,
+        config: &RtuConfig,
+        response: &mut [u8],
+        response_deadline: Instant,
+        transaction_start: Instant,
+    ) -> Result<usize, TransportError> {
+        let buffer_size = response.len();
+
+        // Read response
+        if self.trace_frames {
+            trace!("Reading response (up to {} bytes)", buffer_size);
+        }
+
+        let mut total_bytes = 0;
+        let mut attempts: u8 = 0;
+        let inter_frame_gap = config.inter_frame_gap();
+
+        while total_bytes < buffer_size {
+            let frame_length = rtu_response_length(&response[..total_bytes]);
 
-            const MAX_TIMEOUTS: u8 = 3;
-            let mut total_bytes = 0;
-            let mut consecutive_timeouts = 0;
-            let inter_byte_timeout = Duration::from_millis(100);
-            let mut last_read_time = tokio::time::Instant::now();
-
-            while total_bytes < expected_size {
-                match port.read(&mut response[total_bytes..]) {
-                    Ok(0) => {
-                        if total_bytes > 0 {
-                            let elapsed = last_read_time.elapsed();
-                            if elapsed >= inter_byte_timeout {
-                                trace!("Inter-byte timeout reached with {} bytes", total_bytes);
-                                break;
-                            }
-                        }
-                        tokio::task::yield_now().await;
+            if let RtuFrameLength::Complete(length) = frame_length {
+                if total_bytes >= length {
+                    if self.trace_frames {
+                        trace!("Received complete response");
                     }
-                    Ok(n) => {
-                        if self.trace_frames {
-                            trace!(
-                                "Read {} bytes: {:02X?}",
-                                n,
-                                &response[total_bytes..total_bytes + n]
-                            );
-                        }
-                        total_bytes += n;
-                        last_read_time = tokio::time::Instant::now();
-                        consecutive_timeouts = 0;
-
-                        if total_bytes >= expected_size {
-                            if self.trace_frames {
-                                trace!("Received complete response");
-                            }
-                            break;
-                        }
+                    // Anything past the declared length is line noise
+                    total_bytes = length;
+                    break;
+                }
+            }
+
+            // Wait for the first byte in serial_timeout slices until the
+            // response deadline. Once bytes arrive, a frame whose length is
+            // known keeps waiting for the rest (USB adapters deliver in
+            // bursts), otherwise T3.5 of silence ends it
+            let wait = match frame_length {
+                _ if total_bytes == 0 => config
+                    .serial_timeout
+                    .min(response_deadline.saturating_duration_since(Instant::now())),
+                RtuFrameLength::Unknown => inter_frame_gap,
+                _ => config.serial_timeout,
+            };
+
+            match tokio::time::timeout(wait, port.read_some(&mut response[total_bytes..])).await {
+                Ok(Ok(n)) => {
+                    if self.trace_frames {
+                        trace!(
+                            "Read {} bytes: {:02X?}",
+                            n,
+                            &response[total_bytes..total_bytes + n]
+                        );
                     }
-                    Err(e) if e.kind() == std::io::ErrorKind::TimedOut => {
-                        if total_bytes > 0 {
-                            let elapsed = last_read_time.elapsed();
-                            if elapsed >= inter_byte_timeout {
-                                trace!("Inter-byte timeout reached after timeout");
-                                break;
-                            }
-                        }
-                        consecutive_timeouts += 1;
-                        if consecutive_timeouts >= MAX_TIMEOUTS {
-                            if total_bytes == 0 {
-                                return Err(TransportError::NoResponse {
-                                    attempts: consecutive_timeouts,
-                                    elapsed: transaction_start.elapsed(),
-                                });
-                            }
-                            trace!("Max timeouts reached with {} bytes", total_bytes);
-                            break;
-                        }
-                        tokio::task::yield_now().await;
+                    total_bytes += n;
+                }
+                Ok(Err(e)) => {
+                    return Err(TransportError::Io {
+                        operation: IoOperation::Read,
+                        details: "Failed to read response".to_string(),
+                        source: e,
+                    });
+                }
+                Err(_) => {
+                    if total_bytes > 0 {
+                        trace!("Inter-frame gap reached with {} bytes", total_bytes);
+                        break;
                     }
-                    Err(e) => {
-                        return Err(TransportError::Io {
-                            operation: IoOperation::Read,
-                            details: "Failed to read response".to_string(),
-                            source: e,
+                    attempts = attempts.saturating_add(1);
+                    if Instant::now() >= response_deadline {
+                        return Err(TransportError::NoResponse {
+                            attempts,
+                            elapsed: transaction_start.elapsed(),
                         });
                     }
                 }
             }
+        }
 
-            if total_bytes == 0 {
-                return Err(TransportError::NoResponse {
-                    attempts: consecutive_timeouts,
-                    elapsed: transaction_start.elapsed(),
-                });
-            }
+        if total_bytes == 0 {
+            return Err(TransportError::NoResponse {
+                attempts,
+                elapsed: transaction_start.elapsed(),
+            });
+        }
 
-            // Verify minimum response size
-            if total_bytes < 3 {
-                return Err(TransportError::Io {
-                    operation: IoOperation::Read,
-                    details: format!("Response too short: {} bytes", total_bytes),
-                    source: std::io::Error::new(
-                        std::io::ErrorKind::InvalidData,
-                        "Response too short",
-                    ),
-                });
-            }
+        // Verify minimum response size
+        if total_bytes < 3 {
+            return Err(TransportError::Io {
+                operation: IoOperation::Read,
+                details: format!("Response too short: {} bytes", total_bytes),
+                source: std::io::Error::new(std::io::ErrorKind::InvalidData, "Response too short"),
+            });
+        }
 
-            if self.trace_frames {
-                trace!(
-                    "RX: {} bytes: {:02X?}",
-                    total_bytes,
-                    &response[..total_bytes],
-                );
+        if self.trace_frames {
+            trace!(
+                "RX: {} bytes: {:02X?}",
+                total_bytes,
+                &response[..total_bytes],
+            );
+        }
+
+        Ok(total_bytes)
+    }
+
+    pub async fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+    ) -> Result<usize, RelayError> {
+        self.transaction_with_timeout(request, response, self.response_timeout())
+            .await
+    }
+
+    /// Default time a device gets to start its response
+    pub fn response_timeout(&self) -> Duration {
+        self.config().serial_timeout * MAX_TIMEOUTS
+    }
+
+    /// Like [`RtuTransport::transaction`], giving up when the response has
+    /// not started `response_timeout` after the request went out.
+    ///
+    /// `transaction_timeout` still bounds the whole transaction.
+    pub async fn transaction_with_timeout(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> Result<usize, RelayError> {
+        let config = self.config();
+
+        if request.len() > config.max_frame_size as usize {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Request frame too long: {} bytes", request.len()),
+                Some(request.to_vec()),
+            ));
+        }
+
+        if self.trace_frames {
+            trace!("TX: {} bytes: {:02X?}", request.len(), request);
+            trace!("Response buffer size: {} bytes", response.len());
+        }
+
+        let transaction_start = Instant::now();
+
+        let result = tokio::time::timeout(config.transaction_timeout, async {
+            let mut state = self.state.lock().await;
+            let port = self.port(&mut state, &config)?;
+
+            let result = async {
+                let drain = self.send_request(port, &config, request, false).await?;
+
+                // An undrained request is still going out
+                let sending = if drain {
+                    Duration::ZERO
+                } else {
+                    config.char_time() * request.len() as u32
+                };
+                let response_deadline = Instant::now() + sending + response_timeout;
+
+                self.read_response(
+                    port,
+                    &config,
+                    response,
+                    response_deadline,
+                    transaction_start,
+                )
+                .await
             }
+            .await;
 
-            Ok(total_bytes)
+            self.check_lost(&mut state, &config, &result);
+            result
         })
         .await
         .map_err(|elapsed| TransportError::Timeout {
             elapsed: transaction_start.elapsed(),
-            limit: self.config.transaction_timeout,
+            limit: config.transaction_timeout,
             source: elapsed,
         })?;
 
         Ok(result?)
     }
+
+    /// Sends a broadcast request, then keeps the bus for
+    /// `broadcast_turnaround` while the devices carry it out. No device
+    /// answers a broadcast, so nothing is read.
+    pub async fn broadcast(&self, request: &[u8]) -> Result<(), RelayError> {
+        let config = self.config();
+
+        if request.len() > config.max_frame_size as usize {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Request frame too long: {} bytes", request.len()),
+                Some(request.to_vec()),
+            ));
+        }
+
+        if self.trace_frames {
+            trace!("TX broadcast: {} bytes: {:02X?}", request.len(), request);
+        }
+
+        let started = Instant::now();
+        let result = tokio::time::timeout(config.transaction_timeout, async {
+            let mut state = self.state.lock().await;
+            let port = self.port(&mut state, &config)?;
+
+            // Turnaround counts from the end of the frame
+            let result = self.send_request(port, &config, request, true).await;
+            self.check_lost(&mut state, &config, &result);
+            result?;
+
+            tokio::time::sleep(config.broadcast_turnaround).await;
+
+            Ok::<_, TransportError>(())
+        })
+        .await
+        .map_err(|elapsed| TransportError::Timeout {
+            elapsed: started.elapsed(),
+            limit: config.transaction_timeout,
+            source: elapsed,
+        })?;
+
+        Ok(result?)
+    }
+}
+
+/// Waits `delay` to within a few microseconds.
+///
+/// A plain tokio sleep rounds up to the next millisecond tick, turning the
+/// usual 3.5 ms RTS delay into 4-5 ms. On a bus thread of its own
+/// (`runtime.serial_thread`) the last [`SPIN_THRESHOLD`] is spun. Shared
+/// workers must not spin, client tasks would stall behind them, so there
+/// the wait runs on the blocking pool instead.
+async fn precise_delay(delay: Duration) {
+    let deadline = Instant::now() + delay;
+
+    if !crate::runtime::on_bus_thread() {
+        let wait = tokio::task::spawn_blocking(move || blocking_delay(deadline));
+        if wait.await.is_err() {
+            // No blocking pool while the runtime shuts down
+            tokio::time::sleep_until(deadline.into()).await;
+        }
+        return;
+    }
+
+    if let Some(sleep) = delay.checked_sub(SPIN_THRESHOLD) {
+        if !sleep.is_zero() {
+            tokio::time::sleep(sleep).await;
+        }
+    }
+    spin_until(deadline);
+}
+
+fn blocking_delay(deadline: Instant) {
+    let left = deadline.saturating_duration_since(Instant::now());
+    if let Some(sleep) = left.checked_sub(BLOCKING_SPIN) {
+        std::thread::sleep(sleep);
+    }
+    spin_until(deadline);
+}
+
+fn spin_until(deadline: Instant) {
+    while Instant::now() < deadline {
+        std::hint::spin_loop();
+    }
+}
+
+impl Transport for RtuTransport {
+    fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> impl Future<Output = Result<usize, RelayError>> + Send {
+        self.transaction_with_timeout(request, response, response_timeout)
+    }
+
+    fn response_timeout(&self) -> Duration {
+        RtuTransport::response_timeout(self)
+    }
+
+    fn answers_broadcasts(&self) -> bool {
+        false
+    }
+
+    fn broadcast(&self, request: &[u8]) -> impl Future<Output = Result<(), RelayError>> + Send {
+        RtuTransport::broadcast(self, request)
+    }
+
+    fn close(&self) -> impl Future<Output = Result<(), TransportError>> + Send {
+        RtuTransport::close(self)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::{
+        io::{Read, Write},
+        sync::{
+            atomic::{AtomicUsize, Ordering},
+            Arc,
+        },
+    };
+
+    fn open_pty() -> (std::fs::File, String) {
+        crate::mock::open_pty().unwrap()
+    }
+
+    fn test_config(device: String) -> RtuConfig {
+        RtuConfig {
+            device,
+            rts_type: RtsType::None,
+            flush_after_write: false,
+            transaction_timeout: Duration::from_secs(2),
+            serial_timeout: Duration::from_millis(50),
+            ..Default::default()
+        }
+    }
+
+    #[tokio::test]
+    async fn test_transaction_roundtrip() {
+        let (mut master, device) = open_pty();
+        let transport = RtuTransport::new(&test_config(device), false).unwrap();
+
+        let request = [0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A];
+        let reply = [0x01, 0x03, 0x02, 0x12, 0x34, 0xB5, 0x33];
+
+        let slave = std::thread::spawn(move || {
+            let mut received = [0u8; 8];
+            master.read_exact(&mut received).unwrap();
+            master.write_all(&reply).unwrap();
+            (master, received)
+        });
+
+        let mut response = [0u8; 256];
+        let len = transport
+            .transaction(&request, &mut response)
+            .await
+            .unwrap();
+
+        let (_master, received) = slave.join().unwrap();
+        assert_eq!(received, request);
+        assert_eq!(len, reply.len());
+        assert_eq!(&response[..len], reply);
+    }
+
+    #[tokio::test]
+    async fn test_exception_response_completes_without_waiting() {
+        let (mut master, device) = open_pty();
+        let config = RtuConfig {
+            // A gap-based read would wait the whole serial_timeout
+            serial_timeout: Duration::from_secs(1),
+            ..test_config(device)
+        };
+        let transport = RtuTransport::new(&config, false).unwrap();
+
+        let request = [0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A];
+        let reply = [0x01, 0x83, 0x02, 0xC0, 0xF1];
+
+        let slave = std::thread::spawn(move || {
+            let mut received = [0u8; 8];
+            master.read_exact(&mut received).unwrap();
+            master.write_all(&reply).unwrap();
+            master
+        });
+
+        let start = Instant::now();
+        let mut response = [0u8; 256];
+        let len = transport
+            .transaction(&request, &mut response)
+            .await
+            .unwrap();
+
+        let _master = slave.join().unwrap();
+        assert_eq!(&response[..len], reply);
+        assert!(start.elapsed() < Duration::from_millis(500));
+    }
+
+    #[tokio::test]
+    async fn test_silent_slave_does_not_block_runtime() {
+        let (mut master, device) = open_pty();
+        let transport = RtuTransport::new(&test_config(device), false).unwrap();
+
+        let slave = std::thread::spawn(move || {
+            let mut received = [0u8; 8];
+            master.read_exact(&mut received).unwrap();
+            master
+        });
+
+        // On the single-threaded test runtime this only advances if the
+        // transaction yields while it waits for bytes
+        let ticks = Arc::new(AtomicUsize::new(0));
+        let ticker = tokio::spawn({
+            let ticks = Arc::clone(&ticks);
+            async move {
+                loop {
+                    tokio::time::sleep(Duration::from_millis(10)).await;
+                    ticks.fetch_add(1, Ordering::Relaxed);
+                }
+            }
+        });
+
+        let request = [0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A];
+        let mut response = [0u8; 256];
+        let result = transport.transaction(&request, &mut response).await;
+
+        ticker.abort();
+        let _master = slave.join().unwrap();
+
+        assert!(matches!(
+            result,
+            Err(RelayError::Transport(TransportError::NoResponse { .. }))
+        ));
+        assert!(ticks.load(Ordering::Relaxed) >= 5);
+    }
+
+    #[tokio::test]
+    async fn test_lost_port_is_reopened() {
+        let dir = tempfile::tempdir().unwrap();
+        let link = dir.path().join("ttyUSB0");
+        let (master, device) = open_pty();
+        std::os::unix::fs::symlink(&device, &link).unwrap();
+
+        let config = RtuConfig {
+            reconnect: crate::config::BackoffConfig {
+                initial_interval: Duration::from_millis(20),
+                ..Default::default()
+            },
+            ..test_config(link.to_string_lossy().into_owned())
+        };
+        let transport = RtuTransport::new(&config, false).unwrap();
+        let request = [0x01, 0x03, 0x00, 0x00, 0x00, 0x01, 0x84, 0x0A];
+        let reply = [0x01, 0x03, 0x02, 0x12, 0x34, 0xB5, 0x33];
+        let mut response = [0u8; 256];
+
+        // The adapter goes away, the port gets closed
+        drop(master);
+        let result = transport.transaction(&request, &mut response).await;
+        assert!(matches!(
+            result,
+            Err(RelayError::Transport(TransportError::Io { .. }))
+        ));
+        assert!(transport.state.lock().await.port.is_none());
+
+        // And comes back under the same name
+        let (mut master, device) = open_pty();
+        std::fs::remove_file(&link).unwrap();
+        std::os::unix::fs::symlink(&device, &link).unwrap();
+
+        let slave = std::thread::spawn(move || {
+            let mut received = [0u8; 8];
+            master.read_exact(&mut received).unwrap();
+            master.write_all(&reply).unwrap();
+            master
+        });
+
+        let len = transport
+            .transaction(&request, &mut response)
+            .await
+            .unwrap();
+        let _master = slave.join().unwrap();
+        assert_eq!(&response[..len], reply);
+    }
+
+    #[tokio::test]
+    async fn test_reload_keeps_port_settings() {
+        let (_master, device) = open_pty();
+        let config = test_config(device);
+        let transport = RtuTransport::new(&config, false).unwrap();
+
+        transport.reload(&RtuConfig {
+            device: "/dev/null".to_string(),
+            baud_rate: 115200,
+            serial_timeout: Duration::from_millis(20),
+            ..config.clone()
+        });
+
+        let reloaded = transport.config();
+        assert_eq!(reloaded.device, config.device);
+        assert_eq!(reloaded.baud_rate, config.baud_rate);
+        assert_eq!(reloaded.serial_timeout, Duration::from_millis(20));
+        assert_eq!(transport.response_timeout(), Duration::from_millis(60));
+    }
+
+    #[tokio::test]
+    async fn test_precise_delay() {
+        // No upper bound, a loaded machine may run the wait late
+        for delay in [Duration::from_micros(300), Duration::from_micros(3500)] {
+            let start = Instant::now();
+            precise_delay(delay).await;
+            assert!(start.elapsed() >= delay);
+        }
+    }
 }
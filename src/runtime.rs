@@ -0,0 +1,181 @@
+use std::{cell::Cell, io};
+
+use tokio::runtime::{Builder, Handle, Runtime};
+use tracing::{info, warn};
+
+use crate::{errors::InitializationError, RuntimeConfig, RuntimeFlavor};
+
+thread_local! {
+    static BUS_THREAD: Cell<bool> = const { Cell::new(false) };
+}
+
+/// Whether the calling thread belongs to a [`BusThread`], where nothing but
+/// its bus is held up by a busy wait
+pub fn on_bus_thread() -> bool {
+    BUS_THREAD.with(Cell::get)
+}
+
+/// Builds the runtime the relay runs on
+pub fn build(config: &RuntimeConfig) -> Result<Runtime, InitializationError> {
+    let mut builder = match config.flavor {
+        RuntimeFlavor::MultiThread => {
+            let mut builder = Builder::new_multi_thread();
+            if let Some(workers) = config.worker_threads {
+                builder.worker_threads(workers);
+            }
+            builder
+        }
+        RuntimeFlavor::CurrentThread => Builder::new_current_thread(),
+    };
+
+    builder
+        .thread_name("modbus-relay")
+        .enable_all()
+        .build()
+        .map_err(|e| InitializationError::runtime(format!("Failed to build runtime: {}", e)))
+}
+
+/// Runtime of one serial bus, driven by a single OS thread of its own.
+///
+/// Tasks spawned on [`BusThread::handle`], and serial ports opened while it
+/// is entered, are polled and woken on that thread only, however busy the
+/// workers serving TCP and HTTP clients are.
+pub struct BusThread {
+    runtime: Option<Runtime>,
+}
+
+impl BusThread {
+    /// Starts the thread of bus `name`, pinned to `cpu` and running under
+    /// SCHED_FIFO at `priority` when given
+    pub fn spawn(
+        name: &str,
+        cpu: Option<usize>,
+        priority: Option<u8>,
+    ) -> Result<Self, InitializationError> {
+        let bus = name.to_string();
+        let runtime = Builder::new_multi_thread()
+            .worker_threads(1)
+            // The only blocking call is draining the port, one at a time
+            .max_blocking_threads(1)
+            .thread_name(format!("rtu-{}", name))
+            .on_thread_start(move || configure_thread(&bus, cpu, priority))
+            .enable_all()
+            .build()
+            .map_err(|e| {
+                InitializationError::runtime(format!(
+                    "Failed to start thread of bus {}: {}",
+                    name, e
+                ))
+            })?;
+
+        Ok(Self {
+            runtime: Some(runtime),
+        })
+    }
+
+    pub fn handle(&self) -> &Handle {
+        self.runtime
+            .as_ref()
+            .expect("runtime is only taken on drop")
+            .handle()
+    }
+}
+
+impl Drop for BusThread {
+    fn drop(&mut self) {
+        // Dropped from within the main runtime, where it must not block
+        if let Some(runtime) = self.runtime.take() {
+            runtime.shutdown_background();
+        }
+    }
+}
+
+fn configure_thread(bus: &str, cpu: Option<usize>, priority: Option<u8>) {
+    BUS_THREAD.with(|bus_thread| bus_thread.set(true));
+
+    if let Some(cpu) = cpu {
+        match pin_to_cpu(cpu) {
+            Ok(()) => info!("Bus {} thread pinned to CPU {}", bus, cpu),
+            Err(e) => warn!("Failed to pin bus {} thread to CPU {}: {}", bus, cpu, e),
+        }
+    }
+
+    if let Some(priority) = priority {
+        match set_fifo_priority(priority) {
+            Ok(()) => info!("Bus {} thread running SCHED_FIFO at {}", bus, priority),
+            Err(e) => warn!(
+                "Failed to set SCHED_FIFO priority {} of bus {} thread: {}",
+                priority, bus, e
+            ),
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+fn pin_to_cpu(cpu: usize) -> io::Result<()> {
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        libc::CPU_SET(cpu, &mut set);
+        if libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) != 0 {
+            return Err(io::Error::last_os_error());
+        }
+    }
+    Ok(())
+}
+
+#[cfg(not(target_os = "linux"))]
+fn pin_to_cpu(_cpu: usize) -> io::Result<()> {
+    Err(io::Error::new(
+        io::ErrorKind::Unsupported,
+        "CPU affinity is only supported on Linux",
+    ))
+}
+
+#[cfg(unix)]
+fn set_fifo_priority(priority: u8) -> io::Result<()> {
+    let param = libc::sched_param {
+        sched_priority: priority as libc::c_int,
+    };
+    // Returns the error number rather than setting errno
+    match unsafe { libc::pthread_setschedparam(libc::pthread_self(), libc::SCHED_FIFO, &param) } {
+        0 => Ok(()),
+        errno => Err(io::Error::from_raw_os_error(errno)),
+    }
+}
+
+#[cfg(not(unix))]
+fn set_fifo_priority(_priority: u8) -> io::Result<()> {
+    Err(io::Error::new(
+        io::ErrorKind::Unsupported,
+        "SCHED_FIFO is only supported on Unix",
+    ))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bus_thread_runs_tasks() {
+        let thread = BusThread::spawn("test", None, None).unwrap();
+        let name = thread
+            .handle()
+            .block_on(thread.handle().spawn(async {
+                assert!(on_bus_thread());
+                std::thread::current().name().map(str::to_string)
+            }))
+            .unwrap();
+        assert_eq!(name.as_deref(), Some("rtu-test"));
+        assert!(!on_bus_thread());
+    }
+
+    #[test]
+    fn test_build_current_thread() {
+        let config = RuntimeConfig {
+            flavor: RuntimeFlavor::CurrentThread,
+            ..Default::default()
+        };
+        let runtime = build(&config).unwrap();
+        assert_eq!(runtime.block_on(async { 1 + 1 }), 2);
+    }
+}
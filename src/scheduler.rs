@@ -0,0 +1,1432 @@
+use std::{
+    collections::{HashMap, VecDeque},
+    hash::Hash,
+    net::{IpAddr, SocketAddr},
+    sync::{
+        atomic::{AtomicU64, AtomicUsize, Ordering},
+        Arc,
+    },
+    time::{Duration, Instant},
+};
+
+use serde::Serialize;
+use tokio::sync::{broadcast, mpsc, oneshot, Semaphore};
+use tracing::{debug, trace};
+
+use crate::{
+    adaptive_timeout::AdaptiveTimeouts,
+    cache::CacheKey,
+    capture::{Direction, FrameCapture},
+    circuit_breaker::CircuitBreaker,
+    crc::calc_crc16,
+    frame_buffer::{BufferPool, FrameBuffer, MBAP_HEADROOM},
+    latency::LatencyStats,
+    modbus::broadcast_echo,
+    rates::{RateReport, RateWindow},
+    ConnectionError, Fairness, LoadSheddingConfig, Priority, PriorityConfig, ProtocolErrorKind,
+    RelayError, SchedulerConfig, Transport, TransportError,
+};
+
+/// A single RTU transaction waiting for the bus
+struct BusRequest {
+    client: SocketAddr,
+    priority: Priority,
+    unit_id: u8,
+    /// Complete RTU request ADU, CRC included
+    frame: FrameBuffer,
+    enqueued_at: Instant,
+    /// Dropped without using the bus once passed, set by load shedding
+    deadline: Option<Instant>,
+    reply: oneshot::Sender<Result<FrameBuffer, RelayError>>,
+}
+
+/// Key requests are grouped by when taking turns on the bus
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+enum FlowKey {
+    Client(IpAddr),
+    Unit(u8),
+}
+
+impl FlowKey {
+    fn new(fairness: Fairness, request: &BusRequest) -> Self {
+        match fairness {
+            Fairness::Client => FlowKey::Client(request.client.ip()),
+            Fairness::Unit => FlowKey::Unit(request.unit_id),
+        }
+    }
+}
+
+/// Round-robin queue over flows.
+///
+/// Every flow keeps its own FIFO, `pop` takes one item from the flow at
+/// the front of the ring and moves that flow to the back. A client with a
+/// hundred queued requests gets the same share of the bus as a client with
+/// one.
+struct FairQueue<K, T> {
+    flows: HashMap<K, VecDeque<T>>,
+    ring: VecDeque<K>,
+    len: usize,
+}
+
+impl<K: Copy + Eq + Hash, T> FairQueue<K, T> {
+    fn new() -> Self {
+        Self {
+            flows: HashMap::new(),
+            ring: VecDeque::new(),
+            len: 0,
+        }
+    }
+
+    fn len(&self) -> usize {
+        self.len
+    }
+
+    fn push(&mut self, key: K, item: T) {
+        let queue = self.flows.entry(key).or_default();
+        if queue.is_empty() {
+            self.ring.push_back(key);
+        }
+        queue.push_back(item);
+        self.len += 1;
+    }
+
+    fn pop(&mut self) -> Option<T> {
+        let key = self.ring.pop_front()?;
+        let queue = self.flows.get_mut(&key)?;
+        let item = queue.pop_front();
+
+        if queue.is_empty() {
+            self.flows.remove(&key);
+        } else {
+            self.ring.push_back(key);
+        }
+
+        self.len -= 1;
+        item
+    }
+
+    /// Removes the first flow head, in ring order, matching `predicate`.
+    ///
+    /// Only heads are considered so the order within a flow is kept.
+    fn take_head_if<P>(&mut self, mut predicate: P) -> Option<T>
+    where
+        P: FnMut(&T) -> bool,
+    {
+        let position = self.ring.iter().position(|key| {
+            self.flows
+                .get(key)
+                .and_then(VecDeque::front)
+                .is_some_and(&mut predicate)
+        })?;
+
+        let key = self.ring[position];
+        let queue = self.flows.get_mut(&key)?;
+        let item = queue.pop_front();
+
+        if queue.is_empty() {
+            self.flows.remove(&key);
+            self.ring.remove(position);
+        }
+
+        self.len -= 1;
+        item
+    }
+}
+
+/// Fair queues of the priority classes.
+///
+/// `pop` serves the highest class with requests waiting, a class passed
+/// over `starvation_limit` times in a row gets the next turn, so low
+/// priority pollers keep some share of a bus busy with writes.
+struct PriorityQueue<K, T> {
+    classes: [FairQueue<K, T>; Priority::ALL.len()],
+    passed_over: [u32; Priority::ALL.len()],
+    starvation_limit: u32,
+}
+
+impl<K: Copy + Eq + Hash, T> PriorityQueue<K, T> {
+    fn new(starvation_limit: u32) -> Self {
+        Self {
+            classes: std::array::from_fn(|_| FairQueue::new()),
+            passed_over: [0; Priority::ALL.len()],
+            starvation_limit,
+        }
+    }
+
+    fn len(&self) -> usize {
+        self.classes.iter().map(FairQueue::len).sum()
+    }
+
+    fn push(&mut self, priority: Priority, key: K, item: T) {
+        let class = priority.index();
+        if self.classes[class].len() == 0 {
+            self.passed_over[class] = 0;
+        }
+        self.classes[class].push(key, item);
+    }
+
+    fn pop(&mut self) -> Option<T> {
+        let waiting = |classes: &[FairQueue<K, T>], class: usize| classes[class].len() > 0;
+        let highest = (0..self.classes.len()).find(|&class| waiting(&self.classes, class))?;
+
+        let class = (highest + 1..self.classes.len())
+            .find(|&class| {
+                self.starvation_limit > 0
+                    && waiting(&self.classes, class)
+                    && self.passed_over[class] >= self.starvation_limit
+            })
+            .unwrap_or(highest);
+
+        for lower in class + 1..self.classes.len() {
+            if waiting(&self.classes, lower) {
+                self.passed_over[lower] += 1;
+            }
+        }
+        self.passed_over[class] = 0;
+
+        self.classes[class].pop()
+    }
+
+    /// [`FairQueue::take_head_if`] within one class
+    fn take_head_if<P>(&mut self, priority: Priority, predicate: P) -> Option<T>
+    where
+        P: FnMut(&T) -> bool,
+    {
+        self.classes[priority.index()].take_head_if(predicate)
+    }
+}
+
+/// Address range of a plain read (0x01-0x04), used for merging queued
+/// reads and by the poller
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) struct ReadSpan {
+    unit_id: u8,
+    function: u8,
+    start: u32,
+    /// One past the last address
+    end: u32,
+}
+
+impl From<CacheKey> for ReadSpan {
+    fn from(key: CacheKey) -> Self {
+        Self {
+            unit_id: key.unit_id,
+            function: key.function,
+            start: key.start as u32,
+            end: key.start as u32 + key.quantity as u32,
+        }
+    }
+}
+
+impl ReadSpan {
+    /// Parses an RTU read request: Unit ID, Function, Start(2), Quantity(2), CRC(2)
+    fn from_frame(frame: &[u8]) -> Option<Self> {
+        if frame.len() != 8 || frame[0] == 0 {
+            return None;
+        }
+
+        CacheKey::from_request(frame[0], &frame[1..6]).map(Self::from)
+    }
+
+    fn quantity(&self) -> u32 {
+        self.end - self.start
+    }
+
+    /// Modbus limits on items per read: 2000 coils/inputs or 125 registers
+    fn max_quantity(function: u8) -> u32 {
+        match function {
+            0x01 | 0x02 => 2000,
+            _ => 125,
+        }
+    }
+
+    fn is_bits(&self) -> bool {
+        matches!(self.function, 0x01 | 0x02)
+    }
+
+    fn data_len(&self) -> usize {
+        if self.is_bits() {
+            (self.quantity() as usize).div_ceil(8)
+        } else {
+            self.quantity() as usize * 2
+        }
+    }
+
+    /// Smallest span covering both reads, if close enough and within limits
+    fn merge(&self, other: &ReadSpan, max_gap: u16) -> Option<ReadSpan> {
+        let gap = max_gap as u32;
+        if self.unit_id != other.unit_id
+            || self.function != other.function
+            || other.start > self.end + gap
+            || self.start > other.end + gap
+        {
+            return None;
+        }
+
+        let merged = ReadSpan {
+            start: self.start.min(other.start),
+            end: self.end.max(other.end),
+            ..*self
+        };
+
+        (merged.quantity() <= Self::max_quantity(self.function)).then_some(merged)
+    }
+
+    /// Writes the RTU request for this read into `frame`
+    pub(crate) fn to_frame(self, frame: &mut FrameBuffer) {
+        frame.push(self.unit_id);
+        frame.push(self.function);
+        frame.extend_from_slice(&(self.start as u16).to_be_bytes());
+        frame.extend_from_slice(&(self.quantity() as u16).to_be_bytes());
+        let crc = calc_crc16(frame);
+        frame.extend_from_slice(&crc.to_le_bytes());
+    }
+
+    /// Returns the data bytes of a valid, non-exception response to this read
+    pub(crate) fn response_data<'a>(&self, response: &'a [u8]) -> Option<&'a [u8]> {
+        let data_len = self.data_len();
+        if response.len() != 3 + data_len + 2
+            || response[0] != self.unit_id
+            || response[1] != self.function
+            || response[2] as usize != data_len
+        {
+            return None;
+        }
+
+        let (frame, crc) = response.split_at(response.len() - 2);
+        if calc_crc16(frame) != u16::from_le_bytes([crc[0], crc[1]]) {
+            return None;
+        }
+
+        Some(&frame[3..])
+    }
+
+    /// Writes the RTU response `part` would have received into `frame`, out
+    /// of the data returned for this (merged) read
+    fn split_response(&self, part: &ReadSpan, data: &[u8], frame: &mut FrameBuffer) {
+        self.write_part(part, data, frame);
+
+        let crc = calc_crc16(frame);
+        frame.extend_from_slice(&crc.to_le_bytes());
+    }
+
+    /// [`ReadSpan::split_response`] without the CRC
+    pub(crate) fn write_part(&self, part: &ReadSpan, data: &[u8], frame: &mut FrameBuffer) {
+        let offset = (part.start - self.start) as usize;
+        let quantity = part.quantity() as usize;
+        let data_len = part.data_len();
+
+        frame.extend_from_slice(&[part.unit_id, part.function, data_len as u8]);
+
+        if part.is_bits() {
+            for byte in 0..data_len {
+                let mut value = 0u8;
+                for bit in (0..8).take_while(|bit| byte * 8 + bit < quantity) {
+                    let source = offset + byte * 8 + bit;
+                    if data[source / 8] & (1 << (source % 8)) != 0 {
+                        value |= 1 << bit;
+                    }
+                }
+                frame.push(value);
+            }
+        } else {
+            frame.extend_from_slice(&data[offset * 2..offset * 2 + data_len]);
+        }
+    }
+
+    /// Whether every address of `part` is covered by this read
+    pub(crate) fn covers(&self, part: &ReadSpan) -> bool {
+        self.unit_id == part.unit_id
+            && self.function == part.function
+            && self.start <= part.start
+            && part.end <= self.end
+    }
+}
+
+/// Bus statistics, updated by the scheduler and read by the HTTP API
+#[derive(Debug)]
+pub struct BusStats {
+    queue_capacity: usize,
+    /// Queued requests per priority class
+    queued: [AtomicUsize; Priority::ALL.len()],
+    requests: AtomicU64,
+    total_wait_us: AtomicU64,
+    max_wait_us: AtomicU64,
+    total_busy_us: AtomicU64,
+    merged_requests: AtomicU64,
+    /// RTU transactions actually sent, merged reads count once
+    transactions: AtomicU64,
+    /// Time the bus spent on those transactions
+    bus_busy_us: AtomicU64,
+    /// Moving average of the transaction time, the basis of wait estimates
+    recent_transaction_us: AtomicU64,
+    /// Requests rejected because they could not be answered in time
+    shed: AtomicU64,
+    /// Queued requests dropped once their deadline had passed
+    expired: AtomicU64,
+    /// Transactions, failures and busy time over the last minutes
+    rates: RateWindow,
+}
+
+/// Point in time copy of [`BusStats`]
+#[derive(Debug, Clone, Serialize)]
+pub struct BusStatsSnapshot {
+    pub queue_length: usize,
+    pub queue_capacity: usize,
+    pub total_requests: u64,
+    pub avg_wait_us: u64,
+    pub max_wait_us: u64,
+    pub avg_transaction_us: u64,
+    pub merged_requests: u64,
+    pub transactions: u64,
+    pub bus_busy_us: u64,
+    pub shed_requests: u64,
+    pub expired_requests: u64,
+    /// Transactions per second and share of time the bus was busy
+    pub rates: RateReport,
+}
+
+impl BusStats {
+    pub fn new(queue_capacity: usize) -> Self {
+        Self {
+            queue_capacity,
+            queued: std::array::from_fn(|_| AtomicUsize::new(0)),
+            requests: AtomicU64::new(0),
+            total_wait_us: AtomicU64::new(0),
+            max_wait_us: AtomicU64::new(0),
+            total_busy_us: AtomicU64::new(0),
+            merged_requests: AtomicU64::new(0),
+            transactions: AtomicU64::new(0),
+            bus_busy_us: AtomicU64::new(0),
+            recent_transaction_us: AtomicU64::new(0),
+            shed: AtomicU64::new(0),
+            expired: AtomicU64::new(0),
+            rates: RateWindow::new(),
+        }
+    }
+
+    fn record_transaction(&self, busy_us: u64, failed: bool) {
+        self.transactions.fetch_add(1, Ordering::Relaxed);
+        self.bus_busy_us.fetch_add(busy_us, Ordering::Relaxed);
+        self.rates.record(failed, Duration::from_micros(busy_us));
+
+        // Concurrent updates may lose a sample, that's fine for an estimate
+        let recent = self.recent_transaction_us.load(Ordering::Relaxed);
+        let recent = match recent {
+            0 => busy_us,
+            _ => recent - recent / 8 + busy_us / 8,
+        };
+        self.recent_transaction_us.store(recent, Ordering::Relaxed);
+    }
+
+    fn queued(&self, priority: Priority) -> &AtomicUsize {
+        &self.queued[priority.index()]
+    }
+
+    pub fn queue_length(&self) -> usize {
+        self.queued
+            .iter()
+            .map(|queued| queued.load(Ordering::Relaxed))
+            .sum()
+    }
+
+    /// Time until a new request in `priority` would be answered: the
+    /// requests queued in its class and above, spread over the
+    /// `concurrency` transactions the bus runs at once, plus its own.
+    /// Zero until the bus has seen a transaction.
+    pub fn estimated_wait(&self, priority: Priority, concurrency: usize) -> Duration {
+        let ahead: usize = Priority::ALL[..=priority.index()]
+            .iter()
+            .map(|&class| self.queued(class).load(Ordering::Relaxed))
+            .sum();
+        let transaction_us = self.recent_transaction_us.load(Ordering::Relaxed);
+        let wait_us = ahead as u64 * transaction_us / concurrency.max(1) as u64;
+
+        Duration::from_micros(wait_us + transaction_us)
+    }
+
+    fn record(&self, wait_us: u64, busy_us: u64) {
+        self.requests.fetch_add(1, Ordering::Relaxed);
+        self.total_wait_us.fetch_add(wait_us, Ordering::Relaxed);
+        self.max_wait_us.fetch_max(wait_us, Ordering::Relaxed);
+        self.total_busy_us.fetch_add(busy_us, Ordering::Relaxed);
+    }
+
+    pub fn snapshot(&self) -> BusStatsSnapshot {
+        let requests = self.requests.load(Ordering::Relaxed);
+        let avg = |total: &AtomicU64| {
+            total
+                .load(Ordering::Relaxed)
+                .checked_div(requests)
+                .unwrap_or(0)
+        };
+
+        BusStatsSnapshot {
+            queue_length: self.queue_length(),
+            queue_capacity: self.queue_capacity,
+            total_requests: requests,
+            avg_wait_us: avg(&self.total_wait_us),
+            max_wait_us: self.max_wait_us.load(Ordering::Relaxed),
+            avg_transaction_us: avg(&self.total_busy_us),
+            merged_requests: self.merged_requests.load(Ordering::Relaxed),
+            transactions: self.transactions.load(Ordering::Relaxed),
+            bus_busy_us: self.bus_busy_us.load(Ordering::Relaxed),
+            shed_requests: self.shed.load(Ordering::Relaxed),
+            expired_requests: self.expired.load(Ordering::Relaxed),
+            rates: self.rates.report(),
+        }
+    }
+}
+
+/// Cloneable handle used by connections to submit RTU transactions
+#[derive(Clone)]
+pub struct BusHandle {
+    tx: mpsc::Sender<BusRequest>,
+    priority: Arc<PriorityConfig>,
+    shedding: Arc<LoadSheddingConfig>,
+    max_in_flight: usize,
+    stats: Arc<BusStats>,
+    breaker: Arc<CircuitBreaker>,
+    timeouts: Arc<AdaptiveTimeouts>,
+    latency: Arc<LatencyStats>,
+    pool: Arc<BufferPool>,
+}
+
+impl BusHandle {
+    /// Queues an RTU request in the `priority` class and waits for the
+    /// slave's response.
+    ///
+    /// `frame` is a complete RTU ADU including CRC, the returned buffer holds
+    /// the raw response frame as read from the bus.
+    pub async fn transaction(
+        &self,
+        client: SocketAddr,
+        priority: Priority,
+        unit_id: u8,
+        frame: FrameBuffer,
+    ) -> Result<FrameBuffer, RelayError> {
+        // Dead units are failed here, before they take a place in the queue
+        self.breaker.check(unit_id)?;
+
+        let enqueued_at = Instant::now();
+        let deadline = match self.shedding.enabled {
+            true => {
+                // Answered late is as good as not answered, the client
+                // has given up and retried by then
+                let wait = self.stats.estimated_wait(priority, self.max_in_flight);
+                if wait > self.shedding.max_wait {
+                    self.stats.shed.fetch_add(1, Ordering::Relaxed);
+                    return Err(server_busy(
+                        self.shedding.exception_code,
+                        format!("Bus overloaded, estimated wait {:?}", wait),
+                    ));
+                }
+                Some(enqueued_at + self.shedding.max_wait)
+            }
+            false => None,
+        };
+
+        let (reply_tx, reply_rx) = oneshot::channel();
+
+        let request = BusRequest {
+            client,
+            priority,
+            unit_id,
+            frame,
+            enqueued_at,
+            deadline,
+            reply: reply_tx,
+        };
+
+        let queued = self.stats.queued(priority);
+        queued.fetch_add(1, Ordering::Relaxed);
+        if self.tx.send(request).await.is_err() {
+            queued.fetch_sub(1, Ordering::Relaxed);
+            return Err(bus_unavailable());
+        }
+
+        reply_rx.await.map_err(|_| bus_unavailable())?
+    }
+
+    /// Class of a request with `function` from `client`, received on `port`
+    pub fn classify(&self, client: IpAddr, port: u16, function: u8) -> Priority {
+        self.priority.classify(client, port, function)
+    }
+
+    pub fn stats(&self) -> Arc<BusStats> {
+        Arc::clone(&self.stats)
+    }
+
+    pub fn breaker(&self) -> Arc<CircuitBreaker> {
+        Arc::clone(&self.breaker)
+    }
+
+    /// Response timeouts learned on this bus
+    pub fn timeouts(&self) -> Arc<AdaptiveTimeouts> {
+        Arc::clone(&self.timeouts)
+    }
+
+    /// Latency histograms, the scheduler fills in queue and bus time
+    pub fn latency(&self) -> Arc<LatencyStats> {
+        Arc::clone(&self.latency)
+    }
+
+    /// Pool shared by request and response frames on this bus
+    pub fn buffers(&self) -> Arc<BufferPool> {
+        Arc::clone(&self.pool)
+    }
+}
+
+fn bus_unavailable() -> RelayError {
+    RelayError::Connection(ConnectionError::invalid_state(
+        "RTU bus scheduler is not running",
+    ))
+}
+
+/// Error answered with `exception_code`, 0x06 (server device busy) or
+/// 0x0B (gateway target device failed to respond)
+pub(crate) fn server_busy(exception_code: u8, details: impl Into<String>) -> RelayError {
+    let kind = match exception_code {
+        0x0B => ProtocolErrorKind::GatewayTargetFailedToRespond,
+        _ => ProtocolErrorKind::ServerBusy,
+    };
+    RelayError::protocol(kind, details)
+}
+
+/// Single owner of the RTU bus.
+///
+/// All connections submit their requests through a [`BusHandle`], the
+/// scheduler executes them one at a time and picks the next request
+/// round-robin across clients (or unit IDs), so a single aggressive poller
+/// cannot starve everyone else. Transports that can carry several
+/// transactions at once, see [`Transport::max_in_flight`], get up to that
+/// many running concurrently, still taken from the queue in fair order.
+pub struct BusScheduler<T> {
+    bus: Arc<Bus<T>>,
+    rx: mpsc::Receiver<BusRequest>,
+    queue: PriorityQueue<FlowKey, BusRequest>,
+    fairness: Fairness,
+    capacity: usize,
+    merge_reads: bool,
+    merge_max_gap: u16,
+    max_in_flight: usize,
+    in_flight: Arc<Semaphore>,
+}
+
+/// Requests taken off the queue to go out as one transaction
+enum Batch {
+    Single(BusRequest),
+    Merged(ReadSpan, Vec<(ReadSpan, BusRequest)>),
+}
+
+/// Everything a transaction needs, shared by the transactions in flight
+struct Bus<T> {
+    transport: Arc<T>,
+    shedding: Arc<LoadSheddingConfig>,
+    stats: Arc<BusStats>,
+    breaker: Arc<CircuitBreaker>,
+    timeouts: Arc<AdaptiveTimeouts>,
+    latency: Arc<LatencyStats>,
+    pool: Arc<BufferPool>,
+    /// Ring the frames on the wire are recorded into, with the bus index
+    capture: Option<(Arc<FrameCapture>, u8)>,
+}
+
+impl<T: Transport> BusScheduler<T> {
+    /// Creates the scheduler for `transport`, recording queue and bus time
+    /// into `latency`, which may be shared with other buses, and the
+    /// outcome of every transaction into `breaker`
+    pub fn new(
+        transport: Arc<T>,
+        config: &SchedulerConfig,
+        latency: Arc<LatencyStats>,
+        breaker: Arc<CircuitBreaker>,
+    ) -> (Self, BusHandle) {
+        let (tx, rx) = mpsc::channel(config.queue_size);
+        let stats = Arc::new(BusStats::new(config.queue_size));
+        // Every queued request holds a buffer, and so does its response
+        let pool = BufferPool::new(2 * config.queue_size);
+        let max_in_flight = transport.max_in_flight().max(1);
+        let timeouts = Arc::new(AdaptiveTimeouts::new(
+            &config.adaptive_timeout,
+            transport.response_timeout(),
+        ));
+        let shedding = Arc::new(config.load_shedding.clone());
+
+        let scheduler = Self {
+            bus: Arc::new(Bus {
+                transport,
+                shedding: Arc::clone(&shedding),
+                stats: Arc::clone(&stats),
+                breaker: Arc::clone(&breaker),
+                timeouts: Arc::clone(&timeouts),
+                latency: Arc::clone(&latency),
+                pool: Arc::clone(&pool),
+                capture: None,
+            }),
+            rx,
+            queue: PriorityQueue::new(config.priority.starvation_limit),
+            fairness: config.fairness,
+            capacity: config.queue_size,
+            merge_reads: config.merge_reads,
+            merge_max_gap: config.merge_max_gap,
+            max_in_flight,
+            in_flight: Arc::new(Semaphore::new(max_in_flight)),
+        };
+
+        let handle = BusHandle {
+            tx,
+            priority: Arc::new(config.priority.clone()),
+            shedding,
+            max_in_flight,
+            stats,
+            breaker,
+            timeouts,
+            latency,
+            pool,
+        };
+
+        (scheduler, handle)
+    }
+
+    /// Records every RTU frame sent and received into `capture` as bus
+    /// number `bus`
+    pub fn with_capture(mut self, capture: Arc<FrameCapture>, bus: u8) -> Self {
+        Arc::get_mut(&mut self.bus)
+            .expect("the bus is only shared once the scheduler runs")
+            .capture = Some((capture, bus));
+        self
+    }
+
+    /// Runs until shutdown is signalled or every handle is dropped.
+    ///
+    /// A transaction that is already on the wire is always completed, the
+    /// shutdown signal is only checked between transactions. The relay
+    /// signals it once its clients are gone, what is queued by then is
+    /// still served.
+    pub async fn run(mut self, mut shutdown_rx: broadcast::Receiver<()>) {
+        let mut closed = false;
+        let mut draining = false;
+
+        loop {
+            // Move everything waiting in the channel into the fair queue,
+            // leaving the rest in the channel as backpressure once full
+            while !closed && self.queue.len() < self.capacity {
+                match self.rx.try_recv() {
+                    Ok(request) => self.enqueue(request),
+                    Err(mpsc::error::TryRecvError::Empty) => break,
+                    Err(mpsc::error::TryRecvError::Disconnected) => closed = true,
+                }
+            }
+
+            if !draining
+                && !matches!(
+                    shutdown_rx.try_recv(),
+                    Err(broadcast::error::TryRecvError::Empty)
+                )
+            {
+                draining = true;
+            }
+
+            if let Some(request) = self.queue.pop() {
+                self.stats()
+                    .queued(request.priority)
+                    .fetch_sub(1, Ordering::Relaxed);
+                let batch = self.batch(request);
+                self.dispatch(batch).await;
+                continue;
+            }
+
+            if closed || draining {
+                break;
+            }
+
+            tokio::select! {
+                request = self.rx.recv() => match request {
+                    Some(request) => self.enqueue(request),
+                    None => closed = true,
+                },
+                _ = shutdown_rx.recv() => draining = true,
+            }
+        }
+
+        // Let concurrent transactions finish before the transport goes away
+        let _ = self.in_flight.acquire_many(self.max_in_flight as u32).await;
+
+        // Requests sent after the queue ran dry, their callers see the bus
+        // as unavailable
+        self.rx.close();
+        let mut dropped = self.queue.len();
+        while self.rx.try_recv().is_ok() {
+            dropped += 1;
+        }
+        debug!(
+            "RTU bus scheduler stopped, {} queued requests dropped",
+            dropped
+        );
+    }
+
+    fn stats(&self) -> &BusStats {
+        &self.bus.stats
+    }
+
+    fn enqueue(&mut self, request: BusRequest) {
+        let key = FlowKey::new(self.fairness, &request);
+        self.queue.push(request.priority, key, request);
+    }
+
+    /// Runs a batch, in the background if the transport takes concurrent
+    /// transactions and there is a free slot, otherwise waits for a slot
+    async fn dispatch(&self, batch: Batch) {
+        if self.max_in_flight == 1 {
+            return self.bus.execute_batch(batch).await;
+        }
+
+        let Ok(slot) = Arc::clone(&self.in_flight).acquire_owned().await else {
+            return;
+        };
+        let bus = Arc::clone(&self.bus);
+        tokio::spawn(async move {
+            bus.execute_batch(batch).await;
+            drop(slot);
+        });
+    }
+
+    /// Takes queued reads next to `request` along with it if merging is enabled
+    fn batch(&mut self, request: BusRequest) -> Batch {
+        let span = match ReadSpan::from_frame(&request.frame) {
+            Some(span) if self.merge_reads => span,
+            _ => return Batch::Single(request),
+        };
+
+        let mut merged = span;
+        let mut batch = vec![(span, request)];
+        let max_gap = self.merge_max_gap;
+        // Lower classes don't get to lengthen the transaction
+        let priority = batch[0].1.priority;
+
+        while let Some(next) = self.queue.take_head_if(priority, |queued| {
+            ReadSpan::from_frame(&queued.frame)
+                .and_then(|part| merged.merge(&part, max_gap))
+                .is_some()
+        }) {
+            self.stats()
+                .queued(priority)
+                .fetch_sub(1, Ordering::Relaxed);
+
+            if let Some(part) = ReadSpan::from_frame(&next.frame) {
+                merged = merged.merge(&part, max_gap).unwrap_or(merged);
+                batch.push((part, next));
+            }
+        }
+
+        if batch.len() == 1 {
+            if let Some((_, request)) = batch.pop() {
+                return Batch::Single(request);
+            }
+        }
+
+        Batch::Merged(merged, batch)
+    }
+}
+
+impl<T: Transport> Bus<T> {
+    async fn execute_batch(&self, batch: Batch) {
+        match batch {
+            Batch::Single(request) => self.execute(request).await,
+            Batch::Merged(merged, batch) => {
+                let mut batch: Vec<_> = batch
+                    .into_iter()
+                    .filter_map(|(part, request)| Some((part, self.admit(request)?)))
+                    .collect();
+
+                match batch.len() {
+                    0 => {}
+                    1 => {
+                        if let Some((_, request)) = batch.pop() {
+                            self.execute(request).await;
+                        }
+                    }
+                    _ => self.execute_merged(merged, batch).await,
+                }
+            }
+        }
+    }
+
+    /// Issues one read covering every request in `batch` and splits the
+    /// response. Exceptions and unexpected responses fall back to executing
+    /// the requests one by one, the gap between them may not be readable.
+    async fn execute_merged(&self, merged: ReadSpan, batch: Vec<(ReadSpan, BusRequest)>) {
+        trace!(
+            "Merging {} reads into unit 0x{:02X} function 0x{:02X} {}..{}",
+            batch.len(),
+            merged.unit_id,
+            merged.function,
+            merged.start,
+            merged.end
+        );
+
+        let started = Instant::now();
+        let mut frame = self.pool.get();
+        merged.to_frame(&mut frame);
+        let result = self.send(batch[0].1.client, &frame).await;
+        let busy_us = started.elapsed().as_micros() as u64;
+        self.stats.record_transaction(busy_us, result.is_err());
+        self.breaker.record(merged.unit_id, &result);
+
+        match result {
+            Ok(response) => {
+                let Some(data) = merged.response_data(&response) else {
+                    debug!(
+                        "Merged read rejected by unit 0x{:02X}, retrying {} reads separately",
+                        merged.unit_id,
+                        batch.len()
+                    );
+                    for (_, request) in batch {
+                        self.execute(request).await;
+                    }
+                    return;
+                };
+
+                for (part, request) in batch {
+                    self.record(&request, started, busy_us);
+                    self.stats.merged_requests.fetch_add(1, Ordering::Relaxed);
+
+                    let mut response = self.pool.get_with_headroom(MBAP_HEADROOM);
+                    merged.split_response(&part, data, &mut response);
+                    let _ = request.reply.send(Ok(response));
+                }
+            }
+            Err(e) => {
+                let details = e.to_string();
+                let mut error = Some(e);
+
+                for (_, request) in batch {
+                    self.record(&request, started, busy_us);
+
+                    let error = error.take().unwrap_or_else(|| {
+                        RelayError::Connection(ConnectionError::invalid_state(format!(
+                            "Merged read failed: {}",
+                            details
+                        )))
+                    });
+                    let _ = request.reply.send(Err(error));
+                }
+            }
+        }
+    }
+
+    /// Accounts a request that got on the bus at `started`
+    fn record(&self, request: &BusRequest, started: Instant, busy_us: u64) {
+        let wait_us = started.duration_since(request.enqueued_at).as_micros() as u64;
+
+        self.stats.record(wait_us, busy_us);
+        self.latency.record_bus(
+            request.client.ip(),
+            request.unit_id,
+            request.frame.get(1).copied().unwrap_or_default(),
+            wait_us,
+            busy_us,
+        );
+    }
+
+    /// Runs one RTU transaction for `client`, the response is read straight
+    /// into a buffer with room for the MBAP header in front of it
+    async fn send(&self, client: SocketAddr, frame: &[u8]) -> Result<FrameBuffer, RelayError> {
+        let unit_id = frame.first().copied().unwrap_or_default();
+        let function = frame.get(1).copied().unwrap_or_default();
+
+        if let Some((capture, bus)) = &self.capture {
+            capture.record_rtu(Direction::RtuRequest, client, *bus, frame);
+        }
+
+        if unit_id == 0 && !self.transport.answers_broadcasts() {
+            return self.broadcast(frame).await;
+        }
+
+        let mut response = self.pool.get_with_headroom(MBAP_HEADROOM);
+        let started = Instant::now();
+        let result = self
+            .transport
+            .transaction(
+                frame,
+                response.spare_capacity_mut(),
+                self.timeouts.timeout(unit_id, function),
+            )
+            .await;
+        self.timeouts
+            .record(unit_id, function, started.elapsed(), &result);
+
+        response.set_len(result?);
+        if let Some((capture, bus)) = &self.capture {
+            capture.record_rtu(Direction::RtuResponse, client, *bus, &response);
+        }
+        Ok(response)
+    }
+
+    /// Sends a broadcast without waiting for a response that never comes,
+    /// answering it with the echo a device would have sent
+    async fn broadcast(&self, frame: &[u8]) -> Result<FrameBuffer, RelayError> {
+        let pdu = frame
+            .get(1..frame.len().saturating_sub(2))
+            .unwrap_or_default();
+        let Some(echo) = broadcast_echo(pdu) else {
+            // A read of every unit has no answer, don't hold the bus for it
+            return Err(RelayError::Transport(TransportError::NoResponse {
+                attempts: 0,
+                elapsed: Duration::ZERO,
+            }));
+        };
+
+        self.transport.broadcast(frame).await?;
+
+        let mut response = self.pool.get_with_headroom(MBAP_HEADROOM);
+        response.push(0);
+        response.extend_from_slice(echo);
+        let crc = calc_crc16(&response);
+        response.extend_from_slice(&crc.to_le_bytes());
+        Ok(response)
+    }
+
+    /// Gives back `request` if it still has to go on the bus. Requests
+    /// whose client went away are dropped, those past their deadline are
+    /// answered as overloaded.
+    fn admit(&self, request: BusRequest) -> Option<BusRequest> {
+        // The client went away while waiting, don't waste bus time on it
+        if request.reply.is_closed() {
+            trace!("Dropping request from {}, client gone", request.client);
+            return None;
+        }
+
+        if request
+            .deadline
+            .is_some_and(|deadline| Instant::now() >= deadline)
+        {
+            self.stats.expired.fetch_add(1, Ordering::Relaxed);
+            let waited = request.enqueued_at.elapsed();
+            let _ = request.reply.send(Err(server_busy(
+                self.shedding.exception_code,
+                format!("Request expired after waiting {:?} for the bus", waited),
+            )));
+            return None;
+        }
+
+        Some(request)
+    }
+
+    async fn execute(&self, request: BusRequest) {
+        let Some(request) = self.admit(request) else {
+            return;
+        };
+
+        let started = Instant::now();
+        let wait = started.duration_since(request.enqueued_at);
+
+        let result = self.send(request.client, &request.frame).await;
+        let busy_us = started.elapsed().as_micros() as u64;
+
+        self.stats.record_transaction(busy_us, result.is_err());
+        self.breaker.record(request.unit_id, &result);
+        self.record(&request, started, busy_us);
+
+        trace!(
+            "Bus transaction for {} (unit 0x{:02X}) waited {:?}, took {:?}",
+            request.client,
+            request.unit_id,
+            wait,
+            started.elapsed()
+        );
+
+        let _ = request.reply.send(result);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_fair_queue_round_robin() {
+        let mut queue = FairQueue::new();
+
+        // Client "a" floods the queue before "b" and "c" get a request in
+        for i in 0..4 {
+            queue.push('a', ('a', i));
+        }
+        queue.push('b', ('b', 0));
+        queue.push('c', ('c', 0));
+        queue.push('b', ('b', 1));
+        assert_eq!(queue.len(), 7);
+
+        let order: Vec<_> = std::iter::from_fn(|| queue.pop()).collect();
+        assert_eq!(
+            order,
+            vec![
+                ('a', 0),
+                ('b', 0),
+                ('c', 0),
+                ('a', 1),
+                ('b', 1),
+                ('a', 2),
+                ('a', 3)
+            ]
+        );
+        assert_eq!(queue.len(), 0);
+    }
+
+    #[test]
+    fn test_fair_queue_reactivates_flow() {
+        let mut queue = FairQueue::new();
+
+        queue.push(1u8, 10);
+        assert_eq!(queue.pop(), Some(10));
+        assert_eq!(queue.pop(), None);
+
+        queue.push(1u8, 11);
+        queue.push(2u8, 20);
+        assert_eq!(queue.pop(), Some(11));
+        assert_eq!(queue.pop(), Some(20));
+        assert_eq!(queue.pop(), None);
+    }
+
+    #[test]
+    fn test_priority_queue_starvation_limit() {
+        let mut queue = PriorityQueue::new(2);
+
+        for i in 0..3 {
+            queue.push(Priority::Low, 'h', ('r', i));
+        }
+        for i in 0..5 {
+            queue.push(Priority::High, 'c', ('w', i));
+        }
+        assert_eq!(queue.len(), 8);
+
+        // Writes overtake the queued reads, every third turn goes to a read
+        let order: Vec<_> = std::iter::from_fn(|| queue.pop()).collect();
+        assert_eq!(
+            order,
+            vec![
+                ('w', 0),
+                ('w', 1),
+                ('r', 0),
+                ('w', 2),
+                ('w', 3),
+                ('r', 1),
+                ('w', 4),
+                ('r', 2)
+            ]
+        );
+
+        // Zero serves strictly by class
+        let mut queue = PriorityQueue::new(0);
+        queue.push(Priority::Low, 1u8, 1);
+        queue.push(Priority::Normal, 1u8, 2);
+        queue.push(Priority::High, 1u8, 3);
+        assert_eq!(queue.take_head_if(Priority::Normal, |_| true), Some(2));
+        assert_eq!(queue.pop(), Some(3));
+        assert_eq!(queue.pop(), Some(1));
+    }
+
+    #[test]
+    fn test_take_head_keeps_flow_order() {
+        let mut queue = FairQueue::new();
+        queue.push('a', 1);
+        queue.push('a', 2);
+        queue.push('b', 3);
+
+        // 2 is not a head, so it cannot jump ahead of 1
+        assert_eq!(queue.take_head_if(|&i| i == 2), None);
+        assert_eq!(queue.take_head_if(|&i| i == 3), Some(3));
+        assert_eq!(queue.take_head_if(|&i| i == 1), Some(1));
+        assert_eq!(queue.take_head_if(|&i| i == 2), Some(2));
+        assert_eq!(queue.len(), 0);
+        assert_eq!(queue.pop(), None);
+    }
+
+    fn read_frame(unit_id: u8, function: u8, start: u16, quantity: u16) -> FrameBuffer {
+        let mut frame = BufferPool::new(1).get();
+        ReadSpan {
+            unit_id,
+            function,
+            start: start as u32,
+            end: start as u32 + quantity as u32,
+        }
+        .to_frame(&mut frame);
+        frame
+    }
+
+    #[test]
+    fn test_read_span_merge() {
+        let a = ReadSpan::from_frame(&read_frame(1, 0x03, 100, 10)).unwrap();
+        let b = ReadSpan::from_frame(&read_frame(1, 0x03, 110, 10)).unwrap();
+        let near = ReadSpan::from_frame(&read_frame(1, 0x03, 123, 2)).unwrap();
+        let other_unit = ReadSpan::from_frame(&read_frame(2, 0x03, 110, 10)).unwrap();
+        let other_fn = ReadSpan::from_frame(&read_frame(1, 0x04, 110, 10)).unwrap();
+
+        let ab = a.merge(&b, 0).unwrap();
+        assert_eq!((ab.start, ab.end), (100, 120));
+        assert!(ab.merge(&near, 2).is_none());
+        assert_eq!(ab.merge(&near, 3).unwrap().end, 125);
+        assert!(a.merge(&other_unit, 4).is_none());
+        assert!(a.merge(&other_fn, 4).is_none());
+
+        // 125 registers at most
+        let far = ReadSpan::from_frame(&read_frame(1, 0x03, 200, 26)).unwrap();
+        assert!(a.merge(&far, 100).is_none());
+
+        // Writes and broadcasts are never merged
+        assert!(ReadSpan::from_frame(&read_frame(0, 0x03, 0, 1)).is_none());
+        assert!(ReadSpan::from_frame(&read_frame(1, 0x06, 0, 1)).is_none());
+    }
+
+    #[test]
+    fn test_split_register_response() {
+        let merged = ReadSpan::from_frame(&read_frame(1, 0x03, 100, 4)).unwrap();
+        let part = ReadSpan::from_frame(&read_frame(1, 0x03, 102, 2)).unwrap();
+
+        let mut response = vec![0x01, 0x03, 0x08, 0, 1, 0, 2, 0, 3, 0, 4];
+        let crc = calc_crc16(&response);
+        response.extend_from_slice(&crc.to_le_bytes());
+
+        let data = merged.response_data(&response).unwrap();
+        let mut split = BufferPool::new(1).get();
+        merged.split_response(&part, data, &mut split);
+
+        let mut expected = vec![0x01, 0x03, 0x04, 0, 3, 0, 4];
+        let crc = calc_crc16(&expected);
+        expected.extend_from_slice(&crc.to_le_bytes());
+        assert_eq!(&split[..], expected);
+
+        // Exceptions and truncated responses are rejected
+        let mut exception = vec![0x01, 0x83, 0x02];
+        let crc = calc_crc16(&exception);
+        exception.extend_from_slice(&crc.to_le_bytes());
+        assert!(merged.response_data(&exception).is_none());
+        assert!(merged.response_data(&response[..9]).is_none());
+    }
+
+    #[test]
+    fn test_split_coil_response() {
+        // Coils 10..22 read as one block: 0b1010_1100, 0b0000_1011
+        let merged = ReadSpan::from_frame(&read_frame(1, 0x01, 10, 12)).unwrap();
+        let data = [0b1010_1100, 0b0000_1011];
+
+        // Coils 13..20, shifted down by 3 bits
+        let part = ReadSpan::from_frame(&read_frame(1, 0x01, 13, 7)).unwrap();
+        let mut split = BufferPool::new(1).get();
+        merged.split_response(&part, &data, &mut split);
+        assert_eq!(&split[..4], &[0x01, 0x01, 0x01, 0b0111_0101]);
+
+        let crc = calc_crc16(&split[..4]);
+        assert_eq!(&split[4..], &crc.to_le_bytes());
+    }
+
+    /// Answers every request with an empty exception after a short delay,
+    /// keeping track of how many transactions overlap
+    struct SlowTransport {
+        active: AtomicUsize,
+        peak: AtomicUsize,
+    }
+
+    impl Transport for SlowTransport {
+        async fn transaction(
+            &self,
+            request: &[u8],
+            response: &mut [u8],
+            _response_timeout: std::time::Duration,
+        ) -> Result<usize, RelayError> {
+            let active = self.active.fetch_add(1, Ordering::SeqCst) + 1;
+            self.peak.fetch_max(active, Ordering::SeqCst);
+            tokio::time::sleep(std::time::Duration::from_millis(20)).await;
+            self.active.fetch_sub(1, Ordering::SeqCst);
+
+            response[..2].copy_from_slice(&[request[0], request[1] | 0x80]);
+            Ok(2)
+        }
+
+        fn response_timeout(&self) -> std::time::Duration {
+            std::time::Duration::from_secs(1)
+        }
+
+        fn max_in_flight(&self) -> usize {
+            2
+        }
+
+        async fn close(&self) -> Result<(), crate::TransportError> {
+            Ok(())
+        }
+    }
+
+    #[tokio::test]
+    async fn test_concurrent_transactions() {
+        let transport = Arc::new(SlowTransport {
+            active: AtomicUsize::new(0),
+            peak: AtomicUsize::new(0),
+        });
+        let (scheduler, bus) = BusScheduler::new(
+            Arc::clone(&transport),
+            &SchedulerConfig::default(),
+            Arc::new(LatencyStats::new()),
+            Arc::new(CircuitBreaker::new(&Default::default())),
+        );
+        let (shutdown_tx, shutdown_rx) = broadcast::channel(1);
+        let scheduler = tokio::spawn(scheduler.run(shutdown_rx));
+
+        let client = "127.0.0.1:5020".parse().unwrap();
+        let requests = (1..=3).map(|unit_id| {
+            let mut frame = bus.buffers().get();
+            frame.extend_from_slice(&[unit_id, 0x03]);
+            bus.transaction(client, Priority::Normal, unit_id, frame)
+        });
+        let responses = futures::future::join_all(requests).await;
+
+        for (unit_id, response) in (1..=3).zip(responses) {
+            assert_eq!(&response.unwrap()[..], &[unit_id, 0x83]);
+        }
+        assert_eq!(transport.peak.load(Ordering::SeqCst), 2);
+        assert_eq!(bus.stats().snapshot().transactions, 3);
+
+        shutdown_tx.send(()).unwrap();
+        scheduler.await.unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_broadcast_not_waited_for() {
+        use crate::mock::{MockSlave, MockTransport};
+
+        let slave = Arc::new(MockSlave::new());
+        let transport = Arc::new(
+            MockTransport::new(Arc::clone(&slave))
+                .with_response_timeout(Duration::from_secs(5))
+                .with_broadcast_turnaround(Duration::from_millis(10)),
+        );
+        let (scheduler, bus) = BusScheduler::new(
+            transport,
+            &SchedulerConfig::default(),
+            Arc::new(LatencyStats::new()),
+            Arc::new(CircuitBreaker::new(&Default::default())),
+        );
+        let (shutdown_tx, shutdown_rx) = broadcast::channel(1);
+        let scheduler = tokio::spawn(scheduler.run(shutdown_rx));
+
+        let client = "127.0.0.1:5020".parse().unwrap();
+        let send = |request: &[u8]| {
+            let mut frame = bus.buffers().get();
+            frame.extend_from_slice(request);
+            let crc = calc_crc16(&frame);
+            frame.extend_from_slice(&crc.to_le_bytes());
+            bus.transaction(client, Priority::Normal, 0, frame)
+        };
+
+        // Write Single Register 5 on every unit, answered with the echo
+        let started = Instant::now();
+        let response = send(&[0x00, 0x06, 0x00, 0x05, 0x00, 0x2A]).await.unwrap();
+        assert!(started.elapsed() < Duration::from_secs(1));
+        assert_eq!(&response[..6], &[0x00, 0x06, 0x00, 0x05, 0x00, 0x2A]);
+        assert_eq!(calc_crc16(&response[..6]).to_le_bytes(), response[6..]);
+        assert_eq!(slave.register(5), 0x2A);
+
+        // A broadcast read never reaches the bus
+        let result = send(&[0x00, 0x03, 0x00, 0x00, 0x00, 0x01]).await;
+        assert!(matches!(
+            result,
+            Err(RelayError::Transport(TransportError::NoResponse { .. }))
+        ));
+        assert_eq!(slave.requests(), 1);
+
+        shutdown_tx.send(()).unwrap();
+        scheduler.await.unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_load_shedding() {
+        let transport = Arc::new(SlowTransport {
+            active: AtomicUsize::new(0),
+            peak: AtomicUsize::new(0),
+        });
+        let mut config = SchedulerConfig::default();
+        config.load_shedding.enabled = true;
+        config.load_shedding.max_wait = Duration::from_millis(55);
+        let (scheduler, bus) = BusScheduler::new(
+            transport,
+            &config,
+            Arc::new(LatencyStats::new()),
+            Arc::new(CircuitBreaker::new(&Default::default())),
+        );
+        let (shutdown_tx, shutdown_rx) = broadcast::channel(1);
+        let scheduler = tokio::spawn(scheduler.run(shutdown_rx));
+
+        let client = "127.0.0.1:5020".parse().unwrap();
+        let burst = |count: u8| {
+            let requests = (1..=count).map(|unit_id| {
+                let mut frame = bus.buffers().get();
+                frame.extend_from_slice(&[unit_id, 0x03]);
+                bus.transaction(client, Priority::Normal, unit_id, frame)
+            });
+            futures::future::join_all(requests)
+        };
+        let busy = |result: &Result<FrameBuffer, RelayError>| {
+            matches!(
+                result,
+                Err(RelayError::Protocol {
+                    kind: ProtocolErrorKind::ServerBusy,
+                    ..
+                })
+            )
+        };
+
+        // Nothing is known about the bus yet, everything is queued and the
+        // requests still waiting after 55ms are dropped
+        let responses = burst(12).await;
+        assert!(responses[..2].iter().all(|response| response.is_ok()));
+        assert!(responses[10..].iter().all(busy));
+        let expired = bus.stats().snapshot().expired_requests;
+        assert!(expired >= 2);
+
+        // With 20ms per transaction, two at a time, the fifth request of a
+        // burst would wait too long and is rejected right away
+        let responses = burst(8).await;
+        assert!(responses[..2].iter().all(|response| response.is_ok()));
+        assert!(responses[4..].iter().all(busy));
+        let snapshot = bus.stats().snapshot();
+        assert!(snapshot.shed_requests >= 4);
+        assert_eq!(snapshot.expired_requests, expired);
+
+        shutdown_tx.send(()).unwrap();
+        scheduler.await.unwrap();
+    }
+
+    #[test]
+    fn test_estimated_wait() {
+        let stats = BusStats::new(16);
+        assert_eq!(stats.estimated_wait(Priority::Low, 1), Duration::ZERO);
+
+        stats.record_transaction(10_000, false);
+        stats.queued(Priority::High).store(2, Ordering::Relaxed);
+        stats.queued(Priority::Normal).store(4, Ordering::Relaxed);
+        stats.queued(Priority::Low).store(5, Ordering::Relaxed);
+
+        // Lower classes wait behind higher ones, not the other way round
+        let ms = Duration::from_millis;
+        assert_eq!(stats.estimated_wait(Priority::High, 2), ms(20));
+        assert_eq!(stats.estimated_wait(Priority::Normal, 2), ms(40));
+        assert_eq!(stats.estimated_wait(Priority::Low, 2), ms(65));
+        assert_eq!(stats.snapshot().queue_length, 11);
+    }
+
+    #[test]
+    fn test_bus_stats_snapshot() {
+        let stats = BusStats::new(8);
+        assert_eq!(stats.snapshot().avg_wait_us, 0);
+
+        stats.record(100, 1000);
+        stats.record(300, 3000);
+
+        let snapshot = stats.snapshot();
+        assert_eq!(snapshot.queue_capacity, 8);
+        assert_eq!(snapshot.total_requests, 2);
+        assert_eq!(snapshot.avg_wait_us, 200);
+        assert_eq!(snapshot.max_wait_us, 300);
+        assert_eq!(snapshot.avg_transaction_us, 2000);
+    }
+}
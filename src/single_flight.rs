@@ -0,0 +1,157 @@
+use std::{
+    collections::HashMap,
+    hash::Hash,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, Mutex,
+    },
+};
+
+use futures::future::{BoxFuture, FutureExt, Shared, WeakShared};
+
+type Flight<V> = Shared<BoxFuture<'static, V>>;
+
+/// Prune dead entries once the map grows past this size
+const PRUNE_THRESHOLD: usize = 1024;
+
+/// Deduplicates concurrent calls for the same key.
+///
+/// The first caller for a key starts the work, everyone asking for the same
+/// key while it is still running waits for that result instead of starting
+/// their own. The work keeps running as long as at least one caller is
+/// waiting for it; once it completes the key is forgotten, so later calls
+/// start fresh.
+pub struct SingleFlight<K, V> {
+    in_flight: Arc<Mutex<HashMap<K, WeakShared<BoxFuture<'static, V>>>>>,
+    coalesced: AtomicU64,
+}
+
+impl<K, V> Default for SingleFlight<K, V> {
+    fn default() -> Self {
+        Self {
+            in_flight: Arc::new(Mutex::new(HashMap::new())),
+            coalesced: AtomicU64::new(0),
+        }
+    }
+}
+
+impl<K, V> SingleFlight<K, V>
+where
+    K: Clone + Eq + Hash + Send + 'static,
+    V: Clone + Send + Sync + 'static,
+{
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Number of calls that were served by a flight started by someone else
+    pub fn coalesced(&self) -> u64 {
+        self.coalesced.load(Ordering::Relaxed)
+    }
+
+    /// Runs `start()` unless a flight for `key` is already in progress, in
+    /// which case its result is awaited instead.
+    pub async fn run<F>(&self, key: K, start: F) -> V
+    where
+        F: FnOnce() -> BoxFuture<'static, V>,
+    {
+        let flight = {
+            let mut in_flight = self.in_flight.lock().unwrap();
+
+            match in_flight.get(&key).and_then(WeakShared::upgrade) {
+                Some(flight) => {
+                    self.coalesced.fetch_add(1, Ordering::Relaxed);
+                    flight
+                }
+                None => {
+                    if in_flight.len() >= PRUNE_THRESHOLD {
+                        in_flight.retain(|_, flight| flight.upgrade().is_some());
+                    }
+
+                    let flight =
+                        Self::start_flight(Arc::clone(&self.in_flight), key.clone(), start());
+                    // Not polled yet, so it can always be downgraded
+                    if let Some(weak) = flight.downgrade() {
+                        in_flight.insert(key, weak);
+                    }
+                    flight
+                }
+            }
+        };
+
+        flight.await
+    }
+
+    fn start_flight(
+        in_flight: Arc<Mutex<HashMap<K, WeakShared<BoxFuture<'static, V>>>>>,
+        key: K,
+        work: BoxFuture<'static, V>,
+    ) -> Flight<V> {
+        async move {
+            let value = work.await;
+            // Forget the key before anyone sees the result, later calls get a
+            // fresh flight instead of this (possibly stale) value
+            in_flight.lock().unwrap().remove(&key);
+            value
+        }
+        .boxed()
+        .shared()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::AtomicUsize;
+
+    use tokio::sync::oneshot;
+
+    use super::*;
+
+    #[tokio::test]
+    async fn test_concurrent_calls_share_one_flight() {
+        let flights = SingleFlight::<u8, u32>::new();
+        let started = Arc::new(AtomicUsize::new(0));
+        let (release_tx, release_rx) = oneshot::channel::<()>();
+        let mut release_rx = Some(release_rx);
+
+        let mut start = || {
+            started.fetch_add(1, Ordering::SeqCst);
+            let release_rx = release_rx.take().unwrap();
+            async move {
+                release_rx.await.unwrap();
+                42
+            }
+            .boxed()
+        };
+
+        let first = flights.run(1, &mut start);
+        let second = flights.run(1, || unreachable!("must join the first flight"));
+        let release = async {
+            tokio::task::yield_now().await;
+            release_tx.send(()).unwrap();
+        };
+
+        let (a, b, ()) = tokio::join!(first, second, release);
+        assert_eq!((a, b), (42, 42));
+        assert_eq!(started.load(Ordering::SeqCst), 1);
+        assert_eq!(flights.coalesced(), 1);
+
+        // Completed flights are forgotten
+        assert_eq!(flights.run(1, || async { 7 }.boxed()).await, 7);
+    }
+
+    #[tokio::test]
+    async fn test_abandoned_flight_is_restarted() {
+        let flights = SingleFlight::<u8, u32>::new();
+
+        // Start a flight and drop it before it completes
+        {
+            let pending = flights.run(1, || futures::future::pending().boxed());
+            futures::pin_mut!(pending);
+            assert!(futures::poll!(pending.as_mut()).is_pending());
+        }
+
+        assert_eq!(flights.run(1, || async { 3 }.boxed()).await, 3);
+        assert_eq!(flights.coalesced(), 0);
+    }
+}
@@ -0,0 +1,165 @@
+use std::{
+    io,
+    net::{SocketAddr, TcpListener as StdTcpListener},
+    sync::Mutex,
+};
+
+#[cfg(unix)]
+use std::os::unix::io::{FromRawFd, RawFd};
+
+use tokio::net::TcpListener;
+use tracing::info;
+
+/// First file descriptor passed by systemd, after stdin, stdout and stderr
+#[cfg(unix)]
+const LISTEN_FDS_START: RawFd = 3;
+
+/// Listening sockets passed in by systemd socket activation.
+///
+/// systemd keeps them open while the relay restarts, so clients connecting
+/// in between wait in the backlog instead of being refused. A configured
+/// address is bound by the relay itself when no inherited socket matches.
+#[derive(Debug, Default)]
+pub struct InheritedListeners {
+    listeners: Mutex<Vec<StdTcpListener>>,
+}
+
+impl InheritedListeners {
+    /// Takes the sockets announced in `LISTEN_FDS` if `LISTEN_PID` names
+    /// this process, and clears the variables so children do not see them.
+    ///
+    /// Call before any other thread is started, changing the environment
+    /// is not thread safe. Nothing is logged, logging may not be set up yet.
+    pub fn from_env() -> Self {
+        let pid = std::env::var("LISTEN_PID").ok();
+        let fds = std::env::var("LISTEN_FDS").ok();
+        std::env::remove_var("LISTEN_PID");
+        std::env::remove_var("LISTEN_FDS");
+        std::env::remove_var("LISTEN_FDNAMES");
+
+        let count = listen_fds(pid.as_deref(), fds.as_deref(), std::process::id());
+        Self::from_listeners((0..count).filter_map(Self::adopt).collect())
+    }
+
+    pub fn from_listeners(listeners: Vec<StdTcpListener>) -> Self {
+        Self {
+            listeners: Mutex::new(listeners),
+        }
+    }
+
+    /// Takes ownership of passed descriptor `index`, skipping anything that
+    /// is not a listening TCP socket
+    #[cfg(unix)]
+    fn adopt(index: usize) -> Option<StdTcpListener> {
+        let fd = LISTEN_FDS_START + index as RawFd;
+
+        // SAFETY: systemd hands these descriptors over to this process and
+        // nothing else refers to them
+        let socket = unsafe { socket2::Socket::from_raw_fd(fd) };
+        let kind = socket.r#type();
+        let address = socket.local_addr().ok().and_then(|addr| addr.as_socket());
+        match (kind, address) {
+            (Ok(socket2::Type::STREAM), Some(_)) => {
+                // Not passed on to anything the relay starts
+                unsafe { libc::fcntl(fd, libc::F_SETFD, libc::FD_CLOEXEC) };
+                Some(socket.into())
+            }
+            _ => {
+                // Dropping it would close a descriptor we do not understand
+                std::mem::forget(socket);
+                None
+            }
+        }
+    }
+
+    #[cfg(not(unix))]
+    fn adopt(_index: usize) -> Option<StdTcpListener> {
+        None
+    }
+
+    pub fn len(&self) -> usize {
+        self.listeners.lock().unwrap().len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Takes the inherited socket listening on `addr`. An unspecified
+    /// address on either side matches any address with the same port, so a
+    /// socket unit may bind more or less widely than the config says.
+    pub fn take(&self, addr: &SocketAddr) -> Option<StdTcpListener> {
+        let mut listeners = self.listeners.lock().unwrap();
+
+        let index = listeners.iter().position(|listener| {
+            listener.local_addr().is_ok_and(|local| {
+                local.port() == addr.port()
+                    && (local.ip() == addr.ip()
+                        || local.ip().is_unspecified()
+                        || addr.ip().is_unspecified())
+            })
+        })?;
+
+        Some(listeners.swap_remove(index))
+    }
+
+    /// The inherited socket for `addr` if there is one, otherwise a newly
+    /// bound listener
+    pub async fn bind(&self, addr: &str) -> io::Result<TcpListener> {
+        for resolved in tokio::net::lookup_host(addr).await? {
+            if let Some(listener) = self.take(&resolved) {
+                info!("Listening on {} through socket activation", resolved);
+                listener.set_nonblocking(true)?;
+                return TcpListener::from_std(listener);
+            }
+        }
+
+        TcpListener::bind(addr).await
+    }
+}
+
+/// Number of descriptors passed to process `pid`, following `sd_listen_fds`
+fn listen_fds(listen_pid: Option<&str>, listen_fds: Option<&str>, pid: u32) -> usize {
+    if listen_pid.and_then(|listen_pid| listen_pid.parse::<u32>().ok()) != Some(pid) {
+        return 0;
+    }
+
+    listen_fds
+        .and_then(|listen_fds| listen_fds.parse().ok())
+        .unwrap_or(0)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_listen_fds() {
+        assert_eq!(listen_fds(Some("42"), Some("2"), 42), 2);
+        // Meant for another process, e.g. inherited through a shell
+        assert_eq!(listen_fds(Some("41"), Some("2"), 42), 0);
+        assert_eq!(listen_fds(None, Some("2"), 42), 0);
+        assert_eq!(listen_fds(Some("42"), Some("x"), 42), 0);
+    }
+
+    #[tokio::test]
+    async fn test_bind_prefers_inherited_listener() {
+        let inherited = StdTcpListener::bind("127.0.0.1:0").unwrap();
+        let port = inherited.local_addr().unwrap().port();
+        let listeners = InheritedListeners::from_listeners(vec![inherited]);
+
+        // Another port is bound anew
+        let other = listeners.bind("127.0.0.1:0").await.unwrap();
+        assert_ne!(other.local_addr().unwrap().port(), port);
+        assert_eq!(listeners.len(), 1);
+
+        // Binding the inherited address again would fail with EADDRINUSE
+        let listener = listeners.bind(&format!("0.0.0.0:{}", port)).await.unwrap();
+        assert_eq!(listener.local_addr().unwrap().port(), port);
+        assert!(listeners.is_empty());
+
+        let client = tokio::net::TcpStream::connect(("127.0.0.1", port));
+        let (accepted, connected) = tokio::join!(listener.accept(), client);
+        assert!(accepted.is_ok() && connected.is_ok());
+    }
+}
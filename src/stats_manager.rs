@@ -1,32 +1,105 @@
-use std::{collections::HashMap, net::SocketAddr, sync::Arc, time::SystemTime};
+use std::{
+    collections::HashMap,
+    net::SocketAddr,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        Arc, RwLock,
+    },
+    time::{Duration, SystemTime},
+};
 
-use tokio::sync::{mpsc, Mutex};
 use tracing::{debug, info, warn};
 
-use crate::{config::StatsConfig, connection::StatEvent, ClientStats, ConnectionStats};
-
+use crate::{
+    config::StatsConfig,
+    rates::{RateReport, RateWindow},
+    ClientCounters, ClientStats, ConnectionStats,
+};
+
+/// Registry of per-client counters.
+///
+/// Every client address owns its own [`ClientCounters`], which connection
+/// tasks update directly with atomics. The registry lock is only taken when
+/// a client connects, when stats are queried and during cleanup, so
+/// recording a request never waits on other connections or on a reader.
+#[derive(Debug)]
 pub struct StatsManager {
-    stats: Arc<Mutex<HashMap<SocketAddr, ClientStats>>>,
-    event_rx: mpsc::Receiver<StatEvent>,
+    clients: RwLock<HashMap<SocketAddr, Arc<ClientCounters>>>,
     config: StatsConfig,
-    total_connections: u64,
+    total_connections: AtomicU64,
+    /// Requests of all clients over the last minutes
+    rates: RateWindow,
 }
 
 impl StatsManager {
-    pub fn new(config: StatsConfig) -> (Self, mpsc::Sender<StatEvent>) {
-        let (tx, rx) = mpsc::channel(config.max_events_per_second as usize);
-
-        let manager = Self {
-            stats: Arc::new(Mutex::new(HashMap::new())),
-            event_rx: rx,
+    pub fn new(config: StatsConfig) -> Self {
+        Self {
+            clients: RwLock::new(HashMap::new()),
             config,
-            total_connections: 0,
-        };
+            total_connections: AtomicU64::new(0),
+            rates: RateWindow::new(),
+        }
+    }
+
+    /// Registers a new connection from `addr` and returns its counters
+    pub fn client_connected(&self, addr: SocketAddr) -> Arc<ClientCounters> {
+        let counters = Arc::clone(self.clients.write().unwrap().entry(addr).or_default());
+
+        counters.connected();
+        self.total_connections.fetch_add(1, Ordering::Relaxed);
+        debug!("Client connected from {}", addr);
+
+        counters
+    }
+
+    /// Marks a connection registered with [`StatsManager::client_connected`] as closed
+    pub fn client_disconnected(&self, addr: SocketAddr, counters: &ClientCounters) {
+        counters.disconnected();
+        debug!("Client disconnected from {}", addr);
+    }
+
+    /// Records a request of the client owning `counters`
+    pub fn record_request(&self, counters: &ClientCounters, success: bool, duration: Duration) {
+        counters.record_request(success, duration);
+        self.rates.record(!success, duration);
+    }
+
+    /// Counters of a connected client, if any
+    pub fn client(&self, addr: &SocketAddr) -> Option<Arc<ClientCounters>> {
+        self.clients.read().unwrap().get(addr).cloned()
+    }
 
-        (manager, tx)
+    /// Snapshot of a single client
+    pub fn client_stats(&self, addr: &SocketAddr) -> Option<ClientStats> {
+        self.client(addr).map(|counters| counters.snapshot())
     }
 
-    pub async fn run(&mut self, mut shutdown_rx: tokio::sync::watch::Receiver<bool>) {
+    /// Requests of all clients over the last minutes
+    pub fn rates(&self) -> RateReport {
+        self.rates.report()
+    }
+
+    /// Connections accepted since start
+    pub fn total_connections(&self) -> u64 {
+        self.total_connections.load(Ordering::Relaxed)
+    }
+
+    /// Aggregates the counters of every client
+    pub fn connection_stats(&self) -> ConnectionStats {
+        let snapshot: HashMap<SocketAddr, ClientStats> = self
+            .clients
+            .read()
+            .unwrap()
+            .iter()
+            .map(|(addr, counters)| (*addr, counters.snapshot()))
+            .collect();
+
+        let mut stats = ConnectionStats::from_client_stats(&snapshot, self.rates());
+        stats.total_connections = self.total_connections();
+        stats
+    }
+
+    pub async fn run(&self, mut shutdown_rx: tokio::sync::watch::Receiver<bool>) {
         let mut cleanup_interval = tokio::time::interval(self.config.cleanup_interval);
 
         loop {
@@ -35,10 +108,6 @@ impl StatsManager {
                     match shutdown {
                         Ok(_) => {
                             info!("Stats manager shutting down");
-                            // Ensure all events are processed before shutting down
-                            while let Ok(event) = self.event_rx.try_recv() {
-                                self.handle_event(event).await;
-                            }
                             break;
                         }
                         Err(e) => {
@@ -48,12 +117,8 @@ impl StatsManager {
                     }
                 }
 
-                Some(event) = self.event_rx.recv() => {
-                    self.handle_event(event).await;
-                }
-
                 _ = cleanup_interval.tick() => {
-                    self.cleanup_idle_stats().await;
+                    self.cleanup_idle_stats();
                 }
             }
         }
@@ -61,85 +126,26 @@ impl StatsManager {
         info!("Stats manager shutdown complete");
     }
 
-    async fn handle_event(&mut self, event: StatEvent) {
-        let mut stats = self.stats.lock().await;
-
-        match event {
-            StatEvent::ClientConnected(addr) => {
-                let client_stats = stats.entry(addr).or_default();
-                client_stats.active_connections = client_stats.active_connections.saturating_add(1);
-                client_stats.last_active = SystemTime::now();
-                self.total_connections = self.total_connections.saturating_add(1);
-                debug!("Client connected from {}", addr);
-            }
-
-            StatEvent::ClientDisconnected(addr) => {
-                if let Some(client_stats) = stats.get_mut(&addr) {
-                    client_stats.active_connections =
-                        client_stats.active_connections.saturating_sub(1);
-                    client_stats.last_active = SystemTime::now();
-                    debug!("Client disconnected from {}", addr);
-                }
-            }
-
-            StatEvent::RequestProcessed {
-                addr,
-                success,
-                duration_ms,
-            } => {
-                let client_stats = stats.entry(addr).or_default();
-                client_stats.total_requests = client_stats.total_requests.saturating_add(1);
-
-                if !success {
-                    client_stats.total_errors = client_stats.total_errors.saturating_add(1);
-                    client_stats.last_error = Some(SystemTime::now());
-                }
-
-                // Update average response time using exponential moving average
-                const ALPHA: f64 = 0.1; // Smoothing factor
-
-                if client_stats.avg_response_time_ms == 0 {
-                    client_stats.avg_response_time_ms = duration_ms;
-                } else {
-                    let current_avg = client_stats.avg_response_time_ms as f64;
-                    client_stats.avg_response_time_ms =
-                        (current_avg + ALPHA * (duration_ms as f64 - current_avg)) as u64;
-                }
-
-                client_stats.last_active = SystemTime::now();
-            }
-
-            StatEvent::QueryStats { addr, response_tx } => {
-                if let Some(stats) = stats.get(&addr) {
-                    if response_tx.send(stats.clone()).is_err() {
-                        warn!("Failed to send stats for {}", addr);
-                    }
-                }
-            }
+    /// Forgets clients without connections that were idle for too long
+    pub fn cleanup_idle_stats(&self) {
+        let mut clients = self.clients.write().unwrap();
+        let now = SystemTime::now();
 
-            StatEvent::QueryConnectionStats { response_tx } => {
-                let conn_stats = ConnectionStats::from_client_stats(&stats);
-                if response_tx.send(conn_stats).is_err() {
-                    warn!("Failed to send connection stats");
-                }
+        clients.retain(|addr, counters| {
+            // Counters of open connections are still being updated
+            if counters.active_connections() > 0 {
+                return true;
             }
-        }
-    }
-
-    async fn cleanup_idle_stats(&self) {
-        let mut stats = self.stats.lock().await;
-        let now = SystemTime::now();
 
-        stats.retain(|addr, client_stats| {
             // Check if client has been idle for too long
             let is_idle = now
-                .duration_since(client_stats.last_active)
+                .duration_since(counters.last_active())
                 .map(|idle_time| idle_time <= self.config.idle_timeout)
                 .unwrap_or(true);
 
             // Check if there was an error that's old enough to clean up
-            let has_recent_error = client_stats
-                .last_error
+            let has_recent_error = counters
+                .last_error()
                 .and_then(|last_error| now.duration_since(last_error).ok())
                 .map(|error_time| error_time <= self.config.error_timeout)
                 .unwrap_or(false);
@@ -147,12 +153,10 @@ impl StatsManager {
             let should_retain = is_idle || has_recent_error;
 
             if !should_retain {
+                let stats = counters.snapshot();
                 debug!(
-                    "Cleaning up stats for {}: {} connections, {} requests, {} errors",
-                    addr,
-                    client_stats.active_connections,
-                    client_stats.total_requests,
-                    client_stats.total_errors
+                    "Cleaning up stats for {}: {} requests, {} errors",
+                    addr, stats.total_requests, stats.total_errors
                 );
             }
 
@@ -163,98 +167,65 @@ impl StatsManager {
 
 #[cfg(test)]
 mod tests {
-    use std::time::Duration;
-
     use super::*;
-    use tokio::{sync::oneshot, time::sleep};
 
-    #[tokio::test]
-    async fn test_client_lifecycle() {
-        let config = StatsConfig::default();
-        let (mut manager, tx) = StatsManager::new(config);
+    #[test]
+    fn test_client_lifecycle() {
+        let manager = StatsManager::new(StatsConfig::default());
         let addr = "127.0.0.1:8080".parse().unwrap();
 
-        let (shutdown_tx, shutdown_rx) = tokio::sync::watch::channel(false);
-        let manager_handle = tokio::spawn(async move {
-            manager.run(shutdown_rx).await;
-        });
-
-        // Test connection
-        tx.send(StatEvent::ClientConnected(addr)).await.unwrap();
-
-        // Test successful request
-        tx.send(StatEvent::RequestProcessed {
-            addr,
-            success: true,
-            duration_ms: Duration::from_millis(100).as_millis() as u64,
-        })
-        .await
-        .unwrap();
-
-        // Test failed request
-        tx.send(StatEvent::RequestProcessed {
-            addr,
-            success: false,
-            duration_ms: Duration::from_millis(150).as_millis() as u64,
-        })
-        .await
-        .unwrap();
-
-        sleep(Duration::from_millis(100)).await;
+        // Nothing has to run for the counters to be updated
+        let counters = manager.client_connected(addr);
+        manager.record_request(&counters, true, Duration::from_millis(100));
+        manager.record_request(&counters, false, Duration::from_millis(150));
 
         // Query per-client stats
-        let (response_tx, response_rx) = oneshot::channel();
-        tx.send(StatEvent::QueryStats { addr, response_tx })
-            .await
-            .unwrap();
-
-        let stats = response_rx.await.unwrap();
+        let stats = manager.client_stats(&addr).unwrap();
         assert_eq!(stats.active_connections, 1);
         assert_eq!(stats.total_requests, 2);
         assert_eq!(stats.total_errors, 1);
+        assert_eq!(stats.avg_response_time_ms, 125);
 
         // Query global stats
-        let (response_tx, response_rx) = oneshot::channel();
-        tx.send(StatEvent::QueryConnectionStats { response_tx })
-            .await
-            .unwrap();
-
-        let conn_stats = response_rx.await.unwrap();
+        let conn_stats = manager.connection_stats();
+        assert_eq!(conn_stats.total_connections, 1);
         assert_eq!(conn_stats.total_requests, 2);
         assert_eq!(conn_stats.total_errors, 1);
 
-        // Cleanup
-        shutdown_tx.send(true).unwrap();
-        manager_handle.await.unwrap();
+        manager.client_disconnected(addr, &counters);
+        let conn_stats = manager.connection_stats();
+        assert_eq!(conn_stats.active_connections, 0);
+        assert_eq!(conn_stats.total_connections, 1);
     }
 
     #[tokio::test]
     async fn test_cleanup_idle_stats() {
-        let mut config = StatsConfig::default();
-        config.idle_timeout = Duration::from_millis(100);
-        let (mut manager, tx) = StatsManager::new(config);
-        let addr = "127.0.0.1:8080".parse().unwrap();
+        let config = StatsConfig {
+            cleanup_interval: Duration::from_millis(50),
+            idle_timeout: Duration::from_millis(100),
+            ..Default::default()
+        };
+        let manager = Arc::new(StatsManager::new(config));
+        let idle = "127.0.0.1:8080".parse().unwrap();
+        let open = "127.0.0.1:8081".parse().unwrap();
 
         let (shutdown_tx, shutdown_rx) = tokio::sync::watch::channel(false);
-        let manager_handle = tokio::spawn(async move {
-            manager.run(shutdown_rx).await;
+        let manager_handle = tokio::spawn({
+            let manager = Arc::clone(&manager);
+            async move { manager.run(shutdown_rx).await }
         });
 
-        // Add client and disconnect
-        tx.send(StatEvent::ClientConnected(addr)).await.unwrap();
-        tx.send(StatEvent::ClientDisconnected(addr)).await.unwrap();
+        // Add a client and disconnect, keep another one connected
+        let counters = manager.client_connected(idle);
+        manager.client_disconnected(idle, &counters);
+        let _open = manager.client_connected(open);
 
         // Wait for idle timeout
-        sleep(Duration::from_millis(200)).await;
-
-        // Query stats - should be cleaned up
-        let (response_tx, response_rx) = oneshot::channel();
-        tx.send(StatEvent::QueryConnectionStats { response_tx })
-            .await
-            .unwrap();
+        tokio::time::sleep(Duration::from_millis(250)).await;
 
-        let conn_stats = response_rx.await.unwrap();
-        assert_eq!(conn_stats.active_connections, 0);
+        assert!(manager.client_stats(&idle).is_none());
+        assert!(manager.client_stats(&open).is_some());
+        assert_eq!(manager.connection_stats().active_connections, 1);
 
         shutdown_tx.send(true).unwrap();
         manager_handle.await.unwrap();
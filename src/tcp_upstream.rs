@@ -0,0 +1,678 @@
+use std::{
+    collections::HashMap,
+    future::Future,
+    io,
+    sync::{
+        atomic::{AtomicBool, AtomicU16, AtomicU32, AtomicUsize, Ordering},
+        Arc, Mutex,
+    },
+    time::{Duration, Instant},
+};
+
+use socket2::{SockRef, TcpKeepalive};
+use tokio::{
+    io::{AsyncReadExt, AsyncWriteExt},
+    net::{
+        tcp::{OwnedReadHalf, OwnedWriteHalf},
+        TcpStream,
+    },
+    sync::{broadcast, oneshot, Mutex as AsyncMutex, Semaphore},
+    task::JoinHandle,
+    time::timeout,
+};
+use tracing::{debug, info, trace, warn};
+
+use crate::{
+    crc::calc_crc16,
+    frame_buffer::{BufferPool, FrameBuffer},
+    mbap::MBAP_HEADER_SIZE,
+    FrameErrorKind, IoOperation, RelayError, Transport, TransportError, UpstreamConfig,
+};
+
+/// Largest MBAP length field the spec allows: Unit ID plus a 253 byte PDU.
+///
+/// Deliberately larger than [`crate::mbap::MAX_MBAP_LENGTH`], which limits
+/// what clients may send. A downstream device is not under the relay's
+/// control, and a full-size response is still valid Modbus.
+const MAX_UPSTREAM_MBAP_LENGTH: usize = 254;
+
+/// Requests in a row a connection may leave unanswered before it is
+/// treated as lost and reopened
+const MAX_MISSED_RESPONSES: u32 = 3;
+
+/// Requests waiting for their response, by transaction ID
+type Pending = Mutex<HashMap<u16, oneshot::Sender<FrameBuffer>>>;
+
+/// State shared between a connection and its reader task
+struct Shared {
+    pending: Pending,
+    alive: AtomicBool,
+    /// Requests in a row sent without getting a response
+    missed: AtomicU32,
+}
+
+impl Shared {
+    /// Marks the connection as lost, failing every request still waiting on it
+    fn fail(&self) {
+        self.alive.store(false, Ordering::Relaxed);
+        self.pending.lock().unwrap().clear();
+    }
+}
+
+/// One persistent connection, requests are written under a lock and a
+/// reader task hands responses to their requests by transaction ID
+struct Connection {
+    writer: AsyncMutex<OwnedWriteHalf>,
+    shared: Arc<Shared>,
+    reader: JoinHandle<()>,
+}
+
+impl Connection {
+    fn is_alive(&self) -> bool {
+        self.shared.alive.load(Ordering::Relaxed)
+    }
+}
+
+impl Drop for Connection {
+    fn drop(&mut self) {
+        self.reader.abort();
+        self.shared.fail();
+    }
+}
+
+/// Removes a request from the pending table if it is given up on
+struct PendingGuard<'a> {
+    shared: &'a Shared,
+    transaction_id: u16,
+}
+
+impl Drop for PendingGuard<'_> {
+    fn drop(&mut self) {
+        self.shared
+            .pending
+            .lock()
+            .unwrap()
+            .remove(&self.transaction_id);
+    }
+}
+
+/// Fails the connection if a write is dropped before it finished, the
+/// part already sent would put every later frame out of step
+struct WriteGuard<'a> {
+    shared: &'a Shared,
+    finished: bool,
+}
+
+impl Drop for WriteGuard<'_> {
+    fn drop(&mut self) {
+        if !self.finished {
+            self.shared.fail();
+        }
+    }
+}
+
+/// Counts a request as missed unless its response arrived, a device that
+/// stops answering while keeping the socket open is only noticed this way
+struct ResponseGuard<'a> {
+    shared: &'a Shared,
+    address: &'a str,
+    answered: bool,
+}
+
+impl Drop for ResponseGuard<'_> {
+    fn drop(&mut self) {
+        if self.answered {
+            self.shared.missed.store(0, Ordering::Relaxed);
+            return;
+        }
+
+        let missed = self.shared.missed.fetch_add(1, Ordering::Relaxed) + 1;
+        if missed >= MAX_MISSED_RESPONSES && self.shared.alive.load(Ordering::Relaxed) {
+            warn!(
+                "Upstream {} left {} requests in a row unanswered, reconnecting",
+                self.address, missed
+            );
+            self.shared.fail();
+        }
+    }
+}
+
+/// A connection slot, reopened on demand after the connection is lost
+struct Link {
+    connection: AsyncMutex<Option<Arc<Connection>>>,
+    slots: Semaphore,
+}
+
+/// Pool of persistent Modbus TCP connections to one downstream device.
+///
+/// Devices like this often accept only one or two connections, so every
+/// client of the relay shares the few connections opened here instead of
+/// connecting on its own. Requests on one connection are multiplexed by
+/// transaction ID, up to `max_in_flight` of them waiting at a time.
+pub struct TcpUpstream {
+    config: UpstreamConfig,
+    links: Vec<Link>,
+    next_link: AtomicUsize,
+    next_transaction_id: AtomicU16,
+    closed: AtomicBool,
+    pool: Arc<BufferPool>,
+    trace_frames: bool,
+}
+
+impl TcpUpstream {
+    /// Creates the pool, connections are opened by the first request on
+    /// them or the next health check
+    pub fn new(config: &UpstreamConfig, trace_frames: bool) -> Self {
+        let links = (0..config.connections.max(1))
+            .map(|_| Link {
+                connection: AsyncMutex::new(None),
+                slots: Semaphore::new(config.max_in_flight.max(1)),
+            })
+            .collect::<Vec<_>>();
+
+        Self {
+            pool: BufferPool::new(links.len() * config.max_in_flight.max(1)),
+            config: config.clone(),
+            links,
+            next_link: AtomicUsize::new(0),
+            next_transaction_id: AtomicU16::new(0),
+            closed: AtomicBool::new(false),
+            trace_frames,
+        }
+    }
+
+    /// Reopens lost connections every `health_check_interval` until
+    /// shutdown, so requests do not pay for connecting after an outage.
+    ///
+    /// Half-open connections are found by TCP keepalive probes sent at the
+    /// same interval. A connection that stays open but leaves
+    /// `MAX_MISSED_RESPONSES` requests in a row unanswered is failed by
+    /// the requests themselves and reopened here like any other.
+    pub async fn run_health_checks(self: Arc<Self>, mut shutdown_rx: broadcast::Receiver<()>) {
+        if self.config.health_check_interval.is_zero() {
+            return;
+        }
+
+        let mut interval = tokio::time::interval(self.config.health_check_interval);
+        interval.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Skip);
+
+        loop {
+            tokio::select! {
+                _ = interval.tick() => {
+                    for link in &self.links {
+                        if let Err(e) = self.connection(link).await {
+                            warn!("Upstream {} health check failed: {}", self.config.address, e);
+                        }
+                    }
+                }
+                _ = shutdown_rx.recv() => break,
+            }
+        }
+    }
+
+    /// The link with the most free slots, ties are taken in turns
+    fn pick_link(&self) -> &Link {
+        let start = self.next_link.fetch_add(1, Ordering::Relaxed);
+        let count = self.links.len();
+
+        (0..count)
+            .map(|i| &self.links[(start + i) % count])
+            .max_by_key(|link| link.slots.available_permits())
+            .unwrap_or(&self.links[0])
+    }
+
+    /// Returns the open connection of `link`, connecting if there is none
+    async fn connection(&self, link: &Link) -> Result<Arc<Connection>, TransportError> {
+        let mut connection = link.connection.lock().await;
+
+        if let Some(connection) = connection.as_ref().filter(|c| c.is_alive()) {
+            return Ok(Arc::clone(connection));
+        }
+        if self.closed.load(Ordering::Relaxed) {
+            return Err(upstream_closed());
+        }
+
+        let opened = Arc::new(self.connect().await?);
+        *connection = Some(Arc::clone(&opened));
+
+        Ok(opened)
+    }
+
+    async fn connect(&self) -> Result<Connection, TransportError> {
+        let address = &self.config.address;
+        let stream = timeout(self.config.connect_timeout, TcpStream::connect(address))
+            .await
+            .map_err(|_| {
+                TransportError::Network(io::Error::new(
+                    io::ErrorKind::TimedOut,
+                    format!("Connecting to {} timed out", address),
+                ))
+            })?
+            .map_err(TransportError::Network)?;
+
+        let sock_ref = SockRef::from(&stream);
+        let configured = sock_ref.set_nodelay(true).and_then(|_| {
+            if self.config.health_check_interval.is_zero() {
+                return Ok(());
+            }
+            let interval = self.config.health_check_interval;
+            sock_ref.set_tcp_keepalive(
+                &TcpKeepalive::new()
+                    .with_time(interval)
+                    .with_interval(interval),
+            )
+        });
+        configured.map_err(|e| TransportError::Io {
+            operation: IoOperation::Configure,
+            details: format!("upstream connection to {}", address),
+            source: e,
+        })?;
+
+        info!("Connected to upstream {}", address);
+
+        let (reader, writer) = stream.into_split();
+        let shared = Arc::new(Shared {
+            pending: Mutex::new(HashMap::new()),
+            alive: AtomicBool::new(true),
+            missed: AtomicU32::new(0),
+        });
+
+        let reader = tokio::spawn({
+            let shared = Arc::clone(&shared);
+            let pool = Arc::clone(&self.pool);
+            let address = address.clone();
+
+            async move {
+                let Err(e) = read_responses(reader, &shared, &pool).await;
+                debug!("Upstream connection to {} lost: {}", address, e);
+                shared.fail();
+            }
+        });
+
+        Ok(Connection {
+            writer: AsyncMutex::new(writer),
+            shared,
+            reader,
+        })
+    }
+
+    /// Sends `adu` (Unit ID and PDU) and waits up to `response_timeout` for
+    /// the response to it
+    async fn exchange(
+        &self,
+        adu: &[u8],
+        response_timeout: Duration,
+    ) -> Result<FrameBuffer, TransportError> {
+        let link = self.pick_link();
+        let _slot = link.slots.acquire().await.map_err(|_| upstream_closed())?;
+        let connection = self.connection(link).await?;
+
+        let transaction_id = self.next_transaction_id.fetch_add(1, Ordering::Relaxed);
+        let (reply_tx, reply_rx) = oneshot::channel();
+        connection
+            .shared
+            .pending
+            .lock()
+            .unwrap()
+            .insert(transaction_id, reply_tx);
+        let _pending = PendingGuard {
+            shared: &connection.shared,
+            transaction_id,
+        };
+        // Lost while the request was being registered, nothing would answer it
+        if !connection.is_alive() {
+            return Err(connection_lost(&self.config.address));
+        }
+
+        let mut request = [0u8; MBAP_HEADER_SIZE - 1 + MAX_UPSTREAM_MBAP_LENGTH];
+        request[0..2].copy_from_slice(&transaction_id.to_be_bytes());
+        request[4..6].copy_from_slice(&(adu.len() as u16).to_be_bytes());
+        request[6..6 + adu.len()].copy_from_slice(adu);
+        let request = &request[..6 + adu.len()];
+
+        if self.trace_frames {
+            trace!("Upstream TX {}: {:02X?}", self.config.address, request);
+        }
+
+        let mut writer = connection.writer.lock().await;
+        // Cancelled with the whole exchange when request_timeout runs out
+        let mut write = WriteGuard {
+            shared: &connection.shared,
+            finished: false,
+        };
+        let written = writer.write_all(request).await;
+        write.finished = written.is_ok();
+        drop(write);
+        drop(writer);
+        if let Err(e) = written {
+            return Err(TransportError::Io {
+                operation: IoOperation::Write,
+                details: format!("request to upstream {}", self.config.address),
+                source: e,
+            });
+        }
+
+        let sent = Instant::now();
+        // Also counts the request when request_timeout cancels the wait
+        let mut response = ResponseGuard {
+            shared: &connection.shared,
+            address: &self.config.address,
+            answered: false,
+        };
+        match timeout(response_timeout, reply_rx).await {
+            Ok(Ok(reply)) => {
+                response.answered = true;
+                Ok(reply)
+            }
+            Ok(Err(_)) => Err(connection_lost(&self.config.address)),
+            Err(_) => Err(TransportError::NoResponse {
+                attempts: 1,
+                elapsed: sent.elapsed(),
+            }),
+        }
+    }
+
+    async fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> Result<usize, RelayError> {
+        // Unit ID, function code and CRC at least
+        if request.len() < 4 || request.len() - 2 > MAX_UPSTREAM_MBAP_LENGTH {
+            return Err(RelayError::frame(
+                FrameErrorKind::InvalidFormat,
+                format!("Invalid request length: {} bytes", request.len()),
+                Some(request.to_vec()),
+            ));
+        }
+
+        let started = Instant::now();
+        let limit = self.config.request_timeout;
+        let adu = &request[..request.len() - 2];
+
+        let reply = timeout(limit, self.exchange(adu, response_timeout))
+            .await
+            .map_err(|elapsed| TransportError::Timeout {
+                elapsed: started.elapsed(),
+                limit,
+                source: elapsed,
+            })??;
+
+        if self.trace_frames {
+            trace!("Upstream RX {}: {:02X?}", self.config.address, &reply[..]);
+        }
+
+        // Back to RTU for the rest of the relay
+        let len = reply.len() + 2;
+        if len > response.len() {
+            return Err(RelayError::frame(
+                FrameErrorKind::TooLong,
+                format!("Upstream response too long: {} bytes", reply.len()),
+                Some(reply.to_vec()),
+            ));
+        }
+        response[..reply.len()].copy_from_slice(&reply);
+        let crc = calc_crc16(&reply);
+        response[reply.len()..len].copy_from_slice(&crc.to_le_bytes());
+
+        Ok(len)
+    }
+
+    /// Drops every connection, requests fail from now on
+    async fn close(&self) -> Result<(), TransportError> {
+        self.closed.store(true, Ordering::Relaxed);
+
+        for link in &self.links {
+            link.slots.close();
+            link.connection.lock().await.take();
+        }
+
+        Ok(())
+    }
+}
+
+impl Transport for TcpUpstream {
+    fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> impl Future<Output = Result<usize, RelayError>> + Send {
+        TcpUpstream::transaction(self, request, response, response_timeout)
+    }
+
+    fn response_timeout(&self) -> Duration {
+        self.config.request_timeout
+    }
+
+    fn max_in_flight(&self) -> usize {
+        self.links.len() * self.config.max_in_flight.max(1)
+    }
+
+    fn close(&self) -> impl Future<Output = Result<(), TransportError>> + Send {
+        TcpUpstream::close(self)
+    }
+}
+
+fn upstream_closed() -> TransportError {
+    TransportError::Network(io::Error::new(
+        io::ErrorKind::NotConnected,
+        "Upstream connection pool is closed",
+    ))
+}
+
+fn connection_lost(address: &str) -> TransportError {
+    TransportError::Network(io::Error::new(
+        io::ErrorKind::ConnectionAborted,
+        format!("Connection to {} lost", address),
+    ))
+}
+
+/// Reads MBAP responses until the connection fails, handing each one
+/// (Unit ID and PDU) to the request with its transaction ID
+async fn read_responses(
+    mut reader: OwnedReadHalf,
+    shared: &Shared,
+    pool: &Arc<BufferPool>,
+) -> io::Result<std::convert::Infallible> {
+    loop {
+        let mut header = [0u8; MBAP_HEADER_SIZE];
+        reader.read_exact(&mut header).await?;
+
+        let transaction_id = u16::from_be_bytes([header[0], header[1]]);
+        let protocol_id = u16::from_be_bytes([header[2], header[3]]);
+        let length = u16::from_be_bytes([header[4], header[5]]) as usize;
+
+        // Out of sync with the stream, nothing after this can be trusted
+        if protocol_id != 0 || !(2..=MAX_UPSTREAM_MBAP_LENGTH).contains(&length) {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                format!("Invalid MBAP header {:02X?}", header),
+            ));
+        }
+
+        let mut reply = pool.get();
+        reply.push(header[6]);
+        reader
+            .read_exact(&mut reply.spare_capacity_mut()[..length - 1])
+            .await?;
+        reply.set_len(length);
+
+        match shared.pending.lock().unwrap().remove(&transaction_id) {
+            Some(reply_tx) => {
+                let _ = reply_tx.send(reply);
+            }
+            None => trace!("Dropping late response {}", transaction_id),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use tokio::net::TcpListener;
+
+    use super::*;
+
+    const RESPONSE_TIMEOUT: Duration = Duration::from_secs(1);
+
+    /// Reads one MBAP request, returns its header and PDU
+    async fn read_request(stream: &mut TcpStream) -> ([u8; 7], Vec<u8>) {
+        let mut header = [0u8; 7];
+        stream.read_exact(&mut header).await.unwrap();
+        let length = u16::from_be_bytes([header[4], header[5]]) as usize;
+        let mut pdu = vec![0u8; length - 1];
+        stream.read_exact(&mut pdu).await.unwrap();
+        (header, pdu)
+    }
+
+    fn rtu_frame(adu: &[u8]) -> Vec<u8> {
+        let mut frame = adu.to_vec();
+        frame.extend_from_slice(&calc_crc16(adu).to_le_bytes());
+        frame
+    }
+
+    fn test_config(address: String) -> UpstreamConfig {
+        UpstreamConfig {
+            address,
+            max_in_flight: 2,
+            ..Default::default()
+        }
+    }
+
+    #[tokio::test]
+    async fn test_responses_matched_by_transaction_id() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let address = listener.local_addr().unwrap().to_string();
+
+        // Answers two requests in reverse order, echoing the first register
+        let device = tokio::spawn(async move {
+            let (mut stream, _) = listener.accept().await.unwrap();
+            let first = read_request(&mut stream).await;
+            let second = read_request(&mut stream).await;
+
+            for (header, pdu) in [second, first] {
+                let mut response = header;
+                response[5] = 5;
+                stream.write_all(&response).await.unwrap();
+                stream
+                    .write_all(&[0x03, 0x02, pdu[1], pdu[2]])
+                    .await
+                    .unwrap();
+            }
+            stream
+        });
+
+        let upstream = TcpUpstream::new(&test_config(address), false);
+        assert_eq!(upstream.max_in_flight(), 2);
+
+        let first = rtu_frame(&[0x01, 0x03, 0x00, 0x0A, 0x00, 0x01]);
+        let second = rtu_frame(&[0x01, 0x03, 0x00, 0x14, 0x00, 0x01]);
+        let mut first_response = [0u8; 256];
+        let mut second_response = [0u8; 256];
+
+        let (a, b) = tokio::join!(
+            upstream.transaction(&first, &mut first_response, RESPONSE_TIMEOUT),
+            upstream.transaction(&second, &mut second_response, RESPONSE_TIMEOUT),
+        );
+
+        assert_eq!(
+            &first_response[..a.unwrap()],
+            rtu_frame(&[0x01, 0x03, 0x02, 0x00, 0x0A])
+        );
+        assert_eq!(
+            &second_response[..b.unwrap()],
+            rtu_frame(&[0x01, 0x03, 0x02, 0x00, 0x14])
+        );
+
+        let _stream = device.await.unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_reconnect_after_connection_lost() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let address = listener.local_addr().unwrap().to_string();
+
+        let device = tokio::spawn(async move {
+            // The first connection is dropped without an answer
+            let (mut stream, _) = listener.accept().await.unwrap();
+            read_request(&mut stream).await;
+            drop(stream);
+
+            let (mut stream, _) = listener.accept().await.unwrap();
+            let (mut header, _) = read_request(&mut stream).await;
+            header[5] = 3;
+            stream.write_all(&header).await.unwrap();
+            stream.write_all(&[0x86, 0x02]).await.unwrap();
+            stream
+        });
+
+        let upstream = TcpUpstream::new(&test_config(address), false);
+        let request = rtu_frame(&[0x01, 0x06, 0x00, 0x01, 0x00, 0x03]);
+        let mut response = [0u8; 256];
+
+        let lost = upstream
+            .transaction(&request, &mut response, RESPONSE_TIMEOUT)
+            .await;
+        assert!(matches!(
+            lost,
+            Err(RelayError::Transport(TransportError::Network(_)))
+        ));
+
+        let len = upstream
+            .transaction(&request, &mut response, RESPONSE_TIMEOUT)
+            .await
+            .unwrap();
+        assert_eq!(&response[..len], rtu_frame(&[0x01, 0x86, 0x02]));
+
+        upstream.close().await.unwrap();
+        assert!(upstream
+            .transaction(&request, &mut response, RESPONSE_TIMEOUT)
+            .await
+            .is_err());
+
+        let _stream = device.await.unwrap();
+    }
+
+    #[tokio::test]
+    async fn test_reconnect_after_missed_responses() {
+        let listener = TcpListener::bind("127.0.0.1:0").await.unwrap();
+        let address = listener.local_addr().unwrap().to_string();
+
+        let device = tokio::spawn(async move {
+            // The first connection stays open but never answers
+            let (mut silent, _) = listener.accept().await.unwrap();
+            for _ in 0..MAX_MISSED_RESPONSES {
+                read_request(&mut silent).await;
+            }
+
+            let (mut stream, _) = listener.accept().await.unwrap();
+            let (mut header, _) = read_request(&mut stream).await;
+            header[5] = 3;
+            stream.write_all(&header).await.unwrap();
+            stream.write_all(&[0x86, 0x02]).await.unwrap();
+            (silent, stream)
+        });
+
+        let upstream = TcpUpstream::new(&test_config(address), false);
+        let request = rtu_frame(&[0x01, 0x06, 0x00, 0x01, 0x00, 0x03]);
+        let mut response = [0u8; 256];
+        let short = Duration::from_millis(50);
+
+        for _ in 0..MAX_MISSED_RESPONSES {
+            let missed = upstream.transaction(&request, &mut response, short).await;
+            assert!(matches!(
+                missed,
+                Err(RelayError::Transport(TransportError::NoResponse { .. }))
+            ));
+        }
+
+        let len = upstream
+            .transaction(&request, &mut response, RESPONSE_TIMEOUT)
+            .await
+            .unwrap();
+        assert_eq!(&response[..len], rtu_frame(&[0x01, 0x86, 0x02]));
+
+        let _streams = device.await.unwrap();
+    }
+}
@@ -0,0 +1,51 @@
+use std::{future::Future, time::Duration};
+
+use crate::{IoOperation, RelayError, TransportError};
+
+/// Link to the Modbus devices behind a bus.
+///
+/// The bus scheduler talks RTU frames to every transport, CRC included,
+/// whatever the devices behind it actually speak.
+pub trait Transport: Send + Sync + 'static {
+    /// Sends an RTU request and reads the RTU response into `response`,
+    /// returning its length.
+    ///
+    /// Fails with [`TransportError::NoResponse`] when the device has not
+    /// started to answer within `response_timeout`.
+    fn transaction(
+        &self,
+        request: &[u8],
+        response: &mut [u8],
+        response_timeout: Duration,
+    ) -> impl Future<Output = Result<usize, RelayError>> + Send;
+
+    /// Configured time a device gets to answer, the upper bound of any
+    /// `response_timeout`
+    fn response_timeout(&self) -> Duration;
+
+    /// Whether devices answer requests to unit 0 like any other. Serial
+    /// devices carry broadcasts out silently, the scheduler sends those
+    /// with [`Transport::broadcast`] instead of waiting for a response
+    fn answers_broadcasts(&self) -> bool {
+        true
+    }
+
+    /// Sends a broadcast RTU request, holding the bus until the devices had
+    /// time to carry it out. Only used when broadcasts are not answered
+    fn broadcast(&self, request: &[u8]) -> impl Future<Output = Result<(), RelayError>> + Send {
+        let _ = request;
+        std::future::ready(Err(RelayError::Transport(TransportError::Io {
+            operation: IoOperation::Write,
+            details: "Transport does not send broadcasts".to_string(),
+            source: std::io::ErrorKind::Unsupported.into(),
+        })))
+    }
+
+    /// Number of transactions the scheduler may run at the same time
+    fn max_in_flight(&self) -> usize {
+        1
+    }
+
+    /// Releases the underlying port or connections
+    fn close(&self) -> impl Future<Output = Result<(), TransportError>> + Send;
+}
@@ -7,6 +7,36 @@ pub fn generate_request_id() -> u64 {
     REQUEST_ID.fetch_add(1, Ordering::SeqCst)
 }
 
+/// Raises the soft limit on open files towards `wanted`, as far as the hard
+/// limit allows, and returns the limit in effect.
+///
+/// The usual soft limit of 1024 caps the number of clients well below
+/// what the relay handles otherwise.
+#[cfg(unix)]
+#[allow(clippy::useless_conversion)] // Only useless where rlim_t is u64
+pub fn raise_fd_limit(wanted: u64) -> std::io::Result<u64> {
+    let mut limit = libc::rlimit {
+        rlim_cur: 0,
+        rlim_max: 0,
+    };
+    if unsafe { libc::getrlimit(libc::RLIMIT_NOFILE, &mut limit) } != 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+
+    // rlim_t is 32 bits wide on 32 bit targets
+    let wanted = libc::rlim_t::try_from(wanted)
+        .unwrap_or(libc::RLIM_INFINITY)
+        .min(limit.rlim_max);
+    if wanted > limit.rlim_cur {
+        limit.rlim_cur = wanted;
+        if unsafe { libc::setrlimit(libc::RLIMIT_NOFILE, &limit) } != 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+    }
+
+    Ok(u64::from(limit.rlim_cur))
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -17,4 +47,12 @@ mod tests {
         let id2 = generate_request_id();
         assert!(id2 > id1);
     }
+
+    #[cfg(unix)]
+    #[test]
+    fn test_raise_fd_limit_never_lowers() {
+        let current = raise_fd_limit(0).unwrap();
+        assert!(current > 0);
+        assert!(raise_fd_limit(current + 1).unwrap() >= current);
+    }
 }